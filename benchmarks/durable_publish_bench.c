@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "message_broker.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// @note results go to stderr; the broker logs the publishes at debug level
+// only, below the default one. The data directory defaults to /tmp, pass
+// another path (e.g. on NVMe) as argument.
+
+#define N_MESSAGES 200000
+#define PAYLOAD_SIZE 128
+
+static uint64_t
+now_ns()
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void
+remove_channel_dir(const char* data_dir, const char* channel)
+{
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", data_dir, channel);
+
+    DIR* dir = opendir(path);
+    if (!dir)
+    {
+        return;
+    }
+
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)))
+    {
+
+        char file[1024];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        unlink(file);
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+// @note measures publish throughput up to the point where every message is
+// stored: message_broker_wait also waits for the last group commit of the
+// durable channels. A subscriber is attached so the log is actually read.
+static int
+run(const char* label, const char* data_dir, int durable,
+    double* out_msgs_per_s)
+{
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 2, ._channels_capacity = 16, ._data_dir = data_dir};
+
+    struct message_broker_t* broker = NULL;
+    if (message_broker_new(&config, &broker))
+    {
+        return 1;
+    }
+
+    struct channel_options_t options = {._storage = CHANNEL_STORAGE_LOG,
+                                        ._durable = durable};
+    struct subscription_t* sub = NULL;
+    if (message_broker_declare_channel(broker, "bench", &options)
+        || message_broker_subscribe(broker, "bench", &sub))
+    {
+
+        message_broker_free(broker);
+
+        return 1;
+    }
+
+    unsigned char payload[PAYLOAD_SIZE];
+    memset(payload, 'x', sizeof(payload));
+
+    uint64_t start = now_ns();
+
+    size_t i = 0;
+    while (i < N_MESSAGES)
+    {
+        message_broker_publish_bytes(broker, "bench", payload,
+                                     sizeof(payload));
+        i++;
+    }
+    message_broker_wait(broker);
+
+    double elapsed_s = (now_ns() - start) / 1e9;
+    *out_msgs_per_s = N_MESSAGES / elapsed_s;
+
+    fprintf(stderr, "%-10s %10.0f msg/s  (%.3f s)\n", label,
+            *out_msgs_per_s, elapsed_s);
+
+    subscription_unsubscribe(sub);
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+
+    char data_dir[256];
+    if (argc > 1)
+    {
+        snprintf(data_dir, sizeof(data_dir), "%s", argv[1]);
+    }
+    else
+    {
+
+        snprintf(data_dir, sizeof(data_dir), "/tmp/durable_bench_XXXXXX");
+        if (!mkdtemp(data_dir))
+        {
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "publish throughput, %d messages of %d bytes\n",
+            N_MESSAGES, PAYLOAD_SIZE);
+
+    double in_memory = 0;
+    double durable = 0;
+    int exit_code = run("in-memory", data_dir, 0, &in_memory);
+    exit_code |= run("durable", data_dir, 1, &durable);
+
+    if (!exit_code)
+    {
+        fprintf(stderr, "durable / in-memory slowdown: %.2fx\n",
+                in_memory / durable);
+    }
+
+    remove_channel_dir(data_dir, "bench");
+    if (argc <= 1)
+    {
+        rmdir(data_dir);
+    }
+
+    return exit_code;
+}
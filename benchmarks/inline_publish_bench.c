@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "message_broker.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// @note results go to stderr; the broker logs the publishes at debug level
+// only, below the default one, so logging stays out of the measurement.
+
+#define N_WARMUP 1000
+#define N_SAMPLES 20000
+
+struct _consumer_arg_t
+{
+    struct subscription_t* _subscription;
+    uint64_t* _samples;
+    size_t _n_samples;
+    atomic_size_t _n_received;
+};
+
+static uint64_t
+now_ns()
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int
+compare_u64(const void* a, const void* b)
+{
+
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static void*
+consumer(void* arg)
+{
+
+    struct _consumer_arg_t* consumer_arg = arg;
+
+    size_t i = 0;
+    while (i < consumer_arg->_n_samples)
+    {
+
+        struct message_t* msg = NULL;
+        if (subscription_receive(consumer_arg->_subscription, &msg) || !msg)
+        {
+            break;
+        }
+
+        const void* payload = NULL;
+        size_t len = 0;
+        message_get_payload(msg, &payload, &len);
+
+        uint64_t sent_at = 0;
+        if (len == sizeof(sent_at))
+        {
+            memcpy(&sent_at, payload, sizeof(sent_at));
+        }
+
+        consumer_arg->_samples[i] = now_ns() - sent_at;
+        message_free(msg);
+
+        i++;
+        atomic_store(&consumer_arg->_n_received, i);
+    }
+
+    return NULL;
+}
+
+// @note ping-pong: the next message is published only once the previous one
+// has been received, so each sample measures a single publish-to-receive hop
+// on an otherwise idle broker.
+static int
+run(const char* label, size_t inline_fanout_threshold)
+{
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 2,
+        ._channels_capacity = 16,
+        ._inline_fanout_threshold = inline_fanout_threshold};
+
+    struct message_broker_t* broker = NULL;
+    if (message_broker_new(&config, &broker))
+    {
+        return 1;
+    }
+
+    struct _consumer_arg_t consumer_arg;
+    consumer_arg._subscription = NULL;
+    consumer_arg._n_samples = N_WARMUP + N_SAMPLES;
+    consumer_arg._samples = malloc(consumer_arg._n_samples * sizeof(uint64_t));
+    atomic_init(&consumer_arg._n_received, 0);
+
+    if (!consumer_arg._samples
+        || message_broker_subscribe(broker, "bench",
+                                    &consumer_arg._subscription))
+    {
+
+        free(consumer_arg._samples);
+        message_broker_free(broker);
+
+        return 1;
+    }
+
+    pthread_t consumer_thread;
+    pthread_create(&consumer_thread, NULL, consumer, &consumer_arg);
+
+    size_t i = 0;
+    while (i < consumer_arg._n_samples)
+    {
+
+        uint64_t sent_at = now_ns();
+        message_broker_publish_bytes(broker, "bench", &sent_at,
+                                     sizeof(sent_at));
+
+        i++;
+        while (atomic_load(&consumer_arg._n_received) < i)
+        {
+        }
+    }
+
+    pthread_join(consumer_thread, NULL);
+
+    uint64_t* samples = consumer_arg._samples + N_WARMUP;
+    qsort(samples, N_SAMPLES, sizeof(uint64_t), compare_u64);
+
+    fprintf(stderr, "%-8s p50: %8.2f us  p99: %8.2f us  max: %8.2f us\n",
+            label, samples[N_SAMPLES / 2] / 1000.0,
+            samples[N_SAMPLES * 99 / 100] / 1000.0,
+            samples[N_SAMPLES - 1] / 1000.0);
+
+    subscription_unsubscribe(consumer_arg._subscription);
+    subscription_free(consumer_arg._subscription);
+    free(consumer_arg._samples);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+main()
+{
+
+    fprintf(stderr, "publish -> receive latency, %d samples\n", N_SAMPLES);
+
+    int exit_code = run("pooled", 0);
+    exit_code |= run("inline", 4);
+
+    return exit_code;
+}
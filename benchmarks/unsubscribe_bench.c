@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "message_broker.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// @note a mass disconnect: every subscription of one channel is dropped at
+// once by N_THREADS threads. With a constant cost per unsubscribe the total
+// time grows linearly with the number of subscriptions.
+
+#define N_THREADS 8
+
+struct _unsubscriber_arg_t
+{
+    struct subscription_t** _subs;
+    size_t _first;
+    size_t _n;
+};
+
+static uint64_t
+now_ns()
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void*
+unsubscriber(void* arg)
+{
+
+    struct _unsubscriber_arg_t* a = arg;
+
+    size_t i = a->_first;
+    while (i < a->_n)
+    {
+        subscription_unsubscribe(a->_subs[i]);
+        i += N_THREADS;
+    }
+
+    return NULL;
+}
+
+static int
+run(size_t n_subs)
+{
+
+    struct message_broker_configuration_t config = {._n_threads = 2,
+                                                    ._channels_capacity = 16};
+
+    struct message_broker_t* broker = NULL;
+    if (message_broker_new(&config, &broker))
+    {
+        return 1;
+    }
+
+    struct subscription_t** subs = calloc(n_subs, sizeof(*subs));
+    if (!subs)
+    {
+        message_broker_free(broker);
+        return 1;
+    }
+
+    size_t i = 0;
+    while (i < n_subs)
+    {
+
+        if (message_broker_subscribe(broker, "bench", &subs[i]))
+        {
+            break;
+        }
+
+        i++;
+    }
+    size_t n_subscribed = i;
+
+    struct _unsubscriber_arg_t args[N_THREADS];
+    pthread_t threads[N_THREADS];
+
+    uint64_t start = now_ns();
+
+    i = 0;
+    while (i < N_THREADS)
+    {
+
+        args[i] = (struct _unsubscriber_arg_t) {
+            ._subs = subs, ._first = i, ._n = n_subscribed};
+        pthread_create(&threads[i], NULL, unsubscriber, &args[i]);
+        i++;
+    }
+
+    i = 0;
+    while (i < N_THREADS)
+    {
+        pthread_join(threads[i], NULL);
+        i++;
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    fprintf(stderr, "%6zu subscriptions: %8.2f ms total  %6.2f us each\n",
+            n_subscribed, elapsed / 1e6,
+            n_subscribed ? elapsed / 1e3 / n_subscribed : 0.0);
+
+    i = 0;
+    while (i < n_subscribed)
+    {
+        subscription_free(subs[i]);
+        i++;
+    }
+
+    free(subs);
+    message_broker_free(broker);
+
+    return n_subscribed != n_subs;
+}
+
+int
+main()
+{
+
+    fprintf(stderr, "concurrent unsubscribe, %d threads\n", N_THREADS);
+
+    int exit_code = run(5000);
+    exit_code |= run(50000);
+
+    return exit_code;
+}
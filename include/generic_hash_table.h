@@ -65,13 +65,67 @@ generic_hash_table_get(generic_hash_table self, void* key, void** out_value);
 int
 generic_hash_table_contains(generic_hash_table self, void* key);
 
+// @note the following operations run entirely under the lock of the bucket
+// owning the key, so they are atomic with respect to any other operation on the
+// same key without serializing unrelated keys.
+
+// Returns in out_value the value stored for key; when the key is absent the
+// value produced by create_function(key, context, &value) is inserted first.
+// The created value goes through the copy value function as for insert.
+int
+generic_hash_table_compute_if_absent(generic_hash_table self, void* key,
+                                     int (*create_function)(void*, void*,
+                                                            void**),
+                                     void* context, void** out_value);
+
+// Same as generic_hash_table_compute_if_absent, then calls apply(value,
+// context) on the stored or created value before the bucket lock is released,
+// e.g. to take a reference that no concurrent delete can race with.
+int
+generic_hash_table_compute_if_absent_apply(
+    generic_hash_table self, void* key,
+    int (*create_function)(void*, void*, void**),
+    void (*apply)(void*, void*), void* context, void** out_value);
+
+// Same as generic_hash_table_get, then calls apply(value, context) before the
+// bucket lock is released; returns 1 when the key is absent.
+int
+generic_hash_table_get_apply(generic_hash_table self, void* key,
+                             void (*apply)(void*, void*), void* context,
+                             void** out_value);
+
+// Inserts the key-value pair or replaces (and frees) the value already stored.
+int
+generic_hash_table_upsert(generic_hash_table self, void* key, void* value);
+
+// Deletes the key only if its stored value is expected_value (pointer
+// equality); returns 1 when the key is absent or bound to another value.
+int
+generic_hash_table_compare_and_delete(generic_hash_table self, void* key,
+                                      void* expected_value);
+
 // @todo implement.
 int
 generic_hash_table_clear(generic_hash_table self);
 
-// @todo implement.
+// Deletes every pair for which predicate(key, value, context) is non-zero, one
+// bucket at a time: the predicate and the free functions run under the bucket
+// lock. out_n_deleted (may be NULL) is the number of deleted pairs.
+int
+generic_hash_table_delete_if(generic_hash_table self,
+                             int (*predicate)(void*, void*, void*),
+                             void* context, size_t* out_n_deleted);
+
+// Calls apply(key, value) on every pair, one bucket at a time under the bucket
+// lock: apply must not call back into the table.
 int
 generic_hash_table_for_each(generic_hash_table self,
                             void (*apply)(void*, void*));
 
+// Same as generic_hash_table_for_each, calling apply(key, value, context).
+int
+generic_hash_table_for_each_context(generic_hash_table self,
+                                    void (*apply)(void*, void*, void*),
+                                    void* context);
+
 #endif  // GENERIC_HASH_TABLE_H
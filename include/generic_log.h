@@ -0,0 +1,64 @@
+#ifndef GENERIC_LOG_H
+#define GENERIC_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct generic_log_t* generic_log;
+typedef struct generic_log_cursor_t* generic_log_cursor;
+
+// @note append-only log split in fixed size segments. A single writer appends
+// (callers serialize appends and cursor creation), any number of cursors read
+// concurrently with it. A segment is released, and its items freed with the
+// free function, as soon as the writer and every cursor have moved past it.
+int
+generic_log_new(size_t segment_capacity, generic_log* out_self);
+
+// @note every cursor must be freed before the log.
+int
+generic_log_free(generic_log self);
+
+int
+generic_log_set_free_function(generic_log self, void (*free_function)(void*));
+
+int
+generic_log_append(generic_log self, void* data);
+
+int
+generic_log_append_batch(generic_log self, void** data, size_t n);
+
+// Offset the next appended item will get; offsets start at 0.
+int
+generic_log_get_tail(generic_log self, uint64_t* out_offset);
+
+// Moves the offset origin of an empty log with no cursor, e.g. to align it
+// with an external sequence; returns 1 once an item has been appended.
+int
+generic_log_set_tail(generic_log self, uint64_t offset);
+
+int
+generic_log_get_segment_count(generic_log self, size_t* out_count);
+
+// Creates a cursor positioned at the tail: it reads the items appended after
+// its creation.
+int
+generic_log_cursor_new(generic_log self, generic_log_cursor* out_cursor);
+
+int
+generic_log_cursor_free(generic_log_cursor self);
+
+// Reads the item at the cursor and moves past it; returns 1 when the cursor
+// has caught up with the tail. The item stays owned by the log and is valid
+// until the next call on the cursor.
+int
+generic_log_cursor_next(generic_log_cursor self, void** out_data);
+
+// Offset of the next item the cursor will read.
+int
+generic_log_cursor_get_offset(generic_log_cursor self, uint64_t* out_offset);
+
+// Number of items appended and not read yet through the cursor.
+int
+generic_log_cursor_get_lag(generic_log_cursor self, size_t* out_lag);
+
+#endif  // GENERIC_LOG_H
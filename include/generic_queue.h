@@ -55,4 +55,11 @@ generic_queue_contains(generic_queue self, void* target,
 int
 generic_queue_for_each(generic_queue self, void (*apply)(void*));
 
+// Removes every item for which predicate returns non zero, keeping the order
+// of the others; removed items are released with the free function, if set.
+int
+generic_queue_remove_if(generic_queue self,
+                        int (*predicate)(void* data, void* context),
+                        void* context, size_t* out_n_removed);
+
 #endif  // GENERIC_QUEUE_H
\ No newline at end of file
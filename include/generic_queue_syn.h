@@ -2,6 +2,7 @@
 #define GENERIC_QUEUE_SYN_H
 
 #include <stddef.h>
+#include <time.h>
 
 typedef struct generic_queue_syn_t* generic_queue_syn;
 
@@ -11,6 +12,14 @@ generic_queue_syn_new(generic_queue_syn* out_self);
 int
 generic_queue_syn_free(generic_queue_syn self);
 
+// Bounds the queue to capacity items (0, the default, means unbounded). Once
+// the queue is full the plain and batch enqueues return 1 without enqueuing.
+int
+generic_queue_syn_set_capacity(generic_queue_syn self, size_t capacity);
+
+int
+generic_queue_syn_get_capacity(generic_queue_syn self, size_t* out_capacity);
+
 int
 generic_queue_syn_set_free_function(generic_queue_syn self,
                                     void (*free_function)(void*));
@@ -33,12 +42,42 @@ generic_queue_syn_size(generic_queue_syn self, size_t* out_size);
 int
 generic_queue_syn_is_empty(generic_queue_syn self);
 
+// Largest size the queue reached since it was created; read without taking
+// the queue lock.
+int
+generic_queue_syn_get_high_water(generic_queue_syn self, size_t* out_size);
+
 int
 generic_queue_syn_enqueue(generic_queue_syn self, void* data);
 
+// Enqueues n items in order taking the queue lock once; out_n_enqueued (may be
+// NULL) reports how many items were enqueued when an error stops the batch.
+int
+generic_queue_syn_enqueue_batch(generic_queue_syn self, void** data, size_t n,
+                                size_t* out_n_enqueued);
+
+// Enqueues data, removing the oldest item first when the queue is full. The
+// removed item is handed back through out_evicted (NULL if none) and the caller
+// owns it.
+int
+generic_queue_syn_enqueue_or_evict(generic_queue_syn self, void* data,
+                                   void** out_evicted);
+
+// Waits until the queue has room or abs_timeout (CLOCK_REALTIME) expires;
+// returns 1 on timeout.
+int
+generic_queue_syn_enqueue_timed(generic_queue_syn self, void* data,
+                                const struct timespec* abs_timeout);
+
 int
 generic_queue_syn_dequeue(generic_queue_syn self, void** out_data);
 
+// Dequeues up to max items in order taking the queue lock once; out_n reports
+// how many were stored in out_data (0 when the queue is empty).
+int
+generic_queue_syn_dequeue_batch(generic_queue_syn self, void** out_data,
+                                size_t max, size_t* out_n);
+
 int
 generic_queue_syn_peek(generic_queue_syn self, void** out_data);
 
@@ -52,6 +91,11 @@ int
 generic_queue_syn_contains(generic_queue_syn self, void* target,
                            int (*compare)(void*, void*));
 
+int
+generic_queue_syn_remove_if(generic_queue_syn self,
+                            int (*predicate)(void* data, void* context),
+                            void* context, size_t* out_n_removed);
+
 int
 generic_queue_syn_for_each(generic_queue_syn self, void (*apply)(void*));
 
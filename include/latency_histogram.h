@@ -0,0 +1,46 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct latency_histogram_t* latency_histogram;
+
+// @note HDR-style histogram of non-negative values (e.g. nanoseconds): values
+// below 32 get a bucket each, larger ones are bucketed by power of two split
+// into 16 linear sub-buckets, so a reported value is within 1/16 of the
+// recorded ones. Values from 2^40 on share the last bucket. Recording is a
+// relaxed atomic add, lock-free and safe from any number of threads; reads
+// are not a snapshot of a single instant.
+int
+latency_histogram_new(latency_histogram* out_self);
+
+int
+latency_histogram_free(latency_histogram self);
+
+int
+latency_histogram_record(latency_histogram self, uint64_t value);
+
+// Records n occurrences of value with a single add.
+int
+latency_histogram_record_n(latency_histogram self, uint64_t value, uint64_t n);
+
+// Adds the values recorded by other to self, e.g. to read histograms recorded
+// per thread as one; other may still be recorded to meanwhile.
+int
+latency_histogram_merge(latency_histogram self, latency_histogram other);
+
+int
+latency_histogram_get_count(latency_histogram self, uint64_t* out_count);
+
+int
+latency_histogram_get_max(latency_histogram self, uint64_t* out_max);
+
+// Highest value of the bucket holding the given percentile (0 to 100) of the
+// recorded values, capped by the maximum recorded; 0 when nothing has been
+// recorded.
+int
+latency_histogram_get_percentile(latency_histogram self, double percentile,
+                                 uint64_t* out_value);
+
+#endif  // LATENCY_HISTOGRAM_H
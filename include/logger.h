@@ -0,0 +1,68 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum logger_level_t
+{
+    LOGGER_DEBUG,
+    LOGGER_INFO,
+    LOGGER_WARN,
+    LOGGER_ERROR,
+    LOGGER_OFF
+};
+
+// @note records below _level are discarded by the caller before anything is
+// formatted. Each thread logs into its own ring of _ring_capacity records (a
+// power of two, rounded up), drained to _output by a background thread every
+// _flush_interval_ms; a record logged while the ring of its thread is full is
+// dropped and counted. _output (stderr when NULL) is not closed by the logger.
+struct logger_configuration_t
+{
+    enum logger_level_t _level;
+    FILE* _output;
+    size_t _ring_capacity;
+    size_t _flush_interval_ms;
+};
+
+// @note process-wide asynchronous logger. Starts are counted: the first one
+// applies config (NULL for INFO to stderr) and starts the background thread,
+// the later ones only take a reference, released by logger_stop. Records logged
+// while the logger is stopped stay in the rings until it is started again.
+int
+logger_start(const struct logger_configuration_t* config);
+
+// Drops a reference; the last one drains every ring and stops the background
+// thread.
+int
+logger_stop();
+
+// Can be called at any time, from any thread or from a signal handler.
+int
+logger_set_level(enum logger_level_t level);
+
+enum logger_level_t
+logger_get_level();
+
+// Returns 1 when name is not one of debug, info, warn, error or off.
+int
+logger_parse_level(const char* name, enum logger_level_t* out_level);
+
+// Formats a record into the ring of the calling thread without blocking; the
+// timestamp, level and component are added when the record is written out.
+// component must be a string literal, or at least outlive the logger.
+void
+logger_log(enum logger_level_t level, const char* component,
+           const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+// Writes out every record logged so far, by any thread; returns 1 when the
+// logger is stopped.
+int
+logger_flush();
+
+// Number of records dropped because the ring of their thread was full.
+size_t
+logger_get_dropped_count();
+
+#endif  // LOGGER_H
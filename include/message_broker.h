@@ -7,11 +7,40 @@
 typedef struct message_broker_t* message_broker;
 typedef struct message_t* message;
 typedef struct subscription_t* subscription;
+typedef struct channel_handle_t* channel_handle;
 
+// @note _n_shards enables the sharded mode: every channel is owned by one of
+// _n_shards single-thread workers chosen by the channel name hash, publishes to
+// the same channel are delivered in FIFO order and the channel state is only
+// touched by its worker. When _n_shards is 0 publishes are executed by a shared
+// pool of _n_threads workers with no per-channel ordering guarantee.
+// @note _inline_fanout_threshold enables the inline fast path (shared pool mode
+// only): a publish to a channel with fewer subscribers than the threshold is
+// fanned out on the caller thread instead of being submitted to the pool, 0
+// disables it.
+// @note _data_dir (may be NULL) is the directory the durable channels are
+// stored in, one sub-directory per channel; it is required to declare them.
+// @note _channel_idle_ms enables the idle channel reclamation: a channel that
+// has no subscriber, no open handle and no publish in flight for that long is
+// freed, and created again by its next use. Declared channels are never
+// reclaimed. 0 keeps every channel until the broker is freed.
+// @note _global_message_ids gives every message a broker-wide id taken from a
+// single counter shared by every publisher. Without it a message is known by
+// its channel sequence (see message_get_sequence) and publishers on distinct
+// channels share nothing.
+// @note _latency_tracing records, per channel, the time from the publish of
+// every message to its fan-out, to its enqueue into every inbox and to its
+// receive; see message_broker_get_channel_latency.
 struct message_broker_configuration_t
 {
     size_t _n_threads;
     size_t _channels_capacity;
+    size_t _n_shards;
+    size_t _inline_fanout_threshold;
+    const char* _data_dir;
+    size_t _channel_idle_ms;
+    int _global_message_ids;
+    int _latency_tracing;
 };
 
 int
@@ -21,26 +50,380 @@ message_broker_new(struct message_broker_configuration_t* config,
 int
 message_broker_free(struct message_broker_t* self);
 
+enum subscription_overflow_policy_t
+{
+    SUBSCRIPTION_OVERFLOW_DROP_OLDEST = 0,
+    SUBSCRIPTION_OVERFLOW_DROP_NEWEST,
+    SUBSCRIPTION_OVERFLOW_BLOCK,
+    SUBSCRIPTION_OVERFLOW_DISCONNECT,
+};
+
+// @note _capacity bounds the subscriber inbox (0 means unbounded, the policy
+// is then ignored). When the inbox is full:
+// - DROP_OLDEST evicts the oldest pending message to make room;
+// - DROP_NEWEST discards the message being delivered;
+// - BLOCK makes the publishing thread wait up to _block_timeout_ms for room,
+//   then discards the message; the subscribes and unsubscribes on the
+//   channel do not wait for it meanwhile;
+// - DISCONNECT discards the message and deactivates the subscription, it is
+//   no longer delivered to and further receives fail.
+// Every discarded message is counted, see subscription_get_dropped_count.
+// @note _name (may be NULL) makes the subscription durable on a durable
+// channel: its position is persisted under that name, survives unsubscribes
+// and restarts, and a later subscription with the same name resumes from it.
+// Only one subscription per name can be attached at a time.
+// @note _ack_window enables the ack mode (0 means a message is done with once
+// received): at most _ack_window received messages can be waiting for an ack,
+// a receive waits for room once the window is full. A message not acked within
+// _ack_timeout_ms (0 picks the default) is delivered again by a later receive.
+// On a named subscription the persisted position is the oldest unacked
+// message, so unacked messages are also delivered again after a restart.
+// @note _partitions selects partitions of a partitioned channel (bit p for
+// partition p, see channel_options_t), 0 selects them all: only the messages
+// of the selected partitions are delivered. Subscribing with partitions the
+// channel does not have fails.
+struct subscription_options_t
+{
+    size_t _capacity;
+    enum subscription_overflow_policy_t _overflow_policy;
+    size_t _block_timeout_ms;
+    const char* _name;
+    size_t _ack_window;
+    size_t _ack_timeout_ms;
+    uint64_t _partitions;
+};
+
+enum message_header_type_t
+{
+    MESSAGE_HEADER_STRING = 0,
+    MESSAGE_HEADER_INT,
+    MESSAGE_HEADER_BYTES,
+};
+
+// @note a typed key/value pair carried next to the payload, so that a message
+// can be routed without parsing its body. _key is a NUL-terminated string of 1
+// to MESSAGE_HEADER_MAX_KEY_LEN bytes. A STRING value is the NUL-terminated
+// _value (_len is ignored when publishing), a BYTES value is _len bytes at
+// _value, an INT value is _int_value. Headers read back from a message point
+// into it: they are valid as long as the message is, their _key and STRING or
+// BYTES _value are NUL-terminated and _len is set for both.
+struct message_header_t
+{
+    const char* _key;
+    enum message_header_type_t _type;
+    const void* _value;
+    size_t _len;
+    int64_t _int_value;
+};
+
+#define MESSAGE_HEADER_MAX_KEY_LEN 255
+
+// @note _ttl_ms is the time to live of the message in milliseconds, 0 falls
+// back to the channel default (see message_broker_declare_channel).
+// @note _headers (may be NULL) are the _n_headers headers of the message.
+struct message_broker_batch_entry_t
+{
+    const char* _channel;
+    const void* _payload;
+    size_t _len;
+    size_t _ttl_ms;
+    const struct message_header_t* _headers;
+    size_t _n_headers;
+};
+
+// @note a message that outlives its TTL is dropped from the inboxes it is still
+// pending in: lazily when a receive meets it and eagerly by the broker expiry
+// sweeper. _ttl_ms 0 falls back to the channel default, see
+// message_broker_declare_channel.
+// @note _key (may be NULL, _key_len bytes) binds the message to the partition
+// its key hashes to on a partitioned channel: the messages of a key keep
+// their order (in sharded mode) while the partitions are fanned out in
+// parallel. Messages without a key are spread round-robin.
+// @note _headers (may be NULL) are the _n_headers headers of the message, see
+// message_header_t; the publish fails with 1 when one of them is invalid.
+struct publish_options_t
+{
+    size_t _ttl_ms;
+    const void* _key;
+    size_t _key_len;
+    const struct message_header_t* _headers;
+    size_t _n_headers;
+};
+
+// @note QUEUE gives every subscriber a private inbox the message is enqueued
+// in, LOG appends the message once to a segmented log owned by the channel and
+// every subscriber reads it through its own cursor: a publish costs the same
+// whatever the number of subscribers and a segment is freed once the slowest
+// subscriber has read past it. Inbox bounds, overflow policies and the eager
+// TTL sweep only apply to QUEUE channels; on LOG channels an unread message is
+// retained until every subscriber read it, expired ones are skipped on receive.
+enum channel_storage_t
+{
+    CHANNEL_STORAGE_QUEUE = 0,
+    CHANNEL_STORAGE_LOG,
+};
+
+// @note _default_ttl_ms applies to the messages published without a TTL of
+// their own, 0 means they never expire.
+// @note _durable (LOG storage only) also appends the messages to a write-ahead
+// log under the broker _data_dir, recovered when the channel is declared again
+// after a restart. Messages are delivered once appended and made durable by a
+// group commit: one fdatasync every _commit_batch_size messages or after at
+// most _commit_latency_ms (0 picks the defaults); message_broker_wait returns
+// once every publish is durable. Once a write or an fdatasync of the log fails
+// the channel drops its messages (counted in _n_dropped) and
+// message_broker_wait returns the error.
+// @note _n_partitions (QUEUE storage only, at most 64) splits the channel into
+// partitions, 0 or 1 leaves it whole; see publish_options_t and
+// subscription_options_t.
+struct channel_options_t
+{
+    size_t _default_ttl_ms;
+    enum channel_storage_t _storage;
+    int _durable;
+    size_t _commit_batch_size;
+    size_t _commit_latency_ms;
+    size_t _n_partitions;
+};
+
+// Creates the channel if needed and sets its options; publishes already in
+// flight may still see the previous options. The storage and the partitions
+// can only be changed while the channel has no subscribers, 1 is returned
+// otherwise. A durable channel whose log was written in another on-disk format
+// fails with EPROTO and its files are left as they are.
+int
+message_broker_declare_channel(struct message_broker_t* self,
+                               const char* channel,
+                               const struct channel_options_t* options);
+
+// out_n_live is the number of channels currently allocated, out_n_reclaimed
+// the number of channels freed by the idle reclamation so far.
+int
+message_broker_get_channel_counts(struct message_broker_t* self,
+                                  size_t* out_n_live, size_t* out_n_reclaimed);
+
+// Number of messages of the channel dropped because their TTL expired.
+int
+message_broker_get_channel_expired_count(struct message_broker_t* self,
+                                         const char* channel,
+                                         size_t* out_count);
+
+// @note counters since the broker (or the channel) was created. _n_published
+// counts the messages fanned out to their channel, _n_fanned_out the copies
+// enqueued into the inboxes (on LOG channels, the messages appended to the
+// log), _n_dropped the messages lost to a full inbox, to their TTL or to a
+// failed write-ahead log and _n_delivered the messages handed to the
+// receivers, redeliveries included. The bytes are those of the contents.
+// Pattern subscriptions count toward the broker only.
+struct message_broker_counters_t
+{
+    uint64_t _n_published;
+    uint64_t _n_fanned_out;
+    uint64_t _n_dropped;
+    uint64_t _n_delivered;
+    uint64_t _bytes_in;
+    uint64_t _bytes_out;
+};
+
+// @note _n_pending_tasks is the depth of the publisher pool (of every shard in
+// sharded mode): the publishes submitted and not completed yet.
+struct message_broker_stats_t
+{
+    struct message_broker_counters_t _counters;
+    size_t _n_pending_tasks;
+    size_t _n_channels;
+};
+
+struct channel_stats_t
+{
+    struct message_broker_counters_t _counters;
+    size_t _n_subscribers;
+};
+
+enum message_latency_stage_t
+{
+    MESSAGE_LATENCY_FAN_OUT,
+    MESSAGE_LATENCY_ENQUEUE,
+    MESSAGE_LATENCY_DEQUEUE
+};
+
+// @note nanoseconds since the publish, each percentile within 1/16 of the
+// recorded latencies; all 0 when nothing has been recorded.
+struct message_latency_t
+{
+    uint64_t _count;
+    uint64_t _p50_ns;
+    uint64_t _p90_ns;
+    uint64_t _p99_ns;
+    uint64_t _p999_ns;
+    uint64_t _max_ns;
+};
+
+// @note the broker counters are sharded per thread on cache lines of their
+// own, the publishers never share one; a read sums the shards without locking,
+// it is not a snapshot of a single instant.
+int
+message_broker_get_stats(struct message_broker_t* self,
+                         struct message_broker_stats_t* out_stats);
+
+// @note sharded like the broker counters, one cache line per CPU and channel.
+// Returns 1 when the channel does not exist.
+int
+message_broker_get_channel_stats(struct message_broker_t* self,
+                                 const char* channel,
+                                 struct channel_stats_t* out_stats);
+
+// @note latency percentiles of the messages published to channel, needs
+// _latency_tracing: from the publish call to the start of their fan-out, to
+// the end of their enqueue into every inbox (their append on LOG channels),
+// once per message, and to their receive by each subscriber, redeliveries
+// included. Pattern subscriptions are not accounted. The histograms are
+// sharded like the counters and merged by the read. Returns 1 when the channel
+// does not exist.
+int
+message_broker_get_channel_latency(struct message_broker_t* self,
+                                   const char* channel,
+                                   enum message_latency_stage_t stage,
+                                   struct message_latency_t* out_latency);
+
 int
 message_broker_publish(struct message_broker_t* self, const char* channel,
                        const char* content);
 
+// @note binary-safe variant of message_broker_publish: the payload may contain
+// embedded zeros and is delivered exactly as len bytes.
+int
+message_broker_publish_bytes(struct message_broker_t* self,
+                             const char* channel, const void* payload,
+                             size_t len);
+
+// @note options may be NULL, which is the same as message_broker_publish_bytes.
+int
+message_broker_publish_with_options(struct message_broker_t* self,
+                                    const char* channel, const void* payload,
+                                    size_t len,
+                                    const struct publish_options_t* options);
+
+// @note the whole batch is fanned out by a single publisher task: messages are
+// grouped by channel so that each channel and each subscriber inbox is locked
+// once per batch. Messages of the same channel keep their order in the batch.
+int
+message_broker_publish_batch(
+    struct message_broker_t* self,
+    const struct message_broker_batch_entry_t* entries, size_t n);
+
 int
 message_broker_subscribe(struct message_broker_t* self, const char* channel,
                          struct subscription_t** out_subscription);
 
+// @note options may be NULL, which is the same as message_broker_subscribe.
+int
+message_broker_subscribe_with_options(
+    struct message_broker_t* self, const char* channel,
+    const struct subscription_options_t* options,
+    struct subscription_t** out_subscription);
+
+// @note joins the consumer group named group on channel, created by its first
+// member and dropped with its last one: each message published to the channel
+// is delivered to a single member of the group, the one with the fewest
+// pending (queued or unacked) messages, ties broken round-robin. Groups sit
+// next to the plain subscribers, which still get every message, and several
+// groups on a channel each get every message once. options may be NULL but
+// cannot name the subscription. Returns 1 on LOG channels.
+int
+message_broker_subscribe_group(struct message_broker_t* self,
+                               const char* channel, const char* group,
+                               const struct subscription_options_t* options,
+                               struct subscription_t** out_subscription);
+
+// @note subscribes to every channel whose name matches pattern: names are
+// '.'-separated segments, a '*' segment matches exactly one segment and a '#'
+// segment matches zero or more ("sensors.*.temp", "orders.#"). The messages
+// keep the name of the channel they were published to. Subscriptions with the
+// same pattern share one pattern channel; options may be NULL but cannot name
+// the subscription, nor ask for the ack mode unless the broker has
+// _global_message_ids (the sequences of the channels overlap). Returns 1 when
+// pattern has an empty segment.
+int
+message_broker_subscribe_pattern(struct message_broker_t* self,
+                                 const char* pattern,
+                                 const struct subscription_options_t* options,
+                                 struct subscription_t** out_subscription);
+
+// @note a channel handle pre-creates the channel and keeps it resolved:
+// publishing and subscribing through it skip the hashing and the lookup of the
+// channel name. The handle must be closed before the broker is freed; closing
+// it does not affect the channel.
+int
+message_broker_channel_open(struct message_broker_t* self, const char* channel,
+                            struct channel_handle_t** out_handle);
+
+int
+message_broker_channel_close(struct channel_handle_t* self);
+
+// @note options may be NULL.
+int
+message_broker_publish_to(struct channel_handle_t* self, const void* payload,
+                          size_t len, const struct publish_options_t* options);
+
+// @note options may be NULL.
+int
+message_broker_subscribe_to(struct channel_handle_t* self,
+                            const struct subscription_options_t* options,
+                            struct subscription_t** out_subscription);
+
 int
 message_broker_wait(struct message_broker_t* self);
 
+// The broker-wide id with _global_message_ids, the channel sequence otherwise.
 int
 message_get_id(struct message_t* self, uint64_t* out_id);
 
+// @note the sequence numbers the messages of a channel from 1, or of each
+// partition on partitioned channels, in delivery order on LOG channels and in
+// sharded mode: a subscriber can tell a gap (a message it did not get) from
+// two consecutive sequences. On LOG channels it is the log offset plus one,
+// kept across restarts by durable channels.
+int
+message_get_sequence(struct message_t* self, uint64_t* out_sequence);
+
 int
 message_get_channel(struct message_t* self, const char** out_channel);
 
+// Partition the message was published to, 0 on channels without partitions.
+int
+message_get_partition(struct message_t* self, size_t* out_partition);
+
 int
 message_get_content(struct message_t* self, const char** out_content);
 
+int
+message_get_payload(struct message_t* self, const void** out_payload,
+                    size_t* out_len);
+
+// @note looks key up in the headers of the message, the first one wins when
+// it was given several times. Returns 1 when the message has no such header.
+int
+message_get_header(struct message_t* self, const char* key,
+                   struct message_header_t* out_header);
+
+// @note the headers of the message as the single block they are stored in
+// (out_len 0 when it has none), e.g. to relay them as is; see
+// message_headers_decode. Each header is encoded as its type and key length
+// (one byte each), the key and a NUL, then for an INT the zigzag LEB128 varint
+// of the value, for a STRING or BYTES the LEB128 varint of its length, the
+// value and a NUL.
+int
+message_get_headers(struct message_t* self, const void** out_block,
+                    size_t* out_len);
+
+// @note decodes a header block into at most max headers pointing into block.
+// Returns 1 when the block is malformed or holds more than max headers.
+int
+message_headers_decode(const void* block, size_t len,
+                       struct message_header_t* out_headers, size_t max,
+                       size_t* out_n);
+
 int
 message_free(struct message_t* self);
 
@@ -51,6 +434,34 @@ int
 subscription_try_receive(struct subscription_t* self,
                          struct message_t** out_msg);
 
+#define SUBSCRIPTION_WAIT_FOREVER ((size_t) -1)
+
+// Waits up to timeout_ms (0 does not wait, SUBSCRIPTION_WAIT_FOREVER has no
+// limit) for a message; returns 1 when the wait timed out or the subscription
+// is no longer active.
+int
+subscription_receive_timeout(struct subscription_t* self,
+                             struct message_t** out_msg, size_t timeout_ms);
+
+// @note eventfd (Linux) of the subscription for poll/epoll: it is readable
+// when messages may be pending and is cleared by the receive that finds none,
+// so a poller drains with subscription_try_receive until it returns 1 and then
+// polls again. In ack mode it is not readable while the window is full and
+// does not report the ack timeouts, bound the poll by the ack timeout. The fd
+// is owned by the subscription and closed when it is unsubscribed.
+int
+subscription_get_fd(struct subscription_t* self, int* out_fd);
+
+// Waits up to timeout_ms (0 does not wait, SUBSCRIPTION_WAIT_FOREVER has no
+// limit) for a message, then takes up to max pending messages at once: the
+// inbox, or the log, is drained in a single critical section. out_n is the
+// number of messages stored in out_msgs, each to be freed; returns 1 when the
+// wait timed out or the subscription is no longer active.
+int
+subscription_receive_batch(struct subscription_t* self,
+                           struct message_t** out_msgs, size_t max,
+                           size_t timeout_ms, size_t* out_n);
+
 int
 subscription_unsubscribe(struct subscription_t* self);
 
@@ -66,4 +477,46 @@ subscription_get_channel(struct subscription_t* self, const char** out_channel);
 int
 subscription_get_pending_count(struct subscription_t* self, size_t* out_count);
 
+int
+subscription_get_dropped_count(struct subscription_t* self, size_t* out_count);
+
+// @note cumulative ack by delivery order: the message waiting for an ack with
+// id message_id is done with, and so is every message delivered to the
+// subscription before it (a redelivery counts as a new delivery). Ids are not
+// compared, they do not follow the delivery order when several workers fan
+// out the same channel. An id waiting for no ack (e.g. acked already) acks
+// nothing; the first delivered wins on partitioned channels, where the
+// partition sequences overlap. Returns 1 when the subscription is not in ack
+// mode.
+int
+subscription_ack(struct subscription_t* self, uint64_t message_id);
+
+// Number of received messages waiting for an ack.
+int
+subscription_get_in_flight_count(struct subscription_t* self,
+                                 size_t* out_count);
+
+// Number of messages delivered again because their ack timed out.
+int
+subscription_get_redelivered_count(struct subscription_t* self,
+                                   size_t* out_count);
+
+// @note _inbox_depth is the pending count, _inbox_high_water the largest
+// number of messages the inbox held (0 on LOG channels, which have no inbox),
+// _n_dropped the messages lost to a full inbox.
+struct subscription_stats_t
+{
+    uint64_t _n_delivered;
+    uint64_t _bytes_out;
+    size_t _n_dropped;
+    size_t _inbox_depth;
+    size_t _inbox_high_water;
+    size_t _n_in_flight;
+    size_t _n_redelivered;
+};
+
+int
+subscription_get_stats(struct subscription_t* self,
+                       struct subscription_stats_t* out_stats);
+
 #endif
\ No newline at end of file
@@ -15,6 +15,8 @@ struct network_server_configuration_t
     const char* _api_key;
     struct message_broker_t* _broker;
     size_t _max_clients;
+    struct subscription_options_t _subscription_options;
+    size_t _default_ttl_ms;
 };
 
 int
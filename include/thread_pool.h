@@ -21,4 +21,9 @@ int
 thread_pool_submit(struct thread_pool_t* self, void* (*function)(void*),
                    void* arg);
 
+// Number of tasks submitted and not completed yet, queued or running; read
+// without taking the pool lock.
+int
+thread_pool_get_pending_count(struct thread_pool_t* self, size_t* out_count);
+
 #endif  // THREAD_POOL_H
\ No newline at end of file
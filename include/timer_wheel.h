@@ -0,0 +1,54 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct timer_wheel_t* timer_wheel;
+typedef struct timer_wheel_timer_t* timer_wheel_timer;
+
+// @note hierarchical timing wheel: timers are bucketed by expiry tick in a few
+// levels of slots, so arming, cancelling and advancing by one tick are O(1)
+// whatever the number of armed timers. Times are in milliseconds on a clock
+// chosen by the caller (e.g. CLOCK_MONOTONIC), rounded down to tick_ms.
+int
+timer_wheel_new(uint64_t tick_ms, uint64_t now_ms,
+                struct timer_wheel_t** out_self);
+
+// @note every timer must have been cancelled (or never armed) before the wheel
+// is freed.
+int
+timer_wheel_free(struct timer_wheel_t* self);
+
+// @note the callback runs on the thread calling timer_wheel_advance, under the
+// wheel lock: it must not call back into the wheel. It returns the next expiry
+// of the timer in ms, or 0 to leave it disarmed.
+int
+timer_wheel_timer_new(uint64_t (*callback)(void* arg, uint64_t now_ms),
+                      void* arg, struct timer_wheel_timer_t** out_timer);
+
+int
+timer_wheel_timer_free(struct timer_wheel_timer_t* timer);
+
+// Arms the timer to fire at expires_at_ms; a timer already armed for an
+// earlier time is left untouched, so the earliest deadline always wins.
+int
+timer_wheel_arm(struct timer_wheel_t* self, struct timer_wheel_timer_t* timer,
+                uint64_t expires_at_ms);
+
+// Disarms the timer; once it returns the callback is not running and will not
+// run until the timer is armed again.
+int
+timer_wheel_cancel(struct timer_wheel_t* self,
+                   struct timer_wheel_timer_t* timer);
+
+// Moves the wheel forward to now_ms firing every timer that expired on the way;
+// out_n_fired (may be NULL) reports how many callbacks ran.
+int
+timer_wheel_advance(struct timer_wheel_t* self, uint64_t now_ms,
+                    size_t* out_n_fired);
+
+int
+timer_wheel_size(struct timer_wheel_t* self, size_t* out_size);
+
+#endif  // TIMER_WHEEL_H
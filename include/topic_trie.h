@@ -0,0 +1,51 @@
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+#include <stddef.h>
+
+typedef struct topic_trie_t* topic_trie;
+
+// @note trie of topic patterns made of '.'-separated segments, where a '*'
+// segment matches exactly one segment and a '#' segment matches zero or more.
+// Each pattern holds the values inserted under it, a run of '#' is stored as a
+// single one. Matching a topic walks the trie segment by segment, each trie
+// node visited at most once per segment: its cost depends on the topic depth
+// and not on the number of patterns. The trie is not synchronized: callers
+// serialize inserts and removals with the matches (matches may run
+// concurrently).
+int
+topic_trie_new(topic_trie* out_self);
+
+// The values are not owned by the trie.
+int
+topic_trie_free(topic_trie self);
+
+// Returns 1 when pattern is not a valid pattern (empty, or with an empty
+// segment), 0 otherwise.
+int
+topic_trie_validate(const char* pattern);
+
+// Returns 1 when topic contains a '*' or '#' segment, 0 otherwise.
+int
+topic_trie_is_pattern(const char* topic);
+
+int
+topic_trie_insert(topic_trie self, const char* pattern, void* value);
+
+// Removes one occurrence of value under pattern, the nodes left empty are
+// freed; returns 1 when value is not found under pattern.
+int
+topic_trie_remove(topic_trie self, const char* pattern, void* value);
+
+// Calls callback on every value of every pattern matching topic, once per
+// pattern even when the pattern matches the topic in several ways; a non-zero
+// return stops the match and is returned.
+int
+topic_trie_match(topic_trie self, const char* topic,
+                 int (*callback)(void* context, void* value), void* context);
+
+// Number of patterns holding at least one value.
+int
+topic_trie_get_size(topic_trie self, size_t* out_size);
+
+#endif  // TOPIC_TRIE_H
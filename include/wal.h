@@ -0,0 +1,82 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef struct wal_t* wal;
+
+// @note _segment_size is the size in bytes past which the active segment file
+// is closed and a new one started. A commit (one write and one fdatasync) is
+// issued once _commit_batch_size records are pending or the oldest pending
+// record waited _commit_latency_ms, whichever comes first. _format_version
+// tags the layout of the records data and is stored in every segment header.
+struct wal_configuration_t
+{
+    size_t _segment_size;
+    size_t _commit_batch_size;
+    size_t _commit_latency_ms;
+    uint32_t _format_version;
+};
+
+// @note write-ahead log stored as segment files in dir, each named after the
+// offset of its first record. Records are framed with their length, offset and
+// a CRC32; on open the segments are mapped and scanned, a torn or corrupted
+// tail is truncated at the last record that checks. Records are buffered by
+// wal_append and written by a background flusher with group commit.
+// @note fails with EPROTO, leaving dir untouched, when a segment holds another
+// _format_version or was written without a segment header.
+// @note named offsets (e.g. subscriber positions) are persisted along with the
+// records; the segments entirely below the smallest named offset, or below the
+// tail when there is none, are deleted.
+int
+wal_open(const char* dir, const struct wal_configuration_t* config,
+         wal* out_self);
+
+// Commits what is pending and closes the log.
+int
+wal_close(wal self);
+
+// Appends a record made of the concatenation of the n_parts buffers; its offset
+// is returned in out_offset (may be NULL). The record is durable once a later
+// commit completes, see wal_sync. A failed commit is final: the records it
+// held and those appended after it are dropped, the file is truncated back to
+// the last committed record and every later append fails with its error.
+int
+wal_append(wal self, const struct iovec* parts, size_t n_parts,
+           uint64_t* out_offset);
+
+// Blocks until every record appended so far is durable; returns the error of
+// the last failed write or fdatasync, if any.
+int
+wal_sync(wal self);
+
+// Offsets of the first record stored and of the next record to be appended.
+int
+wal_get_range(wal self, uint64_t* out_first, uint64_t* out_next);
+
+// Calls callback on every committed record from offset from on, reading the
+// segments through a memory mapping; a non-zero return stops the replay and is
+// returned.
+int
+wal_replay(wal self, uint64_t from,
+           int (*callback)(void* context, uint64_t offset, const void* data,
+                           size_t len),
+           void* context);
+
+// Records offset under name; the names cannot contain a newline.
+int
+wal_commit_offset(wal self, const char* name, uint64_t offset);
+
+// Returns 1 when no offset is recorded under name.
+int
+wal_get_offset(wal self, const char* name, uint64_t* out_offset);
+
+int
+wal_for_each_offset(wal self,
+                    int (*callback)(void* context, const char* name,
+                                    uint64_t offset),
+                    void* context);
+
+#endif  // WAL_H
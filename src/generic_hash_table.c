@@ -514,6 +514,8 @@ generic_hash_table_insert(generic_hash_table self, void* key, void* value)
 
         // @todo log
 
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+
         self->_free_value_function(pair->_value);
         self->_free_key_function(pair->_key);
         free(pair);
@@ -760,6 +762,578 @@ generic_hash_table_contains(generic_hash_table self, void* key)
     return 1;
 }
 
+// @note must be called with the bucket lock held; on success out_iterator (if
+// not NULL) is left positioned on the pair and must be freed by the caller.
+static int
+_generic_hash_table_find_locked(generic_hash_table self, size_t bucket_index,
+                                void* key, struct _key_value_t** out_pair,
+                                generic_linked_list_iterator* out_iterator)
+{
+
+    generic_linked_list_iterator begin = NULL;
+    int exit_code = generic_linked_list_iterator_begin(
+        *(self->_buckets + bucket_index), &begin);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    while (generic_linked_list_iterator_is_valid(begin) == 0)
+    {
+
+        struct _key_value_t* pair = NULL;
+        exit_code = generic_linked_list_iterator_get(begin, (void**) &pair);
+        if (exit_code)
+        {
+
+            generic_linked_list_iterator_free(begin);
+            return exit_code;
+        }
+
+        if (self->_compare_key_function(key, pair->_key) == 0)
+        {
+
+            *out_pair = pair;
+            if (out_iterator)
+            {
+                *out_iterator = begin;
+            }
+            else
+            {
+                generic_linked_list_iterator_free(begin);
+            }
+
+            return 0;
+        }
+
+        generic_linked_list_iterator_next(begin);
+    }
+    generic_linked_list_iterator_free(begin);
+
+    *out_pair = NULL;
+
+    return 0;
+}
+
+// @note must be called with the bucket lock held, the value is stored as is.
+static int
+_generic_hash_table_insert_locked(generic_hash_table self, size_t bucket_index,
+                                  void* key, void* value)
+{
+
+    struct _key_value_t* pair =
+        (struct _key_value_t*) malloc(sizeof(struct _key_value_t));
+    if (!pair)
+    {
+        return -1;
+    }
+
+    int exit_code = self->_copy_key_function(key, &(pair->_key));
+    if (exit_code)
+    {
+
+        free(pair);
+        return exit_code;
+    }
+
+    pair->_value = value;
+
+    exit_code = generic_linked_list_insert_first(
+        *(self->_buckets + bucket_index), pair);
+    if (exit_code)
+    {
+
+        self->_free_key_function(pair->_key);
+        free(pair);
+
+        return exit_code;
+    }
+    atomic_fetch_add(&self->_size, 1);
+
+    return 0;
+}
+
+int
+generic_hash_table_compute_if_absent(generic_hash_table self, void* key,
+                                     int (*create_function)(void*, void*,
+                                                            void**),
+                                     void* context, void** out_value)
+{
+    return generic_hash_table_compute_if_absent_apply(
+        self, key, create_function, NULL, context, out_value);
+}
+
+int
+generic_hash_table_compute_if_absent_apply(
+    generic_hash_table self, void* key,
+    int (*create_function)(void*, void*, void**),
+    void (*apply)(void*, void*), void* context, void** out_value)
+{
+
+    if (!self)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!key)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!create_function)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!out_value)
+    {
+        // @todo log
+        return 1;
+    }
+
+    size_t hashed_key = self->_hash_function(key);
+    size_t bucket_index = hashed_key % self->_capacity;
+
+    pthread_mutex_lock(self->_mutexes + bucket_index);
+
+    struct _key_value_t* pair = NULL;
+    int exit_code =
+        _generic_hash_table_find_locked(self, bucket_index, key, &pair, NULL);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return exit_code;
+    }
+
+    if (pair)
+    {
+
+        *out_value = pair->_value;
+        if (apply)
+        {
+            apply(pair->_value, context);
+        }
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return 0;
+    }
+
+    void* created = NULL;
+    exit_code = create_function(key, context, &created);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return exit_code;
+    }
+
+    void* value = NULL;
+    exit_code = self->_copy_value_function(created, &value);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        self->_free_value_function(created);
+
+        return exit_code;
+    }
+
+    exit_code =
+        _generic_hash_table_insert_locked(self, bucket_index, key, value);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+
+        self->_free_value_function(value);
+        if (value != created)
+        {
+            self->_free_value_function(created);
+        }
+
+        return exit_code;
+    }
+
+    *out_value = value;
+    if (apply)
+    {
+        apply(value, context);
+    }
+
+    pthread_mutex_unlock(self->_mutexes + bucket_index);
+
+    if (value != created)
+    {
+        self->_free_value_function(created);
+    }
+
+    return 0;
+}
+
+int
+generic_hash_table_get_apply(generic_hash_table self, void* key,
+                             void (*apply)(void*, void*), void* context,
+                             void** out_value)
+{
+
+    if (!self)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!key)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!apply)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!out_value)
+    {
+        // @todo log
+        return 1;
+    }
+
+    size_t hashed_key = self->_hash_function(key);
+    size_t bucket_index = hashed_key % self->_capacity;
+
+    pthread_mutex_lock(self->_mutexes + bucket_index);
+
+    struct _key_value_t* pair = NULL;
+    int exit_code =
+        _generic_hash_table_find_locked(self, bucket_index, key, &pair, NULL);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return exit_code;
+    }
+
+    if (!pair)
+    {
+
+        *out_value = NULL;
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return 1;
+    }
+
+    *out_value = pair->_value;
+    apply(pair->_value, context);
+
+    pthread_mutex_unlock(self->_mutexes + bucket_index);
+
+    return 0;
+}
+
+int
+generic_hash_table_upsert(generic_hash_table self, void* key, void* value)
+{
+
+    if (!self)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!key)
+    {
+        // @todo log
+        return 1;
+    }
+
+    void* copy = NULL;
+    int exit_code = self->_copy_value_function(value, &copy);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    size_t hashed_key = self->_hash_function(key);
+    size_t bucket_index = hashed_key % self->_capacity;
+
+    pthread_mutex_lock(self->_mutexes + bucket_index);
+
+    struct _key_value_t* pair = NULL;
+    exit_code =
+        _generic_hash_table_find_locked(self, bucket_index, key, &pair, NULL);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        self->_free_value_function(copy);
+
+        return exit_code;
+    }
+
+    if (pair)
+    {
+
+        void* old_value = pair->_value;
+        pair->_value = copy;
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        self->_free_value_function(old_value);
+
+        return 0;
+    }
+
+    exit_code =
+        _generic_hash_table_insert_locked(self, bucket_index, key, copy);
+
+    pthread_mutex_unlock(self->_mutexes + bucket_index);
+
+    if (exit_code)
+    {
+        self->_free_value_function(copy);
+    }
+
+    return exit_code;
+}
+
+int
+generic_hash_table_compare_and_delete(generic_hash_table self, void* key,
+                                      void* expected_value)
+{
+
+    if (!self)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!key)
+    {
+        // @todo log
+        return 1;
+    }
+
+    size_t hashed_key = self->_hash_function(key);
+    size_t bucket_index = hashed_key % self->_capacity;
+
+    pthread_mutex_lock(self->_mutexes + bucket_index);
+
+    struct _key_value_t* pair = NULL;
+    generic_linked_list_iterator iterator = NULL;
+    int exit_code = _generic_hash_table_find_locked(self, bucket_index, key,
+                                                    &pair, &iterator);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return exit_code;
+    }
+
+    if (!pair)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return 1;
+    }
+
+    if (pair->_value != expected_value)
+    {
+
+        generic_linked_list_iterator_free(iterator);
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return 1;
+    }
+
+    exit_code = generic_linked_list_iterator_remove(iterator, (void**) &pair);
+    generic_linked_list_iterator_free(iterator);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+        return exit_code;
+    }
+
+    atomic_fetch_sub(&self->_size, 1);
+
+    pthread_mutex_unlock(self->_mutexes + bucket_index);
+
+    self->_free_key_function(pair->_key);
+    self->_free_value_function(pair->_value);
+    free(pair);
+
+    return 0;
+}
+
+int
+generic_hash_table_for_each_context(generic_hash_table self,
+                                    void (*apply)(void*, void*, void*),
+                                    void* context)
+{
+
+    if (!self)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!apply)
+    {
+        // @todo log
+        return 1;
+    }
+
+    size_t bucket_index = 0;
+    while (bucket_index < self->_capacity)
+    {
+
+        pthread_mutex_lock(self->_mutexes + bucket_index);
+
+        generic_linked_list_iterator iterator = NULL;
+        int exit_code = generic_linked_list_iterator_begin(
+            *(self->_buckets + bucket_index), &iterator);
+        if (exit_code)
+        {
+
+            pthread_mutex_unlock(self->_mutexes + bucket_index);
+            return exit_code;
+        }
+
+        while (generic_linked_list_iterator_is_valid(iterator) == 0)
+        {
+
+            struct _key_value_t* pair = NULL;
+            if (generic_linked_list_iterator_get(iterator, (void**) &pair) == 0
+                && pair)
+            {
+                apply(pair->_key, pair->_value, context);
+            }
+
+            generic_linked_list_iterator_next(iterator);
+        }
+
+        generic_linked_list_iterator_free(iterator);
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+
+        bucket_index++;
+    }
+
+    return 0;
+}
+
+struct _for_each_call_t
+{
+    void (*_apply)(void*, void*);
+};
+
+static void
+_for_each_apply(void* key, void* value, void* context)
+{
+    ((struct _for_each_call_t*) context)->_apply(key, value);
+}
+
+int
+generic_hash_table_for_each(generic_hash_table self,
+                            void (*apply)(void*, void*))
+{
+
+    if (!apply)
+    {
+        // @todo log
+        return 1;
+    }
+
+    struct _for_each_call_t call = {._apply = apply};
+
+    return generic_hash_table_for_each_context(self, _for_each_apply, &call);
+}
+
+int
+generic_hash_table_delete_if(generic_hash_table self,
+                             int (*predicate)(void*, void*, void*),
+                             void* context, size_t* out_n_deleted)
+{
+
+    if (!self)
+    {
+        // @todo log
+        return 1;
+    }
+
+    if (!predicate)
+    {
+        // @todo log
+        return 1;
+    }
+
+    size_t n_deleted = 0;
+
+    size_t bucket_index = 0;
+    while (bucket_index < self->_capacity)
+    {
+
+        pthread_mutex_lock(self->_mutexes + bucket_index);
+
+        generic_linked_list bucket = *(self->_buckets + bucket_index);
+        generic_linked_list_iterator iterator = NULL;
+        int exit_code = generic_linked_list_iterator_begin(bucket, &iterator);
+        if (exit_code)
+        {
+
+            pthread_mutex_unlock(self->_mutexes + bucket_index);
+            return exit_code;
+        }
+
+        while (generic_linked_list_iterator_is_valid(iterator) == 0)
+        {
+
+            struct _key_value_t* pair = NULL;
+            if (generic_linked_list_iterator_get(iterator, (void**) &pair)
+                || !pair || !predicate(pair->_key, pair->_value, context))
+            {
+
+                generic_linked_list_iterator_next(iterator);
+                continue;
+            }
+
+            // removing moves the iterator to the next pair
+            if (generic_linked_list_iterator_remove(iterator, (void**) &pair))
+            {
+
+                generic_linked_list_iterator_next(iterator);
+                continue;
+            }
+
+            atomic_fetch_sub(&self->_size, 1);
+
+            self->_free_key_function(pair->_key);
+            self->_free_value_function(pair->_value);
+            free(pair);
+
+            n_deleted++;
+        }
+
+        generic_linked_list_iterator_free(iterator);
+
+        pthread_mutex_unlock(self->_mutexes + bucket_index);
+
+        bucket_index++;
+    }
+
+    if (out_n_deleted)
+    {
+        *out_n_deleted = n_deleted;
+    }
+
+    return 0;
+}
+
 // @todo temporary for the free, set_free_function etc I have decided to warning
 // the first error but to continue with the operation; this decision can be
 // reverted or modified in future.
\ No newline at end of file
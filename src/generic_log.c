@@ -0,0 +1,440 @@
+#include "generic_log.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// @note a segment is referenced by the writer while it is the tail, by every
+// cursor positioned in it and by the previous segment (the link). Dropping the
+// last reference frees the items and releases the link to the next segment.
+struct _generic_log_segment_t
+{
+    atomic_size_t _ref_count;
+    uint64_t _base_offset;
+    size_t _n_items;
+    _Atomic(struct _generic_log_segment_t*) _next;
+    void (*_free_function)(void*);
+    atomic_size_t* _n_segments;
+    void* _items[];
+};
+
+struct generic_log_t
+{
+    size_t _segment_capacity;
+    void (*_free_function)(void*);
+    struct _generic_log_segment_t* _tail_segment;
+    atomic_uint_fast64_t _tail_offset;
+    atomic_size_t _n_segments;
+};
+
+struct generic_log_cursor_t
+{
+    struct generic_log_t* _log;
+    struct _generic_log_segment_t* _segment;
+    uint64_t _offset;
+};
+
+static int
+_generic_log_segment_new(struct generic_log_t* log, uint64_t base_offset,
+                         size_t ref_count,
+                         struct _generic_log_segment_t** out_segment)
+{
+
+    struct _generic_log_segment_t* segment =
+        malloc(sizeof(struct _generic_log_segment_t)
+               + sizeof(void*) * log->_segment_capacity);
+    if (!segment)
+    {
+        return -1;
+    }
+
+    atomic_init(&segment->_ref_count, ref_count);
+    segment->_base_offset = base_offset;
+    segment->_n_items = 0;
+    atomic_init(&segment->_next, NULL);
+    segment->_free_function = log->_free_function;
+    segment->_n_segments = &log->_n_segments;
+
+    atomic_fetch_add(&log->_n_segments, 1);
+
+    *out_segment = segment;
+
+    return 0;
+}
+
+static void
+_generic_log_segment_acquire(struct _generic_log_segment_t* segment)
+{
+    atomic_fetch_add_explicit(&segment->_ref_count, 1, memory_order_relaxed);
+}
+
+// @note iterative so that a long chain of segments released at once does not
+// recurse.
+static void
+_generic_log_segment_release(struct _generic_log_segment_t* segment)
+{
+
+    while (segment)
+    {
+
+        if (atomic_fetch_sub_explicit(&segment->_ref_count, 1,
+                                      memory_order_acq_rel)
+            != 1)
+        {
+            return;
+        }
+
+        struct _generic_log_segment_t* next = atomic_load(&segment->_next);
+
+        if (segment->_free_function)
+        {
+
+            size_t i = 0;
+            while (i < segment->_n_items)
+            {
+                segment->_free_function(segment->_items[i]);
+                i++;
+            }
+        }
+
+        atomic_fetch_sub(segment->_n_segments, 1);
+        free(segment);
+
+        segment = next;
+    }
+}
+
+int
+generic_log_new(size_t segment_capacity, generic_log* out_self)
+{
+
+    if (!segment_capacity)
+    {
+        return 1;
+    }
+
+    if (!out_self)
+    {
+        return 1;
+    }
+
+    struct generic_log_t* self = malloc(sizeof(struct generic_log_t));
+    if (!self)
+    {
+        return -1;
+    }
+
+    self->_segment_capacity = segment_capacity;
+    self->_free_function = NULL;
+    atomic_init(&self->_tail_offset, 0);
+    atomic_init(&self->_n_segments, 0);
+
+    int exit_code = _generic_log_segment_new(self, 0, 1, &self->_tail_segment);
+    if (exit_code)
+    {
+        free(self);
+        return exit_code;
+    }
+
+    *out_self = self;
+
+    return 0;
+}
+
+int
+generic_log_free(generic_log self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    _generic_log_segment_release(self->_tail_segment);
+    free(self);
+
+    return 0;
+}
+
+int
+generic_log_set_free_function(generic_log self, void (*free_function)(void*))
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    self->_free_function = free_function;
+    self->_tail_segment->_free_function = free_function;
+
+    return 0;
+}
+
+// @note the item is stored before the tail offset is published, so a cursor
+// that observes the new tail also observes the item and the segment link.
+static int
+_generic_log_append_one(struct generic_log_t* self, void* data)
+{
+
+    struct _generic_log_segment_t* tail = self->_tail_segment;
+
+    if (tail->_n_items == self->_segment_capacity)
+    {
+
+        // the writer reference moves to the new segment, the old one keeps
+        // the link reference on it
+        struct _generic_log_segment_t* next = NULL;
+        int exit_code = _generic_log_segment_new(
+            self, tail->_base_offset + tail->_n_items, 2, &next);
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        atomic_store_explicit(&tail->_next, next, memory_order_release);
+        self->_tail_segment = next;
+        _generic_log_segment_release(tail);
+
+        tail = next;
+    }
+
+    tail->_items[tail->_n_items] = data;
+    tail->_n_items++;
+
+    atomic_fetch_add_explicit(&self->_tail_offset, 1, memory_order_release);
+
+    return 0;
+}
+
+int
+generic_log_append(generic_log self, void* data)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    return _generic_log_append_one(self, data);
+}
+
+int
+generic_log_append_batch(generic_log self, void** data, size_t n)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!data && n)
+    {
+        return 1;
+    }
+
+    size_t i = 0;
+    while (i < n)
+    {
+
+        int exit_code = _generic_log_append_one(self, data[i]);
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        i++;
+    }
+
+    return 0;
+}
+
+int
+generic_log_get_tail(generic_log self, uint64_t* out_offset)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_offset)
+    {
+        return 1;
+    }
+
+    *out_offset =
+        atomic_load_explicit(&self->_tail_offset, memory_order_acquire);
+
+    return 0;
+}
+
+int
+generic_log_set_tail(generic_log self, uint64_t offset)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    // a segment is only ever created to store an item right away, the tail
+    // is empty only before the first append
+    struct _generic_log_segment_t* tail = self->_tail_segment;
+    if (tail->_n_items)
+    {
+        return 1;
+    }
+
+    tail->_base_offset = offset;
+    atomic_store(&self->_tail_offset, offset);
+
+    return 0;
+}
+
+int
+generic_log_get_segment_count(generic_log self, size_t* out_count)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_count)
+    {
+        return 1;
+    }
+
+    *out_count = atomic_load(&self->_n_segments);
+
+    return 0;
+}
+
+int
+generic_log_cursor_new(generic_log self, generic_log_cursor* out_cursor)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_cursor)
+    {
+        return 1;
+    }
+
+    struct generic_log_cursor_t* cursor =
+        malloc(sizeof(struct generic_log_cursor_t));
+    if (!cursor)
+    {
+        return -1;
+    }
+
+    cursor->_log = self;
+    cursor->_segment = self->_tail_segment;
+    cursor->_offset = atomic_load(&self->_tail_offset);
+    _generic_log_segment_acquire(cursor->_segment);
+
+    *out_cursor = cursor;
+
+    return 0;
+}
+
+int
+generic_log_cursor_free(generic_log_cursor self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    _generic_log_segment_release(self->_segment);
+    free(self);
+
+    return 0;
+}
+
+int
+generic_log_cursor_next(generic_log_cursor self, void** out_data)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_data)
+    {
+        return 1;
+    }
+
+    uint64_t tail =
+        atomic_load_explicit(&self->_log->_tail_offset, memory_order_acquire);
+    if (self->_offset == tail)
+    {
+        *out_data = NULL;
+        return 1;
+    }
+
+    struct _generic_log_segment_t* segment = self->_segment;
+    size_t index = (size_t) (self->_offset - segment->_base_offset);
+    if (index == self->_log->_segment_capacity)
+    {
+
+        struct _generic_log_segment_t* next =
+            atomic_load_explicit(&segment->_next, memory_order_acquire);
+
+        _generic_log_segment_acquire(next);
+        _generic_log_segment_release(segment);
+
+        self->_segment = next;
+        segment = next;
+        index = 0;
+    }
+
+    *out_data = segment->_items[index];
+    self->_offset++;
+
+    return 0;
+}
+
+int
+generic_log_cursor_get_offset(generic_log_cursor self, uint64_t* out_offset)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_offset)
+    {
+        return 1;
+    }
+
+    *out_offset = self->_offset;
+
+    return 0;
+}
+
+int
+generic_log_cursor_get_lag(generic_log_cursor self, size_t* out_lag)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_lag)
+    {
+        return 1;
+    }
+
+    uint64_t tail =
+        atomic_load_explicit(&self->_log->_tail_offset, memory_order_acquire);
+    *out_lag = (size_t) (tail - self->_offset);
+
+    return 0;
+}
@@ -571,3 +571,85 @@ generic_queue_for_each(generic_queue self, void (*apply)(void*))
 
     return exit_code;
 }
+
+int
+generic_queue_remove_if(generic_queue self,
+                        int (*predicate)(void* data, void* context),
+                        void* context, size_t* out_n_removed)
+{
+
+    if (!self)
+    {
+
+#ifdef STDIO_DEBUG
+        fprintf(stderr, "%s - self parameter NULL\n", __PRETTY_FUNCTION__);
+#endif
+
+        return 1;
+    }
+
+    if (!predicate)
+    {
+
+#ifdef STDIO_DEBUG
+        fprintf(stderr, "%s - predicate parameter NULL\n", __PRETTY_FUNCTION__);
+#endif
+
+        return 1;
+    }
+
+    void (*free_function)(void*) = NULL;
+    generic_linked_list_get_free_function(self->_generic_linked_list,
+                                          &free_function);
+
+    generic_linked_list_iterator iter = NULL;
+    int exit_code =
+        generic_linked_list_iterator_begin(self->_generic_linked_list, &iter);
+
+    if (exit_code)
+    {
+
+#ifdef STDIO_DEBUG
+        fprintf(stderr,
+                "%s - generic_linked_list_iterator_begin failed with code %d\n",
+                __PRETTY_FUNCTION__, exit_code);
+#endif
+
+        return exit_code;
+    }
+
+    size_t n_removed = 0;
+    while (generic_linked_list_iterator_is_valid(iter) == 0)
+    {
+
+        void* data = NULL;
+        generic_linked_list_iterator_get(iter, &data);
+
+        if (!predicate(data, context))
+        {
+            generic_linked_list_iterator_next(iter);
+            continue;
+        }
+
+        // the removed item is released with the free function when one is set,
+        // the iterator moves on to the next item either way.
+        void* removed = NULL;
+        exit_code = generic_linked_list_iterator_remove(
+            iter, free_function ? NULL : &removed);
+        if (exit_code)
+        {
+            break;
+        }
+
+        n_removed++;
+    }
+
+    generic_linked_list_iterator_free(iter);
+
+    if (out_n_removed)
+    {
+        *out_n_removed = n_removed;
+    }
+
+    return exit_code;
+}
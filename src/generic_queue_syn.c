@@ -1,12 +1,20 @@
 #include "generic_queue_syn.h"
 #include "generic_queue.h"
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <time.h>
 
+// @note _capacity == 0 means unbounded; _not_full is signaled on every removal
+// so that generic_queue_syn_enqueue_timed can wait for room.
+// @note _high_water is only raised under the mutex but read without it.
 struct generic_queue_syn_t
 {
     generic_queue _queue;
     pthread_mutex_t _mutex;
+    pthread_cond_t _not_full;
+    size_t _capacity;
+    atomic_size_t _high_water;
 };
 
 int
@@ -36,6 +44,17 @@ generic_queue_syn_new(generic_queue_syn* out_self)
         return -1;
     }
 
+    if (pthread_cond_init(&self->_not_full, NULL) != 0)
+    {
+        pthread_mutex_destroy(&self->_mutex);
+        generic_queue_free(self->_queue);
+        free(self);
+        return -1;
+    }
+
+    self->_capacity = 0;
+    atomic_init(&self->_high_water, 0);
+
     *out_self = self;
     return 0;
 }
@@ -52,12 +71,70 @@ generic_queue_syn_free(generic_queue_syn self)
     int result = generic_queue_free(self->_queue);
     pthread_mutex_unlock(&self->_mutex);
 
+    pthread_cond_destroy(&self->_not_full);
     pthread_mutex_destroy(&self->_mutex);
     free(self);
 
     return result;
 }
 
+static int
+_generic_queue_syn_is_full_locked(generic_queue_syn self)
+{
+    if (self->_capacity == 0)
+    {
+        return 0;
+    }
+
+    size_t size = 0;
+    generic_queue_size(self->_queue, &size);
+
+    return size >= self->_capacity;
+}
+
+static void
+_generic_queue_syn_track_size_locked(generic_queue_syn self)
+{
+    size_t size = 0;
+    generic_queue_size(self->_queue, &size);
+
+    if (size > atomic_load_explicit(&self->_high_water, memory_order_relaxed))
+    {
+        atomic_store_explicit(&self->_high_water, size, memory_order_relaxed);
+    }
+}
+
+int
+generic_queue_syn_set_capacity(generic_queue_syn self, size_t capacity)
+{
+    if (self == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+    self->_capacity = capacity;
+    pthread_cond_broadcast(&self->_not_full);
+    pthread_mutex_unlock(&self->_mutex);
+
+    return 0;
+}
+
+int
+generic_queue_syn_get_capacity(generic_queue_syn self, size_t* out_capacity)
+{
+    if (self == NULL || out_capacity == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+    *out_capacity = self->_capacity;
+    pthread_mutex_unlock(&self->_mutex);
+
+    return 0;
+}
+
 int
 generic_queue_syn_set_free_function(generic_queue_syn self,
                                     void (*free_function)(void*))
@@ -139,6 +216,19 @@ generic_queue_syn_size(generic_queue_syn self, size_t* out_size)
     return result;
 }
 
+int
+generic_queue_syn_get_high_water(generic_queue_syn self, size_t* out_size)
+{
+    if (self == NULL || out_size == NULL)
+    {
+        return -1;
+    }
+
+    *out_size = atomic_load_explicit(&self->_high_water, memory_order_relaxed);
+
+    return 0;
+}
+
 int
 generic_queue_syn_is_empty(generic_queue_syn self)
 {
@@ -163,7 +253,132 @@ generic_queue_syn_enqueue(generic_queue_syn self, void* data)
     }
 
     pthread_mutex_lock(&self->_mutex);
-    int result = generic_queue_enqueue(self->_queue, data);
+    int result = 1;
+    if (!_generic_queue_syn_is_full_locked(self))
+    {
+        result = generic_queue_enqueue(self->_queue, data);
+    }
+
+    if (result == 0)
+    {
+        _generic_queue_syn_track_size_locked(self);
+    }
+    pthread_mutex_unlock(&self->_mutex);
+
+    return result;
+}
+
+int
+generic_queue_syn_enqueue_batch(generic_queue_syn self, void** data, size_t n,
+                                size_t* out_n_enqueued)
+{
+    if (self == NULL)
+    {
+        return -1;
+    }
+
+    if (data == NULL && n > 0)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    size_t i = 0;
+
+    pthread_mutex_lock(&self->_mutex);
+    while (i < n)
+    {
+        if (_generic_queue_syn_is_full_locked(self))
+        {
+            result = 1;
+            break;
+        }
+
+        result = generic_queue_enqueue(self->_queue, data[i]);
+        if (result != 0)
+        {
+            break;
+        }
+        i++;
+    }
+
+    if (i > 0)
+    {
+        _generic_queue_syn_track_size_locked(self);
+    }
+    pthread_mutex_unlock(&self->_mutex);
+
+    if (out_n_enqueued != NULL)
+    {
+        *out_n_enqueued = i;
+    }
+
+    return result;
+}
+
+int
+generic_queue_syn_enqueue_or_evict(generic_queue_syn self, void* data,
+                                   void** out_evicted)
+{
+    if (self == NULL || out_evicted == NULL)
+    {
+        return -1;
+    }
+
+    *out_evicted = NULL;
+
+    pthread_mutex_lock(&self->_mutex);
+    int result = 0;
+    if (_generic_queue_syn_is_full_locked(self))
+    {
+        result = generic_queue_dequeue(self->_queue, out_evicted);
+    }
+
+    if (result == 0)
+    {
+        result = generic_queue_enqueue(self->_queue, data);
+    }
+
+    if (result == 0)
+    {
+        _generic_queue_syn_track_size_locked(self);
+    }
+    pthread_mutex_unlock(&self->_mutex);
+
+    return result;
+}
+
+int
+generic_queue_syn_enqueue_timed(generic_queue_syn self, void* data,
+                                const struct timespec* abs_timeout)
+{
+    if (self == NULL || abs_timeout == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+    int result = 0;
+    while (_generic_queue_syn_is_full_locked(self))
+    {
+        if (pthread_cond_timedwait(&self->_not_full, &self->_mutex,
+                                   abs_timeout)
+            != 0)
+        {
+            result = 1;
+            break;
+        }
+    }
+
+    if (result == 0 || !_generic_queue_syn_is_full_locked(self))
+    {
+        result = generic_queue_enqueue(self->_queue, data);
+    }
+
+    if (result == 0)
+    {
+        _generic_queue_syn_track_size_locked(self);
+    }
     pthread_mutex_unlock(&self->_mutex);
 
     return result;
@@ -179,8 +394,51 @@ generic_queue_syn_dequeue(generic_queue_syn self, void** out_data)
 
     pthread_mutex_lock(&self->_mutex);
     int result = generic_queue_dequeue(self->_queue, out_data);
+    if (result == 0 && self->_capacity)
+    {
+        pthread_cond_signal(&self->_not_full);
+    }
+    pthread_mutex_unlock(&self->_mutex);
+
+    return result;
+}
+
+int
+generic_queue_syn_dequeue_batch(generic_queue_syn self, void** out_data,
+                                size_t max, size_t* out_n)
+{
+    if (self == NULL)
+    {
+        return -1;
+    }
+
+    if ((out_data == NULL && max > 0) || out_n == NULL)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    size_t i = 0;
+
+    pthread_mutex_lock(&self->_mutex);
+    while (i < max && generic_queue_is_empty(self->_queue) == 0)
+    {
+        result = generic_queue_dequeue(self->_queue, &out_data[i]);
+        if (result != 0)
+        {
+            break;
+        }
+        i++;
+    }
+
+    if (i > 0 && self->_capacity)
+    {
+        pthread_cond_broadcast(&self->_not_full);
+    }
     pthread_mutex_unlock(&self->_mutex);
 
+    *out_n = i;
+
     return result;
 }
 
@@ -224,6 +482,7 @@ generic_queue_syn_clear(generic_queue_syn self)
 
     pthread_mutex_lock(&self->_mutex);
     int result = generic_queue_clear(self->_queue);
+    pthread_cond_broadcast(&self->_not_full);
     pthread_mutex_unlock(&self->_mutex);
 
     return result;
@@ -245,6 +504,35 @@ generic_queue_syn_contains(generic_queue_syn self, void* target,
     return result;
 }
 
+int
+generic_queue_syn_remove_if(generic_queue_syn self,
+                            int (*predicate)(void* data, void* context),
+                            void* context, size_t* out_n_removed)
+{
+    if (self == NULL)
+    {
+        return -1;
+    }
+
+    size_t n_removed = 0;
+
+    pthread_mutex_lock(&self->_mutex);
+    int result =
+        generic_queue_remove_if(self->_queue, predicate, context, &n_removed);
+    if (n_removed)
+    {
+        pthread_cond_broadcast(&self->_not_full);
+    }
+    pthread_mutex_unlock(&self->_mutex);
+
+    if (out_n_removed != NULL)
+    {
+        *out_n_removed = n_removed;
+    }
+
+    return result;
+}
+
 int
 generic_queue_syn_for_each(generic_queue_syn self, void (*apply)(void*))
 {
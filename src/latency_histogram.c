@@ -0,0 +1,280 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "latency_histogram.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define _SUB_BUCKET_BITS 4
+#define _SUB_BUCKETS (1 << _SUB_BUCKET_BITS)
+#define _LINEAR_LIMIT (2 * _SUB_BUCKETS)
+#define _MAX_EXPONENT 40
+#define _N_BUCKETS                                                             \
+    (_LINEAR_LIMIT + (_MAX_EXPONENT - _SUB_BUCKET_BITS - 1) * _SUB_BUCKETS)
+
+struct latency_histogram_t
+{
+    atomic_uint_least64_t _count;
+    atomic_uint_least64_t _max;
+    atomic_uint_least64_t _buckets[_N_BUCKETS];
+};
+
+static size_t
+_bucket_index(uint64_t value)
+{
+
+    if (value < _LINEAR_LIMIT)
+    {
+        return (size_t) value;
+    }
+
+    size_t exponent = 63 - (size_t) __builtin_clzll(value);
+    if (exponent >= _MAX_EXPONENT)
+    {
+        return _N_BUCKETS - 1;
+    }
+
+    size_t sub_bucket = (size_t) (value >> (exponent - _SUB_BUCKET_BITS))
+                        & (_SUB_BUCKETS - 1);
+
+    return _LINEAR_LIMIT
+           + (exponent - _SUB_BUCKET_BITS - 1) * _SUB_BUCKETS + sub_bucket;
+}
+
+// Highest value that falls into bucket index.
+static uint64_t
+_bucket_upper_bound(size_t index)
+{
+
+    if (index < _LINEAR_LIMIT)
+    {
+        return index;
+    }
+
+    size_t exponent = (index - _LINEAR_LIMIT) / _SUB_BUCKETS
+                      + _SUB_BUCKET_BITS + 1;
+    uint64_t sub_bucket = (index - _LINEAR_LIMIT) % _SUB_BUCKETS;
+    uint64_t width = (uint64_t) 1 << (exponent - _SUB_BUCKET_BITS);
+
+    return ((uint64_t) 1 << exponent) + (sub_bucket + 1) * width - 1;
+}
+
+int
+latency_histogram_new(latency_histogram* out_self)
+{
+
+    if (!out_self)
+    {
+        return 1;
+    }
+
+    struct latency_histogram_t* self =
+        malloc(sizeof(struct latency_histogram_t));
+    if (!self)
+    {
+        return -1;
+    }
+
+    atomic_init(&self->_count, 0);
+    atomic_init(&self->_max, 0);
+
+    size_t i = 0;
+    while (i < _N_BUCKETS)
+    {
+        atomic_init(&self->_buckets[i], 0);
+        i++;
+    }
+
+    *out_self = self;
+
+    return 0;
+}
+
+int
+latency_histogram_free(latency_histogram self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    free(self);
+
+    return 0;
+}
+
+int
+latency_histogram_record(latency_histogram self, uint64_t value)
+{
+    return latency_histogram_record_n(self, value, 1);
+}
+
+int
+latency_histogram_record_n(latency_histogram self, uint64_t value, uint64_t n)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    atomic_fetch_add_explicit(&self->_buckets[_bucket_index(value)], n,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&self->_count, n, memory_order_relaxed);
+
+    // the maximum only moves up, the loop ends as soon as it is not below
+    uint64_t max = atomic_load_explicit(&self->_max, memory_order_relaxed);
+    while (value > max
+           && !atomic_compare_exchange_weak_explicit(&self->_max, &max, value,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+    {
+    }
+
+    return 0;
+}
+
+int
+latency_histogram_merge(latency_histogram self, latency_histogram other)
+{
+
+    if (!self || !other)
+    {
+        return 1;
+    }
+
+    size_t i = 0;
+    while (i < _N_BUCKETS)
+    {
+
+        uint64_t n =
+            atomic_load_explicit(&other->_buckets[i], memory_order_relaxed);
+        if (n)
+        {
+            atomic_fetch_add_explicit(&self->_buckets[i], n,
+                                      memory_order_relaxed);
+        }
+
+        i++;
+    }
+
+    atomic_fetch_add_explicit(
+        &self->_count,
+        atomic_load_explicit(&other->_count, memory_order_relaxed),
+        memory_order_relaxed);
+
+    uint64_t other_max =
+        atomic_load_explicit(&other->_max, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&self->_max, memory_order_relaxed);
+    while (other_max > max
+           && !atomic_compare_exchange_weak_explicit(&self->_max, &max,
+                                                     other_max,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+    {
+    }
+
+    return 0;
+}
+
+int
+latency_histogram_get_count(latency_histogram self, uint64_t* out_count)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_count)
+    {
+        return 1;
+    }
+
+    *out_count = atomic_load_explicit(&self->_count, memory_order_relaxed);
+
+    return 0;
+}
+
+int
+latency_histogram_get_max(latency_histogram self, uint64_t* out_max)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_max)
+    {
+        return 1;
+    }
+
+    *out_max = atomic_load_explicit(&self->_max, memory_order_relaxed);
+
+    return 0;
+}
+
+int
+latency_histogram_get_percentile(latency_histogram self, double percentile,
+                                 uint64_t* out_value)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_value || percentile < 0 || percentile > 100)
+    {
+        return 1;
+    }
+
+    // the buckets are summed rather than trusting _count, which may be ahead
+    // of them while records are in progress
+    uint64_t total = 0;
+    size_t i = 0;
+    while (i < _N_BUCKETS)
+    {
+        total += atomic_load_explicit(&self->_buckets[i], memory_order_relaxed);
+        i++;
+    }
+
+    *out_value = 0;
+    if (!total)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (percentile / 100 * (double) total + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    i = 0;
+    while (i < _N_BUCKETS)
+    {
+
+        seen += atomic_load_explicit(&self->_buckets[i], memory_order_relaxed);
+        if (seen >= rank)
+        {
+            break;
+        }
+
+        i++;
+    }
+
+    if (i == _N_BUCKETS)
+    {
+        i = _N_BUCKETS - 1;
+    }
+
+    uint64_t value = _bucket_upper_bound(i);
+    uint64_t max = atomic_load_explicit(&self->_max, memory_order_relaxed);
+
+    *out_value = value < max ? value : max;
+
+    return 0;
+}
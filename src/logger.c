@@ -0,0 +1,489 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "logger.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define _LOGGER_TEXT_SIZE 224
+#define _LOGGER_LINE_SIZE 320
+#define _LOGGER_DEFAULT_RING_CAPACITY 1024
+#define _LOGGER_DEFAULT_FLUSH_INTERVAL_MS 50
+
+struct _logger_record_t
+{
+    struct timespec _time;
+    enum logger_level_t _level;
+    const char* _component;
+    char _text[_LOGGER_TEXT_SIZE];
+};
+
+// @note single producer, single consumer: the owning thread is the only one
+// moving _head and the drainer, under the logger mutex, the only one moving
+// _tail. The ring outlives its thread until the drainer finds it orphaned and
+// empty.
+// @note the rings are a list threads push onto lock-free, the logging path
+// never waits for the mutex the drainer holds while writing out. Only the
+// drainer unlinks rings.
+struct _logger_ring_t
+{
+    atomic_size_t _head;
+    atomic_size_t _tail;
+    atomic_size_t _n_dropped;
+    atomic_int _orphaned;
+    size_t _capacity;
+    struct _logger_ring_t* _next;
+    struct _logger_record_t _records[];
+};
+
+struct _logger_t
+{
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    pthread_t _flusher;
+    size_t _n_users;
+    int _running;
+    FILE* _output;
+    atomic_size_t _ring_capacity;
+    size_t _flush_interval_ms;
+    _Atomic(struct _logger_ring_t*) _rings;
+    size_t _n_dropped;
+    atomic_int _level;
+};
+
+static struct _logger_t _logger = {
+    ._mutex = PTHREAD_MUTEX_INITIALIZER,
+    ._cond = PTHREAD_COND_INITIALIZER,
+    ._ring_capacity = _LOGGER_DEFAULT_RING_CAPACITY,
+    ._flush_interval_ms = _LOGGER_DEFAULT_FLUSH_INTERVAL_MS,
+    ._level = LOGGER_INFO};
+
+static pthread_once_t _logger_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _logger_key;
+static _Thread_local struct _logger_ring_t* _logger_thread_ring;
+
+static const char* const _logger_level_names[] = {"debug", "info", "warn",
+                                                  "error", "off"};
+
+static void
+_logger_ring_orphan(void* arg)
+{
+
+    struct _logger_ring_t* ring = arg;
+
+    atomic_store(&ring->_orphaned, 1);
+}
+
+static void
+_logger_key_init()
+{
+    pthread_key_create(&_logger_key, _logger_ring_orphan);
+}
+
+static struct _logger_ring_t*
+_logger_ring_new()
+{
+
+    pthread_once(&_logger_key_once, _logger_key_init);
+
+    size_t capacity = atomic_load(&_logger._ring_capacity);
+
+    struct _logger_ring_t* ring =
+        calloc(1, sizeof(struct _logger_ring_t)
+                      + capacity * sizeof(struct _logger_record_t));
+    if (!ring)
+    {
+        return NULL;
+    }
+
+    ring->_capacity = capacity;
+
+    if (pthread_setspecific(_logger_key, ring))
+    {
+        free(ring);
+        return NULL;
+    }
+
+    // a push only moves the list head, it never touches the rings in it
+    ring->_next = atomic_load(&_logger._rings);
+    while (!atomic_compare_exchange_weak(&_logger._rings, &ring->_next, ring))
+    {
+    }
+
+    _logger_thread_ring = ring;
+
+    return ring;
+}
+
+static size_t
+_logger_format(const struct _logger_record_t* record, char* line, size_t size)
+{
+
+    struct tm tm;
+    localtime_r(&record->_time.tv_sec, &tm);
+
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+    int len = snprintf(line, size, "%s.%03ld %-5s [%s] %s\n", date,
+                       record->_time.tv_nsec / 1000000,
+                       _logger_level_names[record->_level],
+                       record->_component, record->_text);
+    if (len < 0)
+    {
+        return 0;
+    }
+
+    // a truncated line still ends the record
+    if ((size_t) len >= size)
+    {
+        line[size - 2] = '\n';
+        return size - 1;
+    }
+
+    return (size_t) len;
+}
+
+// Unlinks ring, which follows prev (NULL at the head of the list); returns 0
+// when a push moved the head meanwhile, the ring is then left for next time.
+static int
+_logger_ring_unlink(struct _logger_ring_t* prev, struct _logger_ring_t* ring)
+{
+
+    if (prev)
+    {
+        prev->_next = ring->_next;
+        return 1;
+    }
+
+    struct _logger_ring_t* expected = ring;
+
+    return atomic_compare_exchange_strong(&_logger._rings, &expected,
+                                          ring->_next);
+}
+
+// Writes out the records of every ring and frees the rings of the threads that
+// exited; called with the mutex held, so that only one drainer runs at a time.
+static void
+_logger_drain_locked()
+{
+
+    FILE* output = _logger._output ? _logger._output : stderr;
+
+    char line[_LOGGER_LINE_SIZE];
+    size_t n_written = 0;
+
+    struct _logger_ring_t* prev = NULL;
+    struct _logger_ring_t* ring = atomic_load(&_logger._rings);
+    while (ring)
+    {
+
+        // read before the records: an orphaned ring gets no more of them
+        int orphaned = atomic_load(&ring->_orphaned);
+
+        size_t tail = atomic_load(&ring->_tail);
+        size_t head = atomic_load(&ring->_head);
+        while (tail != head)
+        {
+
+            const struct _logger_record_t* record =
+                &ring->_records[tail & (ring->_capacity - 1)];
+
+            size_t len = _logger_format(record, line, sizeof(line));
+            fwrite(line, 1, len, output);
+            n_written++;
+
+            tail++;
+            atomic_store(&ring->_tail, tail);
+        }
+
+        struct _logger_ring_t* next = ring->_next;
+        if (orphaned && _logger_ring_unlink(prev, ring))
+        {
+
+            _logger._n_dropped += atomic_load(&ring->_n_dropped);
+            free(ring);
+            ring = next;
+
+            continue;
+        }
+
+        prev = ring;
+        ring = next;
+    }
+
+    if (n_written)
+    {
+        fflush(output);
+    }
+}
+
+static void*
+_logger_flusher(void* arg)
+{
+
+    (void) arg;
+
+    pthread_mutex_lock(&_logger._mutex);
+
+    while (_logger._running)
+    {
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += _logger._flush_interval_ms / 1000;
+        deadline.tv_nsec += (_logger._flush_interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&_logger._cond, &_logger._mutex, &deadline);
+
+        _logger_drain_locked();
+    }
+
+    pthread_mutex_unlock(&_logger._mutex);
+
+    return NULL;
+}
+
+int
+logger_start(const struct logger_configuration_t* config)
+{
+
+    if (config && config->_level > LOGGER_OFF)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&_logger._mutex);
+
+    if (_logger._n_users)
+    {
+
+        _logger._n_users++;
+        pthread_mutex_unlock(&_logger._mutex);
+
+        return 0;
+    }
+
+    enum logger_level_t level = LOGGER_INFO;
+    _logger._output = NULL;
+    size_t ring_capacity = _LOGGER_DEFAULT_RING_CAPACITY;
+    _logger._flush_interval_ms = _LOGGER_DEFAULT_FLUSH_INTERVAL_MS;
+
+    if (config)
+    {
+
+        level = config->_level;
+        _logger._output = config->_output;
+
+        if (config->_ring_capacity)
+        {
+
+            size_t capacity = 1;
+            while (capacity < config->_ring_capacity)
+            {
+                capacity <<= 1;
+            }
+
+            ring_capacity = capacity;
+        }
+
+        if (config->_flush_interval_ms)
+        {
+            _logger._flush_interval_ms = config->_flush_interval_ms;
+        }
+    }
+
+    atomic_store(&_logger._level, level);
+    atomic_store(&_logger._ring_capacity, ring_capacity);
+
+    _logger._running = 1;
+    int exit_code =
+        pthread_create(&_logger._flusher, NULL, _logger_flusher, NULL);
+    if (exit_code)
+    {
+
+        _logger._running = 0;
+        pthread_mutex_unlock(&_logger._mutex);
+
+        return exit_code;
+    }
+
+    _logger._n_users = 1;
+
+    pthread_mutex_unlock(&_logger._mutex);
+
+    return 0;
+}
+
+int
+logger_stop()
+{
+
+    pthread_mutex_lock(&_logger._mutex);
+
+    if (!_logger._n_users)
+    {
+
+        pthread_mutex_unlock(&_logger._mutex);
+
+        return 1;
+    }
+
+    if (--_logger._n_users)
+    {
+
+        pthread_mutex_unlock(&_logger._mutex);
+
+        return 0;
+    }
+
+    _logger._running = 0;
+    pthread_cond_signal(&_logger._cond);
+    pthread_mutex_unlock(&_logger._mutex);
+
+    pthread_join(_logger._flusher, NULL);
+
+    pthread_mutex_lock(&_logger._mutex);
+    _logger_drain_locked();
+    _logger._output = NULL;
+    pthread_mutex_unlock(&_logger._mutex);
+
+    return 0;
+}
+
+int
+logger_set_level(enum logger_level_t level)
+{
+
+    if (level > LOGGER_OFF)
+    {
+        return 1;
+    }
+
+    atomic_store(&_logger._level, level);
+
+    return 0;
+}
+
+enum logger_level_t
+logger_get_level()
+{
+    return atomic_load(&_logger._level);
+}
+
+int
+logger_parse_level(const char* name, enum logger_level_t* out_level)
+{
+
+    if (!name || !out_level)
+    {
+        return 1;
+    }
+
+    size_t i = 0;
+    while (i <= LOGGER_OFF)
+    {
+
+        if (!strcmp(name, _logger_level_names[i]))
+        {
+            *out_level = (enum logger_level_t) i;
+            return 0;
+        }
+
+        i++;
+    }
+
+    return 1;
+}
+
+void
+logger_log(enum logger_level_t level, const char* component,
+           const char* format, ...)
+{
+
+    if (level >= LOGGER_OFF || (int) level < atomic_load(&_logger._level))
+    {
+        return;
+    }
+
+    struct _logger_ring_t* ring = _logger_thread_ring;
+    if (!ring)
+    {
+
+        ring = _logger_ring_new();
+        if (!ring)
+        {
+            return;
+        }
+    }
+
+    size_t head = atomic_load_explicit(&ring->_head, memory_order_relaxed);
+    if (head - atomic_load(&ring->_tail) == ring->_capacity)
+    {
+        atomic_fetch_add(&ring->_n_dropped, 1);
+        return;
+    }
+
+    struct _logger_record_t* record =
+        &ring->_records[head & (ring->_capacity - 1)];
+
+    clock_gettime(CLOCK_REALTIME, &record->_time);
+    record->_level = level;
+    record->_component = component ? component : "-";
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record->_text, sizeof(record->_text), format, args);
+    va_end(args);
+
+    atomic_store(&ring->_head, head + 1);
+}
+
+int
+logger_flush()
+{
+
+    pthread_mutex_lock(&_logger._mutex);
+
+    if (!_logger._n_users)
+    {
+
+        pthread_mutex_unlock(&_logger._mutex);
+
+        return 1;
+    }
+
+    _logger_drain_locked();
+
+    pthread_mutex_unlock(&_logger._mutex);
+
+    return 0;
+}
+
+size_t
+logger_get_dropped_count()
+{
+
+    pthread_mutex_lock(&_logger._mutex);
+
+    size_t n_dropped = _logger._n_dropped;
+
+    struct _logger_ring_t* ring = atomic_load(&_logger._rings);
+    while (ring)
+    {
+        n_dropped += atomic_load(&ring->_n_dropped);
+        ring = ring->_next;
+    }
+
+    pthread_mutex_unlock(&_logger._mutex);
+
+    return n_dropped;
+}
@@ -1,37 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "message_broker.h"
 #include "generic_hash_table.h"
 #include "generic_linked_list.h"
+#include "generic_log.h"
 #include "generic_queue_syn.h"
+#include "latency_histogram.h"
+#include "logger.h"
 #include "thread_pool.h"
+#include "timer_wheel.h"
+#include "topic_trie.h"
+#include "wal.h"
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
 
 struct message_broker_t
 {
     struct thread_pool_t* _publisher_pool;
+    size_t _n_shards;
+    struct thread_pool_t** _shards;
+    size_t _inline_fanout_threshold;
+    atomic_int _has_partitions;
     generic_hash_table _channels;
-    pthread_mutex_t _channels_mutex;
     atomic_uint_fast64_t _next_subscriber_id;
+    int _global_message_ids;
+    int _latency_tracing;
     atomic_uint_fast64_t _next_message_id;
+    struct timer_wheel_t* _expiry_wheel;
+    pthread_t _expiry_thread;
+    pthread_mutex_t _expiry_mutex;
+    pthread_cond_t _expiry_cond;
+    int _expiry_running;
+    atomic_int _expiry_idle;
+    char* _data_dir;
+    generic_hash_table _pattern_channels;
+    topic_trie _patterns;
+    pthread_rwlock_t _patterns_lock;
+    atomic_size_t _n_patterns;
+    size_t _channel_idle_ms;
+    uint64_t _next_reclaim_ms;
+    atomic_size_t _n_reclaimed;
+    int _logging;
+    struct _stat_counters_t* _stats;
+    size_t _n_stat_slots;
 };
 
-struct message_t
+#define _EXPIRY_TICK_MS 10
+#define _CHANNEL_LOG_SEGMENT_CAPACITY 256
+#define _WAL_SEGMENT_SIZE ((size_t) 64 << 20)
+#define _WAL_DEFAULT_COMMIT_BATCH_SIZE 256
+#define _WAL_DEFAULT_COMMIT_LATENCY_MS 5
+#define _DURABLE_RECORD_FORMAT 1
+#define _ACK_DEFAULT_TIMEOUT_MS 30000
+#define _MAX_PARTITIONS 64
+
+// @note the payload is allocated once per publish as a single block (header,
+// channel name, encoded message headers and content) and shared by every inbox
+// of the fan-out; it is immutable once fanned out and released when the last
+// reference is dropped. The headers are kept in the block encoding of
+// message_get_headers, _headers_len 0 without any.
+// @note times are CLOCK_MONOTONIC milliseconds; _expires_at_ms is resolved from
+// _ttl_ms (or the channel default) right before the fan-out, 0 never expires.
+// @note _partition is resolved at the same point: from _key_hash when _keyed,
+// round-robin otherwise; it stays 0 on channels without partitions. In sharded
+// mode it is resolved at publish time instead, _routed is then set, see
+// _broker_route_partition.
+// @note _sequence is stamped by the channel when the message is fanned out
+// (appended, on LOG channels): it counts from 1 per channel, or per partition
+// on partitioned channels. _id is the broker-wide id, taken at publish time
+// only with _global_message_ids and 0 otherwise.
+struct _message_payload_t
 {
+    atomic_size_t _ref_count;
     uint64_t _id;
+    uint64_t _sequence;
+    uint64_t _published_at_ns;
+    uint64_t _ttl_ms;
+    uint64_t _expires_at_ms;
+    int _keyed;
+    size_t _key_hash;
+    size_t _partition;
+    int _routed;
+    size_t _channel_name_len;
+    size_t _headers_len;
+    size_t _content_len;
     char* _channel_name;
+    char* _headers;
     char* _content;
+    char _data[];
+};
+
+struct message_t
+{
+    struct _message_payload_t* _payload;
+};
+
+// @note a received message waiting for its ack; _offset is its log offset on
+// log storage channels.
+struct _in_flight_t
+{
+    struct _message_payload_t* _payload;
+    uint64_t _offset;
+    uint64_t _redeliver_at_ms;
 };
 
+// @note in ack mode the received messages are kept in the _in_flight ring of
+// _ack_window entries, in delivery order: every delivery (first or repeated)
+// gets the same timeout, so the head is always the next one to redeliver. The
+// ring is guarded by _in_flight_mutex, taken before the inbox mutex; _n_acks
+// grows on every ack that freed room and wakes the receivers waiting on it.
+// @note _event_fd is created on demand by subscription_get_fd, -1 until then.
+// _fd_armed is set by whoever makes the eventfd readable and cleared by the
+// receiver that found nothing to receive, so a burst of publishes costs a
+// single write to the eventfd.
+// @note _n_refs is the subscriber set holding the proxy plus the fan-outs that
+// pinned it to wait for room in its inbox out of their read section, see
+// _fan_out_t: the last one to release it frees it.
 struct subscriber_proxy_t
 {
     uint64_t _id;
     generic_queue_syn _inbox;
     pthread_mutex_t _inbox_mutex;
     pthread_cond_t _inbox_cond;
-    int _active;
+    atomic_int _active;
+    size_t _capacity;
+    enum subscription_overflow_policy_t _overflow_policy;
+    size_t _block_timeout_ms;
+    atomic_size_t _n_dropped;
+    struct message_broker_t* _broker;
+    struct channel_t* _channel;
+    struct timer_wheel_timer_t* _expiry_timer;
+    generic_log_cursor _cursor;
+    char* _name;
+    size_t _ack_window;
+    size_t _ack_timeout_ms;
+    struct _in_flight_t* _in_flight;
+    size_t _in_flight_head;
+    atomic_size_t _n_in_flight;
+    atomic_size_t _n_acks;
+    atomic_size_t _n_redelivered;
+    pthread_mutex_t _in_flight_mutex;
+    atomic_int _event_fd;
+    atomic_int _fd_armed;
+    size_t _slot;
+    int _detached;
+    atomic_size_t _n_refs;
+    struct _consumer_group_t* _group;
+    uint64_t _partitions;
+    atomic_uint_least64_t _n_delivered;
+    atomic_uint_least64_t _bytes_out;
 };
 
 struct subscription_t
@@ -41,667 +166,1077 @@ struct subscription_t
     struct message_broker_t* _broker;
     struct subscriber_proxy_t* _proxy;
     int _active;
+    int _is_pattern;
+};
+
+// @note padded to a cache line: the partitions of a channel fanned out by
+// different shards do not share one.
+struct _sequence_counter_t
+{
+    atomic_uint_least64_t _next;
+    char _padding[64 - sizeof(atomic_uint_least64_t)];
+};
+
+enum _stat_t
+{
+    _STAT_PUBLISHED,
+    _STAT_FANNED_OUT,
+    _STAT_DROPPED,
+    _STAT_DELIVERED,
+    _STAT_BYTES_IN,
+    _STAT_BYTES_OUT,
+    _N_STATS
+};
+
+// @note padded to a cache line like _sequence_counter_t: the broker and each
+// channel keep one per stats slot. The counters are only added to and summed,
+// relaxed ordering is enough.
+struct _stat_counters_t
+{
+    atomic_uint_least64_t _values[_N_STATS];
+    char _padding[64 - _N_STATS * sizeof(atomic_uint_least64_t)];
+};
+
+#define _N_LATENCY_STAGES 3
+
+// @note one histogram per enum message_latency_stage_t.
+struct _latency_slot_t
+{
+    latency_histogram _stages[_N_LATENCY_STAGES];
+};
+
+// @note sharded like the stats counters: a thread records into the histograms
+// of its stats slot, allocated the first time the slot records, and a read
+// merges the slots.
+struct _channel_latency_t
+{
+    size_t _n_slots;
+    _Atomic(struct _latency_slot_t*) _slots[];
+};
+
+// @note the subscribers are an array whose first _n slots never change once
+// published: the membership changes (made under the channel serialization)
+// append in place while there is room and otherwise replace the array
+// copy-on-write. The fan-out of a queue channel walks the current array
+// without the channel lock, inside a read section on _n_readers; a replaced
+// array, and the detached proxies it drops, is freed once the read sections
+// that may still see it are over.
+struct _subscriber_snapshot_t
+{
+    atomic_size_t _n;
+    size_t _capacity;
+    struct subscriber_proxy_t* _proxies[];
+};
+
+// @note _n_detached counts the proxies of the snapshot flagged detached and not
+// freed yet, it is only accessed under the channel serialization.
+struct _subscriber_set_t
+{
+    _Atomic(struct _subscriber_snapshot_t*) _snapshot;
+    size_t _n_detached;
+};
+
+// @note a consumer group shares the messages of a channel among its members:
+// each message goes to the active member with the fewest pending messages,
+// ties broken round-robin from _next. The members are a subscriber set of
+// their own, walked by the fan-out inside the channel read sections;
+// _n_members counts the attached ones under the channel serialization and the
+// group is dropped with its last member.
+struct _consumer_group_t
+{
+    char* _name;
+    struct _subscriber_set_t _members;
+    size_t _n_members;
+    atomic_size_t _next;
 };
 
+// @note the groups of a channel, replaced copy-on-write when a group is
+// created or dropped.
+struct _group_snapshot_t
+{
+    size_t _n;
+    struct _consumer_group_t* _groups[];
+};
+
+// @note in sharded mode the channel is owned by the shard selected by its name
+// hash: fan-out and membership changes all run on that shard worker, so the
+// channel state is single-writer and _mutex is not taken.
+// @note _n_pending_tasks counts the pooled publishes (and batches) resolved on
+// the caller side and not completed yet: the inline fast path is only taken
+// when it is 0, so an inline publish never overtakes a publish queued on the
+// pool.
+// @note _log is set in log storage mode, it is appended to under the same
+// serialization as the fan-out. Receivers caught up with it wait on _log_cond,
+// _n_log_waiters lets the publisher skip the wake-up when nobody waits.
+// @note a pattern subscription is attached to a pattern channel, named after
+// the pattern and kept in the broker _pattern_channels table; the pattern
+// channels with subscribers are the values of the broker _patterns trie, each
+// publish is also delivered to the ones matching its channel name. They are
+// always QUEUE channels shared by the shards (_single_writer is 0) and
+// _in_trie is only accessed under the broker _patterns_lock.
+// @note _n_refs pins the channel in the broker table: it is taken under the
+// table bucket lock by whoever resolves the channel (publisher tasks, handles,
+// subscribe and unsubscribe calls) and the idle reclamation deletes, under
+// that same lock, only the channels with no reference, no subscriber and no
+// use for _channel_idle_ms. _last_used_ms is refreshed when a reference is
+// released. Declared channels carry options (and possibly data), they are
+// never reclaimed.
+// @note _n_event_fds counts the subscribers with an eventfd: a log append only
+// walks the subscribers to notify them when it is not 0.
+// @note _groups holds the consumer groups, only on QUEUE channels: their
+// members are counted in _n_subscribers like the plain subscribers.
+// @note _n_partitions (0 when not partitioned) only changes while the channel
+// has no subscribers. A subscriber with a _partitions mask only gets the
+// messages of those partitions; in sharded mode the publishes of each
+// partition run on a shard of their own (see _broker_route_partition), which
+// is safe because the QUEUE fan-out only reads the subscriber snapshots.
+// @note _next_sequence numbers the messages of the channel, the partitions of
+// a partitioned channel count in _partition_sequences instead (allocated with
+// room for every partition the first time partitions are set, freed with the
+// channel). The sequences follow the delivery order wherever the fan-out of
+// the channel (of the partition) is serialized: LOG channels, and sharded
+// mode; the shared pool fans the publishes of a channel out concurrently.
+// @note _wal is set on durable channels, the log and the WAL get the same
+// messages in the same order so their offsets match. _parked_cursors keeps the
+// position of the named subscriptions not attached at the moment. _wal_error
+// is the first error of the WAL, returned by message_broker_wait.
 struct channel_t
 {
     char* _channel_name;
-    generic_linked_list _subscriber_proxies;
+    struct _subscriber_set_t _subscribers;
+    _Atomic(struct _group_snapshot_t*) _groups;
+    atomic_size_t _n_readers[2];
+    atomic_size_t _reader_epoch;
     pthread_mutex_t _mutex;
+    int _single_writer;
+    atomic_size_t _n_subscribers;
+    atomic_size_t _n_pending_tasks;
+    atomic_size_t _default_ttl_ms;
+    atomic_size_t _n_expired;
+    generic_log _log;
+    pthread_mutex_t _log_mutex;
+    pthread_cond_t _log_cond;
+    atomic_size_t _n_log_waiters;
+    atomic_size_t _n_event_fds;
+    int _in_trie;
+    atomic_size_t _n_partitions;
+    atomic_size_t _next_partition;
+    atomic_uint_least64_t _next_sequence;
+    struct _sequence_counter_t* _partition_sequences;
+    atomic_size_t _n_refs;
+    atomic_uint_least64_t _last_used_ms;
+    atomic_int _declared;
+    wal _wal;
+    atomic_int _wal_error;
+    generic_linked_list _parked_cursors;
+    struct _stat_counters_t* _stats;
+    size_t _n_stat_slots;
+    _Atomic(struct _channel_latency_t*) _latency;
 };
 
-static int
-_message_new(uint64_t id, const char* channel_name, const char* content,
-             struct message_t** out_self)
+// @note a handle holds a reference on the channel, which pins it against the
+// idle reclamation, and caches the executor owning it: a publish through it
+// hashes nothing and looks nothing up.
+struct channel_handle_t
 {
+    struct message_broker_t* _broker;
+    struct channel_t* _channel;
+    struct thread_pool_t* _executor;
+};
 
-    if (!channel_name)
-    {
-        return 1;
-    }
+struct _parked_cursor_t
+{
+    char* _name;
+    generic_log_cursor _cursor;
+};
 
-    if (!content)
-    {
-        return 1;
-    }
+// @note durable record: header followed by the encoded message headers and
+// the content. The expiry is stored on the wall clock, monotonic times do not
+// survive a restart. _DURABLE_RECORD_FORMAT is stored in the WAL segments and
+// bumped with any change of this layout: the WAL of another one is rejected.
+struct _durable_record_header_t
+{
+    uint64_t _id;
+    uint64_t _expires_at_realtime_ms;
+    uint64_t _headers_len;
+};
 
-    if (!out_self)
-    {
-        return 1;
-    }
+static uint64_t
+_monotonic_ms()
+{
 
-    struct message_t* self = malloc(sizeof(struct message_t));
-    if (!self)
-    {
-        return -1;
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    self->_id = id;
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
 
-    size_t channel_len = strlen(channel_name);
-    self->_channel_name = malloc(channel_len + 1);
-    if (!self->_channel_name)
+static uint64_t
+_monotonic_ns()
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t
+_realtime_ms()
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static void
+_stat_counters_init(struct _stat_counters_t* counters, size_t n)
+{
+
+    size_t i = 0;
+    while (i < n * _N_STATS)
     {
-        free(self);
-        return -1;
+        atomic_init(&counters[i / _N_STATS]._values[i % _N_STATS], 0);
+        i++;
     }
-    memcpy(self->_channel_name, channel_name, channel_len + 1);
+}
+
+static void
+_stat_counters_add(struct _stat_counters_t* counters, enum _stat_t stat,
+                   uint64_t n)
+{
+    atomic_fetch_add_explicit(&counters->_values[stat], n,
+                              memory_order_relaxed);
+}
+
+// Adds the n counters to out_counters.
+static void
+_stat_counters_load(struct _stat_counters_t* counters, size_t n,
+                    struct message_broker_counters_t* out_counters)
+{
+
+    uint64_t values[_N_STATS] = {0};
 
-    size_t content_len = strlen(content);
-    self->_content = malloc(content_len + 1);
-    if (!self->_content)
+    size_t i = 0;
+    while (i < n * _N_STATS)
     {
-        free(self->_channel_name);
-        free(self);
-        return -1;
+        values[i % _N_STATS] += atomic_load_explicit(
+            &counters[i / _N_STATS]._values[i % _N_STATS],
+            memory_order_relaxed);
+        i++;
     }
-    memcpy(self->_content, content, content_len + 1);
-
-    *out_self = self;
 
-    return 0;
+    out_counters->_n_published += values[_STAT_PUBLISHED];
+    out_counters->_n_fanned_out += values[_STAT_FANNED_OUT];
+    out_counters->_n_dropped += values[_STAT_DROPPED];
+    out_counters->_n_delivered += values[_STAT_DELIVERED];
+    out_counters->_bytes_in += values[_STAT_BYTES_IN];
+    out_counters->_bytes_out += values[_STAT_BYTES_OUT];
 }
 
-int
-message_free(struct message_t* self)
+static atomic_size_t _next_stat_slot;
+static _Thread_local size_t _thread_stat_slot = SIZE_MAX;
+
+// @note a thread takes the next stats slot the first time it counts, the
+// workers of a broker (one per CPU at most, in the usual setups) then each
+// add to a cache line of their own, in the broker and in every channel.
+static size_t
+_stat_slot_index(size_t n_slots)
 {
 
-    if (!self)
+    if (_thread_stat_slot == SIZE_MAX)
     {
-        return 1;
+        _thread_stat_slot = atomic_fetch_add(&_next_stat_slot, 1);
     }
 
-    free(self->_channel_name);
-    free(self->_content);
-    free(self);
+    return _thread_stat_slot % n_slots;
+}
 
-    return 0;
+static struct _stat_counters_t*
+_stat_slot(struct _stat_counters_t* slots, size_t n_slots)
+{
+    return &slots[_stat_slot_index(n_slots)];
 }
 
-int
-message_get_id(struct message_t* self, uint64_t* out_id)
+static struct _stat_counters_t*
+_stat_slots_new(size_t n_slots)
 {
 
-    if (!self)
+    struct _stat_counters_t* slots =
+        aligned_alloc(64, n_slots * sizeof(struct _stat_counters_t));
+    if (slots)
     {
-        return 1;
+        _stat_counters_init(slots, n_slots);
     }
 
-    if (!out_id)
-    {
-        return 1;
-    }
+    return slots;
+}
 
-    *out_id = self->_id;
+static void
+_broker_count(struct message_broker_t* self, enum _stat_t stat, uint64_t n)
+{
+    _stat_counters_add(_stat_slot(self->_stats, self->_n_stat_slots), stat, n);
+}
 
-    return 0;
+static void
+_channel_count(struct channel_t* self, enum _stat_t stat, uint64_t n)
+{
+    _stat_counters_add(_stat_slot(self->_stats, self->_n_stat_slots), stat, n);
 }
 
-int
-message_get_channel(struct message_t* self, const char** out_channel)
+static void
+_latency_slot_free(struct _latency_slot_t* self)
 {
 
     if (!self)
     {
-        return 1;
+        return;
     }
 
-    if (!out_channel)
+    size_t i = 0;
+    while (i < _N_LATENCY_STAGES)
     {
-        return 1;
+        latency_histogram_free(self->_stages[i]);
+        i++;
     }
 
-    *out_channel = self->_channel_name;
-
-    return 0;
+    free(self);
 }
 
-int
-message_get_content(struct message_t* self, const char** out_content)
+static struct _latency_slot_t*
+_latency_slot_new()
 {
 
+    struct _latency_slot_t* self = calloc(1, sizeof(struct _latency_slot_t));
     if (!self)
     {
-        return 1;
+        return NULL;
     }
 
-    if (!out_content)
+    size_t i = 0;
+    while (i < _N_LATENCY_STAGES)
     {
-        return 1;
-    }
 
-    *out_content = self->_content;
+        if (latency_histogram_new(&self->_stages[i]))
+        {
+            _latency_slot_free(self);
+            return NULL;
+        }
+
+        i++;
+    }
 
-    return 0;
+    return self;
 }
 
 static void
-_message_free_wrapper(void* data)
+_channel_latency_free(struct _channel_latency_t* self)
 {
 
-    if (!data)
+    if (!self)
     {
         return;
     }
 
-    message_free((struct message_t*) data);
+    size_t i = 0;
+    while (i < self->_n_slots)
+    {
+        _latency_slot_free(atomic_load(&self->_slots[i]));
+        i++;
+    }
+
+    free(self);
 }
 
-static int
-_subscriber_proxy_new(uint64_t id, struct subscriber_proxy_t** out_self)
+// @note the slots are only allocated by the first latency recorded on the
+// channel, the histograms of a slot by the first one recorded through it; a
+// thread losing the race to install either frees its own.
+static struct _latency_slot_t*
+_channel_get_latency(struct channel_t* self)
 {
 
-    if (!out_self)
+    struct _channel_latency_t* latency = atomic_load(&self->_latency);
+    if (!latency)
     {
-        return 1;
-    }
 
-    struct subscriber_proxy_t* self = malloc(sizeof(struct subscriber_proxy_t));
-    if (!self)
-    {
-        return -1;
-    }
+        latency = calloc(1, sizeof(struct _channel_latency_t)
+                                + self->_n_stat_slots
+                                      * sizeof(latency->_slots[0]));
+        if (!latency)
+        {
+            return NULL;
+        }
 
-    self->_id = id;
-    self->_active = 1;
+        latency->_n_slots = self->_n_stat_slots;
 
-    int exit_code = generic_queue_syn_new(&self->_inbox);
-    if (exit_code)
-    {
-        free(self);
-        return exit_code;
+        struct _channel_latency_t* installed = NULL;
+        if (!atomic_compare_exchange_strong(&self->_latency, &installed,
+                                            latency))
+        {
+            free(latency);
+            latency = installed;
+        }
     }
 
-    generic_queue_syn_set_free_function(self->_inbox, _message_free_wrapper);
+    _Atomic(struct _latency_slot_t*)* slot =
+        &latency->_slots[_stat_slot_index(latency->_n_slots)];
 
-    exit_code = pthread_mutex_init(&self->_inbox_mutex, NULL);
-    if (exit_code)
+    struct _latency_slot_t* stages = atomic_load(slot);
+    if (stages)
     {
-
-        generic_queue_syn_free(self->_inbox);
-        free(self);
-
-        return exit_code;
+        return stages;
     }
 
-    exit_code = pthread_cond_init(&self->_inbox_cond, NULL);
-    if (exit_code)
+    stages = _latency_slot_new();
+    if (!stages)
     {
-
-        pthread_mutex_destroy(&self->_inbox_mutex);
-        generic_queue_syn_free(self->_inbox);
-        free(self);
-
-        return exit_code;
+        return NULL;
     }
 
-    *out_self = self;
+    struct _latency_slot_t* installed = NULL;
+    if (!atomic_compare_exchange_strong(slot, &installed, stages))
+    {
+        _latency_slot_free(stages);
+        return installed;
+    }
 
-    return 0;
+    return stages;
 }
 
+// @note now_ns is read once by the caller for the whole batch.
 static void
-_subscriber_proxy_free(struct subscriber_proxy_t* self)
+_channel_record_latency(struct channel_t* self,
+                        enum message_latency_stage_t stage,
+                        struct _message_payload_t** payloads, size_t n,
+                        uint64_t now_ns)
 {
 
-    if (!self)
+    struct _latency_slot_t* latency = _channel_get_latency(self);
+    if (!latency)
     {
         return;
     }
 
-    self->_active = 0;
+    size_t i = 0;
+    while (i < n)
+    {
 
-    pthread_mutex_lock(&self->_inbox_mutex);
-    pthread_cond_broadcast(&self->_inbox_cond);
-    pthread_mutex_unlock(&self->_inbox_mutex);
+        uint64_t published_at_ns = payloads[i]->_published_at_ns;
+        latency_histogram_record(
+            latency->_stages[stage],
+            now_ns > published_at_ns ? now_ns - published_at_ns : 0);
 
-    generic_queue_syn_free(self->_inbox);
-    pthread_mutex_destroy(&self->_inbox_mutex);
-    pthread_cond_destroy(&self->_inbox_cond);
-    free(self);
+        i++;
+    }
 }
 
-static void
-_subscriber_proxy_free_wrapper(void* data)
+// Bytes taken by the LEB128 encoding of value.
+static size_t
+_varint_len(uint64_t value)
 {
 
-    if (!data)
+    size_t len = 1;
+    while (value >= 0x80)
     {
-        return;
+        value >>= 7;
+        len++;
     }
 
-    _subscriber_proxy_free((struct subscriber_proxy_t*) data);
+    return len;
 }
 
-static int
-_subscriber_proxy_copy(void* src, void** dst)
+static char*
+_varint_write(char* out, uint64_t value)
 {
 
-    if (!src)
+    while (value >= 0x80)
     {
-        return 1;
+        *out++ = (char) (value | 0x80);
+        value >>= 7;
     }
+    *out++ = (char) value;
 
-    if (!dst)
+    return out;
+}
+
+// Reads the varint at *cursor and moves past it, 1 when it is truncated or
+// does not fit 64 bits.
+static int
+_varint_read(const unsigned char** cursor, const unsigned char* end,
+             uint64_t* out_value)
+{
+
+    uint64_t value = 0;
+    size_t shift = 0;
+    while (*cursor < end && shift < 64)
     {
-        return 1;
+
+        unsigned char byte = **cursor;
+        (*cursor)++;
+
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *out_value = value;
+            return 0;
+        }
+
+        shift += 7;
     }
 
-    *dst = src;
+    return 1;
+}
 
-    return 0;
+// Maps small negative values to small unsigned ones, so they encode short.
+static uint64_t
+_zigzag_encode(int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t
+_zigzag_decode(uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
 }
 
+// Length of the STRING or BYTES value of header, 1 when it is invalid.
 static int
-_subscriber_proxy_enqueue(struct subscriber_proxy_t* self,
-                          struct message_t* msg)
+_message_header_value_len(const struct message_header_t* header,
+                          size_t* out_len)
 {
 
-    if (!self)
+    if (header->_type == MESSAGE_HEADER_STRING)
     {
-        return 1;
-    }
 
-    if (!msg)
-    {
-        return 1;
-    }
+        if (!header->_value)
+        {
+            return 1;
+        }
 
-    if (!self->_active)
-    {
-        return 1;
+        *out_len = strlen(header->_value);
+
+        return 0;
     }
 
-    int exit_code = generic_queue_syn_enqueue(self->_inbox, msg);
-    if (exit_code)
+    if (!header->_value && header->_len)
     {
-        return exit_code;
+        return 1;
     }
 
-    pthread_mutex_lock(&self->_inbox_mutex);
-    pthread_cond_signal(&self->_inbox_cond);
-    pthread_mutex_unlock(&self->_inbox_mutex);
+    *out_len = header->_len;
 
     return 0;
 }
 
+// Size of the block encoding of headers, 1 when one of them is invalid.
 static int
-_channel_new(const char* name, struct channel_t** out_self)
+_message_headers_measure(const struct message_header_t* headers, size_t n,
+                         size_t* out_len)
 {
 
-    if (!name)
+    if (!headers && n)
     {
         return 1;
     }
 
-    if (!out_self)
-    {
-        return 1;
-    }
-
-    struct channel_t* self = malloc(sizeof(struct channel_t));
-    if (!self)
-    {
-        return -1;
-    }
-
-    size_t name_len = strlen(name);
-    self->_channel_name = malloc(name_len + 1);
-    if (!self->_channel_name)
-    {
-        free(self);
-        return -1;
-    }
-    memcpy(self->_channel_name, name, name_len + 1);
-
-    int exit_code = generic_linked_list_new(&self->_subscriber_proxies);
-    if (exit_code)
+    size_t len = 0;
+    size_t i = 0;
+    while (i < n)
     {
 
-        free(self->_channel_name);
-        free(self);
+        const struct message_header_t* header = headers + i;
+        if (!header->_key)
+        {
+            return 1;
+        }
 
-        return exit_code;
-    }
+        size_t key_len = strlen(header->_key);
+        if (!key_len || key_len > MESSAGE_HEADER_MAX_KEY_LEN)
+        {
+            return 1;
+        }
 
-    generic_linked_list_set_free_function(self->_subscriber_proxies,
-                                          _subscriber_proxy_free_wrapper);
-    generic_linked_list_set_copy_function(self->_subscriber_proxies,
-                                          _subscriber_proxy_copy);
+        len += 2 + key_len + 1;
+        if (header->_type == MESSAGE_HEADER_INT)
+        {
+            len += _varint_len(_zigzag_encode(header->_int_value));
+        }
+        else if (header->_type == MESSAGE_HEADER_STRING
+                 || header->_type == MESSAGE_HEADER_BYTES)
+        {
 
-    exit_code = pthread_mutex_init(&self->_mutex, NULL);
-    if (exit_code)
-    {
+            size_t value_len = 0;
+            if (_message_header_value_len(header, &value_len))
+            {
+                return 1;
+            }
 
-        generic_linked_list_free(self->_subscriber_proxies);
-        free(self->_channel_name);
-        free(self);
+            len += _varint_len(value_len) + value_len + 1;
+        }
+        else
+        {
+            return 1;
+        }
 
-        return exit_code;
+        i++;
     }
 
-    *out_self = self;
+    *out_len = len;
 
     return 0;
 }
 
+// @note headers must have been measured by _message_headers_measure, out has
+// room for the length it returned.
 static void
-_channel_free(struct channel_t* self)
+_message_headers_encode(const struct message_header_t* headers, size_t n,
+                        char* out)
 {
 
-    if (!self)
+    size_t i = 0;
+    while (i < n)
     {
-        return;
-    }
 
-    pthread_mutex_lock(&self->_mutex);
+        const struct message_header_t* header = headers + i;
+        size_t key_len = strlen(header->_key);
 
-    generic_linked_list_free(self->_subscriber_proxies);
-    free(self->_channel_name);
+        *out++ = (char) header->_type;
+        *out++ = (char) key_len;
+        memcpy(out, header->_key, key_len + 1);
+        out += key_len + 1;
 
-    pthread_mutex_unlock(&self->_mutex);
-    pthread_mutex_destroy(&self->_mutex);
+        if (header->_type == MESSAGE_HEADER_INT)
+        {
+            out = _varint_write(out, _zigzag_encode(header->_int_value));
+        }
+        else
+        {
 
-    free(self);
-}
+            size_t value_len = 0;
+            _message_header_value_len(header, &value_len);
 
-static void
-_channel_free_wrapper(void* data)
-{
+            out = _varint_write(out, value_len);
+            if (value_len)
+            {
+                memcpy(out, header->_value, value_len);
+            }
+            out += value_len;
+            *out++ = '\0';
+        }
 
-    if (!data)
-    {
-        return;
+        i++;
     }
-
-    _channel_free((struct channel_t*) data);
 }
 
+// Decodes the header at *cursor and moves past it, 1 when it is malformed.
 static int
-_channel_copy(void* src, void** dst)
+_message_header_read(const unsigned char** cursor, const unsigned char* end,
+                     struct message_header_t* out_header)
 {
 
-    if (!src)
+    const unsigned char* at = *cursor;
+    if (end - at < 2)
     {
         return 1;
     }
 
-    if (!dst)
+    unsigned char type = at[0];
+    size_t key_len = at[1];
+    at += 2;
+
+    if (type != MESSAGE_HEADER_STRING && type != MESSAGE_HEADER_INT
+        && type != MESSAGE_HEADER_BYTES)
     {
         return 1;
     }
 
-    *dst = src;
+    if (!key_len || (size_t) (end - at) <= key_len || at[key_len] != '\0'
+        || memchr(at, '\0', key_len))
+    {
+        return 1;
+    }
 
-    return 0;
-}
+    out_header->_key = (const char*) at;
+    out_header->_type = (enum message_header_type_t) type;
+    out_header->_value = NULL;
+    out_header->_len = 0;
+    out_header->_int_value = 0;
+    at += key_len + 1;
 
-static size_t
-_string_hash(void* key)
-{
+    uint64_t value = 0;
+    if (_varint_read(&at, end, &value))
+    {
+        return 1;
+    }
 
-    size_t hash = 5381;
-    unsigned char* p = (unsigned char*) key;
-    while (*p)
+    if (type == MESSAGE_HEADER_INT)
     {
-        hash = ((hash << 5) + hash) + *p++;
+        out_header->_int_value = _zigzag_decode(value);
     }
+    else
+    {
 
-    return hash;
-}
+        if ((uint64_t) (end - at) <= value || at[value] != '\0')
+        {
+            return 1;
+        }
 
-static void
-_string_free(void* data)
-{
-    free(data);
+        out_header->_value = at;
+        out_header->_len = (size_t) value;
+        at += value + 1;
+    }
+
+    *cursor = at;
+
+    return 0;
 }
 
+// @note the content is followed by a NUL terminator which is not part of the
+// payload length, so that message_get_content keeps working on text payloads.
+// Room is left for headers_len bytes of encoded headers, filled by the caller.
+// @note the clock is only read for the latency tracing (traced) or a TTL of
+// the message's own: _published_at_ns is 0 otherwise.
 static int
-_string_copy(void* src, void** dst)
+_message_payload_alloc(uint64_t id, const char* channel_name,
+                       const void* content, size_t content_len,
+                       size_t headers_len, uint64_t ttl_ms, int traced,
+                       struct _message_payload_t** out_self)
 {
 
-    if (!src)
+    if (!channel_name)
     {
         return 1;
     }
 
-    if (!dst)
+    if (!content && content_len)
     {
         return 1;
     }
 
-    size_t len = strlen((char*) src);
-    char* copy = malloc(len + 1);
-    if (!copy)
+    if (!out_self)
+    {
+        return 1;
+    }
+
+    size_t channel_len = strlen(channel_name);
+
+    struct _message_payload_t* self =
+        malloc(sizeof(struct _message_payload_t) + channel_len + 1
+               + headers_len + content_len + 1);
+    if (!self)
     {
         return -1;
     }
 
-    memcpy(copy, src, len + 1);
-    *dst = copy;
+    atomic_init(&self->_ref_count, 1);
+    self->_id = id;
+    self->_sequence = 0;
+    self->_published_at_ns = traced || ttl_ms ? _monotonic_ns() : 0;
+    self->_ttl_ms = ttl_ms;
+    self->_expires_at_ms = 0;
+    self->_keyed = 0;
+    self->_key_hash = 0;
+    self->_partition = 0;
+    self->_routed = 0;
+    self->_channel_name_len = channel_len;
+    self->_headers_len = headers_len;
+    self->_content_len = content_len;
+
+    self->_channel_name = self->_data;
+    memcpy(self->_channel_name, channel_name, channel_len + 1);
+
+    self->_headers = self->_data + channel_len + 1;
+
+    self->_content = self->_headers + headers_len;
+    if (content_len)
+    {
+        memcpy(self->_content, content, content_len);
+    }
+    self->_content[content_len] = '\0';
+
+    *out_self = self;
 
     return 0;
 }
 
 static int
-_string_compare(void* a, void* b)
+_message_payload_new(uint64_t id, const char* channel_name,
+                     const void* content, size_t content_len,
+                     const struct message_header_t* headers, size_t n_headers,
+                     uint64_t ttl_ms, int traced,
+                     struct _message_payload_t** out_self)
 {
-    return strcmp((char*) a, (char*) b);
+
+    size_t headers_len = 0;
+    int exit_code = _message_headers_measure(headers, n_headers, &headers_len);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    exit_code = _message_payload_alloc(id, channel_name, content, content_len,
+                                       headers_len, ttl_ms, traced, out_self);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    _message_headers_encode(headers, n_headers, (*out_self)->_headers);
+
+    return 0;
 }
 
-struct _publisher_task_arg_t
+static void
+_message_payload_acquire(struct _message_payload_t* self)
 {
-    uint64_t _message_id;
-    char* _channel_name;
-    char* _content;
-    generic_hash_table _channels;
-    pthread_mutex_t* _channels_mutex;
-};
+    atomic_fetch_add_explicit(&self->_ref_count, 1, memory_order_relaxed);
+}
 
 static void
-_publisher_task_arg_free(struct _publisher_task_arg_t* arg)
+_message_payload_release(struct _message_payload_t* self)
 {
 
-    if (!arg)
+    if (!self)
     {
         return;
     }
 
-    free(arg->_channel_name);
-    free(arg->_content);
-    free(arg);
+    if (atomic_fetch_sub_explicit(&self->_ref_count, 1, memory_order_acq_rel)
+        == 1)
+    {
+        free(self);
+    }
 }
 
-// @todo refactor this function to avoid _channels_mutex: generic_hash_table
-// must expose something like *_get_and_create as atomic function, and then
-// working on the channel specific mutex
-static void*
-_publisher_task(void* arg)
+static void
+_message_payload_release_wrapper(void* data)
 {
 
-    if (!arg)
+    if (!data)
     {
-        return NULL;
+        return;
     }
 
-    struct _publisher_task_arg_t* task_arg =
-        (struct _publisher_task_arg_t*) arg;
-
-    pthread_mutex_lock(task_arg->_channels_mutex);
+    _message_payload_release((struct _message_payload_t*) data);
+}
 
-    struct channel_t* channel = NULL;
-    int exit_code = generic_hash_table_get(
-        task_arg->_channels, task_arg->_channel_name, (void**) &channel);
+static int
+_message_new(struct _message_payload_t* payload, struct message_t** out_self)
+{
 
-    if (exit_code || !channel)
+    if (!payload)
     {
+        return 1;
+    }
 
-        exit_code = _channel_new(task_arg->_channel_name, &channel);
-        if (exit_code)
-        {
-
-            pthread_mutex_unlock(task_arg->_channels_mutex);
-            fprintf(stderr, "[message_broker] failed to create channel: %s\n",
-                    task_arg->_channel_name);
+    if (!out_self)
+    {
+        return 1;
+    }
 
-            _publisher_task_arg_free(task_arg);
+    struct message_t* self = malloc(sizeof(struct message_t));
+    if (!self)
+    {
+        return -1;
+    }
 
-            return NULL;
-        }
+    _message_payload_acquire(payload);
+    self->_payload = payload;
 
-        exit_code = generic_hash_table_insert(task_arg->_channels,
-                                              task_arg->_channel_name, channel);
-        if (exit_code)
-        {
+    *out_self = self;
 
-            pthread_mutex_unlock(task_arg->_channels_mutex);
+    return 0;
+}
 
-            _channel_free(channel);
+int
+message_free(struct message_t* self)
+{
 
-            // @todo refactor the entire module the way messages are logges with
-            // a
-            // consisten way.
-            printf("[message_broker] failed to insert channel: %s\n",
-                   task_arg->_channel_name);
+    if (!self)
+    {
+        return 1;
+    }
 
-            _publisher_task_arg_free(task_arg);
+    _message_payload_release(self->_payload);
+    free(self);
 
-            return NULL;
-        }
-    }
+    return 0;
+}
 
-    pthread_mutex_unlock(task_arg->_channels_mutex);
+// The id a message is known by: its broker-wide id when the broker hands them
+// out, its channel sequence otherwise.
+static uint64_t
+_message_payload_get_id(const struct _message_payload_t* self)
+{
+    return self->_id ? self->_id : self->_sequence;
+}
 
-    pthread_mutex_lock(&channel->_mutex);
+int
+message_get_id(struct message_t* self, uint64_t* out_id)
+{
 
-    size_t subscriber_count = 0;
-    generic_linked_list_size(channel->_subscriber_proxies, &subscriber_count);
-    if (subscriber_count)
+    if (!self)
     {
+        return 1;
+    }
 
-        generic_linked_list_iterator iter = NULL;
-        exit_code = generic_linked_list_iterator_begin(
-            channel->_subscriber_proxies, &iter);
-        if (exit_code == 0)
-        {
-
-            while (generic_linked_list_iterator_is_valid(iter) == 0)
-            {
+    if (!out_id)
+    {
+        return 1;
+    }
 
-                struct subscriber_proxy_t* proxy = NULL;
-                exit_code =
-                    generic_linked_list_iterator_get(iter, (void**) &proxy);
-                if (exit_code == 0 && proxy && proxy->_active)
-                {
+    *out_id = _message_payload_get_id(self->_payload);
 
-                    struct message_t* msg_copy = NULL;
-                    exit_code = _message_new(task_arg->_message_id,
-                                             task_arg->_channel_name,
-                                             task_arg->_content, &msg_copy);
-                    if (exit_code == 0 && msg_copy)
-                    {
-
-                        exit_code = _subscriber_proxy_enqueue(proxy, msg_copy);
-                        if (exit_code)
-                        {
-                            message_free(msg_copy);
-                        }
-                    }
-                }
+    return 0;
+}
 
-                generic_linked_list_iterator_next(iter);
-            }
+int
+message_get_sequence(struct message_t* self, uint64_t* out_sequence)
+{
 
-            generic_linked_list_iterator_free(iter);
-        }
+    if (!self)
+    {
+        return 1;
     }
 
-    pthread_mutex_unlock(&channel->_mutex);
-
-    // @todo refactor the entire module the way messages are logges with a
-    // consisten way.
-    printf("[message_broker] published (id: %lu) channel: %s, content: %s, "
-           "subscribers: %zu\n",
-           (unsigned long) task_arg->_message_id, task_arg->_channel_name,
-           task_arg->_content, subscriber_count);
+    if (!out_sequence)
+    {
+        return 1;
+    }
 
-    _publisher_task_arg_free(task_arg);
+    *out_sequence = self->_payload->_sequence;
 
-    return NULL;
+    return 0;
 }
 
 int
-message_broker_new(struct message_broker_configuration_t* config,
-                   struct message_broker_t** out_self)
+message_get_channel(struct message_t* self, const char** out_channel)
 {
 
-    if (!out_self)
+    if (!self)
     {
         return 1;
     }
 
-    if (!config)
+    if (!out_channel)
     {
         return 1;
     }
 
-    if (!config->_n_threads)
+    *out_channel = self->_payload->_channel_name;
+
+    return 0;
+}
+
+int
+message_get_partition(struct message_t* self, size_t* out_partition)
+{
+
+    if (!self)
     {
         return 1;
     }
 
-    if (!config->_channels_capacity)
+    if (!out_partition)
     {
         return 1;
     }
 
-    struct message_broker_t* self = malloc(sizeof(struct message_broker_t));
-    if (!self)
+    *out_partition = self->_payload->_partition;
+
+    return 0;
+}
+
+int
+message_get_content(struct message_t* self, const char** out_content)
+{
+
+    if (!self)
     {
-        return -1;
+        return 1;
     }
 
-    int exit_code = thread_pool_new(config->_n_threads, &self->_publisher_pool);
-    if (exit_code)
+    if (!out_content)
     {
-        free(self);
-        return exit_code;
+        return 1;
     }
 
-    exit_code = generic_hash_table_new(config->_channels_capacity, _string_hash,
-                                       _channel_free_wrapper, _channel_copy,
-                                       _string_free, _string_copy,
-                                       _string_compare, &self->_channels);
-    if (exit_code)
-    {
+    *out_content = self->_payload->_content;
 
-        thread_pool_free(self->_publisher_pool);
-        free(self);
+    return 0;
+}
 
-        return exit_code;
+int
+message_get_payload(struct message_t* self, const void** out_payload,
+                    size_t* out_len)
+{
+
+    if (!self)
+    {
+        return 1;
     }
 
-    exit_code = pthread_mutex_init(&self->_channels_mutex, NULL);
-    if (exit_code)
+    if (!out_payload)
     {
+        return 1;
+    }
 
-        generic_hash_table_free(self->_channels);
-        thread_pool_free(self->_publisher_pool);
-        free(self);
+    if (!out_len)
+    {
+        return 1;
+    }
 
-        return exit_code;
+    *out_payload = self->_payload->_content;
+    *out_len = self->_payload->_content_len;
+
+    return 0;
+}
+
+int
+message_get_header(struct message_t* self, const char* key,
+                   struct message_header_t* out_header)
+{
+
+    if (!self)
+    {
+        return 1;
     }
 
-    atomic_init(&self->_next_subscriber_id, 1);
-    atomic_init(&self->_next_message_id, 1);
+    if (!key || !out_header)
+    {
+        return 1;
+    }
 
-    *out_self = self;
+    size_t key_len = strlen(key);
 
-    return 0;
+    const unsigned char* cursor =
+        (const unsigned char*) self->_payload->_headers;
+    const unsigned char* end = cursor + self->_payload->_headers_len;
+    while (cursor < end)
+    {
+
+        struct message_header_t header;
+        if (_message_header_read(&cursor, end, &header))
+        {
+            return 1;
+        }
+
+        if (!strncmp(header._key, key, key_len) && !header._key[key_len])
+        {
+            *out_header = header;
+            return 0;
+        }
+    }
+
+    return 1;
 }
 
 int
-message_broker_free(struct message_broker_t* self)
+message_get_headers(struct message_t* self, const void** out_block,
+                    size_t* out_len)
 {
 
     if (!self)
@@ -709,187 +1244,5625 @@ message_broker_free(struct message_broker_t* self)
         return 1;
     }
 
-    thread_pool_free(self->_publisher_pool);
-    generic_hash_table_free(self->_channels);
-    pthread_mutex_destroy(&self->_channels_mutex);
-    free(self);
+    if (!out_block || !out_len)
+    {
+        return 1;
+    }
+
+    *out_block = self->_payload->_headers;
+    *out_len = self->_payload->_headers_len;
 
     return 0;
 }
 
 int
-message_broker_publish(struct message_broker_t* self, const char* channel,
-                       const char* content)
+message_headers_decode(const void* block, size_t len,
+                       struct message_header_t* out_headers, size_t max,
+                       size_t* out_n)
 {
 
-    if (!self)
+    if (!block && len)
     {
         return 1;
     }
 
-    if (!channel)
+    if (!out_headers && max)
     {
         return 1;
     }
 
-    if (!content)
+    if (!out_n)
     {
         return 1;
     }
 
-    struct _publisher_task_arg_t* task_arg =
-        malloc(sizeof(struct _publisher_task_arg_t));
-    if (!task_arg)
+    *out_n = 0;
+    if (!len)
     {
-        return -1;
+        return 0;
     }
 
-    task_arg->_message_id = atomic_fetch_add(&self->_next_message_id, 1);
+    const unsigned char* cursor = block;
+    const unsigned char* end = cursor + len;
 
-    size_t channel_len = strlen(channel);
-    task_arg->_channel_name = malloc(channel_len + 1);
-    if (!task_arg->_channel_name)
+    size_t n = 0;
+    while (cursor < end)
     {
-        free(task_arg);
-        return -1;
+
+        if (n == max || _message_header_read(&cursor, end, out_headers + n))
+        {
+            return 1;
+        }
+
+        n++;
+    }
+
+    *out_n = n;
+
+    return 0;
+}
+
+static void
+_message_free_wrapper(void* data)
+{
+
+    if (!data)
+    {
+        return;
+    }
+
+    message_free((struct message_t*) data);
+}
+
+struct _expiry_sweep_t
+{
+    uint64_t _now_ms;
+    uint64_t _next_expiry_ms;
+};
+
+static int
+_message_expired(void* data, void* context)
+{
+
+    struct message_t* msg = (struct message_t*) data;
+    struct _expiry_sweep_t* sweep = (struct _expiry_sweep_t*) context;
+
+    uint64_t expires_at_ms = msg->_payload->_expires_at_ms;
+    if (!expires_at_ms)
+    {
+        return 0;
+    }
+
+    if (expires_at_ms <= sweep->_now_ms)
+    {
+        return 1;
+    }
+
+    if (!sweep->_next_expiry_ms || expires_at_ms < sweep->_next_expiry_ms)
+    {
+        sweep->_next_expiry_ms = expires_at_ms;
+    }
+
+    return 0;
+}
+
+static void
+_subscriber_proxy_count(struct subscriber_proxy_t* self, enum _stat_t stat,
+                        uint64_t n)
+{
+
+    _channel_count(self->_channel, stat, n);
+    _broker_count(self->_broker, stat, n);
+}
+
+// @note the expired messages are dropped for the subscriber and accounted to
+// the channel; the overflows are also accounted to the subscriber.
+static void
+_subscriber_proxy_count_expired(struct subscriber_proxy_t* self, size_t n)
+{
+
+    atomic_fetch_add(&self->_channel->_n_expired, n);
+    _subscriber_proxy_count(self, _STAT_DROPPED, n);
+}
+
+static void
+_subscriber_proxy_count_overflow(struct subscriber_proxy_t* self, size_t n)
+{
+
+    atomic_fetch_add(&self->_n_dropped, n);
+    _subscriber_proxy_count(self, _STAT_DROPPED, n);
+}
+
+static void
+_subscriber_proxy_count_delivered(struct subscriber_proxy_t* self,
+                                  struct message_t** msgs, size_t n)
+{
+
+    uint64_t n_bytes = 0;
+
+    size_t i = 0;
+    while (i < n)
+    {
+        n_bytes += msgs[i]->_payload->_content_len;
+        i++;
+    }
+
+    atomic_fetch_add_explicit(&self->_n_delivered, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&self->_bytes_out, n_bytes, memory_order_relaxed);
+    _subscriber_proxy_count(self, _STAT_DELIVERED, n);
+    _subscriber_proxy_count(self, _STAT_BYTES_OUT, n_bytes);
+
+    if (!n || !self->_broker->_latency_tracing)
+    {
+        return;
+    }
+
+    struct _latency_slot_t* latency = _channel_get_latency(self->_channel);
+    if (!latency)
+    {
+        return;
+    }
+
+    uint64_t now_ns = _monotonic_ns();
+
+    i = 0;
+    while (i < n)
+    {
+
+        uint64_t published_at_ns = msgs[i]->_payload->_published_at_ns;
+        latency_histogram_record(
+            latency->_stages[MESSAGE_LATENCY_DEQUEUE],
+            now_ns > published_at_ns ? now_ns - published_at_ns : 0);
+
+        i++;
+    }
+}
+
+// @note expiry timer callback, runs under the broker timer wheel lock: drops
+// the expired messages of the inbox and re-arms the timer for the earliest
+// deadline left.
+static uint64_t
+_subscriber_proxy_expire(void* arg, uint64_t now_ms)
+{
+
+    struct subscriber_proxy_t* self = (struct subscriber_proxy_t*) arg;
+
+    struct _expiry_sweep_t sweep = {._now_ms = now_ms, ._next_expiry_ms = 0};
+
+    size_t n_expired = 0;
+    generic_queue_syn_remove_if(self->_inbox, _message_expired, &sweep,
+                                &n_expired);
+    if (n_expired)
+    {
+        _subscriber_proxy_count_expired(self, n_expired);
+    }
+
+    return sweep._next_expiry_ms;
+}
+
+static int
+_subscriber_proxy_new(uint64_t id, const struct subscription_options_t* options,
+                      struct message_broker_t* broker,
+                      struct channel_t* channel,
+                      struct subscriber_proxy_t** out_self)
+{
+
+    if (!out_self)
+    {
+        return 1;
     }
-    memcpy(task_arg->_channel_name, channel, channel_len + 1);
 
-    size_t content_len = strlen(content);
-    task_arg->_content = malloc(content_len + 1);
-    if (!task_arg->_content)
+    struct subscriber_proxy_t* self = malloc(sizeof(struct subscriber_proxy_t));
+    if (!self)
     {
-        free(task_arg->_channel_name);
-        free(task_arg);
         return -1;
     }
-    memcpy(task_arg->_content, content, content_len + 1);
 
-    task_arg->_channels = self->_channels;
-    task_arg->_channels_mutex = &self->_channels_mutex;
+    self->_id = id;
+    self->_active = 1;
+    self->_capacity = options ? options->_capacity : 0;
+    self->_overflow_policy =
+        options ? options->_overflow_policy : SUBSCRIPTION_OVERFLOW_DROP_OLDEST;
+    self->_block_timeout_ms = options ? options->_block_timeout_ms : 0;
+    atomic_init(&self->_n_dropped, 0);
+    self->_broker = broker;
+    self->_channel = channel;
+    self->_cursor = NULL;
+    self->_name = NULL;
+    self->_ack_window = options ? options->_ack_window : 0;
+    self->_ack_timeout_ms = options && options->_ack_timeout_ms
+                                ? options->_ack_timeout_ms
+                                : _ACK_DEFAULT_TIMEOUT_MS;
+    self->_in_flight = NULL;
+    self->_in_flight_head = 0;
+    atomic_init(&self->_n_in_flight, 0);
+    atomic_init(&self->_n_acks, 0);
+    atomic_init(&self->_n_redelivered, 0);
+    atomic_init(&self->_event_fd, -1);
+    atomic_init(&self->_fd_armed, 0);
+    self->_slot = 0;
+    self->_detached = 0;
+    atomic_init(&self->_n_refs, 1);
+    self->_group = NULL;
+    self->_partitions = options ? options->_partitions : 0;
+    atomic_init(&self->_n_delivered, 0);
+    atomic_init(&self->_bytes_out, 0);
+
+    if (options && options->_name)
+    {
 
-    int exit_code =
-        thread_pool_submit(self->_publisher_pool, _publisher_task, task_arg);
+        self->_name = strdup(options->_name);
+        if (!self->_name)
+        {
+            free(self);
+            return -1;
+        }
+    }
+
+    if (self->_ack_window)
+    {
+
+        self->_in_flight =
+            malloc(sizeof(struct _in_flight_t) * self->_ack_window);
+        if (!self->_in_flight)
+        {
+            free(self->_name);
+            free(self);
+            return -1;
+        }
+    }
+
+    int exit_code = pthread_mutex_init(&self->_in_flight_mutex, NULL);
     if (exit_code)
     {
-        _publisher_task_arg_free(task_arg);
+        free(self->_in_flight);
+        free(self->_name);
+        free(self);
+        return exit_code;
+    }
+
+    exit_code = timer_wheel_timer_new(_subscriber_proxy_expire, self,
+                                      &self->_expiry_timer);
+    if (exit_code)
+    {
+        pthread_mutex_destroy(&self->_in_flight_mutex);
+        free(self->_in_flight);
+        free(self->_name);
+        free(self);
+        return exit_code;
+    }
+
+    exit_code = generic_queue_syn_new(&self->_inbox);
+    if (exit_code)
+    {
+        timer_wheel_timer_free(self->_expiry_timer);
+        pthread_mutex_destroy(&self->_in_flight_mutex);
+        free(self->_in_flight);
+        free(self->_name);
+        free(self);
+        return exit_code;
+    }
+
+    generic_queue_syn_set_free_function(self->_inbox, _message_free_wrapper);
+    generic_queue_syn_set_capacity(self->_inbox, self->_capacity);
+
+    exit_code = pthread_mutex_init(&self->_inbox_mutex, NULL);
+    if (exit_code)
+    {
+
+        generic_queue_syn_free(self->_inbox);
+        timer_wheel_timer_free(self->_expiry_timer);
+        pthread_mutex_destroy(&self->_in_flight_mutex);
+        free(self->_in_flight);
+        free(self->_name);
+        free(self);
+
+        return exit_code;
+    }
+
+    exit_code = pthread_cond_init(&self->_inbox_cond, NULL);
+    if (exit_code)
+    {
+
+        pthread_mutex_destroy(&self->_inbox_mutex);
+        generic_queue_syn_free(self->_inbox);
+        timer_wheel_timer_free(self->_expiry_timer);
+        pthread_mutex_destroy(&self->_in_flight_mutex);
+        free(self->_in_flight);
+        free(self->_name);
+        free(self);
+
         return exit_code;
     }
 
+    *out_self = self;
+
     return 0;
 }
 
-// @todo refactor this function to avoid _channels_mutex
-int
-message_broker_subscribe(struct message_broker_t* self, const char* channel,
-                         struct subscription_t** out_subscription)
+static void
+_subscriber_proxy_signal(struct subscriber_proxy_t* self, int broadcast)
 {
 
-    if (!self)
+    pthread_mutex_lock(&self->_inbox_mutex);
+    if (broadcast)
+    {
+        pthread_cond_broadcast(&self->_inbox_cond);
+    }
+    else
+    {
+        pthread_cond_signal(&self->_inbox_cond);
+    }
+    pthread_mutex_unlock(&self->_inbox_mutex);
+
+    // log receivers wait on the channel, see _subscriber_proxy_wait_log
+    if (broadcast && self->_cursor)
+    {
+
+        pthread_mutex_lock(&self->_channel->_log_mutex);
+        pthread_cond_broadcast(&self->_channel->_log_cond);
+        pthread_mutex_unlock(&self->_channel->_log_mutex);
+    }
+}
+
+// @note makes the eventfd readable, if any, unless it already is or the ack
+// window is full (the ack freeing room notifies then).
+static void
+_subscriber_proxy_notify_fd(struct subscriber_proxy_t* self)
+{
+
+    int event_fd = atomic_load(&self->_event_fd);
+    if (event_fd < 0)
+    {
+        return;
+    }
+
+    if (self->_ack_window
+        && atomic_load(&self->_n_in_flight) == self->_ack_window)
+    {
+        return;
+    }
+
+    if (!atomic_exchange(&self->_fd_armed, 1))
+    {
+        eventfd_write(event_fd, 1);
+    }
+}
+
+static void
+_subscriber_proxy_free(struct subscriber_proxy_t* self)
+{
+
+    if (!self)
+    {
+        return;
+    }
+
+    self->_active = 0;
+
+    _subscriber_proxy_signal(self, 1);
+
+    if (self->_cursor)
+    {
+        generic_log_cursor_free(self->_cursor);
+    }
+
+    // once cancelled the expiry callback cannot be running on this inbox
+    timer_wheel_cancel(self->_broker->_expiry_wheel, self->_expiry_timer);
+    timer_wheel_timer_free(self->_expiry_timer);
+
+    generic_queue_syn_free(self->_inbox);
+    pthread_mutex_destroy(&self->_inbox_mutex);
+    pthread_cond_destroy(&self->_inbox_cond);
+
+    size_t n_in_flight = atomic_load(&self->_n_in_flight);
+    size_t i = 0;
+    while (i < n_in_flight)
+    {
+
+        size_t index = (self->_in_flight_head + i) % self->_ack_window;
+        _message_payload_release(self->_in_flight[index]._payload);
+        i++;
+    }
+
+    pthread_mutex_destroy(&self->_in_flight_mutex);
+    free(self->_in_flight);
+    free(self->_name);
+
+    int event_fd = atomic_load(&self->_event_fd);
+    if (event_fd >= 0)
+    {
+        close(event_fd);
+        atomic_fetch_sub(&self->_channel->_n_event_fds, 1);
+    }
+
+    free(self);
+}
+
+static void
+_subscriber_proxy_release(struct subscriber_proxy_t* self)
+{
+
+    if (atomic_fetch_sub(&self->_n_refs, 1) == 1)
+    {
+        _subscriber_proxy_free(self);
+    }
+}
+
+// @note releases what a proxy detached by subscription_unsubscribe holds
+// (inbox, in-flight messages and log cursor) while it waits in the snapshot
+// for the next compaction, which then only frees the shell. A fan-out that
+// still had the proxy in hand may enqueue after the drain,
+// _subscriber_proxy_free releases that.
+static void
+_subscriber_proxy_drain(struct subscriber_proxy_t* self)
+{
+
+    pthread_mutex_lock(&self->_in_flight_mutex);
+
+    size_t n_in_flight = atomic_load(&self->_n_in_flight);
+    size_t i = 0;
+    while (i < n_in_flight)
+    {
+
+        size_t index = (self->_in_flight_head + i) % self->_ack_window;
+        _message_payload_release(self->_in_flight[index]._payload);
+        i++;
+    }
+    atomic_store(&self->_n_in_flight, 0);
+
+    pthread_mutex_lock(&self->_inbox_mutex);
+    if (self->_cursor)
+    {
+        generic_log_cursor_free(self->_cursor);
+        self->_cursor = NULL;
+    }
+    pthread_mutex_unlock(&self->_inbox_mutex);
+
+    pthread_mutex_unlock(&self->_in_flight_mutex);
+
+    generic_queue_syn_clear(self->_inbox);
+}
+
+static void
+_deadline_after_ms(size_t timeout_ms, struct timespec* out_deadline)
+{
+
+    clock_gettime(CLOCK_REALTIME, out_deadline);
+    out_deadline->tv_sec += (time_t) (timeout_ms / 1000);
+    out_deadline->tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+    if (out_deadline->tv_nsec >= 1000000000L)
+    {
+        out_deadline->tv_sec++;
+        out_deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// @note applies the overflow policy of the proxy; messages that are not
+// enqueued (msgs[*out_n_enqueued..n)) stay owned by the caller and, unless an
+// error is returned, have been accounted as dropped. Without may_wait, a BLOCK
+// policy inbox found full returns EAGAIN, the rest is not dropped.
+static int
+_subscriber_proxy_enqueue_bounded(struct subscriber_proxy_t* self,
+                                  struct message_t** msgs, size_t n,
+                                  int may_wait, size_t* out_n_enqueued)
+{
+
+    int exit_code = 0;
+    size_t n_enqueued = 0;
+
+    switch (self->_capacity ? self->_overflow_policy
+                            : SUBSCRIPTION_OVERFLOW_DROP_NEWEST)
+    {
+
+        case SUBSCRIPTION_OVERFLOW_DROP_OLDEST:
+            while (n_enqueued < n)
+            {
+
+                struct message_t* evicted = NULL;
+                exit_code = generic_queue_syn_enqueue_or_evict(
+                    self->_inbox, msgs[n_enqueued], (void**) &evicted);
+                if (exit_code)
+                {
+                    break;
+                }
+
+                if (evicted)
+                {
+                    message_free(evicted);
+                    _subscriber_proxy_count_overflow(self, 1);
+                }
+
+                n_enqueued++;
+            }
+            break;
+
+        case SUBSCRIPTION_OVERFLOW_BLOCK:
+        {
+
+            struct timespec deadline;
+            _deadline_after_ms(self->_block_timeout_ms, &deadline);
+
+            while (n_enqueued < n && self->_active)
+            {
+
+                exit_code =
+                    generic_queue_syn_enqueue(self->_inbox, msgs[n_enqueued]);
+                if (exit_code == 1 && !may_wait)
+                {
+
+                    exit_code = EAGAIN;
+                    break;
+                }
+
+                if (exit_code == 1)
+                {
+
+                    // wake the receiver before waiting for it to make room
+                    _subscriber_proxy_signal(self, 0);
+                    exit_code = generic_queue_syn_enqueue_timed(
+                        self->_inbox, msgs[n_enqueued], &deadline);
+                }
+
+                if (exit_code)
+                {
+                    break;
+                }
+
+                n_enqueued++;
+            }
+            break;
+        }
+
+        case SUBSCRIPTION_OVERFLOW_DISCONNECT:
+            exit_code = generic_queue_syn_enqueue_batch(
+                self->_inbox, (void**) msgs, n, &n_enqueued);
+            if (exit_code == 1)
+            {
+                self->_active = 0;
+                _subscriber_proxy_signal(self, 1);
+            }
+            break;
+
+        case SUBSCRIPTION_OVERFLOW_DROP_NEWEST:
+        default:
+            exit_code = generic_queue_syn_enqueue_batch(
+                self->_inbox, (void**) msgs, n, &n_enqueued);
+            break;
+    }
+
+    *out_n_enqueued = n_enqueued;
+
+    // a full inbox is handled by the policy, it is not an error
+    if (exit_code == 1 || (exit_code == 0 && n_enqueued < n))
+    {
+
+        _subscriber_proxy_count_overflow(self, n - n_enqueued);
+        exit_code = 0;
+    }
+
+    return exit_code;
+}
+
+static void
+_broker_expiry_arm(struct message_broker_t* broker,
+                   struct timer_wheel_timer_t* timer, uint64_t expires_at_ms)
+{
+
+    timer_wheel_arm(broker->_expiry_wheel, timer, expires_at_ms);
+
+    if (atomic_load(&broker->_expiry_idle))
+    {
+
+        pthread_mutex_lock(&broker->_expiry_mutex);
+        pthread_cond_signal(&broker->_expiry_cond);
+        pthread_mutex_unlock(&broker->_expiry_mutex);
+    }
+}
+
+static void
+_subscriber_proxy_arm_expiry(struct subscriber_proxy_t* self,
+                             struct _message_payload_t** payloads, size_t n)
+{
+
+    uint64_t earliest_ms = 0;
+
+    size_t i = 0;
+    while (i < n)
+    {
+
+        uint64_t expires_at_ms = payloads[i]->_expires_at_ms;
+        if (expires_at_ms && (!earliest_ms || expires_at_ms < earliest_ms))
+        {
+            earliest_ms = expires_at_ms;
+        }
+
+        i++;
+    }
+
+    if (earliest_ms)
+    {
+        _broker_expiry_arm(self->_broker, self->_expiry_timer, earliest_ms);
+    }
+}
+
+#define _ENQUEUE_BATCH_STACK_SIZE 16
+#define _FAN_OUT_STACK_BLOCKED 4
+
+// @note payloads[0..n) that _proxy could not take without waiting for room.
+struct _blocked_enqueue_t
+{
+    struct subscriber_proxy_t* _proxy;
+    struct _message_payload_t** _payloads;
+    size_t _n;
+};
+
+// @note a fan-out runs inside a read section of the channel, which
+// _channel_synchronize waits for: a full BLOCK policy inbox is not waited on
+// there. Its enqueue is deferred, the proxy pinned, and made by
+// _fan_out_finish once the read section is left; the later enqueues of the
+// fan-out to that proxy follow it, in order.
+struct _fan_out_t
+{
+    struct _blocked_enqueue_t _stack_blocked[_FAN_OUT_STACK_BLOCKED];
+    struct _blocked_enqueue_t* _blocked;
+    size_t _n_blocked;
+    size_t _capacity;
+};
+
+static void
+_fan_out_init(struct _fan_out_t* self)
+{
+
+    self->_blocked = self->_stack_blocked;
+    self->_n_blocked = 0;
+    self->_capacity = _FAN_OUT_STACK_BLOCKED;
+}
+
+static int
+_fan_out_is_blocked(struct _fan_out_t* self, struct subscriber_proxy_t* proxy)
+{
+
+    size_t i = 0;
+    while (i < self->_n_blocked)
+    {
+
+        if (self->_blocked[i]._proxy == proxy)
+        {
+            return 1;
+        }
+
+        i++;
+    }
+
+    return 0;
+}
+
+// Returns -1 when there is no room left to defer the enqueue.
+static int
+_fan_out_defer(struct _fan_out_t* self, struct subscriber_proxy_t* proxy,
+               struct _message_payload_t** payloads, size_t n)
+{
+
+    if (self->_n_blocked == self->_capacity)
+    {
+
+        size_t capacity = 2 * self->_capacity;
+        struct _blocked_enqueue_t* blocked =
+            malloc(capacity * sizeof(struct _blocked_enqueue_t));
+        if (!blocked)
+        {
+            return -1;
+        }
+
+        memcpy(blocked, self->_blocked,
+               self->_n_blocked * sizeof(struct _blocked_enqueue_t));
+        if (self->_blocked != self->_stack_blocked)
+        {
+            free(self->_blocked);
+        }
+
+        self->_blocked = blocked;
+        self->_capacity = capacity;
+    }
+
+    atomic_fetch_add(&proxy->_n_refs, 1);
+    self->_blocked[self->_n_blocked++] = (struct _blocked_enqueue_t){
+        ._proxy = proxy, ._payloads = payloads, ._n = n};
+
+    return 0;
+}
+
+// @note the whole batch is appended under a single acquisition of the inbox
+// lock and the waiting receiver is signaled once. fan_out is the fan-out the
+// batch is part of, NULL once out of its read section: see _fan_out_t.
+static int
+_subscriber_proxy_enqueue_batch(struct subscriber_proxy_t* self,
+                                struct _message_payload_t** payloads, size_t n,
+                                struct _fan_out_t* fan_out)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!payloads)
+    {
+        return 1;
+    }
+
+    if (!self->_active)
+    {
+        return 1;
+    }
+
+    if (fan_out && fan_out->_n_blocked && _fan_out_is_blocked(fan_out, self)
+        && !_fan_out_defer(fan_out, self, payloads, n))
+    {
+        return 0;
+    }
+
+    struct message_t* stack_msgs[_ENQUEUE_BATCH_STACK_SIZE];
+    struct message_t** msgs = stack_msgs;
+    if (n > _ENQUEUE_BATCH_STACK_SIZE)
+    {
+
+        msgs = malloc(sizeof(struct message_t*) * n);
+        if (!msgs)
+        {
+            return -1;
+        }
+    }
+
+    int exit_code = 0;
+    size_t n_msgs = 0;
+    while (n_msgs < n)
+    {
+
+        exit_code = _message_new(payloads[n_msgs], &msgs[n_msgs]);
+        if (exit_code)
+        {
+            break;
+        }
+
+        n_msgs++;
+    }
+
+    size_t n_enqueued = 0;
+    if (n_msgs)
+    {
+
+        int enqueue_exit_code = _subscriber_proxy_enqueue_bounded(
+            self, msgs, n_msgs, !fan_out, &n_enqueued);
+
+        // the messages left are made again by the deferred enqueue; with no
+        // room to defer it, it is waited for in the read section
+        if (enqueue_exit_code == EAGAIN)
+        {
+
+            enqueue_exit_code = _fan_out_defer(
+                fan_out, self, payloads + n_enqueued, n_msgs - n_enqueued);
+            if (enqueue_exit_code)
+            {
+
+                size_t n_waited = 0;
+                enqueue_exit_code = _subscriber_proxy_enqueue_bounded(
+                    self, msgs + n_enqueued, n_msgs - n_enqueued, 1,
+                    &n_waited);
+                n_enqueued += n_waited;
+            }
+        }
+
+        if (enqueue_exit_code)
+        {
+            exit_code = enqueue_exit_code;
+        }
+    }
+
+    size_t i = n_enqueued;
+    while (i < n_msgs)
+    {
+        message_free(msgs[i]);
+        i++;
+    }
+
+    if (msgs != stack_msgs)
+    {
+        free(msgs);
+    }
+
+    if (n_enqueued)
+    {
+
+        _subscriber_proxy_count(self, _STAT_FANNED_OUT, n_enqueued);
+        _subscriber_proxy_signal(self, 0);
+        _subscriber_proxy_notify_fd(self);
+        _subscriber_proxy_arm_expiry(self, payloads, n);
+    }
+
+    return exit_code;
+}
+
+// @note out of the read section: waits for room in the inboxes of the
+// deferred enqueues, in the order they were deferred, and releases their
+// proxies.
+static void
+_fan_out_finish(struct _fan_out_t* self)
+{
+
+    size_t i = 0;
+    while (i < self->_n_blocked)
+    {
+
+        struct _blocked_enqueue_t* blocked = &self->_blocked[i];
+        _subscriber_proxy_enqueue_batch(blocked->_proxy, blocked->_payloads,
+                                        blocked->_n, NULL);
+        _subscriber_proxy_release(blocked->_proxy);
+
+        i++;
+    }
+
+    if (self->_blocked != self->_stack_blocked)
+    {
+        free(self->_blocked);
+    }
+}
+
+// @note n_stat_slots is the number of stats slots of the broker, see
+// _stat_slot.
+static int
+_channel_new(const char* name, size_t n_stat_slots,
+             struct channel_t** out_self)
+{
+
+    if (!name)
+    {
+        return 1;
+    }
+
+    if (!out_self)
+    {
+        return 1;
+    }
+
+    struct channel_t* self = malloc(sizeof(struct channel_t));
+    if (!self)
+    {
+        return -1;
+    }
+
+    size_t name_len = strlen(name);
+    self->_channel_name = malloc(name_len + 1);
+    if (!self->_channel_name)
+    {
+        free(self);
+        return -1;
+    }
+    memcpy(self->_channel_name, name, name_len + 1);
+
+    self->_n_stat_slots = n_stat_slots;
+    self->_stats = _stat_slots_new(n_stat_slots);
+    if (!self->_stats)
+    {
+        free(self->_channel_name);
+        free(self);
+        return -1;
+    }
+
+    int exit_code = pthread_mutex_init(&self->_mutex, NULL);
+    if (exit_code)
+    {
+
+        free(self->_stats);
+        free(self->_channel_name);
+        free(self);
+
+        return exit_code;
+    }
+
+    exit_code = pthread_mutex_init(&self->_log_mutex, NULL);
+    if (exit_code)
+    {
+
+        pthread_mutex_destroy(&self->_mutex);
+        free(self->_stats);
+        free(self->_channel_name);
+        free(self);
+
+        return exit_code;
+    }
+
+    exit_code = pthread_cond_init(&self->_log_cond, NULL);
+    if (exit_code)
+    {
+
+        pthread_mutex_destroy(&self->_log_mutex);
+        pthread_mutex_destroy(&self->_mutex);
+        free(self->_stats);
+        free(self->_channel_name);
+        free(self);
+
+        return exit_code;
+    }
+
+    atomic_init(&self->_subscribers._snapshot, NULL);
+    self->_subscribers._n_detached = 0;
+    atomic_init(&self->_groups, NULL);
+    atomic_init(&self->_n_readers[0], 0);
+    atomic_init(&self->_n_readers[1], 0);
+    atomic_init(&self->_reader_epoch, 0);
+    self->_single_writer = 0;
+    atomic_init(&self->_n_subscribers, 0);
+    atomic_init(&self->_n_pending_tasks, 0);
+    atomic_init(&self->_default_ttl_ms, 0);
+    atomic_init(&self->_n_expired, 0);
+    self->_log = NULL;
+    atomic_init(&self->_n_log_waiters, 0);
+    atomic_init(&self->_n_event_fds, 0);
+    self->_in_trie = 0;
+    atomic_init(&self->_n_partitions, 0);
+    atomic_init(&self->_next_partition, 0);
+    atomic_init(&self->_next_sequence, 0);
+    self->_partition_sequences = NULL;
+    atomic_init(&self->_n_refs, 0);
+    atomic_init(&self->_last_used_ms, _monotonic_ms());
+    atomic_init(&self->_declared, 0);
+    self->_wal = NULL;
+    atomic_init(&self->_wal_error, 0);
+    self->_parked_cursors = NULL;
+    atomic_init(&self->_latency, NULL);
+
+    *out_self = self;
+
+    return 0;
+}
+
+// Frees the proxies of the set along with its snapshot.
+static void
+_subscriber_set_clear(struct _subscriber_set_t* self)
+{
+
+    struct _subscriber_snapshot_t* snapshot = atomic_load(&self->_snapshot);
+    if (!snapshot)
+    {
+        return;
+    }
+
+    size_t n = atomic_load(&snapshot->_n);
+    size_t i = 0;
+    while (i < n)
+    {
+        _subscriber_proxy_release(snapshot->_proxies[i]);
+        i++;
+    }
+
+    free(snapshot);
+    atomic_store(&self->_snapshot, NULL);
+    self->_n_detached = 0;
+}
+
+static int
+_consumer_group_new(const char* name, struct _consumer_group_t** out_self)
+{
+
+    struct _consumer_group_t* self = malloc(sizeof(struct _consumer_group_t));
+    if (!self)
+    {
+        return -1;
+    }
+
+    self->_name = strdup(name);
+    if (!self->_name)
+    {
+        free(self);
+        return -1;
+    }
+
+    atomic_init(&self->_members._snapshot, NULL);
+    self->_members._n_detached = 0;
+    self->_n_members = 0;
+    atomic_init(&self->_next, 0);
+
+    *out_self = self;
+
+    return 0;
+}
+
+static void
+_consumer_group_free(struct _consumer_group_t* self)
+{
+
+    if (!self)
+    {
+        return;
+    }
+
+    _subscriber_set_clear(&self->_members);
+    free(self->_name);
+    free(self);
+}
+
+static void
+_channel_free(struct channel_t* self)
+{
+
+    if (!self)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    // commits what is pending, offsets included
+    if (self->_wal)
+    {
+        wal_close(self->_wal);
+    }
+
+    // the proxies hold cursors on the log, they go first
+    _subscriber_set_clear(&self->_subscribers);
+
+    struct _group_snapshot_t* groups = atomic_load(&self->_groups);
+    if (groups)
+    {
+
+        size_t i = 0;
+        while (i < groups->_n)
+        {
+            _consumer_group_free(groups->_groups[i]);
+            i++;
+        }
+
+        free(groups);
+    }
+    if (self->_parked_cursors)
+    {
+        generic_linked_list_free(self->_parked_cursors);
+    }
+    if (self->_log)
+    {
+        generic_log_free(self->_log);
+    }
+    free(self->_partition_sequences);
+    free(self->_stats);
+    _channel_latency_free(atomic_load(&self->_latency));
+    free(self->_channel_name);
+
+    pthread_mutex_unlock(&self->_mutex);
+    pthread_mutex_destroy(&self->_mutex);
+    pthread_cond_destroy(&self->_log_cond);
+    pthread_mutex_destroy(&self->_log_mutex);
+
+    free(self);
+}
+
+static void
+_channel_free_wrapper(void* data)
+{
+
+    if (!data)
+    {
+        return;
+    }
+
+    _channel_free((struct channel_t*) data);
+}
+
+static int
+_channel_copy(void* src, void** dst)
+{
+
+    if (!src)
+    {
+        return 1;
+    }
+
+    if (!dst)
+    {
+        return 1;
+    }
+
+    *dst = src;
+
+    return 0;
+}
+
+static size_t
+_string_hash(void* key)
+{
+
+    size_t hash = 5381;
+    unsigned char* p = (unsigned char*) key;
+    while (*p)
+    {
+        hash = ((hash << 5) + hash) + *p++;
+    }
+
+    return hash;
+}
+
+static size_t
+_bytes_hash(const void* data, size_t len)
+{
+
+    size_t hash = 5381;
+    const unsigned char* p = (const unsigned char*) data;
+    size_t i = 0;
+    while (i < len)
+    {
+        hash = ((hash << 5) + hash) + p[i++];
+    }
+
+    return hash;
+}
+
+static void
+_string_free(void* data)
+{
+    free(data);
+}
+
+static int
+_string_copy(void* src, void** dst)
+{
+
+    if (!src)
+    {
+        return 1;
+    }
+
+    if (!dst)
+    {
+        return 1;
+    }
+
+    size_t len = strlen((char*) src);
+    char* copy = malloc(len + 1);
+    if (!copy)
+    {
+        return -1;
+    }
+
+    memcpy(copy, src, len + 1);
+    *dst = copy;
+
+    return 0;
+}
+
+static int
+_string_compare(void* a, void* b)
+{
+    return strcmp((char*) a, (char*) b);
+}
+
+static int
+_channel_create(void* key, void* context, void** out_value)
+{
+
+    struct message_broker_t* broker = (struct message_broker_t*) context;
+
+    struct channel_t* channel = NULL;
+    int exit_code =
+        _channel_new((const char*) key, broker->_n_stat_slots, &channel);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    channel->_single_writer = broker->_n_shards > 0;
+    *out_value = channel;
+
+    return 0;
+}
+
+static void
+_channel_ref(void* value, void* context)
+{
+
+    (void) context;
+
+    atomic_fetch_add(&((struct channel_t*) value)->_n_refs, 1);
+}
+
+// @note channels are created on first use under the lock of their hash table
+// bucket only, publishes and subscriptions on unrelated channels never contend.
+// The reference is taken under that lock, release it with _channel_release.
+static int
+_channel_acquire(struct message_broker_t* broker, const char* name,
+                 struct channel_t** out_channel)
+{
+    return generic_hash_table_compute_if_absent_apply(
+        broker->_channels, (void*) name, _channel_create, _channel_ref, broker,
+        (void**) out_channel);
+}
+
+static void
+_channel_release(struct message_broker_t* broker, struct channel_t* channel)
+{
+
+    if (broker->_channel_idle_ms)
+    {
+        atomic_store(&channel->_last_used_ms, _monotonic_ms());
+    }
+
+    atomic_fetch_sub(&channel->_n_refs, 1);
+}
+
+static int
+_channel_is_reclaimable(void* key, void* value, void* context)
+{
+
+    (void) key;
+    struct channel_t* channel = (struct channel_t*) value;
+    struct message_broker_t* broker = (struct message_broker_t*) context;
+
+    if (atomic_load(&channel->_n_refs) || atomic_load(&channel->_declared)
+        || atomic_load(&channel->_n_subscribers))
+    {
+        return 0;
+    }
+
+    uint64_t last_used_ms = atomic_load(&channel->_last_used_ms);
+
+    return _monotonic_ms() - last_used_ms >= broker->_channel_idle_ms;
+}
+
+static void
+_broker_reclaim_channels(struct message_broker_t* self)
+{
+
+    size_t n_deleted = 0;
+    generic_hash_table_delete_if(self->_channels, _channel_is_reclaimable, self,
+                                 &n_deleted);
+
+    if (n_deleted)
+    {
+        atomic_fetch_add(&self->_n_reclaimed, n_deleted);
+    }
+}
+
+static int
+_pattern_channel_create(void* key, void* context, void** out_value)
+{
+
+    struct message_broker_t* broker = (struct message_broker_t*) context;
+
+    return _channel_new((const char*) key, broker->_n_stat_slots,
+                        (struct channel_t**) out_value);
+}
+
+// @note keeps the pattern channel in the trie while it has subscribers; called
+// after every attach and detach, outside of the channel lock which publishers
+// take under the patterns lock.
+static void
+_broker_sync_pattern(struct message_broker_t* broker, struct channel_t* channel)
+{
+
+    pthread_rwlock_wrlock(&broker->_patterns_lock);
+
+    int has_subscribers = atomic_load(&channel->_n_subscribers) > 0;
+    if (has_subscribers && !channel->_in_trie)
+    {
+
+        if (!topic_trie_insert(broker->_patterns, channel->_channel_name,
+                               channel))
+        {
+            channel->_in_trie = 1;
+        }
+    }
+    else if (!has_subscribers && channel->_in_trie)
+    {
+
+        topic_trie_remove(broker->_patterns, channel->_channel_name, channel);
+        channel->_in_trie = 0;
+    }
+
+    size_t n_patterns = 0;
+    topic_trie_get_size(broker->_patterns, &n_patterns);
+    atomic_store(&broker->_n_patterns, n_patterns);
+
+    pthread_rwlock_unlock(&broker->_patterns_lock);
+}
+
+// Reserves n consecutive broker-wide message ids and returns the first one, 0
+// when the broker does not hand them out.
+static uint64_t
+_broker_take_message_ids(struct message_broker_t* self, size_t n)
+{
+
+    if (!self->_global_message_ids)
+    {
+        return 0;
+    }
+
+    return atomic_fetch_add(&self->_next_message_id, n);
+}
+
+static struct thread_pool_t*
+_broker_executor(struct message_broker_t* self, const char* channel_name)
+{
+
+    if (!self->_n_shards)
+    {
+        return self->_publisher_pool;
+    }
+
+    return self->_shards[_string_hash((void*) channel_name) % self->_n_shards];
+}
+
+// @note in sharded mode the publishes of partition p run on the shard after
+// the one owning the channel by p: the partitions of a hot channel are fanned
+// out in parallel, each by a single shard so that its sequence follows the
+// delivery order. The partition is therefore resolved at publish time, from
+// the key or round-robin, rather than by the fan-out.
+static void
+_broker_route_partition(struct message_broker_t* self,
+                        struct channel_t* channel,
+                        struct _message_payload_t* payload)
+{
+
+    size_t n_partitions = atomic_load(&channel->_n_partitions);
+    if (!self->_n_shards || !n_partitions)
+    {
+        return;
+    }
+
+    payload->_partition =
+        (payload->_keyed ? payload->_key_hash
+                         : atomic_fetch_add(&channel->_next_partition, 1))
+        % n_partitions;
+    payload->_routed = 1;
+}
+
+// The shard of the channel of payload moved by its partition (0 until routed).
+static size_t
+_broker_payload_shard(struct message_broker_t* self,
+                      const struct _message_payload_t* payload)
+{
+
+    size_t shard =
+        _string_hash((void*) payload->_channel_name) + payload->_partition;
+
+    return shard % self->_n_shards;
+}
+
+// The executor of _broker_payload_shard, the publisher pool in shared mode.
+static struct thread_pool_t*
+_broker_payload_executor(struct message_broker_t* self,
+                         const struct _message_payload_t* payload)
+{
+
+    if (!self->_n_shards)
+    {
+        return self->_publisher_pool;
+    }
+
+    return self->_shards[_broker_payload_shard(self, payload)];
+}
+
+struct _partition_route_t
+{
+    struct message_broker_t* _broker;
+    struct _message_payload_t* _payload;
+};
+
+static void
+_channel_route_payload(void* value, void* context)
+{
+
+    struct _partition_route_t* route = (struct _partition_route_t*) context;
+
+    _broker_route_partition(route->_broker, (struct channel_t*) value,
+                            route->_payload);
+}
+
+// @note the log takes a reference on every payload, released with the segment
+// that holds it once every cursor read past it.
+static int
+_channel_wal_append(struct channel_t* self, struct _message_payload_t* payload,
+                    uint64_t now_ms, uint64_t now_realtime_ms)
+{
+
+    struct _durable_record_header_t header = {
+        ._id = payload->_id,
+        ._expires_at_realtime_ms = 0,
+        ._headers_len = payload->_headers_len};
+    if (payload->_expires_at_ms)
+    {
+
+        header._expires_at_realtime_ms =
+            payload->_expires_at_ms > now_ms
+                ? now_realtime_ms + (payload->_expires_at_ms - now_ms)
+                : now_realtime_ms;
+    }
+
+    struct iovec parts[3] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = payload->_headers, .iov_len = payload->_headers_len},
+        {.iov_base = payload->_content, .iov_len = payload->_content_len}};
+
+    return wal_append(self->_wal, parts, 3, NULL);
+}
+
+// @note only the first error is kept and logged: once a commit failed every
+// later append fails with the same error, see wal_append.
+static void
+_channel_set_wal_error(struct channel_t* self, int error)
+{
+
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&self->_wal_error, &expected, error))
+    {
+        logger_log(LOGGER_ERROR, "message_broker",
+                   "write-ahead log of channel %s failed (%d), its messages "
+                   "are dropped",
+                   self->_channel_name, error);
+    }
+}
+
+// @note a reader registers on the counter of the current epoch parity and
+// checks that the parity did not move meanwhile, so that the writer flipping it
+// in _channel_synchronize waits for every reader that may have loaded the
+// replaced snapshot.
+static size_t
+_channel_read_lock(struct channel_t* self)
+{
+
+    while (1)
+    {
+
+        size_t parity = atomic_load(&self->_reader_epoch) & 1;
+        atomic_fetch_add(&self->_n_readers[parity], 1);
+        if ((atomic_load(&self->_reader_epoch) & 1) == parity)
+        {
+            return parity;
+        }
+
+        atomic_fetch_sub(&self->_n_readers[parity], 1);
+    }
+}
+
+static void
+_channel_read_unlock(struct channel_t* self, size_t parity)
+{
+    atomic_fetch_sub(&self->_n_readers[parity], 1);
+}
+
+// @note called by the writer after a new snapshot is published: the readers
+// entering from now on use the other parity, the ones left on the previous
+// parity are waited for. Writers are serialized by the channel.
+static void
+_channel_synchronize(struct channel_t* self)
+{
+
+    size_t parity = atomic_fetch_add(&self->_reader_epoch, 1) & 1;
+    while (atomic_load(&self->_n_readers[parity]))
+    {
+        sched_yield();
+    }
+}
+
+static void
+_parked_cursor_free_wrapper(void* data)
+{
+
+    struct _parked_cursor_t* parked = (struct _parked_cursor_t*) data;
+    if (!parked)
+    {
+        return;
+    }
+
+    generic_log_cursor_free(parked->_cursor);
+    free(parked->_name);
+    free(parked);
+}
+
+// @note takes ownership of the cursor, which is freed on failure.
+static int
+_channel_park_cursor(struct channel_t* self, const char* name,
+                     generic_log_cursor cursor)
+{
+
+    struct _parked_cursor_t* parked = malloc(sizeof(struct _parked_cursor_t));
+    if (!parked)
+    {
+        generic_log_cursor_free(cursor);
+        return -1;
+    }
+
+    parked->_name = strdup(name);
+    parked->_cursor = cursor;
+    if (!parked->_name
+        || generic_linked_list_insert_last(self->_parked_cursors, parked))
+    {
+        _parked_cursor_free_wrapper(parked);
+        return -1;
+    }
+
+    return 0;
+}
+
+#define _SUBSCRIBERS_MIN_CAPACITY 4
+
+// @note copies the attached proxies of current (may be NULL), the detached
+// ones are left out, into a new snapshot with room for as many again; each
+// proxy learns its new slot. out_self is NULL when no proxy is attached.
+static int
+_subscriber_snapshot_compact(const struct _subscriber_snapshot_t* current,
+                             size_t n_attached,
+                             struct _subscriber_snapshot_t** out_self)
+{
+
+    if (!n_attached)
+    {
+
+        *out_self = NULL;
+        return 0;
+    }
+
+    size_t capacity = n_attached * 2;
+    if (capacity < _SUBSCRIBERS_MIN_CAPACITY)
+    {
+        capacity = _SUBSCRIBERS_MIN_CAPACITY;
+    }
+
+    struct _subscriber_snapshot_t* self =
+        malloc(sizeof(struct _subscriber_snapshot_t)
+               + sizeof(struct subscriber_proxy_t*) * capacity);
+    if (!self)
+    {
+        return -1;
+    }
+
+    self->_capacity = capacity;
+
+    size_t n = 0;
+    size_t n_current = current ? atomic_load(&current->_n) : 0;
+    size_t i = 0;
+    while (i < n_current)
+    {
+
+        struct subscriber_proxy_t* proxy = current->_proxies[i];
+        if (!proxy->_detached)
+        {
+
+            proxy->_slot = n;
+            self->_proxies[n++] = proxy;
+        }
+
+        i++;
+    }
+
+    atomic_init(&self->_n, n);
+    *out_self = self;
+
+    return 0;
+}
+
+// @note publishes next in set, one of the subscriber sets of the channel, and
+// frees the replaced snapshot, with the proxies it still held detached, once
+// no reader can see it anymore.
+static void
+_channel_replace_subscribers(struct channel_t* self,
+                             struct _subscriber_set_t* set,
+                             struct _subscriber_snapshot_t* next)
+{
+
+    struct _subscriber_snapshot_t* previous =
+        atomic_exchange(&set->_snapshot, next);
+    set->_n_detached = 0;
+
+    _channel_synchronize(self);
+
+    if (!previous)
+    {
+        return;
+    }
+
+    size_t n = atomic_load(&previous->_n);
+    size_t i = 0;
+    while (i < n)
+    {
+
+        if (previous->_proxies[i]->_detached)
+        {
+            _subscriber_proxy_release(previous->_proxies[i]);
+        }
+
+        i++;
+    }
+
+    free(previous);
+}
+
+// @note appended in place while the snapshot has room: the slot is written
+// before _n is raised, so a reader sees either the old or the new count with
+// every slot below it set. A full snapshot is compacted into a larger one.
+static int
+_channel_add_subscriber(struct channel_t* self, struct _subscriber_set_t* set,
+                        struct subscriber_proxy_t* proxy)
+{
+
+    struct _subscriber_snapshot_t* current = atomic_load(&set->_snapshot);
+    size_t n = current ? atomic_load(&current->_n) : 0;
+    if (current && n < current->_capacity)
+    {
+
+        proxy->_slot = n;
+        current->_proxies[n] = proxy;
+        atomic_store(&current->_n, n + 1);
+
+        return 0;
+    }
+
+    struct _subscriber_snapshot_t* next = NULL;
+    int exit_code = _subscriber_snapshot_compact(
+        current, n - set->_n_detached + 1, &next);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    proxy->_slot = atomic_load(&next->_n);
+    next->_proxies[proxy->_slot] = proxy;
+    atomic_store(&next->_n, proxy->_slot + 1);
+
+    _channel_replace_subscribers(self, set, next);
+
+    return 0;
+}
+
+// @note O(1): the proxy knows its slot, it is only flagged detached (the
+// fan-out already skips it, the subscription deactivated it) and stays in the
+// snapshot until the detached proxies are half of it, when a compaction frees
+// them all at once. Its messages are released right away, see
+// _subscriber_proxy_drain.
+static int
+_channel_remove_subscriber(struct channel_t* self,
+                           struct _subscriber_set_t* set,
+                           struct subscriber_proxy_t* proxy)
+{
+
+    struct _subscriber_snapshot_t* current = atomic_load(&set->_snapshot);
+    if (!current || proxy->_detached
+        || proxy->_slot >= atomic_load(&current->_n)
+        || current->_proxies[proxy->_slot] != proxy)
+    {
+        return 1;
+    }
+
+    // a named subscription keeps its position on durable channels
+    if (proxy->_name && proxy->_cursor && self->_wal)
+    {
+        _channel_park_cursor(self, proxy->_name, proxy->_cursor);
+        proxy->_cursor = NULL;
+    }
+
+    proxy->_detached = 1;
+    set->_n_detached++;
+    _subscriber_proxy_drain(proxy);
+
+    size_t n = atomic_load(&current->_n);
+    if (set->_n_detached * 2 < n)
+    {
+        return 0;
+    }
+
+    struct _subscriber_snapshot_t* next = NULL;
+    if (_subscriber_snapshot_compact(current, n - set->_n_detached, &next))
+    {
+        // still correct, only the memory is reclaimed later
+        return 0;
+    }
+
+    _channel_replace_subscribers(self, set, next);
+
+    return 0;
+}
+
+// @note copies the groups of current (may be NULL) but skip, plus extra when
+// not NULL; out_self is NULL when no group is left.
+static int
+_group_snapshot_copy(const struct _group_snapshot_t* current,
+                     const struct _consumer_group_t* skip,
+                     struct _consumer_group_t* extra,
+                     struct _group_snapshot_t** out_self)
+{
+
+    size_t n_current = current ? current->_n : 0;
+    size_t capacity = n_current + (extra ? 1 : 0);
+    if (!capacity)
+    {
+
+        *out_self = NULL;
+        return 0;
+    }
+
+    struct _group_snapshot_t* self =
+        malloc(sizeof(struct _group_snapshot_t)
+               + sizeof(struct _consumer_group_t*) * capacity);
+    if (!self)
+    {
+        return -1;
+    }
+
+    size_t n = 0;
+    size_t i = 0;
+    while (i < n_current)
+    {
+
+        if (current->_groups[i] != skip)
+        {
+            self->_groups[n++] = current->_groups[i];
+        }
+
+        i++;
+    }
+
+    if (extra)
+    {
+        self->_groups[n++] = extra;
+    }
+
+    self->_n = n;
+    if (!n)
+    {
+
+        free(self);
+        self = NULL;
+    }
+
+    *out_self = self;
+
+    return 0;
+}
+
+static void
+_channel_replace_groups(struct channel_t* self, struct _group_snapshot_t* next)
+{
+
+    struct _group_snapshot_t* previous = atomic_exchange(&self->_groups, next);
+
+    _channel_synchronize(self);
+
+    free(previous);
+}
+
+static struct _consumer_group_t*
+_channel_find_group(struct channel_t* self, const char* name)
+{
+
+    struct _group_snapshot_t* groups = atomic_load(&self->_groups);
+
+    size_t i = 0;
+    while (groups && i < groups->_n)
+    {
+
+        if (!strcmp(groups->_groups[i]->_name, name))
+        {
+            return groups->_groups[i];
+        }
+
+        i++;
+    }
+
+    return NULL;
+}
+
+static int
+_channel_add_group(struct channel_t* self, struct _consumer_group_t* group)
+{
+
+    struct _group_snapshot_t* next = NULL;
+    int exit_code =
+        _group_snapshot_copy(atomic_load(&self->_groups), NULL, group, &next);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    _channel_replace_groups(self, next);
+
+    return 0;
+}
+
+// @note frees group, and the detached members it still holds, once the fan-out
+// can no longer reach it. On allocation failure the empty group is kept, it
+// is then freed with the channel.
+static void
+_channel_remove_group(struct channel_t* self, struct _consumer_group_t* group)
+{
+
+    struct _group_snapshot_t* next = NULL;
+    if (_group_snapshot_copy(atomic_load(&self->_groups), group, NULL, &next))
+    {
+        return;
+    }
+
+    _channel_replace_groups(self, next);
+    _consumer_group_free(group);
+}
+
+static void
+_channel_log_append(struct channel_t* self,
+                    struct _message_payload_t** payloads, size_t n)
+{
+
+    uint64_t now_ms = 0;
+    uint64_t now_realtime_ms = 0;
+    if (self->_wal)
+    {
+        now_ms = _monotonic_ms();
+        now_realtime_ms = _realtime_ms();
+    }
+
+    // the sequence of a logged message is its offset, plus one
+    uint64_t tail = 0;
+    generic_log_get_tail(self->_log, &tail);
+
+    size_t i = 0;
+    while (i < n)
+    {
+
+        payloads[i]->_sequence = tail + 1;
+
+        // a message the WAL could not take is not appended to the log either,
+        // their offsets would no longer match
+        int exit_code =
+            self->_wal
+                ? _channel_wal_append(self, payloads[i], now_ms,
+                                      now_realtime_ms)
+                : 0;
+        if (exit_code)
+        {
+
+            _channel_set_wal_error(self, exit_code);
+
+            // no sequence: counted as dropped by _broker_count_published
+            payloads[i]->_sequence = 0;
+
+            i++;
+            continue;
+        }
+
+        _message_payload_acquire(payloads[i]);
+        if (generic_log_append(self->_log, payloads[i]))
+        {
+            _message_payload_release(payloads[i]);
+            payloads[i]->_sequence = 0;
+        }
+        else
+        {
+            tail++;
+        }
+
+        i++;
+    }
+
+    // pairs with the fence in _subscriber_proxy_wait_log: either the waiter
+    // is seen here or the waiter sees the new tail
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&self->_n_log_waiters))
+    {
+
+        pthread_mutex_lock(&self->_log_mutex);
+        pthread_cond_broadcast(&self->_log_cond);
+        pthread_mutex_unlock(&self->_log_mutex);
+    }
+
+    if (!atomic_load(&self->_n_event_fds))
+    {
+        return;
+    }
+
+    // appends are serialized with the membership changes, no read section
+    struct _subscriber_snapshot_t* subscribers =
+        atomic_load(&self->_subscribers._snapshot);
+    size_t n_subscribers = subscribers ? atomic_load(&subscribers->_n) : 0;
+    i = 0;
+    while (i < n_subscribers)
+    {
+
+        struct subscriber_proxy_t* proxy = subscribers->_proxies[i];
+        if (proxy->_active)
+        {
+            _subscriber_proxy_notify_fd(proxy);
+        }
+
+        i++;
+    }
+}
+
+static int
+_subscriber_proxy_takes(const struct subscriber_proxy_t* self,
+                        const struct _message_payload_t* payload)
+{
+    return !self->_partitions
+           || (self->_partitions >> payload->_partition) & 1;
+}
+
+// @note enqueues the payloads of the partitions the proxy selected, in runs of
+// consecutive ones.
+static void
+_subscriber_proxy_enqueue_partitions(struct subscriber_proxy_t* self,
+                                     struct _message_payload_t** payloads,
+                                     size_t n, struct _fan_out_t* fan_out)
+{
+
+    size_t i = 0;
+    while (i < n)
+    {
+
+        size_t end = i;
+        while (end < n && _subscriber_proxy_takes(self, payloads[end]))
+        {
+            end++;
+        }
+
+        if (end > i)
+        {
+            _subscriber_proxy_enqueue_batch(self, payloads + i, end - i,
+                                            fan_out);
+            i = end;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// @note the in-flight messages count as pending: an ack mode member still
+// busy with its window is not preferred over an idle one.
+static size_t
+_subscriber_proxy_get_load(struct subscriber_proxy_t* self)
+{
+
+    size_t size = 0;
+    generic_queue_syn_size(self->_inbox, &size);
+
+    return size + atomic_load(&self->_n_in_flight);
+}
+
+// @note runs inside a read section of the channel. A message no member can
+// take (none active, or the chosen inbox full) is lost for the group.
+static void
+_consumer_group_deliver(struct _consumer_group_t* self,
+                        struct _message_payload_t** payloads, size_t n,
+                        struct _fan_out_t* fan_out)
+{
+
+    struct _subscriber_snapshot_t* members =
+        atomic_load(&self->_members._snapshot);
+    size_t n_members = members ? atomic_load(&members->_n) : 0;
+    if (!n_members)
+    {
+        return;
+    }
+
+    size_t i = 0;
+    while (i < n)
+    {
+
+        size_t start = atomic_fetch_add(&self->_next, 1);
+        struct subscriber_proxy_t* chosen = NULL;
+        size_t chosen_load = 0;
+
+        size_t j = 0;
+        while (j < n_members)
+        {
+
+            struct subscriber_proxy_t* member =
+                members->_proxies[(start + j) % n_members];
+            if (member->_active && _subscriber_proxy_takes(member, payloads[i]))
+            {
+
+                size_t load = _subscriber_proxy_get_load(member);
+                if (!chosen || load < chosen_load)
+                {
+                    chosen = member;
+                    chosen_load = load;
+                }
+            }
+
+            j++;
+        }
+
+        if (chosen)
+        {
+            _subscriber_proxy_enqueue_batch(chosen, &payloads[i], 1, fan_out);
+        }
+
+        i++;
+    }
+}
+
+// @note every subscriber gets the group in one enqueue. A log append takes the
+// channel lock once for the whole group; a queue channel is fanned out over the
+// subscriber snapshot without it, so publishes and membership changes on the
+// same channel do not wait for each other.
+static size_t
+_channel_deliver(struct channel_t* self, struct _message_payload_t** payloads,
+                 size_t n)
+{
+
+    if (self->_log)
+    {
+
+        if (!self->_single_writer)
+        {
+            pthread_mutex_lock(&self->_mutex);
+        }
+
+        _channel_log_append(self, payloads, n);
+
+        if (!self->_single_writer)
+        {
+            pthread_mutex_unlock(&self->_mutex);
+        }
+
+        return atomic_load(&self->_n_subscribers);
+    }
+
+    struct _fan_out_t fan_out;
+    _fan_out_init(&fan_out);
+
+    size_t parity = _channel_read_lock(self);
+
+    struct _subscriber_snapshot_t* subscribers =
+        atomic_load(&self->_subscribers._snapshot);
+    size_t n_slots = subscribers ? atomic_load(&subscribers->_n) : 0;
+
+    size_t i = 0;
+    while (i < n_slots)
+    {
+
+        struct subscriber_proxy_t* proxy = subscribers->_proxies[i];
+        if (proxy->_active && proxy->_partitions)
+        {
+            _subscriber_proxy_enqueue_partitions(proxy, payloads, n, &fan_out);
+        }
+        else if (proxy->_active)
+        {
+            _subscriber_proxy_enqueue_batch(proxy, payloads, n, &fan_out);
+        }
+
+        i++;
+    }
+
+    struct _group_snapshot_t* groups = atomic_load(&self->_groups);
+    i = 0;
+    while (groups && i < groups->_n)
+    {
+        _consumer_group_deliver(groups->_groups[i], payloads, n, &fan_out);
+        i++;
+    }
+
+    _channel_read_unlock(self, parity);
+
+    // the subscribe or compaction waiting for the read section goes on
+    // while the publisher waits for room
+    _fan_out_finish(&fan_out);
+
+    return atomic_load(&self->_n_subscribers);
+}
+
+// @note payloads must all belong to the channel.
+static size_t
+_channel_fan_out(struct channel_t* self, struct _message_payload_t** payloads,
+                 size_t n)
+{
+
+    // the payloads are not shared yet, their deadline and their partition can
+    // still be resolved
+    size_t default_ttl_ms = atomic_load(&self->_default_ttl_ms);
+    size_t n_partitions = atomic_load(&self->_n_partitions);
+
+    // a payload published untimed runs its default TTL from here
+    uint64_t now_ns = 0;
+
+    size_t i = 0;
+    while (i < n)
+    {
+
+        struct _message_payload_t* payload = payloads[i];
+        uint64_t ttl_ms = payload->_ttl_ms ? payload->_ttl_ms : default_ttl_ms;
+        if (ttl_ms && !payload->_published_at_ns && !now_ns)
+        {
+            now_ns = _monotonic_ns();
+        }
+
+        if (ttl_ms)
+        {
+            uint64_t published_at_ns = payload->_published_at_ns
+                                           ? payload->_published_at_ns
+                                           : now_ns;
+            payload->_expires_at_ms = published_at_ns / 1000000 + ttl_ms;
+        }
+
+        // a routed payload keeps its partition, unless the partitions were
+        // changed since its publish
+        if (n_partitions)
+        {
+            payload->_partition =
+                (payload->_routed  ? payload->_partition
+                 : payload->_keyed ? payload->_key_hash
+                                   : atomic_fetch_add(&self->_next_partition,
+                                                      1))
+                % n_partitions;
+        }
+        else
+        {
+            payload->_partition = 0;
+        }
+
+        // a LOG channel numbers the messages as it appends them
+        if (n_partitions && !self->_log)
+        {
+            payload->_sequence =
+                atomic_fetch_add(
+                    &self->_partition_sequences[payload->_partition]._next, 1)
+                + 1;
+        }
+        else if (!self->_log)
+        {
+            payload->_sequence = atomic_fetch_add(&self->_next_sequence, 1) + 1;
+        }
+
+        i++;
+    }
+
+    return _channel_deliver(self, payloads, n);
+}
+
+struct _pattern_delivery_t
+{
+    struct _message_payload_t** _payloads;
+    size_t _n_payloads;
+    size_t _subscriber_count;
+};
+
+static int
+_pattern_channel_deliver(void* context, void* value)
+{
+
+    struct _pattern_delivery_t* delivery =
+        (struct _pattern_delivery_t*) context;
+
+    delivery->_subscriber_count +=
+        _channel_deliver((struct channel_t*) value, delivery->_payloads,
+                         delivery->_n_payloads);
+
+    return 0;
+}
+
+// @note the copies enqueued into the inboxes are counted as they are made, a
+// LOG channel counts the appended messages instead.
+static void
+_broker_count_published(struct message_broker_t* broker,
+                        struct channel_t* channel,
+                        struct _message_payload_t** payloads, size_t n)
+{
+
+    uint64_t n_bytes = 0;
+
+    size_t i = 0;
+    while (i < n)
+    {
+        n_bytes += payloads[i]->_content_len;
+        i++;
+    }
+
+    _channel_count(channel, _STAT_PUBLISHED, n);
+    _channel_count(channel, _STAT_BYTES_IN, n_bytes);
+    _broker_count(broker, _STAT_PUBLISHED, n);
+    _broker_count(broker, _STAT_BYTES_IN, n_bytes);
+
+    if (!channel->_log)
+    {
+        return;
+    }
+
+    // the messages left out of the log have no sequence
+    uint64_t n_lost = 0;
+
+    i = 0;
+    while (i < n)
+    {
+        n_lost += !payloads[i]->_sequence;
+        i++;
+    }
+
+    _channel_count(channel, _STAT_FANNED_OUT, n - n_lost);
+    _broker_count(broker, _STAT_FANNED_OUT, n - n_lost);
+
+    if (n_lost)
+    {
+        _channel_count(channel, _STAT_DROPPED, n_lost);
+        _broker_count(broker, _STAT_DROPPED, n_lost);
+    }
+}
+
+// @note the exact-match path only pays an atomic load while no pattern has
+// subscribers; otherwise the trie is matched against the channel name under
+// the read side of the patterns lock.
+static size_t
+_broker_fan_out(struct message_broker_t* broker, struct channel_t* channel,
+                struct _message_payload_t** payloads, size_t n)
+{
+
+    if (broker->_latency_tracing)
+    {
+        _channel_record_latency(channel, MESSAGE_LATENCY_FAN_OUT, payloads, n,
+                                _monotonic_ns());
+    }
+
+    size_t subscriber_count = _channel_fan_out(channel, payloads, n);
+    _broker_count_published(broker, channel, payloads, n);
+
+    // once per message, when its every copy is enqueued (or appended)
+    if (broker->_latency_tracing)
+    {
+        _channel_record_latency(channel, MESSAGE_LATENCY_ENQUEUE, payloads, n,
+                                _monotonic_ns());
+    }
+
+    if (!atomic_load(&broker->_n_patterns))
+    {
+        return subscriber_count;
+    }
+
+    struct _pattern_delivery_t delivery = {
+        ._payloads = payloads, ._n_payloads = n, ._subscriber_count = 0};
+
+    pthread_rwlock_rdlock(&broker->_patterns_lock);
+    topic_trie_match(broker->_patterns, channel->_channel_name,
+                     _pattern_channel_deliver, &delivery);
+    pthread_rwlock_unlock(&broker->_patterns_lock);
+
+    return subscriber_count + delivery._subscriber_count;
+}
+
+// @note returns the parked cursor of name, removed from the parked ones, or
+// NULL.
+static generic_log_cursor
+_channel_unpark_cursor(struct channel_t* self, const char* name)
+{
+
+    generic_log_cursor cursor = NULL;
+
+    generic_linked_list_iterator iter = NULL;
+    if (generic_linked_list_iterator_begin(self->_parked_cursors, &iter))
+    {
+        return NULL;
+    }
+
+    while (generic_linked_list_iterator_is_valid(iter) == 0)
+    {
+
+        struct _parked_cursor_t* parked = NULL;
+        generic_linked_list_iterator_get(iter, (void**) &parked);
+        if (parked && !strcmp(parked->_name, name))
+        {
+
+            if (generic_linked_list_iterator_remove(iter, (void**) &parked)
+                == 0)
+            {
+
+                cursor = parked->_cursor;
+                free(parked->_name);
+                free(parked);
+            }
+
+            break;
+        }
+
+        generic_linked_list_iterator_next(iter);
+    }
+
+    generic_linked_list_iterator_free(iter);
+
+    return cursor;
+}
+
+static struct subscriber_proxy_t*
+_channel_find_proxy_by_name(struct channel_t* self, const char* name)
+{
+
+    struct _subscriber_snapshot_t* subscribers =
+        atomic_load(&self->_subscribers._snapshot);
+
+    size_t n = subscribers ? atomic_load(&subscribers->_n) : 0;
+    size_t i = 0;
+    while (i < n)
+    {
+
+        struct subscriber_proxy_t* proxy = subscribers->_proxies[i];
+        if (!proxy->_detached && proxy->_name && !strcmp(proxy->_name, name))
+        {
+            return proxy;
+        }
+
+        i++;
+    }
+
+    return NULL;
+}
+
+// @note a change of the channel state (membership, storage) applied by
+// _apply under the channel serialization, see _channel_call.
+struct _channel_call_t
+{
+    struct channel_t* _channel;
+    int (*_apply)(struct channel_t* channel, void* arg);
+    void* _arg;
+    int _exit_code;
+    int _done;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+};
+
+// Returns 1 when mask selects partitions the channel does not have, or any
+// partition on a channel without partitions.
+static int
+_channel_check_partitions(struct channel_t* self, uint64_t mask)
+{
+
+    size_t n_partitions = atomic_load(&self->_n_partitions);
+    if (!mask)
+    {
+        return 0;
+    }
+
+    if (!n_partitions)
+    {
+        return 1;
+    }
+
+    return n_partitions < _MAX_PARTITIONS && mask >> n_partitions;
+}
+
+static int
+_channel_attach(struct channel_t* channel, void* arg)
+{
+
+    struct subscriber_proxy_t* proxy = (struct subscriber_proxy_t*) arg;
+
+    if (_channel_check_partitions(channel, proxy->_partitions))
+    {
+        return 1;
+    }
+
+    int durable = proxy->_name && channel->_wal;
+    if (durable && _channel_find_proxy_by_name(channel, proxy->_name))
+    {
+        return 1;
+    }
+
+    if (durable)
+    {
+        proxy->_cursor = _channel_unpark_cursor(channel, proxy->_name);
+    }
+
+    // created here so that the cursor starts at the tail the fan-out sees
+    if (channel->_log && !proxy->_cursor)
+    {
+
+        int exit_code = generic_log_cursor_new(channel->_log, &proxy->_cursor);
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        if (durable)
+        {
+
+            uint64_t offset = 0;
+            generic_log_cursor_get_offset(proxy->_cursor, &offset);
+            wal_commit_offset(channel->_wal, proxy->_name, offset);
+        }
+    }
+
+    int exit_code =
+        _channel_add_subscriber(channel, &channel->_subscribers, proxy);
+    if (exit_code)
+    {
+
+        if (durable)
+        {
+            _channel_park_cursor(channel, proxy->_name, proxy->_cursor);
+        }
+        else if (proxy->_cursor)
+        {
+            generic_log_cursor_free(proxy->_cursor);
+        }
+
+        proxy->_cursor = NULL;
+
+        return exit_code;
+    }
+
+    atomic_fetch_add(&channel->_n_subscribers, 1);
+
+    return 0;
+}
+
+struct _group_join_t
+{
+    struct subscriber_proxy_t* _proxy;
+    const char* _group;
+};
+
+// @note the group is created by its first member. Members share the messages
+// of the channel, which a LOG channel cannot do: every cursor reads the whole
+// log, so 1 is returned on LOG channels.
+static int
+_channel_join_group(struct channel_t* channel, void* arg)
+{
+
+    struct _group_join_t* join = (struct _group_join_t*) arg;
+
+    if (channel->_log
+        || _channel_check_partitions(channel, join->_proxy->_partitions))
+    {
+        return 1;
+    }
+
+    struct _consumer_group_t* group =
+        _channel_find_group(channel, join->_group);
+    if (!group)
+    {
+
+        int exit_code = _consumer_group_new(join->_group, &group);
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        exit_code = _channel_add_group(channel, group);
+        if (exit_code)
+        {
+            _consumer_group_free(group);
+            return exit_code;
+        }
+    }
+
+    int exit_code =
+        _channel_add_subscriber(channel, &group->_members, join->_proxy);
+    if (exit_code)
+    {
+
+        if (!group->_n_members)
+        {
+            _channel_remove_group(channel, group);
+        }
+
+        return exit_code;
+    }
+
+    join->_proxy->_group = group;
+    group->_n_members++;
+    atomic_fetch_add(&channel->_n_subscribers, 1);
+
+    return 0;
+}
+
+static int
+_channel_detach(struct channel_t* channel, void* arg)
+{
+
+    struct subscriber_proxy_t* proxy = (struct subscriber_proxy_t*) arg;
+    struct _consumer_group_t* group = proxy->_group;
+
+    int exit_code = _channel_remove_subscriber(
+        channel, group ? &group->_members : &channel->_subscribers, proxy);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    atomic_fetch_sub(&channel->_n_subscribers, 1);
+
+    if (group && !--group->_n_members)
+    {
+        _channel_remove_group(channel, group);
+    }
+
+    return 0;
+}
+
+struct _channel_storage_call_t
+{
+    struct message_broker_t* _broker;
+    const struct channel_options_t* _options;
+};
+
+struct _channel_recovery_t
+{
+    struct message_broker_t* _broker;
+    struct channel_t* _channel;
+    uint64_t _start_offset;
+    uint64_t _now_ms;
+    uint64_t _now_realtime_ms;
+};
+
+static int
+_channel_recovery_min_offset(void* context, const char* name, uint64_t offset)
+{
+
+    (void) name;
+    struct _channel_recovery_t* recovery =
+        (struct _channel_recovery_t*) context;
+
+    if (offset < recovery->_start_offset)
+    {
+        recovery->_start_offset = offset;
+    }
+
+    return 0;
+}
+
+// @note the cursors are created before the replay, at its start, so that the
+// log keeps every message one of them still has to read.
+static int
+_channel_recovery_park(void* context, const char* name, uint64_t offset)
+{
+
+    (void) offset;
+    struct _channel_recovery_t* recovery =
+        (struct _channel_recovery_t*) context;
+    struct channel_t* channel = recovery->_channel;
+
+    generic_log_cursor cursor = NULL;
+    int exit_code = generic_log_cursor_new(channel->_log, &cursor);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    return _channel_park_cursor(channel, name, cursor);
+}
+
+static int
+_channel_recovery_replay(void* context, uint64_t offset, const void* data,
+                         size_t len)
+{
+
+    struct _channel_recovery_t* recovery =
+        (struct _channel_recovery_t*) context;
+    struct channel_t* channel = recovery->_channel;
+
+    struct _durable_record_header_t header;
+    if (len < sizeof(header))
+    {
+        return 1;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (header._headers_len > len - sizeof(header))
+    {
+        return 1;
+    }
+
+    const char* headers = (const char*) data + sizeof(header);
+    size_t headers_len = (size_t) header._headers_len;
+
+    struct _message_payload_t* payload = NULL;
+    int exit_code = _message_payload_alloc(
+        header._id, channel->_channel_name, headers + headers_len,
+        len - sizeof(header) - headers_len, headers_len, 0, 0, &payload);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    if (headers_len)
+    {
+        memcpy(payload->_headers, headers, headers_len);
+    }
+
+    payload->_sequence = offset + 1;
+
+    if (header._expires_at_realtime_ms)
+    {
+
+        // already expired messages get a deadline in the past, they are
+        // dropped and counted on receive
+        payload->_expires_at_ms =
+            header._expires_at_realtime_ms > recovery->_now_realtime_ms
+                ? recovery->_now_ms
+                      + (header._expires_at_realtime_ms
+                         - recovery->_now_realtime_ms)
+                : 1;
+    }
+
+    exit_code = generic_log_append(channel->_log, payload);
+    if (exit_code)
+    {
+        _message_payload_release(payload);
+        return exit_code;
+    }
+
+    // ids keep growing across restarts
+    atomic_uint_fast64_t* next_message_id =
+        &recovery->_broker->_next_message_id;
+    uint_fast64_t next_id = atomic_load(next_message_id);
+    while (next_id <= header._id
+           && !atomic_compare_exchange_weak(next_message_id, &next_id,
+                                            header._id + 1))
+    {
+    }
+
+    return 0;
+}
+
+// @note moves the cursor forward to the offset persisted for its name.
+static void
+_parked_cursor_seek(struct _parked_cursor_t* parked, wal channel_wal)
+{
+
+    uint64_t target = 0;
+    if (wal_get_offset(channel_wal, parked->_name, &target))
+    {
+        return;
+    }
+
+    uint64_t offset = 0;
+    generic_log_cursor_get_offset(parked->_cursor, &offset);
+    while (offset < target)
+    {
+
+        void* item = NULL;
+        if (generic_log_cursor_next(parked->_cursor, &item))
+        {
+            break;
+        }
+
+        offset++;
+    }
+}
+
+// @note opens the channel WAL and rebuilds the log from the oldest position
+// persisted by its named subscriptions; each of them gets a parked cursor at
+// its position, picked up when it subscribes again.
+static int
+_channel_recover(struct message_broker_t* broker, struct channel_t* channel,
+                 const struct channel_options_t* options)
+{
+
+    size_t path_len =
+        strlen(broker->_data_dir) + 1 + strlen(channel->_channel_name) + 1;
+    char* path = malloc(path_len);
+    if (!path)
+    {
+        return -1;
+    }
+    snprintf(path, path_len, "%s/%s", broker->_data_dir,
+             channel->_channel_name);
+
+    struct wal_configuration_t config = {
+        ._segment_size = _WAL_SEGMENT_SIZE,
+        ._commit_batch_size = options->_commit_batch_size
+                                  ? options->_commit_batch_size
+                                  : _WAL_DEFAULT_COMMIT_BATCH_SIZE,
+        ._commit_latency_ms = options->_commit_latency_ms
+                                  ? options->_commit_latency_ms
+                                  : _WAL_DEFAULT_COMMIT_LATENCY_MS,
+        ._format_version = _DURABLE_RECORD_FORMAT};
+
+    wal channel_wal = NULL;
+    int exit_code = wal_open(path, &config, &channel_wal);
+    free(path);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    exit_code = generic_linked_list_new(&channel->_parked_cursors);
+    if (exit_code)
+    {
+        wal_close(channel_wal);
+        return exit_code;
+    }
+    generic_linked_list_set_free_function(channel->_parked_cursors,
+                                          _parked_cursor_free_wrapper);
+
+    uint64_t first_offset = 0;
+    uint64_t next_offset = 0;
+    wal_get_range(channel_wal, &first_offset, &next_offset);
+
+    struct _channel_recovery_t recovery = {._broker = broker,
+                                           ._channel = channel,
+                                           ._start_offset = next_offset,
+                                           ._now_ms = _monotonic_ms(),
+                                           ._now_realtime_ms = _realtime_ms()};
+
+    wal_for_each_offset(channel_wal, _channel_recovery_min_offset, &recovery);
+    if (recovery._start_offset < first_offset)
+    {
+        recovery._start_offset = first_offset;
+    }
+
+    generic_log_set_tail(channel->_log, recovery._start_offset);
+
+    exit_code =
+        wal_for_each_offset(channel_wal, _channel_recovery_park, &recovery);
+    if (!exit_code)
+    {
+        exit_code = wal_replay(channel_wal, recovery._start_offset,
+                               _channel_recovery_replay, &recovery);
+    }
+
+    if (exit_code)
+    {
+
+        generic_linked_list_free(channel->_parked_cursors);
+        channel->_parked_cursors = NULL;
+        wal_close(channel_wal);
+
+        return exit_code;
+    }
+
+    generic_linked_list_iterator iter = NULL;
+    if (generic_linked_list_iterator_begin(channel->_parked_cursors, &iter)
+        == 0)
+    {
+
+        while (generic_linked_list_iterator_is_valid(iter) == 0)
+        {
+
+            struct _parked_cursor_t* parked = NULL;
+            generic_linked_list_iterator_get(iter, (void**) &parked);
+            _parked_cursor_seek(parked, channel_wal);
+            generic_linked_list_iterator_next(iter);
+        }
+
+        generic_linked_list_iterator_free(iter);
+    }
+
+    channel->_wal = channel_wal;
+    atomic_store(&channel->_wal_error, 0);
+
+    return 0;
+}
+
+static int
+_channel_set_storage(struct channel_t* channel, void* arg)
+{
+
+    struct _channel_storage_call_t* call =
+        (struct _channel_storage_call_t*) arg;
+    const struct channel_options_t* options = call->_options;
+
+    int log = options->_storage == CHANNEL_STORAGE_LOG;
+    int durable = log && options->_durable;
+    size_t n_partitions =
+        options->_n_partitions > 1 ? options->_n_partitions : 0;
+
+    int same_storage =
+        log == (channel->_log != NULL) && durable == (channel->_wal != NULL);
+    if (same_storage && n_partitions == atomic_load(&channel->_n_partitions))
+    {
+        return 0;
+    }
+
+    // the subscribers selected their partitions out of the previous ones
+    if (atomic_load(&channel->_n_subscribers))
+    {
+        return 1;
+    }
+
+    // kept once allocated: publishes in flight may still stamp sequences
+    if (n_partitions && !channel->_partition_sequences)
+    {
+
+        channel->_partition_sequences =
+            calloc(_MAX_PARTITIONS, sizeof(struct _sequence_counter_t));
+        if (!channel->_partition_sequences)
+        {
+            return -1;
+        }
+    }
+
+    // sticky: from now on the publishes look their channel up to be routed
+    if (n_partitions)
+    {
+        atomic_store(&call->_broker->_has_partitions, 1);
+    }
+
+    atomic_store(&channel->_n_partitions, n_partitions);
+    if (same_storage)
+    {
+        return 0;
+    }
+
+    if (channel->_wal)
+    {
+
+        wal_close(channel->_wal);
+        channel->_wal = NULL;
+
+        generic_linked_list_free(channel->_parked_cursors);
+        channel->_parked_cursors = NULL;
+    }
+
+    if (channel->_log)
+    {
+        generic_log_free(channel->_log);
+        channel->_log = NULL;
+    }
+
+    if (!log)
+    {
+        return 0;
+    }
+
+    int exit_code = generic_log_new(_CHANNEL_LOG_SEGMENT_CAPACITY,
+                                    &channel->_log);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    generic_log_set_free_function(channel->_log,
+                                  _message_payload_release_wrapper);
+
+    if (!durable)
+    {
+        return 0;
+    }
+
+    exit_code = _channel_recover(call->_broker, channel, options);
+    if (exit_code)
+    {
+        generic_log_free(channel->_log);
+        channel->_log = NULL;
+    }
+
+    return exit_code;
+}
+
+static void*
+_channel_call_task(void* arg)
+{
+
+    struct _channel_call_t* call = (struct _channel_call_t*) arg;
+
+    int exit_code = call->_apply(call->_channel, call->_arg);
+
+    pthread_mutex_lock(&call->_mutex);
+    call->_exit_code = exit_code;
+    call->_done = 1;
+    pthread_cond_signal(&call->_cond);
+    pthread_mutex_unlock(&call->_mutex);
+
+    return NULL;
+}
+
+// @note runs apply on the channel under its lock, or on the shard worker for
+// single-writer channels, the caller waiting for the change to be applied so
+// that it is ordered with the publishes already routed to that shard.
+static int
+_channel_call(struct message_broker_t* broker, struct channel_t* channel,
+              int (*apply)(struct channel_t* channel, void* arg), void* arg)
+{
+
+    struct _channel_call_t call = {._channel = channel,
+                                   ._apply = apply,
+                                   ._arg = arg,
+                                   ._exit_code = 0,
+                                   ._done = 0};
+
+    if (!channel->_single_writer)
+    {
+
+        pthread_mutex_lock(&channel->_mutex);
+        int exit_code = apply(channel, arg);
+        pthread_mutex_unlock(&channel->_mutex);
+
+        return exit_code;
+    }
+
+    int exit_code = pthread_mutex_init(&call._mutex, NULL);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    exit_code = pthread_cond_init(&call._cond, NULL);
+    if (exit_code)
+    {
+
+        pthread_mutex_destroy(&call._mutex);
+        return exit_code;
+    }
+
+    exit_code =
+        thread_pool_submit(_broker_executor(broker, channel->_channel_name),
+                           _channel_call_task, &call);
+    if (exit_code == 0)
+    {
+
+        pthread_mutex_lock(&call._mutex);
+        while (!call._done)
+        {
+            pthread_cond_wait(&call._cond, &call._mutex);
+        }
+        pthread_mutex_unlock(&call._mutex);
+
+        exit_code = call._exit_code;
+    }
+
+    pthread_cond_destroy(&call._cond);
+    pthread_mutex_destroy(&call._mutex);
+
+    return exit_code;
+}
+
+// @note _channel is set when the caller already resolved the channel (inline
+// fast path enabled or channel handle), in which case the task holds a
+// reference on it and is accounted in _n_pending_tasks.
+struct _publisher_task_arg_t
+{
+    struct _message_payload_t* _payload;
+    struct message_broker_t* _broker;
+    struct channel_t* _channel;
+};
+
+static void
+_publisher_task_arg_free(struct _publisher_task_arg_t* arg)
+{
+
+    if (!arg)
+    {
+        return;
+    }
+
+    if (arg->_channel)
+    {
+
+        atomic_fetch_sub(&arg->_channel->_n_pending_tasks, 1);
+        _channel_release(arg->_broker, arg->_channel);
+    }
+
+    _message_payload_release(arg->_payload);
+    free(arg);
+}
+
+static void
+_log_published(struct _message_payload_t* payload, size_t subscriber_count)
+{
+
+    logger_log(LOGGER_DEBUG, "message_broker",
+               "published (id: %lu) channel: %s, content: %.*s, "
+               "subscribers: %zu",
+               (unsigned long) _message_payload_get_id(payload),
+               payload->_channel_name, (int) payload->_content_len,
+               payload->_content, subscriber_count);
+}
+
+static void*
+_publisher_task(void* arg)
+{
+
+    if (!arg)
+    {
+        return NULL;
+    }
+
+    struct _publisher_task_arg_t* task_arg =
+        (struct _publisher_task_arg_t*) arg;
+    struct _message_payload_t* payload = task_arg->_payload;
+
+    struct channel_t* channel = task_arg->_channel;
+    int exit_code = 0;
+    if (!channel)
+    {
+        exit_code = _channel_acquire(task_arg->_broker, payload->_channel_name,
+                                     &channel);
+    }
+
+    if (exit_code || !channel)
+    {
+
+        logger_log(LOGGER_ERROR, "message_broker",
+                   "failed to create channel: %s", payload->_channel_name);
+
+        _publisher_task_arg_free(task_arg);
+
+        return NULL;
+    }
+
+    size_t subscriber_count =
+        _broker_fan_out(task_arg->_broker, channel, &payload, 1);
+    _log_published(payload, subscriber_count);
+
+    if (!task_arg->_channel)
+    {
+        _channel_release(task_arg->_broker, channel);
+    }
+
+    _publisher_task_arg_free(task_arg);
+
+    return NULL;
+}
+
+// @note _channels is set when the caller already resolved the channels (inline
+// fast path enabled): the payloads are then sorted by channel and _channels
+// holds one reference per run of payloads, each accounted in _n_pending_tasks.
+struct _publisher_batch_task_arg_t
+{
+    struct message_broker_t* _broker;
+    struct channel_t** _channels;
+    size_t _n_channels;
+    size_t _n_payloads;
+    struct _message_payload_t* _payloads[];
+};
+
+static void
+_publisher_batch_task_arg_free(struct _publisher_batch_task_arg_t* arg)
+{
+
+    if (!arg)
+    {
+        return;
+    }
+
+    size_t i = 0;
+    while (i < arg->_n_channels)
+    {
+
+        if (arg->_channels[i])
+        {
+
+            atomic_fetch_sub(&arg->_channels[i]->_n_pending_tasks, 1);
+            _channel_release(arg->_broker, arg->_channels[i]);
+        }
+
+        i++;
+    }
+    free(arg->_channels);
+
+    i = 0;
+    while (i < arg->_n_payloads)
+    {
+        _message_payload_release(arg->_payloads[i]);
+        i++;
+    }
+
+    free(arg);
+}
+
+// @note until fanned out _sequence is the position in the batch, ordering by
+// (channel, position) groups the messages by channel while keeping their
+// publish order.
+static int
+_payload_channel_compare(const void* a, const void* b)
+{
+
+    const struct _message_payload_t* pa =
+        *(const struct _message_payload_t* const*) a;
+    const struct _message_payload_t* pb =
+        *(const struct _message_payload_t* const*) b;
+
+    int cmp = strcmp(pa->_channel_name, pb->_channel_name);
+    if (cmp)
+    {
+        return cmp;
+    }
+
+    return pa->_sequence < pb->_sequence
+               ? -1
+               : (pa->_sequence > pb->_sequence ? 1 : 0);
+}
+
+static void*
+_publisher_batch_task(void* arg)
+{
+
+    if (!arg)
+    {
+        return NULL;
+    }
+
+    struct _publisher_batch_task_arg_t* task_arg =
+        (struct _publisher_batch_task_arg_t*) arg;
+
+    // already sorted when the channels were resolved
+    if (!task_arg->_channels)
+    {
+        qsort(task_arg->_payloads, task_arg->_n_payloads,
+              sizeof(struct _message_payload_t*), _payload_channel_compare);
+    }
+
+    size_t n_runs = 0;
+    size_t begin = 0;
+    while (begin < task_arg->_n_payloads)
+    {
+
+        const char* channel_name = task_arg->_payloads[begin]->_channel_name;
+
+        size_t end = begin + 1;
+        while (end < task_arg->_n_payloads
+               && strcmp(task_arg->_payloads[end]->_channel_name, channel_name)
+                      == 0)
+        {
+            end++;
+        }
+
+        struct channel_t* channel = NULL;
+        int exit_code = 0;
+        if (task_arg->_channels)
+        {
+            channel = task_arg->_channels[n_runs];
+        }
+        else
+        {
+            exit_code =
+                _channel_acquire(task_arg->_broker, channel_name, &channel);
+        }
+        n_runs++;
+
+        if (exit_code || !channel)
+        {
+
+            logger_log(LOGGER_ERROR, "message_broker",
+                       "failed to create channel: %s", channel_name);
+
+            begin = end;
+            continue;
+        }
+
+        size_t subscriber_count =
+            _broker_fan_out(task_arg->_broker, channel,
+                            task_arg->_payloads + begin, end - begin);
+
+        if (task_arg->_channels)
+        {
+
+            task_arg->_channels[n_runs - 1] = NULL;
+            atomic_fetch_sub(&channel->_n_pending_tasks, 1);
+        }
+        _channel_release(task_arg->_broker, channel);
+
+        logger_log(LOGGER_DEBUG, "message_broker",
+                   "published batch channel: %s, messages: %zu, "
+                   "subscribers: %zu",
+                   channel_name, end - begin, subscriber_count);
+
+        begin = end;
+    }
+
+    _publisher_batch_task_arg_free(task_arg);
+
+    return NULL;
+}
+
+// @note each shard is a single worker pool: its private queue executes the
+// tasks routed to it in submission order, which gives per-channel FIFO.
+static int
+_broker_shards_new(struct message_broker_t* self)
+{
+
+    self->_shards = malloc(sizeof(struct thread_pool_t*) * self->_n_shards);
+    if (!self->_shards)
+    {
+        return -1;
+    }
+
+    size_t i = 0;
+    while (i < self->_n_shards)
+    {
+
+        int exit_code = thread_pool_new(1, &self->_shards[i]);
+        if (exit_code)
+        {
+
+            while (i > 0)
+            {
+                i--;
+                thread_pool_free(self->_shards[i]);
+            }
+            free(self->_shards);
+            self->_shards = NULL;
+
+            return exit_code;
+        }
+
+        i++;
+    }
+
+    return 0;
+}
+
+static void
+_broker_executors_free(struct message_broker_t* self)
+{
+
+    if (self->_publisher_pool)
+    {
+        thread_pool_free(self->_publisher_pool);
+    }
+
+    if (self->_shards)
+    {
+
+        size_t i = 0;
+        while (i < self->_n_shards)
+        {
+            thread_pool_free(self->_shards[i]);
+            i++;
+        }
+
+        free(self->_shards);
+    }
+}
+
+// @note sweeps the expiry timer wheel every tick while timers are armed and
+// sleeps on _expiry_cond otherwise; _expiry_idle tells the arming side that a
+// wake up is needed. With _channel_idle_ms set it also looks for idle channels
+// every half idle period, so a channel is reclaimed at most 1.5 idle periods
+// after its last use.
+static void*
+_broker_expiry_thread(void* arg)
+{
+
+    struct message_broker_t* self = (struct message_broker_t*) arg;
+
+    size_t reclaim_period_ms = self->_channel_idle_ms / 2;
+    if (reclaim_period_ms < _EXPIRY_TICK_MS)
+    {
+        reclaim_period_ms = _EXPIRY_TICK_MS;
+    }
+
+    pthread_mutex_lock(&self->_expiry_mutex);
+    while (self->_expiry_running)
+    {
+
+        atomic_store(&self->_expiry_idle, 1);
+
+        size_t n_armed = 0;
+        timer_wheel_size(self->_expiry_wheel, &n_armed);
+        if (!n_armed && !self->_channel_idle_ms)
+        {
+
+            pthread_cond_wait(&self->_expiry_cond, &self->_expiry_mutex);
+            continue;
+        }
+
+        size_t wait_ms = reclaim_period_ms;
+        if (n_armed)
+        {
+
+            atomic_store(&self->_expiry_idle, 0);
+            wait_ms = _EXPIRY_TICK_MS;
+        }
+
+        struct timespec deadline;
+        _deadline_after_ms(wait_ms, &deadline);
+        pthread_cond_timedwait(&self->_expiry_cond, &self->_expiry_mutex,
+                               &deadline);
+
+        pthread_mutex_unlock(&self->_expiry_mutex);
+
+        uint64_t now_ms = _monotonic_ms();
+        if (n_armed)
+        {
+            timer_wheel_advance(self->_expiry_wheel, now_ms, NULL);
+        }
+
+        if (self->_channel_idle_ms && now_ms >= self->_next_reclaim_ms)
+        {
+
+            _broker_reclaim_channels(self);
+            self->_next_reclaim_ms = now_ms + reclaim_period_ms;
+        }
+
+        pthread_mutex_lock(&self->_expiry_mutex);
+    }
+    pthread_mutex_unlock(&self->_expiry_mutex);
+
+    return NULL;
+}
+
+static int
+_broker_expiry_start(struct message_broker_t* self)
+{
+
+    int exit_code = timer_wheel_new(_EXPIRY_TICK_MS, _monotonic_ms(),
+                                    &self->_expiry_wheel);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    pthread_mutex_init(&self->_expiry_mutex, NULL);
+    pthread_cond_init(&self->_expiry_cond, NULL);
+    self->_expiry_running = 1;
+    atomic_init(&self->_expiry_idle, 0);
+
+    exit_code = pthread_create(&self->_expiry_thread, NULL,
+                               _broker_expiry_thread, self);
+    if (exit_code)
+    {
+
+        pthread_cond_destroy(&self->_expiry_cond);
+        pthread_mutex_destroy(&self->_expiry_mutex);
+        timer_wheel_free(self->_expiry_wheel);
+
+        return exit_code;
+    }
+
+    return 0;
+}
+
+static void
+_broker_expiry_stop(struct message_broker_t* self)
+{
+
+    pthread_mutex_lock(&self->_expiry_mutex);
+    self->_expiry_running = 0;
+    pthread_cond_signal(&self->_expiry_cond);
+    pthread_mutex_unlock(&self->_expiry_mutex);
+
+    pthread_join(self->_expiry_thread, NULL);
+}
+
+int
+message_broker_new(struct message_broker_configuration_t* config,
+                   struct message_broker_t** out_self)
+{
+
+    if (!out_self)
+    {
+        return 1;
+    }
+
+    if (!config)
+    {
+        return 1;
+    }
+
+    if (!config->_n_threads && !config->_n_shards)
+    {
+        return 1;
+    }
+
+    if (!config->_channels_capacity)
+    {
+        return 1;
+    }
+
+    struct message_broker_t* self = malloc(sizeof(struct message_broker_t));
+    if (!self)
+    {
+        return -1;
+    }
+
+    self->_publisher_pool = NULL;
+    self->_global_message_ids = config->_global_message_ids;
+    self->_latency_tracing = config->_latency_tracing;
+    self->_n_shards = config->_n_shards;
+    self->_shards = NULL;
+    self->_inline_fanout_threshold = config->_inline_fanout_threshold;
+    atomic_init(&self->_has_partitions, 0);
+    self->_channel_idle_ms = config->_channel_idle_ms;
+    self->_next_reclaim_ms = 0;
+    atomic_init(&self->_n_reclaimed, 0);
+    self->_data_dir = NULL;
+
+    if (config->_data_dir)
+    {
+
+        self->_data_dir = strdup(config->_data_dir);
+        if (!self->_data_dir)
+        {
+            free(self);
+            return -1;
+        }
+    }
+
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    self->_n_stat_slots = n_cpus > 0 ? (size_t) n_cpus : 1;
+    self->_stats = _stat_slots_new(self->_n_stat_slots);
+    if (!self->_stats)
+    {
+
+        free(self->_data_dir);
+        free(self);
+
+        return -1;
+    }
+
+    int exit_code = 0;
+    if (self->_n_shards)
+    {
+        exit_code = _broker_shards_new(self);
+    }
+    else
+    {
+        exit_code = thread_pool_new(config->_n_threads, &self->_publisher_pool);
+    }
+
+    if (exit_code)
+    {
+        free(self->_stats);
+        free(self->_data_dir);
+        free(self);
+        return exit_code;
+    }
+
+    exit_code = generic_hash_table_new(config->_channels_capacity, _string_hash,
+                                       _channel_free_wrapper, _channel_copy,
+                                       _string_free, _string_copy,
+                                       _string_compare, &self->_channels);
+    if (exit_code)
+    {
+
+        _broker_executors_free(self);
+        free(self->_stats);
+        free(self->_data_dir);
+        free(self);
+
+        return exit_code;
+    }
+
+    exit_code = generic_hash_table_new(
+        config->_channels_capacity, _string_hash, _channel_free_wrapper,
+        _channel_copy, _string_free, _string_copy, _string_compare,
+        &self->_pattern_channels);
+    if (exit_code)
+    {
+
+        generic_hash_table_free(self->_channels);
+        _broker_executors_free(self);
+        free(self->_stats);
+        free(self->_data_dir);
+        free(self);
+
+        return exit_code;
+    }
+
+    exit_code = topic_trie_new(&self->_patterns);
+    if (exit_code)
+    {
+
+        generic_hash_table_free(self->_pattern_channels);
+        generic_hash_table_free(self->_channels);
+        _broker_executors_free(self);
+        free(self->_stats);
+        free(self->_data_dir);
+        free(self);
+
+        return exit_code;
+    }
+
+    exit_code = pthread_rwlock_init(&self->_patterns_lock, NULL);
+    if (exit_code)
+    {
+
+        topic_trie_free(self->_patterns);
+        generic_hash_table_free(self->_pattern_channels);
+        generic_hash_table_free(self->_channels);
+        _broker_executors_free(self);
+        free(self->_stats);
+        free(self->_data_dir);
+        free(self);
+
+        return exit_code;
+    }
+
+    atomic_init(&self->_n_patterns, 0);
+
+    exit_code = _broker_expiry_start(self);
+    if (exit_code)
+    {
+
+        pthread_rwlock_destroy(&self->_patterns_lock);
+        topic_trie_free(self->_patterns);
+        generic_hash_table_free(self->_pattern_channels);
+        generic_hash_table_free(self->_channels);
+        _broker_executors_free(self);
+        free(self->_stats);
+        free(self->_data_dir);
+        free(self);
+
+        return exit_code;
+    }
+
+    atomic_init(&self->_next_subscriber_id, 1);
+    atomic_init(&self->_next_message_id, 1);
+
+    // a logger that cannot start only costs the broker its log records
+    self->_logging = !logger_start(NULL);
+
+    *out_self = self;
+
+    return 0;
+}
+
+int
+message_broker_free(struct message_broker_t* self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    _broker_executors_free(self);
+    _broker_expiry_stop(self);
+
+    // the proxies cancel their expiry timer when freed with the channels
+    generic_hash_table_free(self->_channels);
+    generic_hash_table_free(self->_pattern_channels);
+    topic_trie_free(self->_patterns);
+    pthread_rwlock_destroy(&self->_patterns_lock);
+
+    timer_wheel_free(self->_expiry_wheel);
+    pthread_cond_destroy(&self->_expiry_cond);
+    pthread_mutex_destroy(&self->_expiry_mutex);
+    free(self->_stats);
+    free(self->_data_dir);
+
+    if (self->_logging)
+    {
+        logger_stop();
+    }
+
+    free(self);
+
+    return 0;
+}
+
+int
+message_broker_publish(struct message_broker_t* self, const char* channel,
+                       const char* content)
+{
+
+    if (!content)
+    {
+        return 1;
+    }
+
+    return message_broker_publish_bytes(self, channel, content,
+                                        strlen(content));
+}
+
+// @note fans the payload out on the caller thread when the channel has fewer
+// subscribers than the configured threshold and no pooled publish is pending
+// on it; returns 1 when the publish has been completed inline.
+static int
+_channel_try_fan_out_inline(struct message_broker_t* broker,
+                            struct channel_t* channel,
+                            struct _message_payload_t* payload)
+{
+
+    if (atomic_load(&channel->_n_subscribers)
+        >= broker->_inline_fanout_threshold)
+    {
+        return 0;
+    }
+
+    if (atomic_load(&channel->_n_pending_tasks))
+    {
+        return 0;
+    }
+
+    size_t subscriber_count = _broker_fan_out(broker, channel, &payload, 1);
+    _log_published(payload, subscriber_count);
+
+    return 1;
+}
+
+// @note resolved is the channel when the caller already has it (and holds a
+// reference on it), the publisher task then skips the lookup and takes its own
+// reference; the inline fast path needs it. Takes ownership of payload.
+static int
+_broker_publish_payload(struct message_broker_t* self,
+                        struct channel_t* resolved,
+                        struct thread_pool_t* executor,
+                        struct _message_payload_t* payload)
+{
+
+    if (resolved && self->_inline_fanout_threshold && !self->_n_shards)
+    {
+
+        if (_channel_try_fan_out_inline(self, resolved, payload))
+        {
+
+            _message_payload_release(payload);
+            return 0;
+        }
+    }
+
+    if (resolved)
+    {
+
+        atomic_fetch_add(&resolved->_n_refs, 1);
+        atomic_fetch_add(&resolved->_n_pending_tasks, 1);
+    }
+
+    struct _publisher_task_arg_t* task_arg =
+        malloc(sizeof(struct _publisher_task_arg_t));
+    if (!task_arg)
+    {
+
+        if (resolved)
+        {
+
+            atomic_fetch_sub(&resolved->_n_pending_tasks, 1);
+            _channel_release(self, resolved);
+        }
+        _message_payload_release(payload);
+
+        return -1;
+    }
+
+    task_arg->_payload = payload;
+    task_arg->_broker = self;
+    task_arg->_channel = resolved;
+
+    int exit_code = thread_pool_submit(executor, _publisher_task, task_arg);
+    if (exit_code)
+    {
+        _publisher_task_arg_free(task_arg);
+        return exit_code;
+    }
+
+    return 0;
+}
+
+int
+message_broker_publish_bytes(struct message_broker_t* self,
+                             const char* channel, const void* payload,
+                             size_t len)
+{
+    return message_broker_publish_with_options(self, channel, payload, len,
+                                               NULL);
+}
+
+int
+message_broker_publish_with_options(struct message_broker_t* self,
+                                    const char* channel, const void* payload,
+                                    size_t len,
+                                    const struct publish_options_t* options)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!channel)
+    {
+        return 1;
+    }
+
+    if (!payload && len)
+    {
+        return 1;
+    }
+
+    uint64_t message_id = _broker_take_message_ids(self, 1);
+
+    struct _message_payload_t* message_payload = NULL;
+    uint64_t ttl_ms = options ? options->_ttl_ms : 0;
+    int exit_code = _message_payload_new(
+        message_id, channel, payload, len, options ? options->_headers : NULL,
+        options ? options->_n_headers : 0, ttl_ms, self->_latency_tracing,
+        &message_payload);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    // a keyed publish needs the partitions of the channel to be routed
+    int keyed = options && options->_key;
+    if (keyed)
+    {
+        message_payload->_keyed = 1;
+        message_payload->_key_hash =
+            _bytes_hash(options->_key, options->_key_len);
+    }
+
+    // in sharded mode the partition picks the shard, see
+    // _broker_route_partition
+    int routed = self->_n_shards && atomic_load(&self->_has_partitions);
+
+    struct channel_t* resolved = NULL;
+    if (keyed || routed || (self->_inline_fanout_threshold && !self->_n_shards))
+    {
+
+        exit_code = _channel_acquire(self, channel, &resolved);
+        if (exit_code)
+        {
+
+            _message_payload_release(message_payload);
+            return exit_code;
+        }
+    }
+
+    if (resolved)
+    {
+        _broker_route_partition(self, resolved, message_payload);
+    }
+
+    struct thread_pool_t* executor =
+        _broker_payload_executor(self, message_payload);
+    exit_code =
+        _broker_publish_payload(self, resolved, executor, message_payload);
+
+    if (resolved)
+    {
+        _channel_release(self, resolved);
+    }
+
+    return exit_code;
+}
+
+int
+message_broker_channel_open(struct message_broker_t* self, const char* channel,
+                            struct channel_handle_t** out_handle)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!channel)
+    {
+        return 1;
+    }
+
+    if (!out_handle)
+    {
+        return 1;
+    }
+
+    struct channel_handle_t* handle = malloc(sizeof(struct channel_handle_t));
+    if (!handle)
+    {
+        return -1;
+    }
+
+    int exit_code = _channel_acquire(self, channel, &handle->_channel);
+    if (exit_code)
+    {
+        free(handle);
+        return exit_code;
+    }
+
+    handle->_broker = self;
+    handle->_executor = _broker_executor(self, channel);
+
+    *out_handle = handle;
+
+    return 0;
+}
+
+int
+message_broker_channel_close(struct channel_handle_t* self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    _channel_release(self->_broker, self->_channel);
+    free(self);
+
+    return 0;
+}
+
+int
+message_broker_publish_to(struct channel_handle_t* self, const void* payload,
+                          size_t len, const struct publish_options_t* options)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!payload && len)
+    {
+        return 1;
+    }
+
+    struct message_broker_t* broker = self->_broker;
+    uint64_t message_id = _broker_take_message_ids(broker, 1);
+
+    struct _message_payload_t* message_payload = NULL;
+    uint64_t ttl_ms = options ? options->_ttl_ms : 0;
+    int exit_code = _message_payload_new(
+        message_id, self->_channel->_channel_name, payload, len,
+        options ? options->_headers : NULL, options ? options->_n_headers : 0,
+        ttl_ms, broker->_latency_tracing, &message_payload);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    if (options && options->_key)
+    {
+        message_payload->_keyed = 1;
+        message_payload->_key_hash =
+            _bytes_hash(options->_key, options->_key_len);
+    }
+
+    _broker_route_partition(broker, self->_channel, message_payload);
+
+    struct thread_pool_t* executor =
+        message_payload->_routed
+            ? _broker_payload_executor(broker, message_payload)
+            : self->_executor;
+
+    return _broker_publish_payload(broker, self->_channel, executor,
+                                   message_payload);
+}
+
+// @note with the inline fast path, the batch is accounted in the pending tasks
+// of each of its channels before it is queued, see _n_pending_tasks.
+static int
+_publisher_batch_resolve_channels(struct message_broker_t* self,
+                                  struct _publisher_batch_task_arg_t* batch)
+{
+
+    qsort(batch->_payloads, batch->_n_payloads,
+          sizeof(struct _message_payload_t*), _payload_channel_compare);
+
+    batch->_channels = malloc(sizeof(struct channel_t*) * batch->_n_payloads);
+    if (!batch->_channels)
+    {
+        return -1;
+    }
+
+    size_t i = 0;
+    while (i < batch->_n_payloads)
+    {
+
+        const char* channel_name = batch->_payloads[i]->_channel_name;
+        if (i && !strcmp(batch->_payloads[i - 1]->_channel_name, channel_name))
+        {
+            i++;
+            continue;
+        }
+
+        struct channel_t* channel = NULL;
+        int exit_code = _channel_acquire(self, channel_name, &channel);
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        atomic_fetch_add(&channel->_n_pending_tasks, 1);
+        batch->_channels[batch->_n_channels] = channel;
+        batch->_n_channels++;
+
+        i++;
+    }
+
+    return 0;
+}
+
+// @note splits the batch into one task per shard owning at least one of its
+// channels, the relative order of the messages is kept inside each shard task.
+// Every task is allocated before any is submitted: on allocation failure the
+// whole batch is dropped and nothing has been published.
+static int
+_publisher_batch_submit_sharded(struct message_broker_t* self,
+                                struct _publisher_batch_task_arg_t* batch)
+{
+
+    size_t* counts = calloc(self->_n_shards, sizeof(size_t));
+    struct _publisher_batch_task_arg_t** tasks =
+        calloc(self->_n_shards, sizeof(struct _publisher_batch_task_arg_t*));
+    if (!counts || !tasks)
+    {
+
+        free(counts);
+        free(tasks);
+        _publisher_batch_task_arg_free(batch);
+
+        return -1;
+    }
+
+    size_t i = 0;
+    while (i < batch->_n_payloads)
+    {
+        counts[_broker_payload_shard(self, batch->_payloads[i])]++;
+        i++;
+    }
+
+    int exit_code = 0;
+    size_t shard = 0;
+    while (shard < self->_n_shards && !exit_code)
+    {
+
+        if (counts[shard])
+        {
+
+            tasks[shard] =
+                malloc(sizeof(struct _publisher_batch_task_arg_t)
+                       + sizeof(struct _message_payload_t*) * counts[shard]);
+            if (!tasks[shard])
+            {
+                exit_code = -1;
+                break;
+            }
+
+            tasks[shard]->_broker = self;
+            tasks[shard]->_channels = NULL;
+            tasks[shard]->_n_channels = 0;
+            tasks[shard]->_n_payloads = 0;
+        }
+
+        shard++;
+    }
+
+    if (exit_code)
+    {
+
+        shard = 0;
+        while (shard < self->_n_shards)
+        {
+            free(tasks[shard]);
+            shard++;
+        }
+
+        free(counts);
+        free(tasks);
+        _publisher_batch_task_arg_free(batch);
+
+        return exit_code;
+    }
+
+    i = 0;
+    while (i < batch->_n_payloads)
+    {
+
+        struct _publisher_batch_task_arg_t* task_arg =
+            tasks[_broker_payload_shard(self, batch->_payloads[i])];
+        task_arg->_payloads[task_arg->_n_payloads] = batch->_payloads[i];
+        task_arg->_n_payloads++;
+
+        i++;
+    }
+
+    free(batch);
+
+    shard = 0;
+    while (shard < self->_n_shards)
+    {
+
+        if (tasks[shard])
+        {
+
+            int submit_code = thread_pool_submit(
+                self->_shards[shard], _publisher_batch_task, tasks[shard]);
+            if (submit_code)
+            {
+
+                _publisher_batch_task_arg_free(tasks[shard]);
+                if (!exit_code)
+                {
+                    exit_code = submit_code;
+                }
+            }
+        }
+
+        shard++;
+    }
+
+    free(counts);
+    free(tasks);
+
+    return exit_code;
+}
+
+int
+message_broker_publish_batch(
+    struct message_broker_t* self,
+    const struct message_broker_batch_entry_t* entries, size_t n)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!entries)
+    {
+        return 1;
+    }
+
+    if (!n)
+    {
+        return 0;
+    }
+
+    size_t i = 0;
+    while (i < n)
+    {
+
+        if (!entries[i]._channel)
+        {
+            return 1;
+        }
+
+        if (!entries[i]._payload && entries[i]._len)
+        {
+            return 1;
+        }
+
+        i++;
+    }
+
+    struct _publisher_batch_task_arg_t* task_arg =
+        malloc(sizeof(struct _publisher_batch_task_arg_t)
+               + sizeof(struct _message_payload_t*) * n);
+    if (!task_arg)
+    {
+        return -1;
+    }
+
+    task_arg->_broker = self;
+    task_arg->_channels = NULL;
+    task_arg->_n_channels = 0;
+    task_arg->_n_payloads = 0;
+
+    uint64_t first_id = _broker_take_message_ids(self, n);
+
+    int exit_code = 0;
+    while (task_arg->_n_payloads < n)
+    {
+
+        size_t index = task_arg->_n_payloads;
+        const struct message_broker_batch_entry_t* entry = entries + index;
+
+        exit_code = _message_payload_new(
+            first_id ? first_id + index : 0, entry->_channel, entry->_payload,
+            entry->_len, entry->_headers, entry->_n_headers, entry->_ttl_ms,
+            self->_latency_tracing, &task_arg->_payloads[index]);
+        if (exit_code)
+        {
+
+            _publisher_batch_task_arg_free(task_arg);
+            return exit_code;
+        }
+
+        // the batch order until the channel stamps its sequence, see
+        // _payload_channel_compare
+        task_arg->_payloads[index]->_sequence = index;
+        task_arg->_n_payloads++;
+    }
+
+    if (self->_n_shards > 1)
+    {
+
+        if (atomic_load(&self->_has_partitions))
+        {
+
+            i = 0;
+            while (i < n)
+            {
+
+                struct _partition_route_t route = {
+                    ._broker = self, ._payload = task_arg->_payloads[i]};
+                struct channel_t* ch = NULL;
+                generic_hash_table_get_apply(
+                    self->_channels, (void*) entries[i]._channel,
+                    _channel_route_payload, &route, (void**) &ch);
+
+                i++;
+            }
+        }
+
+        return _publisher_batch_submit_sharded(self, task_arg);
+    }
+
+    if (self->_inline_fanout_threshold && !self->_n_shards)
+    {
+
+        exit_code = _publisher_batch_resolve_channels(self, task_arg);
+        if (exit_code)
+        {
+
+            _publisher_batch_task_arg_free(task_arg);
+            return exit_code;
+        }
+    }
+
+    exit_code =
+        thread_pool_submit(_broker_executor(self, entries[0]._channel),
+                           _publisher_batch_task, task_arg);
+    if (exit_code)
+    {
+        _publisher_batch_task_arg_free(task_arg);
+        return exit_code;
+    }
+
+    return 0;
+}
+
+int
+message_broker_declare_channel(struct message_broker_t* self,
+                               const char* channel,
+                               const struct channel_options_t* options)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!channel)
+    {
+        return 1;
+    }
+
+    if (!options)
+    {
+        return 1;
+    }
+
+    if (options->_storage < CHANNEL_STORAGE_QUEUE
+        || options->_storage > CHANNEL_STORAGE_LOG)
+    {
+        return 1;
+    }
+
+    if (options->_n_partitions > _MAX_PARTITIONS
+        || (options->_n_partitions > 1
+            && options->_storage != CHANNEL_STORAGE_QUEUE))
+    {
+        return 1;
+    }
+
+    // the channel name becomes a directory under _data_dir
+    if (options->_durable
+        && (options->_storage != CHANNEL_STORAGE_LOG || !self->_data_dir
+            || strchr(channel, '/') || channel[0] == '.' || !channel[0]))
+    {
+        return 1;
+    }
+
+    struct channel_t* ch = NULL;
+    int exit_code = _channel_acquire(self, channel, &ch);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    atomic_store(&ch->_declared, 1);
+
+    struct _channel_storage_call_t storage_call = {._broker = self,
+                                                   ._options = options};
+    exit_code = _channel_call(self, ch, _channel_set_storage, &storage_call);
+    if (exit_code)
+    {
+
+        _channel_release(self, ch);
+        return exit_code;
+    }
+
+    atomic_store(&ch->_default_ttl_ms, options->_default_ttl_ms);
+    _channel_release(self, ch);
+
+    return 0;
+}
+
+static void
+_channel_load_expired(void* value, void* context)
+{
+    *(size_t*) context =
+        atomic_load(&((struct channel_t*) value)->_n_expired);
+}
+
+int
+message_broker_get_channel_counts(struct message_broker_t* self,
+                                  size_t* out_n_live, size_t* out_n_reclaimed)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_n_live)
+    {
+        return 1;
+    }
+
+    if (!out_n_reclaimed)
+    {
+        return 1;
+    }
+
+    generic_hash_table_get_size(self->_channels, out_n_live);
+    *out_n_reclaimed = atomic_load(&self->_n_reclaimed);
+
+    return 0;
+}
+
+int
+message_broker_get_channel_expired_count(struct message_broker_t* self,
+                                         const char* channel,
+                                         size_t* out_count)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!channel)
+    {
+        return 1;
+    }
+
+    if (!out_count)
+    {
+        return 1;
+    }
+
+    // read under the bucket lock, no reference needed
+    struct channel_t* ch = NULL;
+    int exit_code = generic_hash_table_get_apply(
+        self->_channels, (void*) channel, _channel_load_expired, out_count,
+        (void**) &ch);
+    if (exit_code || !ch)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+message_broker_get_stats(struct message_broker_t* self,
+                         struct message_broker_stats_t* out_stats)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_stats)
+    {
+        return 1;
+    }
+
+    memset(out_stats, 0, sizeof(struct message_broker_stats_t));
+    _stat_counters_load(self->_stats, self->_n_stat_slots,
+                        &out_stats->_counters);
+
+    if (self->_n_shards)
+    {
+
+        size_t i = 0;
+        while (i < self->_n_shards)
+        {
+
+            size_t n_pending = 0;
+            thread_pool_get_pending_count(self->_shards[i], &n_pending);
+            out_stats->_n_pending_tasks += n_pending;
+
+            i++;
+        }
+    }
+    else
+    {
+        thread_pool_get_pending_count(self->_publisher_pool,
+                                      &out_stats->_n_pending_tasks);
+    }
+
+    generic_hash_table_get_size(self->_channels, &out_stats->_n_channels);
+
+    return 0;
+}
+
+static void
+_channel_load_stats(void* value, void* context)
+{
+
+    struct channel_t* channel = (struct channel_t*) value;
+    struct channel_stats_t* stats = (struct channel_stats_t*) context;
+
+    _stat_counters_load(channel->_stats, channel->_n_stat_slots,
+                        &stats->_counters);
+    stats->_n_subscribers = atomic_load(&channel->_n_subscribers);
+}
+
+int
+message_broker_get_channel_stats(struct message_broker_t* self,
+                                 const char* channel,
+                                 struct channel_stats_t* out_stats)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!channel)
+    {
+        return 1;
+    }
+
+    if (!out_stats)
+    {
+        return 1;
+    }
+
+    memset(out_stats, 0, sizeof(struct channel_stats_t));
+
+    // read under the bucket lock, no reference needed
+    struct channel_t* ch = NULL;
+    int exit_code = generic_hash_table_get_apply(
+        self->_channels, (void*) channel, _channel_load_stats, out_stats,
+        (void**) &ch);
+    if (exit_code || !ch)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// @note _merged is allocated by the caller, the slots are merged into it
+// under the bucket lock.
+struct _latency_query_t
+{
+    enum message_latency_stage_t _stage;
+    latency_histogram _merged;
+    struct message_latency_t* _latency;
+};
+
+static void
+_channel_load_latency(void* value, void* context)
+{
+
+    struct channel_t* channel = (struct channel_t*) value;
+    struct _latency_query_t* query = (struct _latency_query_t*) context;
+
+    // freed with the channel, which cannot go while the bucket lock is held
+    struct _channel_latency_t* latency = atomic_load(&channel->_latency);
+    if (!latency)
+    {
+        return;
+    }
+
+    latency_histogram histogram = query->_merged;
+
+    size_t i = 0;
+    while (i < latency->_n_slots)
+    {
+
+        struct _latency_slot_t* slot = atomic_load(&latency->_slots[i]);
+        if (slot)
+        {
+            latency_histogram_merge(histogram, slot->_stages[query->_stage]);
+        }
+
+        i++;
+    }
+
+    struct message_latency_t* out = query->_latency;
+
+    latency_histogram_get_count(histogram, &out->_count);
+    latency_histogram_get_percentile(histogram, 50, &out->_p50_ns);
+    latency_histogram_get_percentile(histogram, 90, &out->_p90_ns);
+    latency_histogram_get_percentile(histogram, 99, &out->_p99_ns);
+    latency_histogram_get_percentile(histogram, 99.9, &out->_p999_ns);
+    latency_histogram_get_max(histogram, &out->_max_ns);
+}
+
+int
+message_broker_get_channel_latency(struct message_broker_t* self,
+                                   const char* channel,
+                                   enum message_latency_stage_t stage,
+                                   struct message_latency_t* out_latency)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!channel)
+    {
+        return 1;
+    }
+
+    if (stage < MESSAGE_LATENCY_FAN_OUT || stage > MESSAGE_LATENCY_DEQUEUE)
+    {
+        return 1;
+    }
+
+    if (!out_latency)
+    {
+        return 1;
+    }
+
+    memset(out_latency, 0, sizeof(struct message_latency_t));
+
+    struct _latency_query_t query = {
+        ._stage = stage, ._merged = NULL, ._latency = out_latency};
+    if (latency_histogram_new(&query._merged))
+    {
+        return -1;
+    }
+
+    struct channel_t* ch = NULL;
+    int exit_code = generic_hash_table_get_apply(
+        self->_channels, (void*) channel, _channel_load_latency, &query,
+        (void**) &ch);
+    latency_histogram_free(query._merged);
+    if (exit_code || !ch)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Returns 1 when options (may be NULL) are not valid.
+static int
+_subscription_options_validate(const struct subscription_options_t* options)
+{
+
+    if (options
+        && (options->_overflow_policy < SUBSCRIPTION_OVERFLOW_DROP_OLDEST
+            || options->_overflow_policy > SUBSCRIPTION_OVERFLOW_DISCONNECT))
+    {
+        return 1;
+    }
+
+    if (options && options->_name
+        && (!options->_name[0] || strchr(options->_name, '\n')))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+// @note group (may be NULL) makes the subscription a member of that consumer
+// group of the channel.
+static int
+_broker_subscribe(struct message_broker_t* self, struct channel_t* channel,
+                  const char* group,
+                  const struct subscription_options_t* options,
+                  struct subscription_t** out_subscription)
+{
+
+    uint64_t subscriber_id = atomic_fetch_add(&self->_next_subscriber_id, 1);
+
+    struct subscriber_proxy_t* proxy = NULL;
+    int exit_code =
+        _subscriber_proxy_new(subscriber_id, options, self, channel, &proxy);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    if (group)
+    {
+
+        struct _group_join_t join = {._proxy = proxy, ._group = group};
+        exit_code = _channel_call(self, channel, _channel_join_group, &join);
+    }
+    else
+    {
+        exit_code = _channel_call(self, channel, _channel_attach, proxy);
+    }
+
+    if (exit_code)
+    {
+        _subscriber_proxy_free(proxy);
+        return exit_code;
+    }
+
+    struct subscription_t* subscription = malloc(sizeof(struct subscription_t));
+    if (!subscription)
+    {
+        return -1;
+    }
+
+    subscription->_id = subscriber_id;
+    subscription->_broker = self;
+    subscription->_proxy = proxy;
+    subscription->_active = 1;
+    subscription->_is_pattern = 0;
+
+    size_t channel_len = strlen(channel->_channel_name);
+    subscription->_channel_name = malloc(channel_len + 1);
+    if (!subscription->_channel_name)
+    {
+        free(subscription);
+        return -1;
+    }
+    memcpy(subscription->_channel_name, channel->_channel_name,
+           channel_len + 1);
+
+    *out_subscription = subscription;
+
+    return 0;
+}
+
+int
+message_broker_subscribe(struct message_broker_t* self, const char* channel,
+                         struct subscription_t** out_subscription)
+{
+    return message_broker_subscribe_with_options(self, channel, NULL,
+                                                 out_subscription);
+}
+
+int
+message_broker_subscribe_with_options(
+    struct message_broker_t* self, const char* channel,
+    const struct subscription_options_t* options,
+    struct subscription_t** out_subscription)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!channel)
+    {
+        return 1;
+    }
+
+    if (!out_subscription)
+    {
+        return 1;
+    }
+
+    if (_subscription_options_validate(options))
+    {
+        return 1;
+    }
+
+    struct channel_t* ch = NULL;
+    int exit_code = _channel_acquire(self, channel, &ch);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    exit_code = _broker_subscribe(self, ch, NULL, options, out_subscription);
+    _channel_release(self, ch);
+
+    return exit_code;
+}
+
+int
+message_broker_subscribe_group(struct message_broker_t* self,
+                               const char* channel, const char* group,
+                               const struct subscription_options_t* options,
+                               struct subscription_t** out_subscription)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!channel)
+    {
+        return 1;
+    }
+
+    if (!group || !*group)
+    {
+        return 1;
+    }
+
+    if (!out_subscription)
+    {
+        return 1;
+    }
+
+    // the members share a position, there is none of their own to persist
+    if (_subscription_options_validate(options) || (options && options->_name))
+    {
+        return 1;
+    }
+
+    struct channel_t* ch = NULL;
+    int exit_code = _channel_acquire(self, channel, &ch);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    exit_code = _broker_subscribe(self, ch, group, options, out_subscription);
+    _channel_release(self, ch);
+
+    return exit_code;
+}
+
+int
+message_broker_subscribe_pattern(struct message_broker_t* self,
+                                 const char* pattern,
+                                 const struct subscription_options_t* options,
+                                 struct subscription_t** out_subscription)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!pattern || topic_trie_validate(pattern))
+    {
+        return 1;
+    }
+
+    if (!out_subscription)
+    {
+        return 1;
+    }
+
+    // a pattern spans channels, there is no single log to keep a position in
+    if (_subscription_options_validate(options) || (options && options->_name))
+    {
+        return 1;
+    }
+
+    // the channel sequences overlap, a cumulative ack needs broker-wide ids
+    if (options && options->_ack_window && !self->_global_message_ids)
+    {
+        return 1;
+    }
+
+    struct channel_t* ch = NULL;
+    int exit_code = generic_hash_table_compute_if_absent(
+        self->_pattern_channels, (void*) pattern, _pattern_channel_create, self,
+        (void**) &ch);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    exit_code = _broker_subscribe(self, ch, NULL, options, out_subscription);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    (*out_subscription)->_is_pattern = 1;
+    _broker_sync_pattern(self, ch);
+
+    return 0;
+}
+
+int
+message_broker_subscribe_to(struct channel_handle_t* self,
+                            const struct subscription_options_t* options,
+                            struct subscription_t** out_subscription)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_subscription)
+    {
+        return 1;
+    }
+
+    if (_subscription_options_validate(options))
+    {
+        return 1;
+    }
+
+    return _broker_subscribe(self->_broker, self->_channel, NULL, options,
+                             out_subscription);
+}
+
+// @note the durable channels are referenced under their bucket lock and synced
+// once it is released: a sync waits for a commit, which may take a while.
+struct _durable_channels_t
+{
+    struct channel_t** _channels;
+    size_t _n;
+    size_t _capacity;
+    int _exit_code;
+};
+
+static void
+_channel_collect_durable(void* key, void* value, void* context)
+{
+
+    (void) key;
+    struct channel_t* channel = (struct channel_t*) value;
+    struct _durable_channels_t* durable = (struct _durable_channels_t*) context;
+
+    if (!channel->_wal)
+    {
+        return;
+    }
+
+    if (durable->_n == durable->_capacity)
+    {
+
+        size_t capacity = durable->_capacity ? 2 * durable->_capacity : 8;
+        struct channel_t** channels =
+            realloc(durable->_channels, capacity * sizeof(*channels));
+        if (!channels)
+        {
+
+            durable->_exit_code = -1;
+            return;
+        }
+
+        durable->_channels = channels;
+        durable->_capacity = capacity;
+    }
+
+    atomic_fetch_add(&channel->_n_refs, 1);
+    durable->_channels[durable->_n++] = channel;
+}
+
+static int
+_broker_sync_wal(struct message_broker_t* self)
+{
+
+    struct _durable_channels_t durable = {
+        ._channels = NULL, ._n = 0, ._capacity = 0, ._exit_code = 0};
+    generic_hash_table_for_each_context(self->_channels,
+                                        _channel_collect_durable, &durable);
+
+    int first_error = durable._exit_code;
+
+    size_t i = 0;
+    while (i < durable._n)
+    {
+
+        struct channel_t* channel = durable._channels[i];
+
+        int exit_code = wal_sync(channel->_wal);
+        if (!exit_code)
+        {
+            exit_code = atomic_load(&channel->_wal_error);
+        }
+
+        if (exit_code && !first_error)
+        {
+            first_error = exit_code;
+        }
+
+        _channel_release(self, channel);
+
+        i++;
+    }
+
+    free(durable._channels);
+
+    return first_error;
+}
+
+int
+message_broker_wait(struct message_broker_t* self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    int first_error = 0;
+
+    if (!self->_n_shards)
+    {
+        first_error = thread_pool_wait(self->_publisher_pool);
+    }
+
+    size_t i = 0;
+    while (i < self->_n_shards)
+    {
+
+        int exit_code = thread_pool_wait(self->_shards[i]);
+        if (exit_code && !first_error)
+        {
+            first_error = exit_code;
+        }
+
+        i++;
+    }
+
+    // every publish has been appended, the durable ones are committed too
+    if (self->_data_dir)
+    {
+
+        int exit_code = _broker_sync_wal(self);
+        if (exit_code && !first_error)
+        {
+            first_error = exit_code;
+        }
+    }
+
+    return first_error;
+}
+
+// @note log storage counterpart of _subscriber_proxy_pop_live: the message
+// wraps the payload read through the cursor, no copy is made. The inbox mutex
+// serializes the receivers of the subscription on the cursor. out_offset (may
+// be NULL) is set to the log offset of the message.
+static int
+_subscriber_proxy_pop_log(struct subscriber_proxy_t* self,
+                          struct message_t** out_msg, uint64_t* out_offset)
+{
+
+    uint64_t now_ms = 0;
+
+    pthread_mutex_lock(&self->_inbox_mutex);
+
+    while (1)
+    {
+
+        struct _message_payload_t* payload = NULL;
+        if (generic_log_cursor_next(self->_cursor, (void**) &payload))
+        {
+
+            pthread_mutex_unlock(&self->_inbox_mutex);
+            return 1;
+        }
+
+        uint64_t expires_at_ms = payload->_expires_at_ms;
+        if (expires_at_ms)
+        {
+
+            if (!now_ms)
+            {
+                now_ms = _monotonic_ms();
+            }
+
+            if (expires_at_ms <= now_ms)
+            {
+
+                _subscriber_proxy_count_expired(self, 1);
+                continue;
+            }
+        }
+
+        int exit_code = _message_new(payload, out_msg);
+        if (!exit_code)
+        {
+            _subscriber_proxy_count_delivered(self, out_msg, 1);
+        }
+
+        uint64_t offset = 0;
+        generic_log_cursor_get_offset(self->_cursor, &offset);
+        if (out_offset)
+        {
+            *out_offset = offset - 1;
+        }
+
+        // at-least-once: the position is persisted once the message is handed
+        // out, a crash before the next commit delivers it again. In ack mode
+        // it is persisted by the acks instead.
+        if (self->_name && self->_channel->_wal && !self->_ack_window)
+        {
+            wal_commit_offset(self->_channel->_wal, self->_name, offset);
+        }
+
+        pthread_mutex_unlock(&self->_inbox_mutex);
+
+        return exit_code;
+    }
+}
+
+// @note blocks while the log tail is still seen_tail, i.e. until a message is
+// appended after the caller found the cursor caught up, or the proxy is
+// deactivated.
+static void
+_subscriber_proxy_wait_log(struct subscriber_proxy_t* self, uint64_t seen_tail)
+{
+
+    struct channel_t* channel = self->_channel;
+
+    atomic_fetch_add(&channel->_n_log_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    pthread_mutex_lock(&channel->_log_mutex);
+
+    uint64_t tail = 0;
+    generic_log_get_tail(channel->_log, &tail);
+    while (tail == seen_tail && self->_active)
+    {
+
+        pthread_cond_wait(&channel->_log_cond, &channel->_log_mutex);
+        generic_log_get_tail(channel->_log, &tail);
+    }
+
+    pthread_mutex_unlock(&channel->_log_mutex);
+
+    atomic_fetch_sub(&channel->_n_log_waiters, 1);
+}
+
+// @note dequeues the first message that has not expired, the expired ones met
+// on the way are dropped and accounted to the channel; returns 1 when no live
+// message is pending.
+static int
+_subscriber_proxy_pop_live(struct subscriber_proxy_t* self,
+                           struct message_t** out_msg)
+{
+
+    if (self->_cursor)
+    {
+        return _subscriber_proxy_pop_log(self, out_msg, NULL);
+    }
+
+    uint64_t now_ms = 0;
+
+    while (1)
+    {
+
+        struct message_t* msg = NULL;
+        int exit_code = generic_queue_syn_dequeue(self->_inbox, (void**) &msg);
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        if (!msg)
+        {
+            return 1;
+        }
+
+        uint64_t expires_at_ms = msg->_payload->_expires_at_ms;
+        if (expires_at_ms)
+        {
+
+            if (!now_ms)
+            {
+                now_ms = _monotonic_ms();
+            }
+
+            if (expires_at_ms <= now_ms)
+            {
+
+                message_free(msg);
+                _subscriber_proxy_count_expired(self, 1);
+
+                continue;
+            }
+        }
+
+        _subscriber_proxy_count_delivered(self, &msg, 1);
+        *out_msg = msg;
+
+        return 0;
+    }
+}
+
+static void
+_subscriber_proxy_track(struct subscriber_proxy_t* self,
+                        struct _message_payload_t* payload, uint64_t offset,
+                        uint64_t now_ms)
+{
+
+    size_t n_in_flight = atomic_load(&self->_n_in_flight);
+    size_t index = (self->_in_flight_head + n_in_flight) % self->_ack_window;
+
+    self->_in_flight[index]._payload = payload;
+    self->_in_flight[index]._offset = offset;
+    self->_in_flight[index]._redeliver_at_ms = now_ms + self->_ack_timeout_ms;
+
+    atomic_store(&self->_n_in_flight, n_in_flight + 1);
+}
+
+// @note ack mode counterpart of _subscriber_proxy_pop_live: a message whose ack
+// timed out is delivered again before any new one, and no new message is
+// dequeued while the window is full. Redelivered messages that expired
+// meanwhile are dropped.
+static int
+_subscriber_proxy_pop_tracked(struct subscriber_proxy_t* self,
+                              struct message_t** out_msg)
+{
+
+    pthread_mutex_lock(&self->_in_flight_mutex);
+
+    uint64_t now_ms = _monotonic_ms();
+
+    while (atomic_load(&self->_n_in_flight))
+    {
+
+        struct _in_flight_t head = self->_in_flight[self->_in_flight_head];
+        if (head._redeliver_at_ms > now_ms)
+        {
+            break;
+        }
+
+        self->_in_flight_head = (self->_in_flight_head + 1) % self->_ack_window;
+        atomic_fetch_sub(&self->_n_in_flight, 1);
+
+        uint64_t expires_at_ms = head._payload->_expires_at_ms;
+        if (expires_at_ms && expires_at_ms <= now_ms)
+        {
+
+            _message_payload_release(head._payload);
+            _subscriber_proxy_count_expired(self, 1);
+
+            continue;
+        }
+
+        _subscriber_proxy_track(self, head._payload, head._offset, now_ms);
+        atomic_fetch_add(&self->_n_redelivered, 1);
+
+        int exit_code = _message_new(head._payload, out_msg);
+        if (!exit_code)
+        {
+            _subscriber_proxy_count_delivered(self, out_msg, 1);
+        }
+        pthread_mutex_unlock(&self->_in_flight_mutex);
+
+        return exit_code;
+    }
+
+    if (atomic_load(&self->_n_in_flight) == self->_ack_window)
+    {
+
+        pthread_mutex_unlock(&self->_in_flight_mutex);
+        return 1;
+    }
+
+    struct message_t* msg = NULL;
+    uint64_t offset = 0;
+    int exit_code = self->_cursor
+                        ? _subscriber_proxy_pop_log(self, &msg, &offset)
+                        : _subscriber_proxy_pop_live(self, &msg);
+    if (exit_code == 0)
+    {
+
+        _message_payload_acquire(msg->_payload);
+        _subscriber_proxy_track(self, msg->_payload, offset, now_ms);
+
+        *out_msg = msg;
+    }
+
+    pthread_mutex_unlock(&self->_in_flight_mutex);
+
+    return exit_code;
+}
+
+// @note blocks until something may be deliverable: a message is appended (or
+// enqueued) while the ack window, if any, has room, an ack frees room,
+// until_ms (monotonic, 0 for none) is reached or the proxy is deactivated.
+static void
+_subscriber_proxy_wait_until(struct subscriber_proxy_t* self,
+                             uint64_t seen_tail, size_t seen_acks,
+                             uint64_t until_ms)
+{
+
+    int window_full = self->_ack_window
+                      && atomic_load(&self->_n_in_flight) == self->_ack_window;
+
+    struct timespec deadline;
+    if (until_ms)
+    {
+
+        uint64_t now_ms = _monotonic_ms();
+        _deadline_after_ms(until_ms > now_ms ? until_ms - now_ms : 0,
+                           &deadline);
+    }
+
+    struct channel_t* channel = self->_channel;
+    pthread_mutex_t* mutex = &self->_inbox_mutex;
+    pthread_cond_t* cond = &self->_inbox_cond;
+    if (self->_cursor)
+    {
+
+        mutex = &channel->_log_mutex;
+        cond = &channel->_log_cond;
+
+        atomic_fetch_add(&channel->_n_log_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+
+    pthread_mutex_lock(mutex);
+
+    while (self->_active && atomic_load(&self->_n_acks) == seen_acks)
+    {
+
+        if (!window_full)
+        {
+
+            uint64_t tail = 0;
+            if (self->_cursor)
+            {
+                generic_log_get_tail(channel->_log, &tail);
+            }
+
+            if (self->_cursor ? tail != seen_tail
+                              : generic_queue_syn_is_empty(self->_inbox) != 1)
+            {
+                break;
+            }
+        }
+
+        if (!until_ms)
+        {
+            pthread_cond_wait(cond, mutex);
+        }
+        else if (pthread_cond_timedwait(cond, mutex, &deadline))
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(mutex);
+
+    if (self->_cursor)
+    {
+        atomic_fetch_sub(&channel->_n_log_waiters, 1);
+    }
+}
+
+static uint64_t
+_subscriber_proxy_next_redelivery_ms(struct subscriber_proxy_t* self)
+{
+
+    pthread_mutex_lock(&self->_in_flight_mutex);
+    uint64_t redeliver_at_ms =
+        atomic_load(&self->_n_in_flight)
+            ? self->_in_flight[self->_in_flight_head]._redeliver_at_ms
+            : 0;
+    pthread_mutex_unlock(&self->_in_flight_mutex);
+
+    return redeliver_at_ms;
+}
+
+static int
+_subscriber_proxy_receive_tracked(struct subscriber_proxy_t* self,
+                                  struct message_t** out_msg)
+{
+
+    while (1)
+    {
+
+        // read before trying, a publish or an ack racing with the attempt
+        // then prevents the wait
+        uint64_t seen_tail = 0;
+        if (self->_cursor)
+        {
+            generic_log_get_tail(self->_channel->_log, &seen_tail);
+        }
+        size_t seen_acks = atomic_load(&self->_n_acks);
+
+        struct message_t* msg = NULL;
+        int exit_code = _subscriber_proxy_pop_tracked(self, &msg);
+        if (exit_code != 1)
+        {
+
+            *out_msg = exit_code ? NULL : msg;
+            return exit_code;
+        }
+
+        _subscriber_proxy_wait_until(
+            self, seen_tail, seen_acks,
+            _subscriber_proxy_next_redelivery_ms(self));
+        if (!self->_active)
+        {
+
+            *out_msg = NULL;
+            return 1;
+        }
+    }
+}
+
+int
+subscription_receive(struct subscription_t* self, struct message_t** out_msg)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_msg)
+    {
+        return 1;
+    }
+
+    if (!self->_active)
+    {
+        return 1;
+    }
+
+    if (!self->_proxy)
+    {
+        return 1;
+    }
+
+    if (!self->_proxy->_active)
+    {
+        return 1;
+    }
+
+    struct subscriber_proxy_t* proxy = self->_proxy;
+
+    if (proxy->_ack_window)
+    {
+        return _subscriber_proxy_receive_tracked(proxy, out_msg);
+    }
+
+    while (proxy->_cursor)
+    {
+
+        // read before trying, an append racing with the attempt then
+        // prevents the wait
+        uint64_t seen_tail = 0;
+        generic_log_get_tail(proxy->_channel->_log, &seen_tail);
+
+        struct message_t* msg = NULL;
+        int exit_code = _subscriber_proxy_pop_log(proxy, &msg, NULL);
+        if (exit_code != 1)
+        {
+
+            *out_msg = exit_code ? NULL : msg;
+            return exit_code;
+        }
+
+        _subscriber_proxy_wait_log(proxy, seen_tail);
+        if (!proxy->_active)
+        {
+
+            *out_msg = NULL;
+            return 1;
+        }
+    }
+
+    // loops when everything that was pending had expired meanwhile
+    while (1)
+    {
+
+        pthread_mutex_lock(&proxy->_inbox_mutex);
+
+        while (generic_queue_syn_is_empty(proxy->_inbox) == 1
+               && proxy->_active)
+        {
+            pthread_cond_wait(&proxy->_inbox_cond, &proxy->_inbox_mutex);
+        }
+
+        if (!proxy->_active)
+        {
+
+            pthread_mutex_unlock(&proxy->_inbox_mutex);
+            *out_msg = NULL;
+
+            return 1;
+        }
+
+        pthread_mutex_unlock(&proxy->_inbox_mutex);
+
+        struct message_t* msg = NULL;
+        int exit_code = _subscriber_proxy_pop_live(proxy, &msg);
+        if (exit_code == 0)
+        {
+
+            *out_msg = msg;
+            return 0;
+        }
+
+        if (exit_code != 1)
+        {
+
+            *out_msg = NULL;
+            return exit_code;
+        }
+    }
+}
+
+static int
+_subscriber_proxy_has_pending(struct subscriber_proxy_t* self)
+{
+
+    if (self->_cursor)
+    {
+
+        size_t lag = 0;
+        pthread_mutex_lock(&self->_inbox_mutex);
+        generic_log_cursor_get_lag(self->_cursor, &lag);
+        pthread_mutex_unlock(&self->_inbox_mutex);
+
+        return lag > 0;
+    }
+
+    return generic_queue_syn_is_empty(self->_inbox) == 0;
+}
+
+// @note called once a receive found nothing: the eventfd stops being readable,
+// then the inbox is checked again since a publish racing with the drain may
+// have seen the eventfd still armed and skipped its write.
+static void
+_subscriber_proxy_clear_fd(struct subscriber_proxy_t* self)
+{
+
+    int event_fd = atomic_load(&self->_event_fd);
+    if (event_fd < 0 || !atomic_load(&self->_fd_armed))
+    {
+        return;
+    }
+
+    atomic_store(&self->_fd_armed, 0);
+
+    eventfd_t value = 0;
+    eventfd_read(event_fd, &value);
+
+    if (self->_active && _subscriber_proxy_has_pending(self))
+    {
+        _subscriber_proxy_notify_fd(self);
+    }
+}
+
+// @note log storage counterpart of _subscriber_proxy_pop_batch, reads up to max
+// messages through the cursor under a single acquisition of the inbox mutex.
+static int
+_subscriber_proxy_pop_log_batch(struct subscriber_proxy_t* self,
+                                struct message_t** out_msgs, size_t max,
+                                size_t* out_n)
+{
+
+    int exit_code = 0;
+    size_t n = 0;
+    uint64_t now_ms = 0;
+
+    pthread_mutex_lock(&self->_inbox_mutex);
+
+    while (n < max)
+    {
+
+        struct _message_payload_t* payload = NULL;
+        if (generic_log_cursor_next(self->_cursor, (void**) &payload))
+        {
+            break;
+        }
+
+        uint64_t expires_at_ms = payload->_expires_at_ms;
+        if (expires_at_ms)
+        {
+
+            if (!now_ms)
+            {
+                now_ms = _monotonic_ms();
+            }
+
+            if (expires_at_ms <= now_ms)
+            {
+
+                _subscriber_proxy_count_expired(self, 1);
+                continue;
+            }
+        }
+
+        exit_code = _message_new(payload, &out_msgs[n]);
+        if (exit_code)
+        {
+            break;
+        }
+
+        n++;
+    }
+
+    _subscriber_proxy_count_delivered(self, out_msgs, n);
+
+    // see _subscriber_proxy_pop_log
+    if (n && self->_name && self->_channel->_wal)
+    {
+
+        uint64_t offset = 0;
+        generic_log_cursor_get_offset(self->_cursor, &offset);
+        wal_commit_offset(self->_channel->_wal, self->_name, offset);
+    }
+
+    pthread_mutex_unlock(&self->_inbox_mutex);
+
+    *out_n = n;
+
+    return n ? 0 : exit_code;
+}
+
+// @note takes up to max live messages at once: the inbox is drained with a
+// single acquisition of the queue lock, the expired messages are dropped
+// afterwards. In ack mode every message still goes through the window.
+static int
+_subscriber_proxy_pop_batch(struct subscriber_proxy_t* self,
+                            struct message_t** out_msgs, size_t max,
+                            size_t* out_n)
+{
+
+    *out_n = 0;
+
+    if (self->_ack_window)
+    {
+
+        int exit_code = 0;
+        while (*out_n < max)
+        {
+
+            exit_code = _subscriber_proxy_pop_tracked(self, &out_msgs[*out_n]);
+            if (exit_code)
+            {
+                break;
+            }
+
+            (*out_n)++;
+        }
+
+        return *out_n || exit_code == 1 ? 0 : exit_code;
+    }
+
+    if (self->_cursor)
+    {
+        return _subscriber_proxy_pop_log_batch(self, out_msgs, max, out_n);
+    }
+
+    size_t n_dequeued = 0;
+    int exit_code = generic_queue_syn_dequeue_batch(
+        self->_inbox, (void**) out_msgs, max, &n_dequeued);
+
+    uint64_t now_ms = 0;
+    size_t n_live = 0;
+    size_t i = 0;
+    while (i < n_dequeued)
+    {
+
+        struct message_t* msg = out_msgs[i];
+        uint64_t expires_at_ms = msg->_payload->_expires_at_ms;
+        if (expires_at_ms)
+        {
+
+            if (!now_ms)
+            {
+                now_ms = _monotonic_ms();
+            }
+
+            if (expires_at_ms <= now_ms)
+            {
+
+                message_free(msg);
+                _subscriber_proxy_count_expired(self, 1);
+
+                i++;
+                continue;
+            }
+        }
+
+        out_msgs[n_live] = msg;
+        n_live++;
+        i++;
+    }
+
+    _subscriber_proxy_count_delivered(self, out_msgs, n_live);
+    *out_n = n_live;
+
+    return n_live ? 0 : exit_code;
+}
+
+int
+subscription_receive_batch(struct subscription_t* self,
+                           struct message_t** out_msgs, size_t max,
+                           size_t timeout_ms, size_t* out_n)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_msgs || !max)
+    {
+        return 1;
+    }
+
+    if (!out_n)
     {
         return 1;
     }
 
-    if (!channel)
+    *out_n = 0;
+
+    if (!self->_active)
     {
         return 1;
     }
 
-    if (!out_subscription)
+    if (!self->_proxy)
     {
         return 1;
     }
 
-    uint64_t subscriber_id = atomic_fetch_add(&self->_next_subscriber_id, 1);
-
-    pthread_mutex_lock(&self->_channels_mutex);
+    struct subscriber_proxy_t* proxy = self->_proxy;
 
-    struct channel_t* ch = NULL;
-    int exit_code =
-        generic_hash_table_get(self->_channels, (void*) channel, (void**) &ch);
+    uint64_t until_ms = 0;
+    if (timeout_ms != SUBSCRIPTION_WAIT_FOREVER)
+    {
+        until_ms = _monotonic_ms() + timeout_ms;
+    }
 
-    // @todo unify this snippet under the same utility, it is used from the
-    // publisher worker too.
-    if (exit_code || !ch)
+    while (proxy->_active)
     {
 
-        exit_code = _channel_new(channel, &ch);
-        if (exit_code)
+        // read before trying, a publish or an ack racing with the attempt
+        // then prevents the wait
+        uint64_t seen_tail = 0;
+        if (proxy->_cursor)
         {
-            pthread_mutex_unlock(&self->_channels_mutex);
-            return exit_code;
+            generic_log_get_tail(proxy->_channel->_log, &seen_tail);
         }
+        size_t seen_acks = atomic_load(&proxy->_n_acks);
 
-        exit_code =
-            generic_hash_table_insert(self->_channels, (void*) channel, ch);
-        if (exit_code)
+        int exit_code =
+            _subscriber_proxy_pop_batch(proxy, out_msgs, max, out_n);
+        if (exit_code || *out_n)
         {
-
-            _channel_free(ch);
-            pthread_mutex_unlock(&self->_channels_mutex);
-
             return exit_code;
         }
-    }
-
-    pthread_mutex_unlock(&self->_channels_mutex);
-
-    struct subscriber_proxy_t* proxy = NULL;
-    exit_code = _subscriber_proxy_new(subscriber_id, &proxy);
-    if (exit_code)
-    {
-        return exit_code;
-    }
 
-    pthread_mutex_lock(&ch->_mutex);
-    exit_code = generic_linked_list_insert_last(ch->_subscriber_proxies, proxy);
-    pthread_mutex_unlock(&ch->_mutex);
+        if (until_ms && _monotonic_ms() >= until_ms)
+        {
 
-    if (exit_code)
-    {
-        _subscriber_proxy_free(proxy);
-        return exit_code;
-    }
+            _subscriber_proxy_clear_fd(proxy);
+            return 1;
+        }
 
-    struct subscription_t* subscription = malloc(sizeof(struct subscription_t));
-    if (!subscription)
-    {
-        return -1;
-    }
+        uint64_t wait_until_ms = until_ms;
+        if (proxy->_ack_window)
+        {
 
-    subscription->_id = subscriber_id;
-    subscription->_broker = self;
-    subscription->_proxy = proxy;
-    subscription->_active = 1;
+            uint64_t redeliver_at_ms =
+                _subscriber_proxy_next_redelivery_ms(proxy);
+            if (redeliver_at_ms
+                && (!wait_until_ms || redeliver_at_ms < wait_until_ms))
+            {
+                wait_until_ms = redeliver_at_ms;
+            }
+        }
 
-    size_t channel_len = strlen(channel);
-    subscription->_channel_name = malloc(channel_len + 1);
-    if (!subscription->_channel_name)
-    {
-        free(subscription);
-        return -1;
+        _subscriber_proxy_wait_until(proxy, seen_tail, seen_acks,
+                                     wait_until_ms);
     }
-    memcpy(subscription->_channel_name, channel, channel_len + 1);
 
-    *out_subscription = subscription;
-
-    return 0;
+    return 1;
 }
 
 int
-message_broker_wait(struct message_broker_t* self)
+subscription_receive_timeout(struct subscription_t* self,
+                             struct message_t** out_msg, size_t timeout_ms)
 {
 
-    if (!self)
+    if (!out_msg)
     {
         return 1;
     }
 
-    return thread_pool_wait(self->_publisher_pool);
+    *out_msg = NULL;
+
+    size_t n = 0;
+    int exit_code =
+        subscription_receive_batch(self, out_msg, 1, timeout_ms, &n);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    return n ? 0 : 1;
 }
 
 int
-subscription_receive(struct subscription_t* self, struct message_t** out_msg)
+subscription_get_fd(struct subscription_t* self, int* out_fd)
 {
 
     if (!self)
@@ -897,55 +6870,44 @@ subscription_receive(struct subscription_t* self, struct message_t** out_msg)
         return 1;
     }
 
-    if (!out_msg)
-    {
-        return 1;
-    }
-
-    if (!self->_active)
-    {
-        return 1;
-    }
-
-    if (!self->_proxy)
+    if (!out_fd)
     {
         return 1;
     }
 
-    if (!self->_proxy->_active)
+    struct subscriber_proxy_t* proxy = self->_proxy;
+    if (!self->_active || !proxy)
     {
         return 1;
     }
 
-    struct subscriber_proxy_t* proxy = self->_proxy;
-
     pthread_mutex_lock(&proxy->_inbox_mutex);
 
-    while (generic_queue_syn_is_empty(proxy->_inbox) == 1 && proxy->_active)
+    int event_fd = atomic_load(&proxy->_event_fd);
+    if (event_fd < 0)
     {
-        pthread_cond_wait(&proxy->_inbox_cond, &proxy->_inbox_mutex);
-    }
 
-    if (!proxy->_active)
-    {
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0)
+        {
 
-        pthread_mutex_unlock(&proxy->_inbox_mutex);
-        *out_msg = NULL;
+            pthread_mutex_unlock(&proxy->_inbox_mutex);
+            return -1;
+        }
 
-        return 1;
+        atomic_fetch_add(&proxy->_channel->_n_event_fds, 1);
+        atomic_store(&proxy->_event_fd, event_fd);
     }
 
     pthread_mutex_unlock(&proxy->_inbox_mutex);
 
-    struct message_t* msg = NULL;
-    int exit_code = generic_queue_syn_dequeue(proxy->_inbox, (void**) &msg);
-    if (exit_code)
+    // the messages pending before the eventfd existed were never notified
+    if (_subscriber_proxy_has_pending(proxy))
     {
-        *out_msg = NULL;
-        return exit_code;
+        _subscriber_proxy_notify_fd(proxy);
     }
 
-    *out_msg = msg;
+    *out_fd = event_fd;
 
     return 0;
 }
@@ -982,16 +6944,18 @@ subscription_try_receive(struct subscription_t* self,
 
     struct subscriber_proxy_t* proxy = self->_proxy;
 
-    if (generic_queue_syn_is_empty(proxy->_inbox) == 1)
-    {
-        *out_msg = NULL;
-        return 1;
-    }
-
     struct message_t* msg = NULL;
-    int exit_code = generic_queue_syn_dequeue(proxy->_inbox, (void**) &msg);
+    int exit_code = proxy->_ack_window
+                        ? _subscriber_proxy_pop_tracked(proxy, &msg)
+                        : _subscriber_proxy_pop_live(proxy, &msg);
     if (exit_code)
     {
+
+        if (exit_code == 1)
+        {
+            _subscriber_proxy_clear_fd(proxy);
+        }
+
         *out_msg = NULL;
         return exit_code;
     }
@@ -1025,52 +6989,36 @@ subscription_unsubscribe(struct subscription_t* self)
     {
 
         self->_proxy->_active = 0;
+        _subscriber_proxy_signal(self->_proxy, 1);
 
-        pthread_mutex_lock(&self->_proxy->_inbox_mutex);
-        pthread_cond_broadcast(&self->_proxy->_inbox_cond);
-        pthread_mutex_unlock(&self->_proxy->_inbox_mutex);
+        // lifting the bound releases a publisher blocked on this inbox, which
+        // would otherwise hold the channel until its timeout expires.
+        generic_queue_syn_set_capacity(self->_proxy->_inbox, 0);
     }
 
-    pthread_mutex_lock(&broker->_channels_mutex);
-
-    struct channel_t* ch = NULL;
-    int exit_code = generic_hash_table_get(
-        broker->_channels, (void*) self->_channel_name, (void**) &ch);
-    if (exit_code == 0 && ch)
+    // the proxy knows its channel and its slot: no lookup by name and no walk
+    // of the subscribers. The channel cannot be reclaimed while the proxy is
+    // attached, the reference pins it until the detach is done.
+    if (self->_proxy)
     {
 
-        pthread_mutex_lock(&ch->_mutex);
+        struct channel_t* ch = self->_proxy->_channel;
+        atomic_fetch_add(&ch->_n_refs, 1);
 
-        generic_linked_list_iterator iter = NULL;
-        exit_code =
-            generic_linked_list_iterator_begin(ch->_subscriber_proxies, &iter);
-        if (exit_code == 0)
+        _channel_call(broker, ch, _channel_detach, self->_proxy);
+        if (self->_is_pattern)
         {
 
-            while (generic_linked_list_iterator_is_valid(iter) == 0)
-            {
-
-                struct subscriber_proxy_t* proxy = NULL;
-                exit_code =
-                    generic_linked_list_iterator_get(iter, (void**) &proxy);
-                if (exit_code == 0 && proxy && proxy->_id == self->_id)
-                {
-
-                    generic_linked_list_iterator_remove(iter, NULL);
-                    break;
-                }
-
-                generic_linked_list_iterator_next(iter);
-            }
-
-            generic_linked_list_iterator_free(iter);
+            // pattern channels are never reclaimed
+            atomic_fetch_sub(&ch->_n_refs, 1);
+            _broker_sync_pattern(broker, ch);
+        }
+        else
+        {
+            _channel_release(broker, ch);
         }
-
-        pthread_mutex_unlock(&ch->_mutex);
     }
 
-    pthread_mutex_unlock(&broker->_channels_mutex);
-
     self->_active = 0;
     self->_proxy = NULL;
 
@@ -1155,18 +7103,214 @@ subscription_get_pending_count(struct subscription_t* self, size_t* out_count)
         return 0;
     }
 
-    return generic_queue_syn_size(self->_proxy->_inbox, out_count);
+    struct subscriber_proxy_t* proxy = self->_proxy;
+    if (proxy->_cursor)
+    {
+
+        pthread_mutex_lock(&proxy->_inbox_mutex);
+        int exit_code = generic_log_cursor_get_lag(proxy->_cursor, out_count);
+        pthread_mutex_unlock(&proxy->_inbox_mutex);
+
+        return exit_code;
+    }
+
+    return generic_queue_syn_size(proxy->_inbox, out_count);
+}
+
+int
+subscription_get_dropped_count(struct subscription_t* self, size_t* out_count)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_count)
+    {
+        return 1;
+    }
+
+    if (!self->_proxy)
+    {
+        *out_count = 0;
+        return 0;
+    }
+
+    *out_count = atomic_load(&self->_proxy->_n_dropped);
+
+    return 0;
+}
+
+int
+subscription_ack(struct subscription_t* self, uint64_t message_id)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    struct subscriber_proxy_t* proxy = self->_proxy;
+    if (!proxy || !proxy->_ack_window)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&proxy->_in_flight_mutex);
+
+    // the ring is in delivery order: the acked message and every one before
+    // it are popped. The ids only grow in delivery order on serialized
+    // channels, they are not compared.
+    size_t n_in_flight = atomic_load(&proxy->_n_in_flight);
+    size_t n_acked = 0;
+    size_t i = 0;
+    while (i < n_in_flight)
+    {
+
+        size_t index = (proxy->_in_flight_head + i) % proxy->_ack_window;
+        if (_message_payload_get_id(proxy->_in_flight[index]._payload)
+            == message_id)
+        {
+            n_acked = i + 1;
+            break;
+        }
+
+        i++;
+    }
+
+    i = 0;
+    while (i < n_acked)
+    {
+
+        size_t index = (proxy->_in_flight_head + i) % proxy->_ack_window;
+        _message_payload_release(proxy->_in_flight[index]._payload);
+        i++;
+    }
+
+    size_t n_kept = n_in_flight - n_acked;
+    proxy->_in_flight_head =
+        (proxy->_in_flight_head + n_acked) % proxy->_ack_window;
+    atomic_store(&proxy->_n_in_flight, n_kept);
+
+    // the persisted position is the oldest unacked message, or the cursor
+    // once everything read has been acked
+    if (n_kept < n_in_flight && proxy->_name && proxy->_channel->_wal)
+    {
+
+        uint64_t offset = 0;
+        generic_log_cursor_get_offset(proxy->_cursor, &offset);
+
+        i = 0;
+        while (i < n_kept)
+        {
+
+            size_t index = (proxy->_in_flight_head + i) % proxy->_ack_window;
+            if (proxy->_in_flight[index]._offset < offset)
+            {
+                offset = proxy->_in_flight[index]._offset;
+            }
+
+            i++;
+        }
+
+        wal_commit_offset(proxy->_channel->_wal, proxy->_name, offset);
+    }
+
+    pthread_mutex_unlock(&proxy->_in_flight_mutex);
+
+    if (n_kept < n_in_flight)
+    {
+
+        atomic_fetch_add(&proxy->_n_acks, 1);
+        _subscriber_proxy_signal(proxy, 1);
+
+        if (_subscriber_proxy_has_pending(proxy))
+        {
+            _subscriber_proxy_notify_fd(proxy);
+        }
+    }
+
+    return 0;
+}
+
+int
+subscription_get_in_flight_count(struct subscription_t* self,
+                                 size_t* out_count)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_count)
+    {
+        return 1;
+    }
+
+    *out_count = self->_proxy ? atomic_load(&self->_proxy->_n_in_flight) : 0;
+
+    return 0;
+}
+
+int
+subscription_get_redelivered_count(struct subscription_t* self,
+                                   size_t* out_count)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_count)
+    {
+        return 1;
+    }
+
+    *out_count =
+        self->_proxy ? atomic_load(&self->_proxy->_n_redelivered) : 0;
+
+    return 0;
+}
+
+int
+subscription_get_stats(struct subscription_t* self,
+                       struct subscription_stats_t* out_stats)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_stats)
+    {
+        return 1;
+    }
+
+    memset(out_stats, 0, sizeof(struct subscription_stats_t));
+
+    struct subscriber_proxy_t* proxy = self->_proxy;
+    if (!proxy)
+    {
+        return 0;
+    }
+
+    out_stats->_n_delivered = atomic_load(&proxy->_n_delivered);
+    out_stats->_bytes_out = atomic_load(&proxy->_bytes_out);
+    out_stats->_n_dropped = atomic_load(&proxy->_n_dropped);
+    out_stats->_n_in_flight = atomic_load(&proxy->_n_in_flight);
+    out_stats->_n_redelivered = atomic_load(&proxy->_n_redelivered);
+    generic_queue_syn_get_high_water(proxy->_inbox,
+                                     &out_stats->_inbox_high_water);
+
+    return subscription_get_pending_count(self, &out_stats->_inbox_depth);
 }
 
 // @todo publisher is anonymous in the current release, setting up a
 // registration phase could be useful in future for many reasons.
-// @todo the channel persists with the message broker lifetime, to avoid memory
-// consumption a release channel api should be implemented.
 // @todo I suppose an improvement could be made on the subscriber side: as for
 // the publisher, instead of waiting for the caller thread to complete the sub
 // operation, I task to an internal thread pool could be submitted.
-
-// @todo I would like to avoid the usage of _channels_mutex, it degrades the
-// parallelism degree given by the hash table: I have forgotten to implement a
-// create_and_get atomic operation which would avoid the lock, and then lock the
-// specific created channel mutex.
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define _DEFAULT_SOURCE
 
 #include "network_server.h"
+#include "logger.h"
 #include "message_broker.h"
 #include "thread_pool.h"
 #include <arpa/inet.h>
@@ -9,6 +10,7 @@
 #include <netinet/in.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdio.h>
@@ -20,8 +22,11 @@
 #define BUFFER_SIZE 4096
 #define MAX_CHANNEL_NAME 256
 #define MAX_CONTENT_SIZE 65536
+#define MAX_HEADERS_SIZE 4096
+#define MAX_HEADERS 64
 #define MAX_DETACHED_SUBSCRIPTIONS 1024
 #define MAX_API_KEY_LEN 256
+#define RECEIVER_POLL_MS 100
 
 struct detached_subscription_t
 {
@@ -43,6 +48,8 @@ struct network_server_t
     struct detached_subscription_t* _detached_subscriptions;
     pthread_mutex_t _detached_mutex;
     char* _api_key;
+    struct subscription_options_t _subscription_options;
+    size_t _default_ttl_ms;
 };
 
 struct client_context_t
@@ -115,7 +122,7 @@ _log_ssl_error(const char* msg)
 
         char buf[256];
         ERR_error_string_n(err, buf, sizeof(buf));
-        fprintf(stderr, "[network_server] %s: %s\n", msg, buf);
+        logger_log(LOGGER_ERROR, "network_server", "%s: %s", msg, buf);
     }
 }
 
@@ -154,8 +161,8 @@ _create_ssl_context(const char* cert_file, const char* key_file)
     if (!SSL_CTX_check_private_key(ctx))
     {
 
-        fprintf(stderr,
-                "[network_server] Private key does not match certificate\n");
+        logger_log(LOGGER_ERROR, "network_server",
+                   "Private key does not match certificate");
         SSL_CTX_free(ctx);
 
         return NULL;
@@ -180,6 +187,26 @@ _send_response(SSL* ssl, const char* response)
     return 0;
 }
 
+static int
+_ssl_read_full(SSL* ssl, void* buffer, size_t len)
+{
+
+    size_t total = 0;
+    while (total < len)
+    {
+
+        int r = SSL_read(ssl, (char*) buffer + total, (int) (len - total));
+        if (r <= 0)
+        {
+            return -1;
+        }
+
+        total += (size_t) r;
+    }
+
+    return 0;
+}
+
 static void*
 _subscriber_receiver_thread(void* arg)
 {
@@ -187,6 +214,16 @@ _subscriber_receiver_thread(void* arg)
     struct client_context_t* ctx = (struct client_context_t*) arg;
     struct message_t* msg = NULL;
 
+    // @note the frame buffer is reused across messages and only grown when a
+    // larger payload arrives.
+    char* frame = NULL;
+    size_t frame_capacity = 0;
+
+    // @note the thread sleeps on the subscription eventfd; the poll timeout
+    // only bounds the time to notice a detach or a disconnection.
+    struct pollfd event = {.fd = -1, .events = POLLIN};
+    subscription_get_fd(ctx->_subscription, &event.fd);
+
     while (atomic_load(&ctx->_active))
     {
 
@@ -196,49 +233,83 @@ _subscriber_receiver_thread(void* arg)
 
             uint64_t id;
             const char* channel;
-            const char* content;
+            const void* payload;
+            size_t payload_len;
+            const void* headers;
+            size_t headers_len;
 
             message_get_id(msg, &id);
             message_get_channel(msg, &channel);
-            message_get_content(msg, &content);
+            message_get_payload(msg, &payload, &payload_len);
+            message_get_headers(msg, &headers, &headers_len);
 
-            size_t content_len = strlen(content);
-            
-            size_t total_len = 512 + content_len + 1;
-            char* full_message = malloc(total_len);
-            if (full_message)
+            size_t required =
+                MAX_CHANNEL_NAME + 96 + headers_len + payload_len + 1;
+            if (required > frame_capacity)
             {
-                int header_len = snprintf(full_message, total_len, 
-                                         "MSG %lu %s %zu\n", id, channel, content_len);
-                memcpy(full_message + header_len, content, content_len);
-                full_message[header_len + content_len] = '\n';
-                
-                int total_write_len = header_len + content_len + 1;
-                int written = SSL_write(ctx->_ssl, full_message, total_write_len);
-                if (written <= 0)
+
+                char* grown = realloc(frame, required);
+                if (!grown)
                 {
-                    int ssl_error = SSL_get_error(ctx->_ssl, written);
-                    fprintf(stderr, "[network_server] SSL_write failed in receiver: %d\n", 
-                           ssl_error);
+
+                    message_free(msg);
+                    msg = NULL;
+
+                    continue;
                 }
-                
-                free(full_message);
+
+                frame = grown;
+                frame_capacity = required;
+            }
+
+            // the headers length is only sent with headers, so that clients
+            // that do not use them keep reading the same frames
+            int header_len =
+                headers_len
+                    ? snprintf(frame, frame_capacity, "MSG %lu %s %zu %zu\n",
+                               id, channel, payload_len, headers_len)
+                    : snprintf(frame, frame_capacity, "MSG %lu %s %zu\n", id,
+                               channel, payload_len);
+            memcpy(frame + header_len, headers, headers_len);
+            header_len += (int) headers_len;
+            memcpy(frame + header_len, payload, payload_len);
+            frame[header_len + payload_len] = '\n';
+
+            int total_write_len = header_len + (int) payload_len + 1;
+            int written = SSL_write(ctx->_ssl, frame, total_write_len);
+            if (written <= 0)
+            {
+                int ssl_error = SSL_get_error(ctx->_ssl, written);
+                logger_log(LOGGER_WARN, "network_server",
+                           "SSL_write failed in receiver: %d", ssl_error);
             }
 
             message_free(msg);
             msg = NULL;
         }
+        else if (event.fd >= 0)
+        {
+            poll(&event, 1, RECEIVER_POLL_MS);
+        }
         else
         {
-            usleep(10000);
+            usleep(RECEIVER_POLL_MS * 1000);
         }
     }
 
+    free(frame);
+
     return NULL;
 }
 
+// @note a non-zero ack_window subscribes in ack mode, the client then
+// acknowledges what it processed with ACK. With is_pattern, channel_name is a
+// wildcard pattern (PSUBSCRIBE); a group (may be NULL) joins that consumer
+// group of the channel (SUBSCRIBE <channel> GROUP <group>).
 static int
-_handle_subscribe(struct client_context_t* ctx, const char* channel_name)
+_handle_subscribe(struct client_context_t* ctx, const char* channel_name,
+                  int is_pattern, const char* group, size_t ack_window,
+                  size_t ack_timeout_ms)
 {
 
     if (ctx->_subscription)
@@ -248,8 +319,28 @@ _handle_subscribe(struct client_context_t* ctx, const char* channel_name)
         return -1;
     }
 
-    int result = message_broker_subscribe(ctx->_server->_broker, channel_name,
-                                          &ctx->_subscription);
+    struct subscription_options_t options = ctx->_server->_subscription_options;
+    options._ack_window = ack_window;
+    options._ack_timeout_ms = ack_timeout_ms;
+
+    int result = 0;
+    if (is_pattern)
+    {
+        result = message_broker_subscribe_pattern(
+            ctx->_server->_broker, channel_name, &options, &ctx->_subscription);
+    }
+    else if (group)
+    {
+        result = message_broker_subscribe_group(ctx->_server->_broker,
+                                                channel_name, group, &options,
+                                                &ctx->_subscription);
+    }
+    else
+    {
+        result = message_broker_subscribe_with_options(
+            ctx->_server->_broker, channel_name, &options, &ctx->_subscription);
+    }
+
     if (result != 0)
     {
 
@@ -337,9 +428,64 @@ _handle_detach(struct client_context_t* ctx)
     return 0;
 }
 
+static int
+_handle_ack(struct client_context_t* ctx, uint64_t message_id)
+{
+
+    if (!ctx->_subscription)
+    {
+        _send_response(ctx->_ssl, "ERR Not subscribed\n");
+        return -1;
+    }
+
+    if (subscription_ack(ctx->_subscription, message_id))
+    {
+        _send_response(ctx->_ssl, "ERR Not in ack mode\n");
+        return -1;
+    }
+
+    size_t in_flight = 0;
+    subscription_get_in_flight_count(ctx->_subscription, &in_flight);
+
+    char response[64];
+    snprintf(response, sizeof(response), "OK %zu\n", in_flight);
+    _send_response(ctx->_ssl, response);
+
+    return 0;
+}
+
+static int
+_handle_stats(struct client_context_t* ctx)
+{
+
+    if (!ctx->_subscription)
+    {
+        _send_response(ctx->_ssl, "ERR Not subscribed\n");
+        return -1;
+    }
+
+    size_t pending = 0;
+    size_t in_flight = 0;
+    size_t redelivered = 0;
+    size_t dropped = 0;
+    subscription_get_pending_count(ctx->_subscription, &pending);
+    subscription_get_in_flight_count(ctx->_subscription, &in_flight);
+    subscription_get_redelivered_count(ctx->_subscription, &redelivered);
+    subscription_get_dropped_count(ctx->_subscription, &dropped);
+
+    char response[128];
+    snprintf(response, sizeof(response), "OK %zu %zu %zu %zu\n", pending,
+             in_flight, redelivered, dropped);
+    _send_response(ctx->_ssl, response);
+
+    return 0;
+}
+
+// @note the headers_len bytes of encoded headers (see message_get_headers)
+// precede the content; they are decoded to be checked before the publish.
 static int
 _handle_publish(struct client_context_t* ctx, const char* channel_name,
-                size_t content_len)
+                size_t content_len, size_t ttl_ms, size_t headers_len)
 {
 
     if (content_len > MAX_CONTENT_SIZE)
@@ -349,31 +495,54 @@ _handle_publish(struct client_context_t* ctx, const char* channel_name,
         return -1;
     }
 
-    char* content = malloc(content_len + 1);
-    if (!content)
+    if (headers_len > MAX_HEADERS_SIZE)
+    {
+
+        _send_response(ctx->_ssl, "ERR Headers too large\n");
+        return -1;
+    }
+
+    char* data = malloc(headers_len + content_len);
+    if (!data)
     {
 
         _send_response(ctx->_ssl, "ERR Out of memory\n");
         return -1;
     }
 
-    int bytes_read = SSL_read(ctx->_ssl, content, (int) content_len);
-    if (bytes_read != (int) content_len)
+    if (_ssl_read_full(ctx->_ssl, data, headers_len + content_len))
     {
 
-        free(content);
+        free(data);
         _send_response(ctx->_ssl, "ERR Failed to read content\n");
 
         return -1;
     }
-    content[content_len] = '\0';
 
     char newline;
     SSL_read(ctx->_ssl, &newline, 1);
 
-    int result =
-        message_broker_publish(ctx->_server->_broker, channel_name, content);
-    free(content);
+    struct message_header_t headers[MAX_HEADERS];
+    size_t n_headers = 0;
+    if (message_headers_decode(data, headers_len, headers, MAX_HEADERS,
+                               &n_headers))
+    {
+
+        free(data);
+        _send_response(ctx->_ssl, "ERR Invalid headers\n");
+
+        return -1;
+    }
+
+    struct publish_options_t options = {
+        ._ttl_ms = ttl_ms ? ttl_ms : ctx->_server->_default_ttl_ms,
+        ._headers = headers,
+        ._n_headers = n_headers};
+
+    int result = message_broker_publish_with_options(
+        ctx->_server->_broker, channel_name, data + headers_len, content_len,
+        &options);
+    free(data);
     if (result != 0)
     {
 
@@ -449,8 +618,11 @@ _client_handler(void* arg)
         char command[32] = {0};
         char channel[MAX_CHANNEL_NAME] = {0};
         size_t content_len = 0;
+        size_t ttl_ms = 0;
+        size_t headers_len = 0;
 
-        if (sscanf(buffer, "%31s %255s %zu", command, channel, &content_len)
+        if (sscanf(buffer, "%31s %255s %zu %zu %zu", command, channel,
+                   &content_len, &ttl_ms, &headers_len)
             >= 2)
         {
             if (strcmp(command, "AUTH") == 0)
@@ -463,11 +635,36 @@ _client_handler(void* arg)
             }
             else if (strcmp(command, "SUBSCRIBE") == 0)
             {
-                _handle_subscribe(ctx, channel);
+
+                char group[MAX_CHANNEL_NAME] = {0};
+                size_t ack_window = 0;
+                size_t ack_timeout_ms = 0;
+                if (sscanf(buffer, "%*31s %*255s GROUP %255s %zu %zu", group,
+                           &ack_window, &ack_timeout_ms)
+                    >= 1)
+                {
+                    _handle_subscribe(ctx, channel, 0, group, ack_window,
+                                      ack_timeout_ms);
+                }
+                else
+                {
+                    _handle_subscribe(ctx, channel, 0, NULL, content_len,
+                                      ttl_ms);
+                }
+            }
+            else if (strcmp(command, "PSUBSCRIBE") == 0)
+            {
+                _handle_subscribe(ctx, channel, 1, NULL, content_len, ttl_ms);
+            }
+            else if (strcmp(command, "ACK") == 0)
+            {
+                uint64_t message_id = strtoull(channel, NULL, 10);
+                _handle_ack(ctx, message_id);
             }
             else if (strcmp(command, "PUBLISH") == 0 && content_len > 0)
             {
-                _handle_publish(ctx, channel, content_len);
+                _handle_publish(ctx, channel, content_len, ttl_ms,
+                                headers_len);
             }
             else if (strcmp(command, "ATTACH") == 0)
             {
@@ -495,6 +692,17 @@ _client_handler(void* arg)
                 _handle_detach(ctx);
             }
         }
+        else if (strcmp(buffer, "STATS") == 0)
+        {
+            if (!ctx->_authenticated)
+            {
+                _send_response(ctx->_ssl, "ERR Authentication required\n");
+            }
+            else
+            {
+                _handle_stats(ctx);
+            }
+        }
         else if (strcmp(buffer, "QUIT") == 0)
         {
             _send_response(ctx->_ssl, "BYE\n");
@@ -542,7 +750,8 @@ _accept_thread(void* arg)
 
             if (atomic_load(&self->_running))
             {
-                perror("[network_server] accept");
+                logger_log(LOGGER_ERROR, "network_server", "accept: %s",
+                           strerror(errno));
             }
 
             continue;
@@ -593,8 +802,10 @@ _accept_thread(void* arg)
         }
         pthread_detach(handler_thread);
 
-        printf("[network_server] Client connected from %s:%d\n",
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        logger_log(LOGGER_INFO, "network_server",
+                   "Client connected from %s:%d",
+                   inet_ntoa(client_addr.sin_addr),
+                   ntohs(client_addr.sin_port));
     }
 
     return NULL;
@@ -628,6 +839,8 @@ network_server_new(struct network_server_configuration_t* config,
     self->_broker = config->_broker;
     self->_port = config->_port;
     self->_max_clients = config->_max_clients > 0 ? config->_max_clients : 10;
+    self->_subscription_options = config->_subscription_options;
+    self->_default_ttl_ms = config->_default_ttl_ms;
     self->_server_fd = -1;
     self->_detached_subscriptions = NULL;
     atomic_init(&self->_running, 0);
@@ -668,7 +881,8 @@ network_server_new(struct network_server_configuration_t* config,
     if (self->_server_fd < 0)
     {
 
-        perror("[network_server] socket");
+        logger_log(LOGGER_ERROR, "network_server", "socket: %s",
+                   strerror(errno));
         SSL_CTX_free(self->_ssl_ctx);
         free(self);
 
@@ -690,7 +904,8 @@ network_server_new(struct network_server_configuration_t* config,
         < 0)
     {
 
-        perror("[network_server] bind");
+        logger_log(LOGGER_ERROR, "network_server", "bind: %s",
+                   strerror(errno));
         close(self->_server_fd);
 
         SSL_CTX_free(self->_ssl_ctx);
@@ -723,22 +938,27 @@ network_server_start(struct network_server_t* self)
     if (listen(self->_server_fd, (int) self->_max_clients) < 0)
     {
 
-        perror("[network_server] listen");
+        logger_log(LOGGER_ERROR, "network_server", "listen: %s",
+                   strerror(errno));
         return -1;
     }
 
     atomic_store(&self->_running, 1);
 
-    if (pthread_create(&self->_accept_thread, NULL, _accept_thread, self) != 0)
+    int exit_code =
+        pthread_create(&self->_accept_thread, NULL, _accept_thread, self);
+    if (exit_code)
     {
 
-        perror("[network_server] pthread_create");
+        logger_log(LOGGER_ERROR, "network_server", "pthread_create: %s",
+                   strerror(exit_code));
         atomic_store(&self->_running, 0);
 
         return -1;
     }
 
-    printf("[network_server] Server started on port %d\n", self->_port);
+    logger_log(LOGGER_INFO, "network_server", "Server started on port %d",
+               self->_port);
 
     return 0;
 }
@@ -765,7 +985,7 @@ network_server_stop(struct network_server_t* self)
 
     pthread_join(self->_accept_thread, NULL);
 
-    printf("[network_server] Server stopped\n");
+    logger_log(LOGGER_INFO, "network_server", "Server stopped");
 
     return 0;
 }
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include "logger.h"
 #include "message_broker.h"
 #include "network_server.h"
 #include <signal.h>
@@ -8,8 +9,13 @@
 #include <string.h>
 #include <unistd.h>
 
+#define MAX_PRELOADED_CHANNELS 64
+
 static struct network_server_t* g_server = NULL;
 static struct message_broker_t* g_broker = NULL;
+static struct channel_handle_t* g_preloaded[MAX_PRELOADED_CHANNELS];
+static size_t g_n_preloaded = 0;
+static enum logger_level_t g_log_level = LOGGER_INFO;
 
 static void
 signal_handler(int sig)
@@ -24,6 +30,63 @@ signal_handler(int sig)
     }
 }
 
+// @note SIGUSR1 switches the log level to debug and back, without a restart.
+static void
+toggle_debug_handler(int sig)
+{
+
+    (void) sig;
+
+    logger_set_level(logger_get_level() == LOGGER_DEBUG ? g_log_level
+                                                        : LOGGER_DEBUG);
+}
+
+// @note opens a handle on every channel of the comma separated list, the
+// channels are created before the first client connects and stay pinned until
+// shutdown.
+static int
+preload_channels(char* channels)
+{
+
+    char* save = NULL;
+    char* name = strtok_r(channels, ",", &save);
+    while (name)
+    {
+
+        if (g_n_preloaded == MAX_PRELOADED_CHANNELS)
+        {
+            fprintf(stderr, "Too many preloaded channels (max %d)\n",
+                    MAX_PRELOADED_CHANNELS);
+            return 1;
+        }
+
+        int exit_code = message_broker_channel_open(
+            g_broker, name, &g_preloaded[g_n_preloaded]);
+        if (exit_code)
+        {
+            fprintf(stderr, "Failed to preload channel %s: %d\n", name,
+                    exit_code);
+            return exit_code;
+        }
+
+        g_n_preloaded++;
+        name = strtok_r(NULL, ",", &save);
+    }
+
+    return 0;
+}
+
+static void
+close_preloaded_channels()
+{
+
+    while (g_n_preloaded)
+    {
+        g_n_preloaded--;
+        message_broker_channel_close(g_preloaded[g_n_preloaded]);
+    }
+}
+
 static void
 print_usage(const char* program)
 {
@@ -37,6 +100,20 @@ print_usage(const char* program)
            "certs/server.key)\n");
     printf("  -a <api_key>  API key for authentication (default: none)\n");
     printf("  -t <threads>  Number of broker threads (default: 4)\n");
+    printf("  -s <shards>   Run the broker sharded with per-channel ordering "
+           "(default: 0, shared pool)\n");
+    printf("  -q <capacity> Bound each subscriber inbox, dropping the oldest "
+           "messages (default: 0, unbounded)\n");
+    printf("  -T <ttl_ms>   TTL of the messages published without one "
+           "(default: 0, never expire)\n");
+    printf("  -P <channels> Comma separated channels created at startup "
+           "(default: none)\n");
+    printf("  -I <idle_ms>  Free the channels unused for that long "
+           "(default: 0, never)\n");
+    printf("  -G            Give messages broker-wide ids instead of "
+           "per-channel sequences\n");
+    printf("  -L <level>    Log level: debug, info, warn, error or off "
+           "(default: info, SIGUSR1 toggles debug)\n");
     printf("  -h            Show this help message\n");
 }
 
@@ -49,9 +126,16 @@ main(int argc, char** argv)
     const char* key_file = "certs/server.key";
     const char* api_key = NULL;
     size_t n_threads = 4;
+    size_t n_shards = 0;
+    size_t inbox_capacity = 0;
+    size_t default_ttl_ms = 0;
+    char* preload = NULL;
+    size_t channel_idle_ms = 0;
+    int global_message_ids = 0;
+    const char* log_level = "info";
 
     int opt;
-    while ((opt = getopt(argc, argv, "p:c:k:a:t:h")) != -1)
+    while ((opt = getopt(argc, argv, "p:c:k:a:t:s:q:T:P:I:GL:h")) != -1)
     {
 
         switch (opt)
@@ -72,6 +156,33 @@ main(int argc, char** argv)
             case 't':
                 n_threads = (size_t) atoi(optarg);
                 break;
+            case 's':
+                n_shards = (size_t) atoi(optarg);
+                break;
+            case 'q':
+                inbox_capacity = (size_t) atoi(optarg);
+                break;
+            case 'T':
+                default_ttl_ms = (size_t) atoi(optarg);
+                break;
+            case 'P':
+                preload = optarg;
+                break;
+            case 'I':
+                channel_idle_ms = (size_t) atoi(optarg);
+                break;
+            case 'G':
+                global_message_ids = 1;
+                break;
+            case 'L':
+                if (logger_parse_level(optarg, &g_log_level))
+                {
+                    fprintf(stderr, "Unknown log level: %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                log_level = optarg;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -89,18 +200,48 @@ main(int argc, char** argv)
     printf("Key:         %s\n", key_file);
     printf("API Key:     %s\n", api_key ? "********" : "(none)");
     printf("Threads:     %zu\n", n_threads);
+    printf("Shards:      %zu\n", n_shards);
+    printf("Inbox cap:   %zu\n", inbox_capacity);
+    printf("Default TTL: %zu ms\n", default_ttl_ms);
+    printf("Preload:     %s\n", preload ? preload : "(none)");
+    printf("Idle:        %zu ms\n", channel_idle_ms);
+    printf("Message ids: %s\n", global_message_ids ? "global" : "per channel");
+    printf("Log level:   %s\n", log_level);
     printf("========================================\n\n");
 
+    struct logger_configuration_t logger_config = {._level = g_log_level};
+
+    int exit_code = logger_start(&logger_config);
+    if (exit_code)
+    {
+        fprintf(stderr, "Failed to start logger: %d\n", exit_code);
+        return 1;
+    }
+
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR1, toggle_debug_handler);
 
     struct message_broker_configuration_t broker_config = {
-        ._n_threads = n_threads, ._channels_capacity = 64};
+        ._n_threads = n_threads,
+        ._channels_capacity = 64,
+        ._n_shards = n_shards,
+        ._channel_idle_ms = channel_idle_ms,
+        ._global_message_ids = global_message_ids};
 
-    int exit_code = message_broker_new(&broker_config, &g_broker);
+    exit_code = message_broker_new(&broker_config, &g_broker);
     if (exit_code)
     {
         fprintf(stderr, "Failed to create message broker: %d\n", exit_code);
+        logger_stop();
+        return 1;
+    }
+
+    if (preload && preload_channels(preload))
+    {
+        close_preloaded_channels();
+        message_broker_free(g_broker);
+        logger_stop();
         return 1;
     }
 
@@ -111,13 +252,19 @@ main(int argc, char** argv)
         ._key_file = key_file,
         ._api_key = api_key,
         ._broker = g_broker,
-        ._max_clients = 100};
+        ._max_clients = 100,
+        ._subscription_options = {
+            ._capacity = inbox_capacity,
+            ._overflow_policy = SUBSCRIPTION_OVERFLOW_DROP_OLDEST},
+        ._default_ttl_ms = default_ttl_ms};
 
     exit_code = network_server_new(&server_config, &g_server);
     if (exit_code)
     {
         fprintf(stderr, "Failed to create network server: %d\n", exit_code);
+        close_preloaded_channels();
         message_broker_free(g_broker);
+        logger_stop();
         return 1;
     }
 
@@ -126,7 +273,9 @@ main(int argc, char** argv)
     {
         fprintf(stderr, "Failed to start network server: %d\n", exit_code);
         network_server_free(g_server);
+        close_preloaded_channels();
         message_broker_free(g_broker);
+        logger_stop();
         return 1;
     }
 
@@ -138,7 +287,9 @@ main(int argc, char** argv)
     }
 
     network_server_free(g_server);
+    close_preloaded_channels();
     message_broker_free(g_broker);
+    logger_stop();
 
     printf("[main] Shutdown complete.\n");
 
@@ -94,8 +94,6 @@ _dispatcher_function(void* arg)
             continue;
         }
 
-        atomic_fetch_add(&thread_pool->_in_flight, 1);
-
         task->_function(task->_arg);
         free(task);
 
@@ -361,9 +359,15 @@ thread_pool_submit(struct thread_pool_t* self, void* (*function)(void*),
     task->_function = function;
     task->_arg = arg;
 
+    // @note a task is counted as in flight from submission to completion,
+    // otherwise thread_pool_wait could observe an empty queue between the
+    // dequeue and the execution of the last task.
+    atomic_fetch_add(&self->_in_flight, 1);
+
     int result = generic_queue_syn_enqueue(self->_queue_syn, task);
     if (result)
     {
+        atomic_fetch_sub(&self->_in_flight, 1);
         free(task);
         return result;
     }
@@ -374,3 +378,21 @@ thread_pool_submit(struct thread_pool_t* self, void* (*function)(void*),
 
     return 0;
 }
+
+int
+thread_pool_get_pending_count(struct thread_pool_t* self, size_t* out_count)
+{
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_count)
+    {
+        return 1;
+    }
+
+    *out_count = atomic_load(&self->_in_flight);
+
+    return 0;
+}
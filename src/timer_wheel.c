@@ -0,0 +1,430 @@
+#include "timer_wheel.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#define _TIMER_WHEEL_LEVELS 4
+#define _TIMER_WHEEL_SLOT_BITS 6
+#define _TIMER_WHEEL_SLOTS (1u << _TIMER_WHEEL_SLOT_BITS)
+#define _TIMER_WHEEL_SLOT_MASK ((uint64_t) _TIMER_WHEEL_SLOTS - 1)
+
+// @note _slot points to the list head the timer is linked in, NULL when the
+// timer is disarmed.
+struct timer_wheel_timer_t
+{
+    struct timer_wheel_timer_t* _prev;
+    struct timer_wheel_timer_t* _next;
+    struct timer_wheel_timer_t** _slot;
+    uint64_t _expires_at_tick;
+    uint64_t (*_callback)(void* arg, uint64_t now_ms);
+    void* _arg;
+};
+
+// @note a timer due in less than 2^(6 * (l + 1)) ticks lives in level l, in the
+// slot picked by the l-th group of 6 bits of its expiry tick. The slot is next
+// visited at the expiry tick with its lower bits cleared, where the timer is
+// moved down (cascaded) towards level 0. Expiries beyond the range of the top
+// level are parked at its far end and placed again when reached.
+struct timer_wheel_t
+{
+    pthread_mutex_t _mutex;
+    uint64_t _tick_ms;
+    uint64_t _current_tick;
+    size_t _size;
+    struct timer_wheel_timer_t* _slots[_TIMER_WHEEL_LEVELS][_TIMER_WHEEL_SLOTS];
+};
+
+static void
+_timer_wheel_link_locked(struct timer_wheel_t* self,
+                         struct timer_wheel_timer_t* timer)
+{
+
+    uint64_t current = self->_current_tick;
+    uint64_t placed = timer->_expires_at_tick;
+    if (placed < current)
+    {
+        placed = current;
+    }
+
+    uint64_t range = (uint64_t) 1
+                     << (_TIMER_WHEEL_SLOT_BITS * _TIMER_WHEEL_LEVELS);
+    if (placed - current >= range)
+    {
+        placed = current + range - 1;
+    }
+
+    uint64_t delta = placed - current;
+    size_t level = 0;
+    while (level + 1 < _TIMER_WHEEL_LEVELS
+           && delta >= (uint64_t) 1 << (_TIMER_WHEEL_SLOT_BITS * (level + 1)))
+    {
+        level++;
+    }
+
+    uint64_t slot =
+        (placed >> (_TIMER_WHEEL_SLOT_BITS * level)) & _TIMER_WHEEL_SLOT_MASK;
+
+    struct timer_wheel_timer_t** head = &self->_slots[level][slot];
+
+    timer->_prev = NULL;
+    timer->_next = *head;
+    if (*head)
+    {
+        (*head)->_prev = timer;
+    }
+    *head = timer;
+    timer->_slot = head;
+}
+
+static void
+_timer_wheel_unlink_locked(struct timer_wheel_timer_t* timer)
+{
+
+    if (timer->_prev)
+    {
+        timer->_prev->_next = timer->_next;
+    }
+    else
+    {
+        *timer->_slot = timer->_next;
+    }
+
+    if (timer->_next)
+    {
+        timer->_next->_prev = timer->_prev;
+    }
+
+    timer->_prev = NULL;
+    timer->_next = NULL;
+    timer->_slot = NULL;
+}
+
+// @note rounds up so that a timer never fires before its deadline.
+static uint64_t
+_timer_wheel_to_tick(struct timer_wheel_t* self, uint64_t ms)
+{
+    return ms / self->_tick_ms + (ms % self->_tick_ms ? 1 : 0);
+}
+
+static void
+_timer_wheel_cascade_locked(struct timer_wheel_t* self, size_t level)
+{
+
+    uint64_t slot = (self->_current_tick >> (_TIMER_WHEEL_SLOT_BITS * level))
+                    & _TIMER_WHEEL_SLOT_MASK;
+
+    struct timer_wheel_timer_t* timer = self->_slots[level][slot];
+    self->_slots[level][slot] = NULL;
+
+    while (timer)
+    {
+
+        struct timer_wheel_timer_t* next = timer->_next;
+        _timer_wheel_link_locked(self, timer);
+        timer = next;
+    }
+}
+
+static size_t
+_timer_wheel_fire_locked(struct timer_wheel_t* self, uint64_t now_ms)
+{
+
+    uint64_t slot = self->_current_tick & _TIMER_WHEEL_SLOT_MASK;
+
+    struct timer_wheel_timer_t* timer = self->_slots[0][slot];
+    self->_slots[0][slot] = NULL;
+
+    size_t n_fired = 0;
+    while (timer)
+    {
+
+        struct timer_wheel_timer_t* next = timer->_next;
+        timer->_prev = NULL;
+        timer->_next = NULL;
+        timer->_slot = NULL;
+
+        if (timer->_expires_at_tick > self->_current_tick)
+        {
+
+            _timer_wheel_link_locked(self, timer);
+            timer = next;
+
+            continue;
+        }
+
+        self->_size--;
+        n_fired++;
+
+        uint64_t next_expiry_ms = timer->_callback(timer->_arg, now_ms);
+        if (next_expiry_ms)
+        {
+
+            uint64_t tick = _timer_wheel_to_tick(self, next_expiry_ms);
+            if (tick <= self->_current_tick)
+            {
+                tick = self->_current_tick + 1;
+            }
+
+            timer->_expires_at_tick = tick;
+            _timer_wheel_link_locked(self, timer);
+            self->_size++;
+        }
+
+        timer = next;
+    }
+
+    return n_fired;
+}
+
+int
+timer_wheel_new(uint64_t tick_ms, uint64_t now_ms,
+                struct timer_wheel_t** out_self)
+{
+
+    if (!tick_ms)
+    {
+        return 1;
+    }
+
+    if (!out_self)
+    {
+        return 1;
+    }
+
+    struct timer_wheel_t* self = calloc(1, sizeof(struct timer_wheel_t));
+    if (!self)
+    {
+        return -1;
+    }
+
+    int exit_code = pthread_mutex_init(&self->_mutex, NULL);
+    if (exit_code)
+    {
+        free(self);
+        return exit_code;
+    }
+
+    self->_tick_ms = tick_ms;
+    self->_current_tick = now_ms / tick_ms;
+    self->_size = 0;
+
+    *out_self = self;
+
+    return 0;
+}
+
+int
+timer_wheel_free(struct timer_wheel_t* self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    pthread_mutex_destroy(&self->_mutex);
+    free(self);
+
+    return 0;
+}
+
+int
+timer_wheel_timer_new(uint64_t (*callback)(void* arg, uint64_t now_ms),
+                      void* arg, struct timer_wheel_timer_t** out_timer)
+{
+
+    if (!callback)
+    {
+        return 1;
+    }
+
+    if (!out_timer)
+    {
+        return 1;
+    }
+
+    struct timer_wheel_timer_t* timer =
+        malloc(sizeof(struct timer_wheel_timer_t));
+    if (!timer)
+    {
+        return -1;
+    }
+
+    timer->_prev = NULL;
+    timer->_next = NULL;
+    timer->_slot = NULL;
+    timer->_expires_at_tick = 0;
+    timer->_callback = callback;
+    timer->_arg = arg;
+
+    *out_timer = timer;
+
+    return 0;
+}
+
+int
+timer_wheel_timer_free(struct timer_wheel_timer_t* timer)
+{
+
+    if (!timer)
+    {
+        return 1;
+    }
+
+    if (timer->_slot)
+    {
+        return 1;
+    }
+
+    free(timer);
+
+    return 0;
+}
+
+int
+timer_wheel_arm(struct timer_wheel_t* self, struct timer_wheel_timer_t* timer,
+                uint64_t expires_at_ms)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!timer)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    uint64_t tick = _timer_wheel_to_tick(self, expires_at_ms);
+    if (tick <= self->_current_tick)
+    {
+        tick = self->_current_tick + 1;
+    }
+
+    if (timer->_slot)
+    {
+
+        if (timer->_expires_at_tick <= tick)
+        {
+
+            pthread_mutex_unlock(&self->_mutex);
+            return 0;
+        }
+
+        _timer_wheel_unlink_locked(timer);
+        self->_size--;
+    }
+
+    timer->_expires_at_tick = tick;
+    _timer_wheel_link_locked(self, timer);
+    self->_size++;
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    return 0;
+}
+
+int
+timer_wheel_cancel(struct timer_wheel_t* self,
+                   struct timer_wheel_timer_t* timer)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!timer)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    if (timer->_slot)
+    {
+        _timer_wheel_unlink_locked(timer);
+        self->_size--;
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    return 0;
+}
+
+int
+timer_wheel_advance(struct timer_wheel_t* self, uint64_t now_ms,
+                    size_t* out_n_fired)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    uint64_t target_tick = now_ms / self->_tick_ms;
+
+    size_t n_fired = 0;
+    while (self->_current_tick < target_tick)
+    {
+
+        // nothing armed: there is no slot to visit on the way
+        if (!self->_size)
+        {
+            self->_current_tick = target_tick;
+            break;
+        }
+
+        self->_current_tick++;
+
+        size_t level = _TIMER_WHEEL_LEVELS - 1;
+        while (level > 0)
+        {
+
+            uint64_t lower_mask =
+                ((uint64_t) 1 << (_TIMER_WHEEL_SLOT_BITS * level)) - 1;
+            if ((self->_current_tick & lower_mask) == 0)
+            {
+                _timer_wheel_cascade_locked(self, level);
+            }
+
+            level--;
+        }
+
+        n_fired += _timer_wheel_fire_locked(self, now_ms);
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    if (out_n_fired)
+    {
+        *out_n_fired = n_fired;
+    }
+
+    return 0;
+}
+
+int
+timer_wheel_size(struct timer_wheel_t* self, size_t* out_size)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_size)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+    *out_size = self->_size;
+    pthread_mutex_unlock(&self->_mutex);
+
+    return 0;
+}
@@ -0,0 +1,915 @@
+#include "topic_trie.h"
+#include <stdlib.h>
+#include <string.h>
+
+// @note the literal children are kept sorted by segment for a binary search,
+// the '*' and '#' children have a slot of their own.
+struct _topic_trie_node_t
+{
+    char* _segment;
+    struct _topic_trie_node_t** _children;
+    size_t _n_children;
+    size_t _children_capacity;
+    struct _topic_trie_node_t* _star;
+    struct _topic_trie_node_t* _hash;
+    void** _values;
+    size_t _n_values;
+    size_t _values_capacity;
+};
+
+struct topic_trie_t
+{
+    struct _topic_trie_node_t* _root;
+    size_t _n_patterns;
+};
+
+struct _topic_segment_t
+{
+    const char* _begin;
+    size_t _len;
+};
+
+#define _TOPIC_STACK_SEGMENTS 32
+#define _TOPIC_STACK_MATCHES 16
+
+static int
+_topic_trie_node_new(const char* segment, size_t len,
+                     struct _topic_trie_node_t** out_node)
+{
+
+    struct _topic_trie_node_t* node =
+        calloc(1, sizeof(struct _topic_trie_node_t));
+    if (!node)
+    {
+        return -1;
+    }
+
+    node->_segment = malloc(len + 1);
+    if (!node->_segment)
+    {
+        free(node);
+        return -1;
+    }
+
+    memcpy(node->_segment, segment, len);
+    node->_segment[len] = '\0';
+
+    *out_node = node;
+
+    return 0;
+}
+
+static void
+_topic_trie_node_free(struct _topic_trie_node_t* node)
+{
+
+    if (!node)
+    {
+        return;
+    }
+
+    size_t i = 0;
+    while (i < node->_n_children)
+    {
+        _topic_trie_node_free(node->_children[i]);
+        i++;
+    }
+
+    _topic_trie_node_free(node->_star);
+    _topic_trie_node_free(node->_hash);
+
+    free(node->_children);
+    free(node->_values);
+    free(node->_segment);
+    free(node);
+}
+
+static int
+_topic_trie_node_is_empty(const struct _topic_trie_node_t* node)
+{
+    return !node->_n_values && !node->_n_children && !node->_star
+           && !node->_hash;
+}
+
+static int
+_topic_segment_compare(const struct _topic_segment_t* segment,
+                       const char* other)
+{
+
+    int cmp = strncmp(segment->_begin, other, segment->_len);
+    if (cmp)
+    {
+        return cmp;
+    }
+
+    return other[segment->_len] ? -1 : 0;
+}
+
+// @note binary search of a literal child; out_index is where the child is, or
+// where it would be inserted.
+static struct _topic_trie_node_t*
+_topic_trie_node_find(const struct _topic_trie_node_t* node,
+                      const struct _topic_segment_t* segment,
+                      size_t* out_index)
+{
+
+    size_t low = 0;
+    size_t high = node->_n_children;
+    while (low < high)
+    {
+
+        size_t middle = low + (high - low) / 2;
+        int cmp =
+            _topic_segment_compare(segment, node->_children[middle]->_segment);
+        if (!cmp)
+        {
+
+            if (out_index)
+            {
+                *out_index = middle;
+            }
+
+            return node->_children[middle];
+        }
+
+        if (cmp < 0)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+
+    if (out_index)
+    {
+        *out_index = low;
+    }
+
+    return NULL;
+}
+
+static int
+_topic_segment_is(const struct _topic_segment_t* segment, char wildcard)
+{
+    return segment->_len == 1 && segment->_begin[0] == wildcard;
+}
+
+// @note splits topic in segments, stored in stack_segments when they fit and
+// in a heap array (to be freed by the caller) otherwise.
+static int
+_topic_split(const char* topic, struct _topic_segment_t* stack_segments,
+             struct _topic_segment_t** out_segments, size_t* out_n)
+{
+
+    size_t n = 1;
+    const char* c = topic;
+    while (*c)
+    {
+
+        if (*c == '.')
+        {
+            n++;
+        }
+
+        c++;
+    }
+
+    struct _topic_segment_t* segments = stack_segments;
+    if (n > _TOPIC_STACK_SEGMENTS)
+    {
+
+        segments = malloc(sizeof(struct _topic_segment_t) * n);
+        if (!segments)
+        {
+            return -1;
+        }
+    }
+
+    size_t i = 0;
+    const char* begin = topic;
+    c = topic;
+    while (1)
+    {
+
+        if (*c == '.' || !*c)
+        {
+
+            segments[i]._begin = begin;
+            segments[i]._len = (size_t) (c - begin);
+            i++;
+
+            if (!*c)
+            {
+                break;
+            }
+
+            begin = c + 1;
+        }
+
+        c++;
+    }
+
+    *out_segments = segments;
+    *out_n = n;
+
+    return 0;
+}
+
+// @note a run of '#' matches what a single '#' does, the pattern segments are
+// stored with the run collapsed.
+static void
+_topic_collapse_hashes(struct _topic_segment_t* segments, size_t* n_segments)
+{
+
+    size_t n = 0;
+    size_t i = 0;
+    while (i < *n_segments)
+    {
+
+        if (!n || !_topic_segment_is(&segments[i], '#')
+            || !_topic_segment_is(&segments[n - 1], '#'))
+        {
+            segments[n++] = segments[i];
+        }
+
+        i++;
+    }
+
+    *n_segments = n;
+}
+
+int
+topic_trie_new(topic_trie* out_self)
+{
+
+    if (!out_self)
+    {
+        return 1;
+    }
+
+    struct topic_trie_t* self = malloc(sizeof(struct topic_trie_t));
+    if (!self)
+    {
+        return -1;
+    }
+
+    int exit_code = _topic_trie_node_new("", 0, &self->_root);
+    if (exit_code)
+    {
+        free(self);
+        return exit_code;
+    }
+
+    self->_n_patterns = 0;
+
+    *out_self = self;
+
+    return 0;
+}
+
+int
+topic_trie_free(topic_trie self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    _topic_trie_node_free(self->_root);
+    free(self);
+
+    return 0;
+}
+
+int
+topic_trie_validate(const char* pattern)
+{
+
+    if (!pattern || !pattern[0])
+    {
+        return 1;
+    }
+
+    const char* c = pattern;
+    char previous = '.';
+    while (*c)
+    {
+
+        if (*c == '.' && previous == '.')
+        {
+            return 1;
+        }
+
+        previous = *c;
+        c++;
+    }
+
+    return previous == '.';
+}
+
+int
+topic_trie_is_pattern(const char* topic)
+{
+
+    if (!topic)
+    {
+        return 0;
+    }
+
+    const char* c = topic;
+    while (*c)
+    {
+
+        if ((*c == '*' || *c == '#') && (c == topic || c[-1] == '.')
+            && (c[1] == '.' || !c[1]))
+        {
+            return 1;
+        }
+
+        c++;
+    }
+
+    return 0;
+}
+
+static int
+_topic_trie_node_child(struct _topic_trie_node_t* node,
+                       const struct _topic_segment_t* segment,
+                       struct _topic_trie_node_t** out_child)
+{
+
+    struct _topic_trie_node_t** slot = NULL;
+    if (_topic_segment_is(segment, '*'))
+    {
+        slot = &node->_star;
+    }
+    else if (_topic_segment_is(segment, '#'))
+    {
+        slot = &node->_hash;
+    }
+
+    if (slot)
+    {
+
+        if (!*slot)
+        {
+
+            int exit_code =
+                _topic_trie_node_new(segment->_begin, segment->_len, slot);
+            if (exit_code)
+            {
+                return exit_code;
+            }
+        }
+
+        *out_child = *slot;
+
+        return 0;
+    }
+
+    size_t index = 0;
+    struct _topic_trie_node_t* child =
+        _topic_trie_node_find(node, segment, &index);
+    if (child)
+    {
+        *out_child = child;
+        return 0;
+    }
+
+    if (node->_n_children == node->_children_capacity)
+    {
+
+        size_t capacity =
+            node->_children_capacity ? node->_children_capacity * 2 : 4;
+        struct _topic_trie_node_t** children =
+            realloc(node->_children, sizeof(*children) * capacity);
+        if (!children)
+        {
+            return -1;
+        }
+
+        node->_children = children;
+        node->_children_capacity = capacity;
+    }
+
+    int exit_code =
+        _topic_trie_node_new(segment->_begin, segment->_len, &child);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    memmove(node->_children + index + 1, node->_children + index,
+            sizeof(*node->_children) * (node->_n_children - index));
+    node->_children[index] = child;
+    node->_n_children++;
+
+    *out_child = child;
+
+    return 0;
+}
+
+int
+topic_trie_insert(topic_trie self, const char* pattern, void* value)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (topic_trie_validate(pattern))
+    {
+        return 1;
+    }
+
+    struct _topic_segment_t stack_segments[_TOPIC_STACK_SEGMENTS];
+    struct _topic_segment_t* segments = NULL;
+    size_t n_segments = 0;
+    int exit_code =
+        _topic_split(pattern, stack_segments, &segments, &n_segments);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+    _topic_collapse_hashes(segments, &n_segments);
+
+    // the nodes created on the way stay in the trie if the insert fails,
+    // they are empty and freed with it
+    struct _topic_trie_node_t* node = self->_root;
+    size_t i = 0;
+    while (i < n_segments && !exit_code)
+    {
+        exit_code = _topic_trie_node_child(node, &segments[i], &node);
+        i++;
+    }
+
+    if (segments != stack_segments)
+    {
+        free(segments);
+    }
+
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    if (node->_n_values == node->_values_capacity)
+    {
+
+        size_t capacity =
+            node->_values_capacity ? node->_values_capacity * 2 : 2;
+        void** values = realloc(node->_values, sizeof(void*) * capacity);
+        if (!values)
+        {
+            return -1;
+        }
+
+        node->_values = values;
+        node->_values_capacity = capacity;
+    }
+
+    if (!node->_n_values)
+    {
+        self->_n_patterns++;
+    }
+
+    node->_values[node->_n_values] = value;
+    node->_n_values++;
+
+    return 0;
+}
+
+// @note recursive on the pattern depth; the child the value was removed from
+// is freed on the way back when it is left empty.
+static int
+_topic_trie_node_remove(struct topic_trie_t* trie,
+                        struct _topic_trie_node_t* node,
+                        const struct _topic_segment_t* segments,
+                        size_t n_segments, void* value)
+{
+
+    if (!n_segments)
+    {
+
+        size_t i = 0;
+        while (i < node->_n_values && node->_values[i] != value)
+        {
+            i++;
+        }
+
+        if (i == node->_n_values)
+        {
+            return 1;
+        }
+
+        node->_n_values--;
+        memmove(node->_values + i, node->_values + i + 1,
+                sizeof(void*) * (node->_n_values - i));
+
+        if (!node->_n_values)
+        {
+            trie->_n_patterns--;
+        }
+
+        return 0;
+    }
+
+    struct _topic_trie_node_t** slot = NULL;
+    size_t index = 0;
+    if (_topic_segment_is(&segments[0], '*'))
+    {
+        slot = &node->_star;
+    }
+    else if (_topic_segment_is(&segments[0], '#'))
+    {
+        slot = &node->_hash;
+    }
+    else if (_topic_trie_node_find(node, &segments[0], &index))
+    {
+        slot = &node->_children[index];
+    }
+
+    if (!slot || !*slot)
+    {
+        return 1;
+    }
+
+    struct _topic_trie_node_t* child = *slot;
+    int exit_code = _topic_trie_node_remove(trie, child, segments + 1,
+                                            n_segments - 1, value);
+    if (exit_code || !_topic_trie_node_is_empty(child))
+    {
+        return exit_code;
+    }
+
+    _topic_trie_node_free(child);
+
+    if (slot == &node->_star || slot == &node->_hash)
+    {
+        *slot = NULL;
+    }
+    else
+    {
+
+        node->_n_children--;
+        memmove(node->_children + index, node->_children + index + 1,
+                sizeof(*node->_children) * (node->_n_children - index));
+    }
+
+    return 0;
+}
+
+int
+topic_trie_remove(topic_trie self, const char* pattern, void* value)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (topic_trie_validate(pattern))
+    {
+        return 1;
+    }
+
+    struct _topic_segment_t stack_segments[_TOPIC_STACK_SEGMENTS];
+    struct _topic_segment_t* segments = NULL;
+    size_t n_segments = 0;
+    int exit_code =
+        _topic_split(pattern, stack_segments, &segments, &n_segments);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+    _topic_collapse_hashes(segments, &n_segments);
+
+    exit_code = _topic_trie_node_remove(self, self->_root, segments,
+                                        n_segments, value);
+
+    if (segments != stack_segments)
+    {
+        free(segments);
+    }
+
+    return exit_code;
+}
+
+// @note the trie is walked as an automaton, one topic segment at a time: the
+// states are the nodes that consumed the segments read so far, each held once,
+// so a match costs the topic depth times the states and never backtracks. A
+// '#' node is a state as soon as its parent is (it matches zero segments) and
+// stays one on every following segment. The matching nodes are collected and
+// deduplicated before the callbacks run.
+struct _topic_states_t
+{
+    struct _topic_trie_node_t** _nodes;
+    size_t _n;
+    size_t _capacity;
+    struct _topic_trie_node_t* _stack_nodes[_TOPIC_STACK_MATCHES];
+};
+
+struct _topic_match_t
+{
+    struct _topic_trie_node_t** _nodes;
+    size_t _n_nodes;
+    size_t _nodes_capacity;
+    struct _topic_trie_node_t* _stack_nodes[_TOPIC_STACK_MATCHES];
+};
+
+static int
+_topic_trie_node_is_hash(const struct _topic_trie_node_t* node)
+{
+    return node->_segment[0] == '#' && !node->_segment[1];
+}
+
+static void
+_topic_states_init(struct _topic_states_t* states)
+{
+
+    states->_nodes = states->_stack_nodes;
+    states->_n = 0;
+    states->_capacity = _TOPIC_STACK_MATCHES;
+}
+
+static void
+_topic_states_destroy(struct _topic_states_t* states)
+{
+
+    if (states->_nodes != states->_stack_nodes)
+    {
+        free(states->_nodes);
+    }
+}
+
+// @note only a '#' node can be reached twice on the same segment (from its
+// parent and from itself), the other nodes are added without a lookup.
+static int
+_topic_states_add(struct _topic_states_t* states,
+                  struct _topic_trie_node_t* node)
+{
+
+    if (_topic_trie_node_is_hash(node))
+    {
+
+        size_t i = 0;
+        while (i < states->_n)
+        {
+
+            if (states->_nodes[i] == node)
+            {
+                return 0;
+            }
+
+            i++;
+        }
+    }
+
+    if (states->_n == states->_capacity)
+    {
+
+        size_t capacity = states->_capacity * 2;
+        struct _topic_trie_node_t** nodes = malloc(sizeof(*nodes) * capacity);
+        if (!nodes)
+        {
+            return -1;
+        }
+
+        memcpy(nodes, states->_nodes, sizeof(*nodes) * states->_n);
+        _topic_states_destroy(states);
+
+        states->_nodes = nodes;
+        states->_capacity = capacity;
+    }
+
+    states->_nodes[states->_n] = node;
+    states->_n++;
+
+    // '#' also matches zero segments
+    if (node->_hash)
+    {
+        return _topic_states_add(states, node->_hash);
+    }
+
+    return 0;
+}
+
+// Moves every state of current over segment into next.
+static int
+_topic_states_step(const struct _topic_states_t* current,
+                   const struct _topic_segment_t* segment,
+                   struct _topic_states_t* next)
+{
+
+    int exit_code = 0;
+
+    size_t i = 0;
+    while (i < current->_n && !exit_code)
+    {
+
+        struct _topic_trie_node_t* node = current->_nodes[i];
+
+        struct _topic_trie_node_t* child =
+            _topic_trie_node_find(node, segment, NULL);
+        if (child)
+        {
+            exit_code = _topic_states_add(next, child);
+        }
+
+        if (!exit_code && node->_star)
+        {
+            exit_code = _topic_states_add(next, node->_star);
+        }
+
+        if (!exit_code && _topic_trie_node_is_hash(node))
+        {
+            exit_code = _topic_states_add(next, node);
+        }
+
+        i++;
+    }
+
+    return exit_code;
+}
+
+static int
+_topic_match_add(struct _topic_match_t* match, struct _topic_trie_node_t* node)
+{
+
+    if (!node->_n_values)
+    {
+        return 0;
+    }
+
+    size_t i = 0;
+    while (i < match->_n_nodes)
+    {
+
+        if (match->_nodes[i] == node)
+        {
+            return 0;
+        }
+
+        i++;
+    }
+
+    if (match->_n_nodes == match->_nodes_capacity)
+    {
+
+        size_t capacity = match->_nodes_capacity * 2;
+        struct _topic_trie_node_t** nodes =
+            malloc(sizeof(*nodes) * capacity);
+        if (!nodes)
+        {
+            return -1;
+        }
+
+        memcpy(nodes, match->_nodes, sizeof(*nodes) * match->_n_nodes);
+        if (match->_nodes != match->_stack_nodes)
+        {
+            free(match->_nodes);
+        }
+
+        match->_nodes = nodes;
+        match->_nodes_capacity = capacity;
+    }
+
+    match->_nodes[match->_n_nodes] = node;
+    match->_n_nodes++;
+
+    return 0;
+}
+
+static int
+_topic_match_walk(struct _topic_match_t* match, struct _topic_trie_node_t* root,
+                  const struct _topic_segment_t* segments, size_t n_segments)
+{
+
+    struct _topic_states_t states[2];
+    _topic_states_init(&states[0]);
+    _topic_states_init(&states[1]);
+
+    struct _topic_states_t* current = &states[0];
+    struct _topic_states_t* next = &states[1];
+
+    int exit_code = _topic_states_add(current, root);
+
+    size_t index = 0;
+    while (index < n_segments && current->_n && !exit_code)
+    {
+
+        next->_n = 0;
+        exit_code = _topic_states_step(current, &segments[index], next);
+
+        struct _topic_states_t* swap = current;
+        current = next;
+        next = swap;
+
+        index++;
+    }
+
+    size_t i = 0;
+    while (i < current->_n && !exit_code)
+    {
+        exit_code = _topic_match_add(match, current->_nodes[i]);
+        i++;
+    }
+
+    _topic_states_destroy(&states[0]);
+    _topic_states_destroy(&states[1]);
+
+    return exit_code;
+}
+
+int
+topic_trie_match(topic_trie self, const char* topic,
+                 int (*callback)(void* context, void* value), void* context)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!topic)
+    {
+        return 1;
+    }
+
+    if (!callback)
+    {
+        return 1;
+    }
+
+    if (!self->_n_patterns)
+    {
+        return 0;
+    }
+
+    struct _topic_segment_t stack_segments[_TOPIC_STACK_SEGMENTS];
+    struct _topic_segment_t* segments = NULL;
+    size_t n_segments = 0;
+    int exit_code = _topic_split(topic, stack_segments, &segments, &n_segments);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    struct _topic_match_t match;
+    match._nodes = match._stack_nodes;
+    match._n_nodes = 0;
+    match._nodes_capacity = _TOPIC_STACK_MATCHES;
+
+    exit_code = _topic_match_walk(&match, self->_root, segments, n_segments);
+
+    size_t i = 0;
+    while (i < match._n_nodes && !exit_code)
+    {
+
+        struct _topic_trie_node_t* node = match._nodes[i];
+
+        size_t j = 0;
+        while (j < node->_n_values && !exit_code)
+        {
+            exit_code = callback(context, node->_values[j]);
+            j++;
+        }
+
+        i++;
+    }
+
+    if (match._nodes != match._stack_nodes)
+    {
+        free(match._nodes);
+    }
+
+    if (segments != stack_segments)
+    {
+        free(segments);
+    }
+
+    return exit_code;
+}
+
+int
+topic_trie_get_size(topic_trie self, size_t* out_size)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!out_size)
+    {
+        return 1;
+    }
+
+    *out_size = self->_n_patterns;
+
+    return 0;
+}
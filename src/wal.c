@@ -0,0 +1,1577 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// @note segment layout, host byte order: magic (4), format version of the
+// records data (4), then the records. Record layout: crc32 (4), length (4),
+// offset (8), data (length). The CRC covers everything after itself.
+#define _WAL_SEGMENT_MAGIC 0x314C4157u
+#define _WAL_SEGMENT_HEADER_SIZE 8
+#define _WAL_RECORD_HEADER_SIZE 16
+#define _WAL_SEGMENT_SUFFIX ".wal"
+#define _WAL_OFFSETS_FILE "offsets"
+#define _WAL_OFFSETS_TMP_FILE "offsets.tmp"
+
+struct _wal_buffer_t
+{
+    char* _data;
+    size_t _len;
+    size_t _capacity;
+};
+
+struct _wal_offset_t
+{
+    char* _name;
+    uint64_t _offset;
+};
+
+// @note _mutex guards everything but _fd and _fd_size, which only the flusher
+// touches once the log is open. Appends fill _pending, the flusher swaps it
+// with _spare and writes it out of the lock.
+struct wal_t
+{
+    char* _dir;
+    size_t _segment_size;
+    size_t _commit_batch_size;
+    size_t _commit_latency_ms;
+    uint32_t _format_version;
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _pending_cond;
+    pthread_cond_t _committed_cond;
+    pthread_t _flusher;
+    int _running;
+    int _sync_requested;
+    struct timespec _commit_deadline;
+
+    struct _wal_buffer_t _pending;
+    struct _wal_buffer_t _spare;
+    size_t _n_pending;
+    uint64_t _next_offset;
+    uint64_t _committed_offset;
+    int _io_error;
+
+    uint64_t* _segment_bases;
+    size_t _n_segments;
+    size_t _segments_capacity;
+    int _fd;
+    size_t _fd_size;
+
+    struct _wal_offset_t* _offsets;
+    size_t _n_offsets;
+    size_t _offsets_capacity;
+    int _offsets_dirty;
+};
+
+static uint32_t _crc32_table[256];
+static pthread_once_t _crc32_once = PTHREAD_ONCE_INIT;
+
+static void
+_crc32_init()
+{
+
+    uint32_t i = 0;
+    while (i < 256)
+    {
+
+        uint32_t crc = i;
+        int bit = 0;
+        while (bit < 8)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            bit++;
+        }
+
+        _crc32_table[i] = crc;
+        i++;
+    }
+}
+
+static uint32_t
+_crc32_update(uint32_t crc, const void* data, size_t len)
+{
+
+    const unsigned char* p = (const unsigned char*) data;
+    while (len--)
+    {
+        crc = _crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+static int
+_wal_path(struct wal_t* self, const char* file, char** out_path)
+{
+
+    size_t len = strlen(self->_dir) + 1 + strlen(file) + 1;
+    char* path = malloc(len);
+    if (!path)
+    {
+        return -1;
+    }
+
+    snprintf(path, len, "%s/%s", self->_dir, file);
+    *out_path = path;
+
+    return 0;
+}
+
+static int
+_wal_segment_path(struct wal_t* self, uint64_t base_offset, char** out_path)
+{
+
+    char file[32];
+    snprintf(file, sizeof(file), "%020" PRIu64 _WAL_SEGMENT_SUFFIX,
+             base_offset);
+
+    return _wal_path(self, file, out_path);
+}
+
+// @note makes a file creation, rename or deletion in the directory durable.
+static int
+_wal_sync_dir(struct wal_t* self)
+{
+
+    int fd = open(self->_dir, O_RDONLY);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    int exit_code = fsync(fd) ? errno : 0;
+    close(fd);
+
+    return exit_code;
+}
+
+static int
+_wal_write_all(int fd, const char* data, size_t len)
+{
+
+    while (len)
+    {
+
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return errno;
+        }
+
+        data += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+static int
+_wal_buffer_reserve(struct _wal_buffer_t* buffer, size_t len)
+{
+
+    if (buffer->_len + len <= buffer->_capacity)
+    {
+        return 0;
+    }
+
+    size_t capacity = buffer->_capacity ? buffer->_capacity : 4096;
+    while (capacity < buffer->_len + len)
+    {
+        capacity *= 2;
+    }
+
+    char* data = realloc(buffer->_data, capacity);
+    if (!data)
+    {
+        return -1;
+    }
+
+    buffer->_data = data;
+    buffer->_capacity = capacity;
+
+    return 0;
+}
+
+// Writes the header of an empty segment and makes it durable.
+static int
+_wal_segment_write_header(struct wal_t* self, int fd)
+{
+
+    char header[_WAL_SEGMENT_HEADER_SIZE];
+    uint32_t magic = _WAL_SEGMENT_MAGIC;
+    memcpy(header, &magic, sizeof(magic));
+    memcpy(header + 4, &self->_format_version, sizeof(self->_format_version));
+
+    int exit_code = _wal_write_all(fd, header, sizeof(header));
+    if (!exit_code && fdatasync(fd))
+    {
+        exit_code = errno;
+    }
+
+    return exit_code;
+}
+
+// Returns EPROTO when the segment was not written by this version of the log
+// or holds records of another format.
+static int
+_wal_segment_check_header(struct wal_t* self, const char* data)
+{
+
+    uint32_t magic = 0;
+    uint32_t format_version = 0;
+    memcpy(&magic, data, sizeof(magic));
+    memcpy(&format_version, data + 4, sizeof(format_version));
+
+    if (magic != _WAL_SEGMENT_MAGIC || format_version != self->_format_version)
+    {
+        return EPROTO;
+    }
+
+    return 0;
+}
+
+static int
+_wal_segments_push(struct wal_t* self, uint64_t base_offset)
+{
+
+    if (self->_n_segments == self->_segments_capacity)
+    {
+
+        size_t capacity =
+            self->_segments_capacity ? self->_segments_capacity * 2 : 8;
+        uint64_t* bases =
+            realloc(self->_segment_bases, capacity * sizeof(uint64_t));
+        if (!bases)
+        {
+            return -1;
+        }
+
+        self->_segment_bases = bases;
+        self->_segments_capacity = capacity;
+    }
+
+    self->_segment_bases[self->_n_segments] = base_offset;
+    self->_n_segments++;
+
+    return 0;
+}
+
+static int
+_wal_segment_open_active(struct wal_t* self, uint64_t base_offset,
+                         int create)
+{
+
+    char* path = NULL;
+    int exit_code = _wal_segment_path(self, base_offset, &path);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    int flags = O_WRONLY | O_APPEND | (create ? O_CREAT | O_EXCL : 0);
+    int fd = open(path, flags, 0644);
+    free(path);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+
+        exit_code = errno;
+        close(fd);
+
+        return exit_code;
+    }
+
+    if (create)
+    {
+
+        exit_code = _wal_segment_write_header(self, fd);
+        if (!exit_code)
+        {
+            exit_code = _wal_sync_dir(self);
+        }
+
+        if (exit_code)
+        {
+
+            close(fd);
+            return exit_code;
+        }
+
+        st.st_size = _WAL_SEGMENT_HEADER_SIZE;
+    }
+
+    self->_fd = fd;
+    self->_fd_size = (size_t) st.st_size;
+
+    return 0;
+}
+
+// @note walks the valid records of a mapped segment starting at base_offset
+// and stops at end_offset, calls visit (may be NULL) on those from offset from
+// on. out_valid_size receives the size of the valid prefix, out_next_offset
+// the offset that follows it. The segment header was checked on recovery.
+static int
+_wal_segment_scan(const char* data, size_t size, uint64_t base_offset,
+                  uint64_t from, uint64_t end_offset,
+                  int (*visit)(void*, uint64_t, const void*, size_t),
+                  void* context, size_t* out_valid_size,
+                  uint64_t* out_next_offset)
+{
+
+    size_t pos = _WAL_SEGMENT_HEADER_SIZE;
+    uint64_t offset = base_offset;
+
+    while (pos + _WAL_RECORD_HEADER_SIZE <= size && offset < end_offset)
+    {
+
+        uint32_t crc = 0;
+        uint32_t len = 0;
+        uint64_t record_offset = 0;
+        memcpy(&crc, data + pos, sizeof(crc));
+        memcpy(&len, data + pos + 4, sizeof(len));
+        memcpy(&record_offset, data + pos + 8, sizeof(record_offset));
+
+        if (len > size - pos - _WAL_RECORD_HEADER_SIZE)
+        {
+            break;
+        }
+
+        if (record_offset != offset)
+        {
+            break;
+        }
+
+        uint32_t actual = _crc32_update(0xFFFFFFFFu, data + pos + 4,
+                                        _WAL_RECORD_HEADER_SIZE - 4 + len)
+                          ^ 0xFFFFFFFFu;
+        if (actual != crc)
+        {
+            break;
+        }
+
+        if (visit && offset >= from)
+        {
+
+            int exit_code =
+                visit(context, offset, data + pos + _WAL_RECORD_HEADER_SIZE,
+                      len);
+            if (exit_code)
+            {
+                return exit_code;
+            }
+        }
+
+        pos += _WAL_RECORD_HEADER_SIZE + len;
+        offset++;
+    }
+
+    if (out_valid_size)
+    {
+        *out_valid_size = pos;
+    }
+
+    if (out_next_offset)
+    {
+        *out_next_offset = offset;
+    }
+
+    return 0;
+}
+
+static int
+_wal_segment_map(struct wal_t* self, uint64_t base_offset, int writable,
+                 int* out_fd, char** out_data, size_t* out_size)
+{
+
+    char* path = NULL;
+    int exit_code = _wal_segment_path(self, base_offset, &path);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    free(path);
+    if (fd < 0)
+    {
+        return errno;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+
+        exit_code = errno;
+        close(fd);
+
+        return exit_code;
+    }
+
+    char* data = NULL;
+    if (st.st_size > 0)
+    {
+
+        data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+
+            exit_code = errno;
+            close(fd);
+
+            return exit_code;
+        }
+    }
+
+    *out_fd = fd;
+    *out_data = data;
+    *out_size = (size_t) st.st_size;
+
+    return 0;
+}
+
+static int
+_wal_compare_bases(const void* a, const void* b)
+{
+
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static int
+_wal_list_segments(struct wal_t* self)
+{
+
+    DIR* dir = opendir(self->_dir);
+    if (!dir)
+    {
+        return errno;
+    }
+
+    size_t suffix_len = strlen(_WAL_SEGMENT_SUFFIX);
+
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)))
+    {
+
+        size_t name_len = strlen(entry->d_name);
+        if (name_len <= suffix_len
+            || strcmp(entry->d_name + name_len - suffix_len,
+                      _WAL_SEGMENT_SUFFIX))
+        {
+            continue;
+        }
+
+        char* end = NULL;
+        uint64_t base_offset = strtoull(entry->d_name, &end, 10);
+        if (end != entry->d_name + name_len - suffix_len)
+        {
+            continue;
+        }
+
+        if (_wal_segments_push(self, base_offset))
+        {
+
+            closedir(dir);
+            return -1;
+        }
+    }
+
+    closedir(dir);
+
+    qsort(self->_segment_bases, self->_n_segments, sizeof(uint64_t),
+          _wal_compare_bases);
+
+    return 0;
+}
+
+// @note validates the segments in order; the first invalid record ends the
+// log: its segment is truncated there and the following ones are deleted.
+// A segment with another header is not touched and fails the recovery, a
+// segment too short to hold its header was torn on creation and is rewritten.
+static int
+_wal_recover(struct wal_t* self)
+{
+
+    int exit_code = _wal_list_segments(self);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    if (!self->_n_segments)
+    {
+
+        exit_code = _wal_segments_push(self, 0);
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        return _wal_segment_open_active(self, 0, 1);
+    }
+
+    uint64_t next_offset = self->_segment_bases[0];
+
+    size_t i = 0;
+    while (i < self->_n_segments)
+    {
+
+        if (self->_segment_bases[i] != next_offset)
+        {
+            break;
+        }
+
+        int fd = -1;
+        char* data = NULL;
+        size_t size = 0;
+        exit_code = _wal_segment_map(self, self->_segment_bases[i], 1, &fd,
+                                     &data, &size);
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        size_t valid_size = 0;
+        if (size >= _WAL_SEGMENT_HEADER_SIZE)
+        {
+
+            exit_code = _wal_segment_check_header(self, data);
+            if (!exit_code)
+            {
+                _wal_segment_scan(data, size, self->_segment_bases[i], 0,
+                                  UINT64_MAX, NULL, NULL, &valid_size,
+                                  &next_offset);
+            }
+        }
+
+        if (data)
+        {
+            munmap(data, size);
+        }
+
+        if (exit_code)
+        {
+
+            close(fd);
+            return exit_code;
+        }
+
+        if (size < _WAL_SEGMENT_HEADER_SIZE)
+        {
+
+            exit_code = ftruncate(fd, 0) ? errno : 0;
+            if (!exit_code)
+            {
+                exit_code = _wal_segment_write_header(self, fd);
+            }
+
+            valid_size = _WAL_SEGMENT_HEADER_SIZE;
+            size = valid_size;
+        }
+        else if (valid_size < size)
+        {
+
+            exit_code = ftruncate(fd, (off_t) valid_size) ? errno : 0;
+            if (!exit_code)
+            {
+                exit_code = fdatasync(fd) ? errno : 0;
+            }
+        }
+
+        close(fd);
+
+        if (exit_code)
+        {
+            return exit_code;
+        }
+
+        i++;
+
+        if (valid_size < size)
+        {
+            break;
+        }
+    }
+
+    // whatever follows the end of the valid records is unreachable
+    size_t n_valid = i;
+    while (i < self->_n_segments)
+    {
+
+        char* path = NULL;
+        if (_wal_segment_path(self, self->_segment_bases[i], &path) == 0)
+        {
+            unlink(path);
+            free(path);
+        }
+
+        i++;
+    }
+
+    self->_n_segments = n_valid;
+    self->_next_offset = next_offset;
+    self->_committed_offset = next_offset;
+
+    return _wal_segment_open_active(
+        self, self->_segment_bases[self->_n_segments - 1], 0);
+}
+
+static int
+_wal_offsets_set_locked(struct wal_t* self, const char* name, uint64_t offset)
+{
+
+    size_t i = 0;
+    while (i < self->_n_offsets)
+    {
+
+        if (!strcmp(self->_offsets[i]._name, name))
+        {
+
+            self->_offsets[i]._offset = offset;
+            return 0;
+        }
+
+        i++;
+    }
+
+    if (self->_n_offsets == self->_offsets_capacity)
+    {
+
+        size_t capacity =
+            self->_offsets_capacity ? self->_offsets_capacity * 2 : 8;
+        struct _wal_offset_t* offsets =
+            realloc(self->_offsets, capacity * sizeof(struct _wal_offset_t));
+        if (!offsets)
+        {
+            return -1;
+        }
+
+        self->_offsets = offsets;
+        self->_offsets_capacity = capacity;
+    }
+
+    char* copy = strdup(name);
+    if (!copy)
+    {
+        return -1;
+    }
+
+    self->_offsets[self->_n_offsets]._name = copy;
+    self->_offsets[self->_n_offsets]._offset = offset;
+    self->_n_offsets++;
+
+    return 0;
+}
+
+// @note one "<offset> <name>" line per name.
+static int
+_wal_load_offsets(struct wal_t* self)
+{
+
+    char* path = NULL;
+    int exit_code = _wal_path(self, _WAL_OFFSETS_FILE, &path);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    FILE* file = fopen(path, "r");
+    free(path);
+    if (!file)
+    {
+        return errno == ENOENT ? 0 : errno;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+
+        char* end = NULL;
+        uint64_t offset = strtoull(line, &end, 10);
+        if (end == line || *end != ' ')
+        {
+            continue;
+        }
+
+        char* name = end + 1;
+        name[strcspn(name, "\n")] = '\0';
+        if (!*name)
+        {
+            continue;
+        }
+
+        if (offset > self->_next_offset)
+        {
+            offset = self->_next_offset;
+        }
+
+        exit_code = _wal_offsets_set_locked(self, name, offset);
+        if (exit_code)
+        {
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return exit_code;
+}
+
+// @note written to a temporary file renamed over the previous one, so a crash
+// leaves either the old or the new offsets.
+static int
+_wal_persist_offsets(struct wal_t* self, const char* data, size_t len)
+{
+
+    char* tmp_path = NULL;
+    char* path = NULL;
+    int exit_code = _wal_path(self, _WAL_OFFSETS_TMP_FILE, &tmp_path);
+    if (!exit_code)
+    {
+        exit_code = _wal_path(self, _WAL_OFFSETS_FILE, &path);
+    }
+
+    if (exit_code)
+    {
+
+        free(tmp_path);
+        return exit_code;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        exit_code = errno;
+    }
+    else
+    {
+
+        exit_code = _wal_write_all(fd, data, len);
+        if (!exit_code && fdatasync(fd))
+        {
+            exit_code = errno;
+        }
+
+        close(fd);
+    }
+
+    if (!exit_code && rename(tmp_path, path))
+    {
+        exit_code = errno;
+    }
+
+    if (!exit_code)
+    {
+        exit_code = _wal_sync_dir(self);
+    }
+
+    free(tmp_path);
+    free(path);
+
+    return exit_code;
+}
+
+static uint64_t
+_wal_min_offset_locked(struct wal_t* self)
+{
+
+    uint64_t min_offset = self->_next_offset;
+
+    size_t i = 0;
+    while (i < self->_n_offsets)
+    {
+
+        if (self->_offsets[i]._offset < min_offset)
+        {
+            min_offset = self->_offsets[i]._offset;
+        }
+
+        i++;
+    }
+
+    return min_offset;
+}
+
+static int
+_wal_snapshot_offsets_locked(struct wal_t* self, struct _wal_buffer_t* out)
+{
+
+    size_t i = 0;
+    while (i < self->_n_offsets)
+    {
+
+        struct _wal_offset_t* entry = &self->_offsets[i];
+        size_t line_len = 21 + 1 + strlen(entry->_name) + 1;
+        if (_wal_buffer_reserve(out, line_len + 1))
+        {
+            return -1;
+        }
+
+        out->_len += (size_t) snprintf(out->_data + out->_len, line_len + 1,
+                                       "%" PRIu64 " %s\n", entry->_offset,
+                                       entry->_name);
+        i++;
+    }
+
+    return 0;
+}
+
+// @note a segment goes when the next one starts at or below min_offset: no
+// offset of interest falls in it anymore. The active segment always stays.
+static void
+_wal_remove_segments_below(struct wal_t* self, uint64_t min_offset)
+{
+
+    pthread_mutex_lock(&self->_mutex);
+
+    size_t n_removable = 0;
+    while (n_removable + 1 < self->_n_segments
+           && self->_segment_bases[n_removable + 1] <= min_offset)
+    {
+        n_removable++;
+    }
+
+    uint64_t* removed = NULL;
+    if (n_removable)
+    {
+
+        removed = malloc(n_removable * sizeof(uint64_t));
+        if (removed)
+        {
+
+            memcpy(removed, self->_segment_bases,
+                   n_removable * sizeof(uint64_t));
+            memmove(self->_segment_bases,
+                    self->_segment_bases + n_removable,
+                    (self->_n_segments - n_removable) * sizeof(uint64_t));
+            self->_n_segments -= n_removable;
+        }
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    if (!removed)
+    {
+        return;
+    }
+
+    size_t i = 0;
+    while (i < n_removable)
+    {
+
+        char* path = NULL;
+        if (_wal_segment_path(self, removed[i], &path) == 0)
+        {
+            unlink(path);
+            free(path);
+        }
+
+        i++;
+    }
+
+    free(removed);
+}
+
+static void
+_wal_mark_pending_locked(struct wal_t* self)
+{
+
+    if (self->_pending._len || self->_offsets_dirty)
+    {
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &self->_commit_deadline);
+
+    self->_commit_deadline.tv_sec += (time_t) (self->_commit_latency_ms / 1000);
+    self->_commit_deadline.tv_nsec +=
+        (long) (self->_commit_latency_ms % 1000) * 1000000L;
+    if (self->_commit_deadline.tv_nsec >= 1000000000L)
+    {
+        self->_commit_deadline.tv_sec++;
+        self->_commit_deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_cond_signal(&self->_pending_cond);
+}
+
+// @note writes the swapped out records in one go and makes them durable with
+// a single fdatasync. On failure the segment is truncated back to its last
+// committed size, so that no torn record is left behind to cut the log short
+// on recovery.
+static int
+_wal_commit_records(struct wal_t* self, struct _wal_buffer_t* records)
+{
+
+    int exit_code = _wal_write_all(self->_fd, records->_data, records->_len);
+    if (!exit_code && fdatasync(self->_fd))
+    {
+        exit_code = errno;
+    }
+
+    if (exit_code)
+    {
+
+        if (!ftruncate(self->_fd, (off_t) self->_fd_size))
+        {
+            fdatasync(self->_fd);
+        }
+
+        return exit_code;
+    }
+
+    self->_fd_size += records->_len;
+
+    return 0;
+}
+
+// Starts a new segment at next_offset once the active one is past its size.
+static int
+_wal_roll_segment(struct wal_t* self, uint64_t next_offset)
+{
+
+    if (self->_fd_size < self->_segment_size)
+    {
+        return 0;
+    }
+
+    close(self->_fd);
+    self->_fd = -1;
+
+    int exit_code = _wal_segment_open_active(self, next_offset, 1);
+    if (exit_code)
+    {
+        return exit_code;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+    exit_code = _wal_segments_push(self, next_offset);
+    pthread_mutex_unlock(&self->_mutex);
+
+    return exit_code;
+}
+
+static void*
+_wal_flusher(void* arg)
+{
+
+    struct wal_t* self = (struct wal_t*) arg;
+
+    struct _wal_buffer_t offsets = {NULL, 0, 0};
+
+    pthread_mutex_lock(&self->_mutex);
+
+    while (1)
+    {
+
+        while (self->_running && !self->_pending._len && !self->_offsets_dirty)
+        {
+            pthread_cond_wait(&self->_pending_cond, &self->_mutex);
+        }
+
+        if (!self->_pending._len && !self->_offsets_dirty)
+        {
+            break;
+        }
+
+        // group commit: let more records join until the batch is full or the
+        // oldest one waited long enough
+        while (self->_running && !self->_sync_requested
+               && self->_n_pending < self->_commit_batch_size)
+        {
+
+            if (pthread_cond_timedwait(&self->_pending_cond, &self->_mutex,
+                                       &self->_commit_deadline)
+                == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+
+        struct _wal_buffer_t records = self->_pending;
+        self->_pending = self->_spare;
+        self->_pending._len = 0;
+        self->_spare = (struct _wal_buffer_t) {NULL, 0, 0};
+        self->_n_pending = 0;
+        self->_sync_requested = 0;
+
+        uint64_t next_offset = self->_next_offset;
+        uint64_t committed_offset = self->_committed_offset;
+
+        uint64_t min_offset = _wal_min_offset_locked(self);
+
+        offsets._len = 0;
+        int offsets_dirty = self->_offsets_dirty;
+        if (offsets_dirty && _wal_snapshot_offsets_locked(self, &offsets) == 0)
+        {
+            self->_offsets_dirty = 0;
+        }
+
+        pthread_mutex_unlock(&self->_mutex);
+
+        int exit_code = 0;
+        if (records._len)
+        {
+
+            exit_code = _wal_commit_records(self, &records);
+            if (!exit_code)
+            {
+                committed_offset = next_offset;
+                exit_code = _wal_roll_segment(self, next_offset);
+            }
+        }
+
+        // the offsets only go out once the records they refer to are durable
+        if (!exit_code && offsets_dirty)
+        {
+            exit_code = _wal_persist_offsets(self, offsets._data, offsets._len);
+        }
+
+        if (!exit_code)
+        {
+            _wal_remove_segments_below(self, min_offset);
+        }
+
+        pthread_mutex_lock(&self->_mutex);
+
+        self->_committed_offset = committed_offset;
+        records._len = 0;
+        self->_spare = records;
+
+        // the log cannot go on past a hole: the records appended meanwhile
+        // are dropped, the later appends and syncs fail with the error
+        if (exit_code)
+        {
+
+            self->_io_error = exit_code;
+            self->_pending._len = 0;
+            self->_n_pending = 0;
+            pthread_cond_broadcast(&self->_committed_cond);
+
+            break;
+        }
+
+        pthread_cond_broadcast(&self->_committed_cond);
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    free(offsets._data);
+
+    return NULL;
+}
+
+static void
+_wal_free(struct wal_t* self)
+{
+
+    if (self->_fd >= 0)
+    {
+        close(self->_fd);
+    }
+
+    size_t i = 0;
+    while (i < self->_n_offsets)
+    {
+        free(self->_offsets[i]._name);
+        i++;
+    }
+
+    free(self->_offsets);
+    free(self->_segment_bases);
+    free(self->_pending._data);
+    free(self->_spare._data);
+    free(self->_dir);
+    free(self);
+}
+
+int
+wal_open(const char* dir, const struct wal_configuration_t* config,
+         wal* out_self)
+{
+
+    if (!dir)
+    {
+        return 1;
+    }
+
+    if (!config || !config->_segment_size || !config->_commit_batch_size)
+    {
+        return 1;
+    }
+
+    if (!out_self)
+    {
+        return 1;
+    }
+
+    pthread_once(&_crc32_once, _crc32_init);
+
+    if (mkdir(dir, 0755) && errno != EEXIST)
+    {
+        return errno;
+    }
+
+    struct wal_t* self = calloc(1, sizeof(struct wal_t));
+    if (!self)
+    {
+        return -1;
+    }
+
+    self->_fd = -1;
+    self->_segment_size = config->_segment_size;
+    self->_commit_batch_size = config->_commit_batch_size;
+    self->_commit_latency_ms = config->_commit_latency_ms;
+    self->_format_version = config->_format_version;
+
+    self->_dir = strdup(dir);
+    if (!self->_dir)
+    {
+        _wal_free(self);
+        return -1;
+    }
+
+    int exit_code = _wal_recover(self);
+    if (!exit_code)
+    {
+        exit_code = _wal_load_offsets(self);
+    }
+
+    if (exit_code)
+    {
+        _wal_free(self);
+        return exit_code;
+    }
+
+    exit_code = pthread_mutex_init(&self->_mutex, NULL);
+    if (exit_code)
+    {
+        _wal_free(self);
+        return exit_code;
+    }
+
+    exit_code = pthread_cond_init(&self->_pending_cond, NULL);
+    if (exit_code)
+    {
+
+        pthread_mutex_destroy(&self->_mutex);
+        _wal_free(self);
+
+        return exit_code;
+    }
+
+    exit_code = pthread_cond_init(&self->_committed_cond, NULL);
+    if (exit_code)
+    {
+
+        pthread_cond_destroy(&self->_pending_cond);
+        pthread_mutex_destroy(&self->_mutex);
+        _wal_free(self);
+
+        return exit_code;
+    }
+
+    self->_running = 1;
+    exit_code = pthread_create(&self->_flusher, NULL, _wal_flusher, self);
+    if (exit_code)
+    {
+
+        pthread_cond_destroy(&self->_committed_cond);
+        pthread_cond_destroy(&self->_pending_cond);
+        pthread_mutex_destroy(&self->_mutex);
+        _wal_free(self);
+
+        return exit_code;
+    }
+
+    *out_self = self;
+
+    return 0;
+}
+
+int
+wal_close(wal self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+    self->_running = 0;
+    pthread_cond_signal(&self->_pending_cond);
+    pthread_mutex_unlock(&self->_mutex);
+
+    pthread_join(self->_flusher, NULL);
+
+    int exit_code = self->_io_error;
+
+    pthread_cond_destroy(&self->_committed_cond);
+    pthread_cond_destroy(&self->_pending_cond);
+    pthread_mutex_destroy(&self->_mutex);
+    _wal_free(self);
+
+    return exit_code;
+}
+
+int
+wal_append(wal self, const struct iovec* parts, size_t n_parts,
+           uint64_t* out_offset)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!parts && n_parts)
+    {
+        return 1;
+    }
+
+    size_t len = 0;
+    size_t i = 0;
+    while (i < n_parts)
+    {
+        len += parts[i].iov_len;
+        i++;
+    }
+
+    if (len > UINT32_MAX)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    if (!self->_running)
+    {
+
+        pthread_mutex_unlock(&self->_mutex);
+        return 1;
+    }
+
+    // the flusher is gone after an I/O error, nothing would be committed
+    if (self->_io_error)
+    {
+
+        int io_error = self->_io_error;
+        pthread_mutex_unlock(&self->_mutex);
+
+        return io_error;
+    }
+
+    int exit_code =
+        _wal_buffer_reserve(&self->_pending, _WAL_RECORD_HEADER_SIZE + len);
+    if (exit_code)
+    {
+
+        pthread_mutex_unlock(&self->_mutex);
+        return exit_code;
+    }
+
+    _wal_mark_pending_locked(self);
+
+    uint64_t offset = self->_next_offset;
+    uint32_t record_len = (uint32_t) len;
+
+    char* header = self->_pending._data + self->_pending._len;
+    memcpy(header + 4, &record_len, sizeof(record_len));
+    memcpy(header + 8, &offset, sizeof(offset));
+
+    char* data = header + _WAL_RECORD_HEADER_SIZE;
+    i = 0;
+    while (i < n_parts)
+    {
+
+        memcpy(data, parts[i].iov_base, parts[i].iov_len);
+        data += parts[i].iov_len;
+        i++;
+    }
+
+    uint32_t crc = _crc32_update(0xFFFFFFFFu, header + 4,
+                                 _WAL_RECORD_HEADER_SIZE - 4 + len)
+                   ^ 0xFFFFFFFFu;
+    memcpy(header, &crc, sizeof(crc));
+
+    self->_pending._len += _WAL_RECORD_HEADER_SIZE + len;
+    self->_n_pending++;
+    self->_next_offset++;
+
+    if (self->_n_pending == self->_commit_batch_size)
+    {
+        pthread_cond_signal(&self->_pending_cond);
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    if (out_offset)
+    {
+        *out_offset = offset;
+    }
+
+    return 0;
+}
+
+int
+wal_sync(wal self)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    uint64_t target = self->_next_offset;
+    if (self->_committed_offset < target)
+    {
+
+        self->_sync_requested = 1;
+        pthread_cond_signal(&self->_pending_cond);
+
+        while (self->_committed_offset < target && !self->_io_error)
+        {
+            pthread_cond_wait(&self->_committed_cond, &self->_mutex);
+        }
+    }
+
+    int exit_code = self->_io_error;
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    return exit_code;
+}
+
+int
+wal_get_range(wal self, uint64_t* out_first, uint64_t* out_next)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    if (out_first)
+    {
+        *out_first = self->_segment_bases[0];
+    }
+
+    if (out_next)
+    {
+        *out_next = self->_next_offset;
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    return 0;
+}
+
+int
+wal_replay(wal self, uint64_t from,
+           int (*callback)(void* context, uint64_t offset, const void* data,
+                           size_t len),
+           void* context)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!callback)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    uint64_t end_offset = self->_committed_offset;
+    size_t n_segments = self->_n_segments;
+    uint64_t* bases = malloc(n_segments * sizeof(uint64_t));
+    if (bases)
+    {
+        memcpy(bases, self->_segment_bases, n_segments * sizeof(uint64_t));
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    if (!bases)
+    {
+        return -1;
+    }
+
+    int exit_code = 0;
+
+    size_t i = 0;
+    while (i < n_segments && !exit_code)
+    {
+
+        // records below from live in earlier segments only
+        if (i + 1 < n_segments && bases[i + 1] <= from)
+        {
+            i++;
+            continue;
+        }
+
+        int fd = -1;
+        char* data = NULL;
+        size_t size = 0;
+        exit_code = _wal_segment_map(self, bases[i], 0, &fd, &data, &size);
+        if (exit_code)
+        {
+            break;
+        }
+
+        exit_code = _wal_segment_scan(data, size, bases[i], from, end_offset,
+                                      callback, context, NULL, NULL);
+
+        if (data)
+        {
+            munmap(data, size);
+        }
+        close(fd);
+
+        i++;
+    }
+
+    free(bases);
+
+    return exit_code;
+}
+
+int
+wal_commit_offset(wal self, const char* name, uint64_t offset)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!name || !*name || strchr(name, '\n'))
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    _wal_mark_pending_locked(self);
+
+    int exit_code = _wal_offsets_set_locked(self, name, offset);
+    if (!exit_code)
+    {
+        self->_offsets_dirty = 1;
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    return exit_code;
+}
+
+int
+wal_get_offset(wal self, const char* name, uint64_t* out_offset)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!name)
+    {
+        return 1;
+    }
+
+    if (!out_offset)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    int exit_code = 1;
+
+    size_t i = 0;
+    while (i < self->_n_offsets)
+    {
+
+        if (!strcmp(self->_offsets[i]._name, name))
+        {
+
+            *out_offset = self->_offsets[i]._offset;
+            exit_code = 0;
+
+            break;
+        }
+
+        i++;
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    return exit_code;
+}
+
+int
+wal_for_each_offset(wal self,
+                    int (*callback)(void* context, const char* name,
+                                    uint64_t offset),
+                    void* context)
+{
+
+    if (!self)
+    {
+        return 1;
+    }
+
+    if (!callback)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&self->_mutex);
+
+    int exit_code = 0;
+
+    size_t i = 0;
+    while (i < self->_n_offsets && !exit_code)
+    {
+        exit_code = callback(context, self->_offsets[i]._name,
+                             self->_offsets[i]._offset);
+        i++;
+    }
+
+    pthread_mutex_unlock(&self->_mutex);
+
+    return exit_code;
+}
@@ -1627,6 +1627,388 @@ generic_hash_table_empty_table_concurrent_test()
     return 0;
 }
 
+static atomic_int create_calls = 0;
+
+static int
+int_create(void* key, void* context, void** out_value)
+{
+
+    int* value = (int*) malloc(sizeof(int));
+    if (!value)
+    {
+        return -1;
+    }
+
+    *value = *(int*) key * (context ? *(int*) context : 1);
+    *out_value = value;
+
+    atomic_fetch_add(&create_calls, 1);
+
+    return 0;
+}
+
+int
+generic_hash_table_compute_if_absent_test()
+{
+    TEST_SUITE("Generic Hash Table Compute If Absent Test");
+
+    generic_hash_table table = NULL;
+    generic_hash_table_new(16, int_hash, int_free, int_copy, int_free,
+                           int_copy, int_compare, &table);
+
+    atomic_store(&create_calls, 0);
+
+    int key = 7;
+    int factor = 3;
+    void* value = NULL;
+    int result = generic_hash_table_compute_if_absent(table, &key, int_create,
+                                                      &factor, &value);
+    TEST_ASSERT(result == 0, "compute_if_absent should succeed on absent key");
+    TEST_ASSERT(value && *(int*) value == 21, "created value is returned");
+    TEST_ASSERT(atomic_load(&create_calls) == 1, "create called once");
+
+    void* again = NULL;
+    result = generic_hash_table_compute_if_absent(table, &key, int_create,
+                                                  &factor, &again);
+    TEST_ASSERT(result == 0, "compute_if_absent should succeed on present key");
+    TEST_ASSERT(again == value, "stored value is returned");
+    TEST_ASSERT(atomic_load(&create_calls) == 1, "create not called again");
+
+    size_t size = 0;
+    generic_hash_table_get_size(table, &size);
+    TEST_ASSERT(size == 1, "size counts the created pair once");
+
+    result = generic_hash_table_compute_if_absent(NULL, &key, int_create, NULL,
+                                                  &value);
+    TEST_ASSERT(result == 1, "should return 1 when self is NULL");
+
+    result = generic_hash_table_compute_if_absent(table, &key, NULL, NULL,
+                                                  &value);
+    TEST_ASSERT(result == 1, "should return 1 when create_function is NULL");
+
+    result = generic_hash_table_compute_if_absent(table, &key, int_create,
+                                                  NULL, NULL);
+    TEST_ASSERT(result == 1, "should return 1 when out_value is NULL");
+
+    generic_hash_table_free(table);
+
+    return 0;
+}
+
+typedef struct
+{
+    generic_hash_table table;
+    int num_keys;
+    void** seen;
+} compute_thread_args_t;
+
+void*
+compute_if_absent_thread(void* arg)
+{
+    compute_thread_args_t* args = (compute_thread_args_t*) arg;
+
+    int i = 0;
+    while (i < args->num_keys)
+    {
+
+        void* value = NULL;
+        generic_hash_table_compute_if_absent(args->table, &i, int_create, NULL,
+                                             &value);
+        args->seen[i] = value;
+        i++;
+    }
+
+    return NULL;
+}
+
+int
+generic_hash_table_concurrent_compute_if_absent_test()
+{
+    TEST_SUITE("Generic Hash Table Concurrent Compute If Absent Test");
+
+    generic_hash_table table = NULL;
+    generic_hash_table_new(8, int_hash, int_free, int_copy, int_free, int_copy,
+                           int_compare, &table);
+
+    atomic_store(&create_calls, 0);
+
+    const int num_threads = 8;
+    const int num_keys = 500;
+    pthread_t threads[8];
+    compute_thread_args_t args[8];
+    void* seen[8][500];
+
+    int i = 0;
+    while (i < num_threads)
+    {
+        args[i].table = table;
+        args[i].num_keys = num_keys;
+        args[i].seen = seen[i];
+        pthread_create(&threads[i], NULL, compute_if_absent_thread, &args[i]);
+        i++;
+    }
+
+    i = 0;
+    while (i < num_threads)
+    {
+        pthread_join(threads[i], NULL);
+        i++;
+    }
+
+    TEST_ASSERT(atomic_load(&create_calls) == num_keys,
+                "Each key created exactly once");
+
+    int consistent = 1;
+    i = 0;
+    while (i < num_keys)
+    {
+
+        int t = 1;
+        while (t < num_threads)
+        {
+            if (seen[t][i] != seen[0][i])
+            {
+                consistent = 0;
+            }
+            t++;
+        }
+
+        i++;
+    }
+    TEST_ASSERT(consistent, "All threads observe the same stored value");
+
+    size_t size = 0;
+    generic_hash_table_get_size(table, &size);
+    TEST_ASSERT(size == (size_t) num_keys, "No duplicate pairs inserted");
+
+    generic_hash_table_free(table);
+
+    return 0;
+}
+
+int
+generic_hash_table_upsert_test()
+{
+    TEST_SUITE("Generic Hash Table Upsert Test");
+
+    generic_hash_table table = NULL;
+    generic_hash_table_new(16, int_hash, int_free, int_copy, int_free,
+                           int_copy, int_compare, &table);
+
+    int key = 4;
+    int first = 40;
+    int second = 400;
+
+    int result = generic_hash_table_upsert(table, &key, &first);
+    TEST_ASSERT(result == 0, "upsert inserts an absent key");
+
+    void* value = NULL;
+    generic_hash_table_get(table, &key, &value);
+    TEST_ASSERT(value && *(int*) value == 40, "inserted value is stored");
+
+    result = generic_hash_table_upsert(table, &key, &second);
+    TEST_ASSERT(result == 0, "upsert replaces a present key");
+
+    generic_hash_table_get(table, &key, &value);
+    TEST_ASSERT(value && *(int*) value == 400, "replaced value is stored");
+
+    size_t size = 0;
+    generic_hash_table_get_size(table, &size);
+    TEST_ASSERT(size == 1, "replacement does not change the size");
+
+    result = generic_hash_table_upsert(table, NULL, &first);
+    TEST_ASSERT(result == 1, "should return 1 when key is NULL");
+
+    generic_hash_table_free(table);
+
+    return 0;
+}
+
+int
+generic_hash_table_compare_and_delete_test()
+{
+    TEST_SUITE("Generic Hash Table Compare And Delete Test");
+
+    generic_hash_table table = NULL;
+    generic_hash_table_new(16, int_hash, int_free, int_copy, int_free,
+                           int_copy, int_compare, &table);
+
+    int key = 9;
+    int value = 90;
+    generic_hash_table_insert(table, &key, &value);
+
+    void* stored = NULL;
+    generic_hash_table_get(table, &key, &stored);
+
+    int result = generic_hash_table_compare_and_delete(table, &key, &value);
+    TEST_ASSERT(result == 1, "delete refused on a different value");
+    TEST_ASSERT(generic_hash_table_contains(table, &key) == 0,
+                "key still present after refused delete");
+
+    result = generic_hash_table_compare_and_delete(table, &key, stored);
+    TEST_ASSERT(result == 0, "delete succeeds on the stored value");
+    TEST_ASSERT(generic_hash_table_contains(table, &key) == 1,
+                "key absent after delete");
+
+    result = generic_hash_table_compare_and_delete(table, &key, stored);
+    TEST_ASSERT(result == 1, "delete of an absent key returns 1");
+
+    generic_hash_table_free(table);
+
+    return 0;
+}
+
+static int for_each_sum = 0;
+
+static void
+sum_values(void* key, void* value)
+{
+    (void) key;
+    for_each_sum += *(int*) value;
+}
+
+static void
+sum_values_context(void* key, void* value, void* context)
+{
+    (void) key;
+    *(int*) context += *(int*) value;
+}
+
+int
+generic_hash_table_for_each_test()
+{
+    TEST_SUITE("Generic Hash Table For Each Test");
+
+    generic_hash_table table = NULL;
+    generic_hash_table_new(4, int_hash, int_free, int_copy, int_free, int_copy,
+                           int_compare, &table);
+
+    int expected = 0;
+    int i = 0;
+    while (i < 10)
+    {
+        int value = i * 10;
+        generic_hash_table_insert(table, &i, &value);
+        expected += value;
+        i++;
+    }
+
+    for_each_sum = 0;
+    int result = generic_hash_table_for_each(table, sum_values);
+    TEST_ASSERT(result == 0 && for_each_sum == expected,
+                "apply called once on every pair");
+
+    result = generic_hash_table_for_each(table, NULL);
+    TEST_ASSERT(result == 1, "should return 1 when apply is NULL");
+
+    int sum = 0;
+    result =
+        generic_hash_table_for_each_context(table, sum_values_context, &sum);
+    TEST_ASSERT(result == 0 && sum == expected,
+                "apply called with the context on every pair");
+
+    generic_hash_table_free(table);
+
+    return 0;
+}
+
+static void
+increment_value(void* value, void* context)
+{
+    (void) context;
+    (*(int*) value)++;
+}
+
+int
+generic_hash_table_apply_test()
+{
+    TEST_SUITE("Generic Hash Table Apply Test");
+
+    generic_hash_table table = NULL;
+    generic_hash_table_new(16, int_hash, int_free, int_copy, int_free,
+                           int_copy, int_compare, &table);
+
+    int key = 5;
+    int factor = 2;
+    void* value = NULL;
+    int result = generic_hash_table_compute_if_absent_apply(
+        table, &key, int_create, increment_value, &factor, &value);
+    TEST_ASSERT(result == 0 && value && *(int*) value == 11,
+                "apply called on the created value");
+
+    void* again = NULL;
+    result = generic_hash_table_compute_if_absent_apply(
+        table, &key, int_create, increment_value, &factor, &again);
+    TEST_ASSERT(result == 0 && again == value && *(int*) value == 12,
+                "apply called on the stored value");
+
+    result = generic_hash_table_get_apply(table, &key, increment_value, NULL,
+                                          &again);
+    TEST_ASSERT(result == 0 && again == value && *(int*) value == 13,
+                "get_apply called on the stored value");
+
+    int missing = 6;
+    result = generic_hash_table_get_apply(table, &missing, increment_value,
+                                          NULL, &again);
+    TEST_ASSERT(result == 1 && !again, "get_apply returns 1 on absent key");
+
+    result = generic_hash_table_get_apply(table, &key, NULL, NULL, &again);
+    TEST_ASSERT(result == 1, "should return 1 when apply is NULL");
+
+    generic_hash_table_free(table);
+
+    return 0;
+}
+
+static int
+is_odd_key(void* key, void* value, void* context)
+{
+
+    (void) value;
+    (void) context;
+
+    return *(int*) key % 2;
+}
+
+int
+generic_hash_table_delete_if_test()
+{
+    TEST_SUITE("Generic Hash Table Delete If Test");
+
+    generic_hash_table table = NULL;
+    generic_hash_table_new(4, int_hash, int_free, int_copy, int_free, int_copy,
+                           int_compare, &table);
+
+    int i = 0;
+    while (i < 20)
+    {
+        generic_hash_table_insert(table, &i, &i);
+        i++;
+    }
+
+    size_t n_deleted = 0;
+    int result = generic_hash_table_delete_if(table, is_odd_key, NULL,
+                                              &n_deleted);
+    TEST_ASSERT(result == 0 && n_deleted == 10, "matching pairs deleted");
+
+    size_t size = 0;
+    generic_hash_table_get_size(table, &size);
+    TEST_ASSERT(size == 10, "size accounts the deleted pairs");
+
+    int odd = 7;
+    int even = 8;
+    TEST_ASSERT(generic_hash_table_contains(table, &odd) == 1
+                    && generic_hash_table_contains(table, &even) == 0,
+                "only the matching keys are gone");
+
+    result = generic_hash_table_delete_if(table, NULL, NULL, NULL);
+    TEST_ASSERT(result == 1, "should return 1 when predicate is NULL");
+
+    generic_hash_table_free(table);
+
+    return 0;
+}
+
 int
 main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
 {
@@ -1684,6 +2066,14 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
     generic_hash_table_rapid_insert_delete_test();
     generic_hash_table_empty_table_concurrent_test();
 
+    generic_hash_table_compute_if_absent_test();
+    generic_hash_table_concurrent_compute_if_absent_test();
+    generic_hash_table_upsert_test();
+    generic_hash_table_compare_and_delete_test();
+    generic_hash_table_for_each_test();
+    generic_hash_table_apply_test();
+    generic_hash_table_delete_if_test();
+
     printf("\n");
     printf("*****************************************\n");
     printf("End Generic Hash Table Test Suite\n");
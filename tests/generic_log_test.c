@@ -0,0 +1,322 @@
+#include "generic_log.h"
+#include "test_utils.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static int freed_count = 0;
+
+static void
+count_free(void* data)
+{
+    (void) data;
+    freed_count++;
+}
+
+int
+generic_log_new_free_test()
+{
+    TEST_SUITE("Generic Log New/Free Test");
+
+    generic_log log = NULL;
+    int exit_code = generic_log_new(4, &log);
+    TEST_ASSERT(!exit_code && log, "Log created");
+
+    uint64_t tail = 1;
+    generic_log_get_tail(log, &tail);
+    TEST_ASSERT(tail == 0, "New log is empty");
+
+    size_t n_segments = 0;
+    generic_log_get_segment_count(log, &n_segments);
+    TEST_ASSERT(n_segments == 1, "New log has one segment");
+
+    exit_code = generic_log_new(0, &log);
+    TEST_ASSERT(exit_code == 1, "Zero segment capacity rejected");
+
+    exit_code = generic_log_free(log);
+    TEST_ASSERT(!exit_code, "Log freed");
+
+    exit_code = generic_log_free(NULL);
+    TEST_ASSERT(exit_code == 1, "Free NULL rejected");
+
+    return 0;
+}
+
+int
+generic_log_cursor_test()
+{
+    TEST_SUITE("Generic Log Cursor Test");
+
+    generic_log log = NULL;
+    generic_log_new(4, &log);
+
+    int before = -1;
+    generic_log_append(log, &before);
+
+    generic_log_cursor first = NULL;
+    generic_log_cursor second = NULL;
+    int exit_code = generic_log_cursor_new(log, &first);
+    TEST_ASSERT(!exit_code && first, "Cursor created");
+    generic_log_cursor_new(log, &second);
+
+    void* data = NULL;
+    exit_code = generic_log_cursor_next(first, &data);
+    TEST_ASSERT(exit_code == 1 && !data,
+                "Cursor does not see items appended before it");
+
+    int values[10];
+    void* items[10];
+    size_t i = 0;
+    while (i < 10)
+    {
+        values[i] = (int) i;
+        items[i] = &values[i];
+        i++;
+    }
+
+    exit_code = generic_log_append_batch(log, items, 10);
+    TEST_ASSERT(!exit_code, "Batch appended");
+
+    size_t lag = 0;
+    generic_log_cursor_get_lag(first, &lag);
+    TEST_ASSERT(lag == 10, "Lag counts the unread items");
+
+    int in_order = 1;
+    i = 0;
+    while (i < 10)
+    {
+        if (generic_log_cursor_next(first, &data) || *(int*) data != (int) i)
+        {
+            in_order = 0;
+        }
+        i++;
+    }
+    TEST_ASSERT(in_order, "Cursor reads items in order across segments");
+
+    exit_code = generic_log_cursor_next(first, &data);
+    TEST_ASSERT(exit_code == 1, "Cursor caught up with the tail");
+
+    exit_code = generic_log_cursor_next(second, &data);
+    TEST_ASSERT(!exit_code && *(int*) data == 0,
+                "Cursors move independently");
+
+    generic_log_cursor_free(first);
+    generic_log_cursor_free(second);
+    generic_log_free(log);
+
+    return 0;
+}
+
+int
+generic_log_reclaim_test()
+{
+    TEST_SUITE("Generic Log Reclaim Test");
+
+    generic_log log = NULL;
+    generic_log_new(4, &log);
+    generic_log_set_free_function(log, count_free);
+    freed_count = 0;
+
+    generic_log_cursor slow = NULL;
+    generic_log_cursor fast = NULL;
+    generic_log_cursor_new(log, &slow);
+    generic_log_cursor_new(log, &fast);
+
+    int value = 0;
+    int i = 0;
+    while (i < 16)
+    {
+        generic_log_append(log, &value);
+        i++;
+    }
+
+    size_t n_segments = 0;
+    generic_log_get_segment_count(log, &n_segments);
+    TEST_ASSERT(n_segments == 4, "Segments allocated as the log grows");
+
+    void* data = NULL;
+    while (generic_log_cursor_next(fast, &data) == 0)
+    {
+    }
+
+    generic_log_get_segment_count(log, &n_segments);
+    TEST_ASSERT(n_segments == 4 && freed_count == 0,
+                "Slowest cursor pins the segments");
+
+    i = 0;
+    while (i < 9)
+    {
+        generic_log_cursor_next(slow, &data);
+        i++;
+    }
+
+    generic_log_get_segment_count(log, &n_segments);
+    TEST_ASSERT(n_segments == 2 && freed_count == 8,
+                "Segments passed by every cursor are freed");
+
+    generic_log_cursor_free(slow);
+    generic_log_cursor_free(fast);
+
+    generic_log_get_segment_count(log, &n_segments);
+    TEST_ASSERT(n_segments == 1, "Writer keeps the tail segment");
+
+    generic_log_free(log);
+    TEST_ASSERT(freed_count == 16, "Every item freed with the log");
+
+    return 0;
+}
+
+int
+generic_log_set_tail_test()
+{
+    TEST_SUITE("Generic Log Set Tail Test");
+
+    generic_log log = NULL;
+    generic_log_new(4, &log);
+
+    int exit_code = generic_log_set_tail(log, 100);
+    TEST_ASSERT(!exit_code, "Tail of an empty log moved");
+
+    generic_log_cursor cursor = NULL;
+    generic_log_cursor_new(log, &cursor);
+
+    uint64_t offset = 0;
+    generic_log_cursor_get_offset(cursor, &offset);
+    TEST_ASSERT(offset == 100, "Cursor starts at the moved tail");
+
+    int values[6] = {0, 1, 2, 3, 4, 5};
+    size_t i = 0;
+    while (i < 6)
+    {
+        generic_log_append(log, &values[i]);
+        i++;
+    }
+
+    uint64_t tail = 0;
+    generic_log_get_tail(log, &tail);
+    TEST_ASSERT(tail == 106, "Offsets continue from the moved tail");
+
+    exit_code = generic_log_set_tail(log, 0);
+    TEST_ASSERT(exit_code == 1, "Tail of a non empty log not moved");
+
+    void* data = NULL;
+    i = 0;
+    while (i < 5)
+    {
+        generic_log_cursor_next(cursor, &data);
+        i++;
+    }
+
+    generic_log_cursor_get_offset(cursor, &offset);
+    TEST_ASSERT(offset == 105 && *(int*) data == 4,
+                "Cursor reads across segments from the moved tail");
+
+    generic_log_cursor_free(cursor);
+    generic_log_free(log);
+
+    return 0;
+}
+
+struct _log_reader_arg_t
+{
+    generic_log_cursor _cursor;
+    size_t _n_items;
+    int _in_order;
+};
+
+void*
+log_reader(void* arg)
+{
+    struct _log_reader_arg_t* reader_arg = arg;
+
+    size_t expected = 0;
+    while (expected < reader_arg->_n_items)
+    {
+        void* data = NULL;
+        if (generic_log_cursor_next(reader_arg->_cursor, &data))
+        {
+            continue;
+        }
+
+        if ((size_t) (uintptr_t) data != expected + 1)
+        {
+            reader_arg->_in_order = 0;
+        }
+        expected++;
+    }
+
+    return NULL;
+}
+
+int
+generic_log_concurrent_readers_test()
+{
+    TEST_SUITE("Generic Log Concurrent Readers Test");
+
+    generic_log log = NULL;
+    generic_log_new(64, &log);
+
+    const size_t n_items = 100000;
+    struct _log_reader_arg_t args[4];
+    pthread_t readers[4];
+
+    size_t i = 0;
+    while (i < 4)
+    {
+        args[i]._n_items = n_items;
+        args[i]._in_order = 1;
+        generic_log_cursor_new(log, &args[i]._cursor);
+        pthread_create(&readers[i], NULL, log_reader, &args[i]);
+        i++;
+    }
+
+    i = 0;
+    while (i < n_items)
+    {
+        generic_log_append(log, (void*) (uintptr_t) (i + 1));
+        i++;
+    }
+
+    int in_order = 1;
+    i = 0;
+    while (i < 4)
+    {
+        pthread_join(readers[i], NULL);
+        in_order &= args[i]._in_order;
+        generic_log_cursor_free(args[i]._cursor);
+        i++;
+    }
+    TEST_ASSERT(in_order, "Readers see every item in order");
+
+    size_t n_segments = 0;
+    generic_log_get_segment_count(log, &n_segments);
+    TEST_ASSERT(n_segments <= 2, "Consumed segments reclaimed");
+
+    generic_log_free(log);
+
+    return 0;
+}
+
+int
+main()
+{
+
+    printf("*****************************************\n");
+    printf("Start Generic Log Test Suite\n");
+    printf("*****************************************\n");
+
+    generic_log_new_free_test();
+    generic_log_cursor_test();
+    generic_log_reclaim_test();
+    generic_log_set_tail_test();
+    generic_log_concurrent_readers_test();
+
+    printf("\n");
+    printf("*****************************************\n");
+    printf("End Generic Log Test Suite\n");
+    printf("*****************************************\n");
+
+    printf("Tests passed: %d\nTests failed: %d\n", stats.passed, stats.failed);
+
+    return stats.failed;
+}
@@ -1,9 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include "generic_queue_syn.h"
 #include "test_utils.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 static pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -1142,6 +1146,327 @@ generic_queue_syn_fifo_order_test()
     return 0;
 }
 
+/* ==========================================================================
+ * Batch Operation Tests
+ * ========================================================================== */
+
+int
+generic_queue_syn_enqueue_batch_test()
+{
+    TEST_SUITE("Generic Queue Syn Enqueue Batch Test");
+
+    generic_queue_syn q = NULL;
+    int exit_code = generic_queue_syn_new(&q);
+    TEST_ASSERT(!exit_code, "Queue created\n");
+
+    int first = -1;
+    generic_queue_syn_enqueue(q, &first);
+
+    int values[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    void* items[8];
+    size_t i = 0;
+    while (i < 8)
+    {
+        items[i] = &values[i];
+        i++;
+    }
+
+    size_t enqueued = 0;
+    exit_code = generic_queue_syn_enqueue_batch(q, items, 8, &enqueued);
+    TEST_ASSERT(!exit_code, "Batch enqueue succeeded\n");
+    TEST_ASSERT(enqueued == 8, "All batch items reported as enqueued\n");
+
+    size_t size = 0;
+    generic_queue_syn_size(q, &size);
+    TEST_ASSERT(size == 9, "Size accounts for the whole batch\n");
+
+    void* data = NULL;
+    generic_queue_syn_dequeue(q, &data);
+    TEST_ASSERT(*(int*) data == -1, "Batch appended after existing items\n");
+
+    int in_order = 1;
+    i = 0;
+    while (i < 8)
+    {
+        generic_queue_syn_dequeue(q, &data);
+        if (*(int*) data != (int) i)
+        {
+            in_order = 0;
+        }
+        i++;
+    }
+    TEST_ASSERT(in_order, "Batch items keep their order\n");
+
+    exit_code = generic_queue_syn_enqueue_batch(q, NULL, 0, NULL);
+    TEST_ASSERT(!exit_code, "Empty batch is a no-op\n");
+
+    exit_code = generic_queue_syn_enqueue_batch(q, NULL, 3, NULL);
+    TEST_ASSERT(exit_code == -1, "NULL items with a length rejected\n");
+
+    exit_code = generic_queue_syn_enqueue_batch(NULL, items, 8, NULL);
+    TEST_ASSERT(exit_code == -1, "enqueue_batch with NULL queue returns -1\n");
+
+    generic_queue_syn_free(q);
+    return 0;
+}
+
+int
+generic_queue_syn_high_water_test()
+{
+    TEST_SUITE("Generic Queue Syn High Water Test");
+
+    generic_queue_syn q = NULL;
+    generic_queue_syn_new(&q);
+
+    size_t high_water = 1;
+    int exit_code = generic_queue_syn_get_high_water(q, &high_water);
+    TEST_ASSERT(!exit_code && high_water == 0, "New queue never held items\n");
+
+    int values[] = {0, 1, 2, 3, 4};
+    void* items[5];
+    size_t i = 0;
+    while (i < 5)
+    {
+        items[i] = &values[i];
+        i++;
+    }
+
+    generic_queue_syn_enqueue_batch(q, items, 3, NULL);
+    generic_queue_syn_enqueue(q, items[3]);
+
+    void* data = NULL;
+    generic_queue_syn_dequeue(q, &data);
+    generic_queue_syn_dequeue(q, &data);
+    generic_queue_syn_enqueue(q, items[4]);
+
+    generic_queue_syn_get_high_water(q, &high_water);
+    TEST_ASSERT(high_water == 4, "Largest size kept after dequeues\n");
+
+    exit_code = generic_queue_syn_get_high_water(NULL, &high_water);
+    TEST_ASSERT(exit_code == -1, "get_high_water with NULL queue returns -1\n");
+
+    generic_queue_syn_free(q);
+    return 0;
+}
+
+int
+generic_queue_syn_dequeue_batch_test()
+{
+    TEST_SUITE("Generic Queue Syn Dequeue Batch Test");
+
+    generic_queue_syn q = NULL;
+    generic_queue_syn_new(&q);
+
+    int values[] = {0, 1, 2, 3, 4};
+    size_t i = 0;
+    while (i < 5)
+    {
+        generic_queue_syn_enqueue(q, &values[i]);
+        i++;
+    }
+
+    void* items[3] = {NULL};
+    size_t n = 0;
+    int exit_code = generic_queue_syn_dequeue_batch(q, items, 3, &n);
+    TEST_ASSERT(!exit_code && n == 3, "Batch limited to max items\n");
+    TEST_ASSERT(*(int*) items[0] == 0 && *(int*) items[2] == 2,
+                "Batch items dequeued in order\n");
+
+    exit_code = generic_queue_syn_dequeue_batch(q, items, 3, &n);
+    TEST_ASSERT(!exit_code && n == 2, "Batch drains what is left\n");
+    TEST_ASSERT(*(int*) items[1] == 4, "Last item dequeued\n");
+
+    exit_code = generic_queue_syn_dequeue_batch(q, items, 3, &n);
+    TEST_ASSERT(!exit_code && n == 0, "Empty queue gives an empty batch\n");
+
+    exit_code = generic_queue_syn_dequeue_batch(q, NULL, 3, &n);
+    TEST_ASSERT(exit_code == -1, "NULL items with a length rejected\n");
+
+    exit_code = generic_queue_syn_dequeue_batch(NULL, items, 3, &n);
+    TEST_ASSERT(exit_code == -1, "dequeue_batch with NULL queue returns -1\n");
+
+    generic_queue_syn_free(q);
+    return 0;
+}
+
+/* ==========================================================================
+ * Capacity Tests
+ * ========================================================================== */
+
+int
+generic_queue_syn_capacity_test()
+{
+    TEST_SUITE("Generic Queue Syn Capacity Test");
+
+    generic_queue_syn q = NULL;
+    int exit_code = generic_queue_syn_new(&q);
+    TEST_ASSERT(!exit_code, "Queue created\n");
+
+    size_t capacity = 1;
+    generic_queue_syn_get_capacity(q, &capacity);
+    TEST_ASSERT(capacity == 0, "Queue is unbounded by default\n");
+
+    exit_code = generic_queue_syn_set_capacity(q, 3);
+    TEST_ASSERT(!exit_code, "Capacity set\n");
+
+    int values[] = {0, 1, 2, 3, 4};
+    void* items[] = {&values[0], &values[1], &values[2], &values[3]};
+
+    size_t enqueued = 0;
+    exit_code = generic_queue_syn_enqueue_batch(q, items, 4, &enqueued);
+    TEST_ASSERT(exit_code == 1, "Batch stops when the queue is full\n");
+    TEST_ASSERT(enqueued == 3, "Batch filled up to the capacity\n");
+
+    exit_code = generic_queue_syn_enqueue(q, &values[4]);
+    TEST_ASSERT(exit_code == 1, "Enqueue on a full queue returns 1\n");
+
+    void* evicted = NULL;
+    exit_code = generic_queue_syn_enqueue_or_evict(q, &values[3], &evicted);
+    TEST_ASSERT(!exit_code, "Enqueue or evict succeeded on a full queue\n");
+    TEST_ASSERT(evicted == &values[0], "Oldest item evicted\n");
+
+    size_t size = 0;
+    generic_queue_syn_size(q, &size);
+    TEST_ASSERT(size == 3, "Size bounded by the capacity\n");
+
+    void* data = NULL;
+    generic_queue_syn_peek(q, &data);
+    TEST_ASSERT(*(int*) data == 1, "Front moved past the evicted item\n");
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 20000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    exit_code = generic_queue_syn_enqueue_timed(q, &values[4], &deadline);
+    TEST_ASSERT(exit_code == 1, "Timed enqueue times out on a full queue\n");
+
+    generic_queue_syn_dequeue(q, &data);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    exit_code = generic_queue_syn_enqueue_timed(q, &values[4], &deadline);
+    TEST_ASSERT(!exit_code, "Timed enqueue succeeds once there is room\n");
+
+    generic_queue_syn_peek_rear(q, &data);
+    TEST_ASSERT(*(int*) data == 4, "Timed enqueue appended at the rear\n");
+
+    generic_queue_syn_set_capacity(q, 0);
+    exit_code = generic_queue_syn_enqueue(q, &values[0]);
+    TEST_ASSERT(!exit_code, "Enqueue succeeds once unbounded again\n");
+
+    generic_queue_syn_free(q);
+    return 0;
+}
+
+struct _blocked_producer_arg_t
+{
+    generic_queue_syn _queue;
+    int* _value;
+    int _exit_code;
+};
+
+void*
+blocked_producer(void* arg)
+{
+    struct _blocked_producer_arg_t* producer_arg = arg;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 5;
+
+    producer_arg->_exit_code = generic_queue_syn_enqueue_timed(
+        producer_arg->_queue, producer_arg->_value, &deadline);
+
+    return NULL;
+}
+
+int
+generic_queue_syn_enqueue_timed_wakeup_test()
+{
+    TEST_SUITE("Generic Queue Syn Enqueue Timed Wakeup Test");
+
+    generic_queue_syn q = NULL;
+    generic_queue_syn_new(&q);
+    generic_queue_syn_set_capacity(q, 1);
+
+    int first = 1;
+    int second = 2;
+    generic_queue_syn_enqueue(q, &first);
+
+    struct _blocked_producer_arg_t arg = {
+        ._queue = q, ._value = &second, ._exit_code = -1};
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, blocked_producer, &arg);
+
+    usleep(20000);
+
+    void* data = NULL;
+    generic_queue_syn_dequeue(q, &data);
+    pthread_join(producer, NULL);
+
+    TEST_ASSERT(arg._exit_code == 0, "Blocked producer woken by dequeue\n");
+
+    generic_queue_syn_dequeue(q, &data);
+    TEST_ASSERT(data == &second, "Blocked item enqueued\n");
+
+    generic_queue_syn_free(q);
+    return 0;
+}
+
+static int
+is_even(void* data, void* context)
+{
+    (void) context;
+    return *(int*) data % 2 == 0;
+}
+
+int
+generic_queue_syn_remove_if_test()
+{
+    TEST_SUITE("Generic Queue Syn Remove If Test");
+
+    generic_queue_syn q = NULL;
+    generic_queue_syn_new(&q);
+
+    int values[] = {0, 1, 2, 3, 4, 5};
+    size_t i = 0;
+    while (i < 6)
+    {
+        generic_queue_syn_enqueue(q, &values[i]);
+        i++;
+    }
+
+    size_t n_removed = 0;
+    int exit_code = generic_queue_syn_remove_if(q, is_even, NULL, &n_removed);
+    TEST_ASSERT(!exit_code, "Remove if succeeded\n");
+    TEST_ASSERT(n_removed == 3, "Matching items removed\n");
+
+    int in_order = 1;
+    int expected = 1;
+    void* data = NULL;
+    while (generic_queue_syn_dequeue(q, &data) == 0 && data)
+    {
+        if (*(int*) data != expected)
+        {
+            in_order = 0;
+        }
+        expected += 2;
+    }
+    TEST_ASSERT(in_order && expected == 7, "Other items keep their order\n");
+
+    exit_code = generic_queue_syn_remove_if(NULL, is_even, NULL, NULL);
+    TEST_ASSERT(exit_code == -1, "remove_if with NULL queue returns -1\n");
+
+    generic_queue_syn_free(q);
+    return 0;
+}
+
 /* ==========================================================================
  * Null Parameter Tests
  * ========================================================================== */
@@ -1228,6 +1553,16 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
     generic_queue_syn_null_parameter_test();
     generic_queue_syn_fifo_order_test();
 
+    /* Batch operation tests */
+    generic_queue_syn_enqueue_batch_test();
+    generic_queue_syn_dequeue_batch_test();
+    generic_queue_syn_high_water_test();
+
+    /* Capacity tests */
+    generic_queue_syn_capacity_test();
+    generic_queue_syn_enqueue_timed_wakeup_test();
+    generic_queue_syn_remove_if_test();
+
     /* Concurrent access tests */
     generic_queue_syn_concurrent_producers_test();
     generic_queue_syn_concurrent_consumers_test();
@@ -0,0 +1,219 @@
+#include "latency_histogram.h"
+#include "test_utils.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#define N_RECORD_THREADS 4
+#define N_RECORDS_PER_THREAD 100000
+
+// Within the 1/16 precision of the buckets, never below the exact value.
+static int
+close_to(uint64_t value, uint64_t exact)
+{
+    return value >= exact && value <= exact + exact / 16;
+}
+
+static void*
+record_values(void* arg)
+{
+
+    latency_histogram histogram = arg;
+
+    uint64_t i = 0;
+    while (i < N_RECORDS_PER_THREAD)
+    {
+        latency_histogram_record(histogram, i % 1000);
+        i++;
+    }
+
+    return NULL;
+}
+
+int
+latency_histogram_new_free_test()
+{
+    TEST_SUITE("Latency Histogram New/Free Test");
+
+    latency_histogram histogram = NULL;
+    int exit_code = latency_histogram_new(&histogram);
+    TEST_ASSERT(!exit_code && histogram, "Histogram created");
+
+    uint64_t value = 1;
+    latency_histogram_get_count(histogram, &value);
+    TEST_ASSERT(value == 0, "New histogram is empty");
+
+    value = 1;
+    latency_histogram_get_percentile(histogram, 50, &value);
+    TEST_ASSERT(value == 0, "Percentile of an empty histogram is 0");
+
+    exit_code = latency_histogram_get_percentile(histogram, 101, &value);
+    TEST_ASSERT(exit_code == 1, "Percentile above 100 rejected");
+
+    exit_code = latency_histogram_free(histogram);
+    TEST_ASSERT(!exit_code, "Histogram freed");
+
+    exit_code = latency_histogram_new(NULL);
+    TEST_ASSERT(exit_code == 1, "NULL output rejected");
+
+    exit_code = latency_histogram_record(NULL, 1);
+    TEST_ASSERT(exit_code == 1, "NULL histogram rejected");
+
+    return 0;
+}
+
+int
+latency_histogram_percentile_test()
+{
+    TEST_SUITE("Latency Histogram Percentile Test");
+
+    latency_histogram histogram = NULL;
+    latency_histogram_new(&histogram);
+
+    latency_histogram_record_n(histogram, 7, 3);
+
+    uint64_t value = 0;
+    latency_histogram_get_percentile(histogram, 50, &value);
+    TEST_ASSERT(value == 7, "Small values are exact");
+
+    latency_histogram_free(histogram);
+    latency_histogram_new(&histogram);
+
+    uint64_t i = 1;
+    while (i <= 10000)
+    {
+        latency_histogram_record(histogram, i * 1000);
+        i++;
+    }
+
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    latency_histogram_get_percentile(histogram, 50, &p50);
+    latency_histogram_get_percentile(histogram, 99, &p99);
+    latency_histogram_get_percentile(histogram, 99.9, &p999);
+    TEST_ASSERT(close_to(p50, 5000000) && close_to(p99, 9900000)
+                    && close_to(p999, 9990000),
+                "Percentiles within the bucket precision");
+
+    uint64_t max = 0;
+    latency_histogram_get_max(histogram, &max);
+    latency_histogram_get_percentile(histogram, 100, &value);
+    TEST_ASSERT(max == 10000000 && value == max,
+                "Highest percentile capped by the maximum");
+
+    latency_histogram_record(histogram, (uint64_t) 1 << 50);
+    latency_histogram_get_max(histogram, &max);
+    latency_histogram_get_percentile(histogram, 100, &value);
+    TEST_ASSERT(max == (uint64_t) 1 << 50 && value >= (uint64_t) 1 << 39,
+                "Values out of range land in the last bucket");
+
+    latency_histogram_free(histogram);
+
+    return 0;
+}
+
+int
+latency_histogram_concurrent_test()
+{
+    TEST_SUITE("Latency Histogram Concurrent Test");
+
+    latency_histogram histogram = NULL;
+    latency_histogram_new(&histogram);
+
+    pthread_t threads[N_RECORD_THREADS];
+    size_t i = 0;
+    while (i < N_RECORD_THREADS)
+    {
+        pthread_create(&threads[i], NULL, record_values, histogram);
+        i++;
+    }
+
+    i = 0;
+    while (i < N_RECORD_THREADS)
+    {
+        pthread_join(threads[i], NULL);
+        i++;
+    }
+
+    uint64_t count = 0;
+    latency_histogram_get_count(histogram, &count);
+    TEST_ASSERT(count == N_RECORD_THREADS * N_RECORDS_PER_THREAD,
+                "Every concurrent record counted");
+
+    uint64_t max = 0;
+    latency_histogram_get_max(histogram, &max);
+    TEST_ASSERT(max == 999, "Maximum kept under contention");
+
+    latency_histogram_free(histogram);
+
+    return 0;
+}
+
+int
+latency_histogram_merge_test()
+{
+    TEST_SUITE("Latency Histogram Merge Test");
+
+    latency_histogram low = NULL;
+    latency_histogram high = NULL;
+    latency_histogram merged = NULL;
+    latency_histogram_new(&low);
+    latency_histogram_new(&high);
+    latency_histogram_new(&merged);
+
+    uint64_t i = 1;
+    while (i <= 5000)
+    {
+        latency_histogram_record(low, i * 1000);
+        latency_histogram_record(high, (i + 5000) * 1000);
+        i++;
+    }
+
+    latency_histogram_merge(merged, low);
+    latency_histogram_merge(merged, high);
+
+    uint64_t count = 0;
+    uint64_t max = 0;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    latency_histogram_get_count(merged, &count);
+    latency_histogram_get_max(merged, &max);
+    latency_histogram_get_percentile(merged, 50, &p50);
+    latency_histogram_get_percentile(merged, 99, &p99);
+    TEST_ASSERT(count == 10000 && max == 10000000,
+                "Counts added, maximum of both kept");
+    TEST_ASSERT(close_to(p50, 5000000) && close_to(p99, 9900000),
+                "Percentiles over the values of both");
+
+    int exit_code = latency_histogram_merge(merged, NULL);
+    TEST_ASSERT(exit_code == 1, "should return 1 when other is NULL");
+
+    latency_histogram_free(low);
+    latency_histogram_free(high);
+    latency_histogram_free(merged);
+
+    return 0;
+}
+
+int
+main()
+{
+
+    printf("*****************************************\n");
+    printf("Start Latency Histogram Test Suite\n");
+    printf("*****************************************\n");
+
+    latency_histogram_new_free_test();
+    latency_histogram_percentile_test();
+    latency_histogram_concurrent_test();
+    latency_histogram_merge_test();
+
+    printf("\n");
+    printf("*****************************************\n");
+    printf("End Latency Histogram Test Suite\n");
+    printf("*****************************************\n");
+
+    printf("Tests passed: %d\nTests failed: %d\n", stats.passed, stats.failed);
+
+    return stats.failed;
+}
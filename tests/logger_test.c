@@ -0,0 +1,314 @@
+#define _DEFAULT_SOURCE
+
+#include "logger.h"
+#include "test_utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define N_LOG_THREADS 4
+#define N_RECORDS_PER_THREAD 200
+
+struct _line_count_t
+{
+    size_t _n_lines;
+    size_t _n_matched;
+};
+
+// Counts the lines written to output, and those containing needle.
+static struct _line_count_t
+count_lines(FILE* output, const char* needle)
+{
+
+    struct _line_count_t count = {0, 0};
+
+    char line[512];
+    rewind(output);
+    while (fgets(line, sizeof(line), output))
+    {
+
+        count._n_lines++;
+        if (needle && strstr(line, needle))
+        {
+            count._n_matched++;
+        }
+    }
+
+    return count;
+}
+
+static void*
+log_records(void* arg)
+{
+
+    size_t thread_id = (size_t) arg;
+
+    size_t i = 0;
+    while (i < N_RECORDS_PER_THREAD)
+    {
+        logger_log(LOGGER_INFO, "test", "thread %zu record %zu", thread_id, i);
+        i++;
+    }
+
+    return NULL;
+}
+
+static void*
+overflow_ring(void* arg)
+{
+
+    (void) arg;
+
+    size_t i = 0;
+    while (i < 20)
+    {
+        logger_log(LOGGER_WARN, "test", "overflow %zu", i);
+        i++;
+    }
+
+    return NULL;
+}
+
+static void*
+log_once(void* arg)
+{
+
+    atomic_int* logged = arg;
+
+    logger_log(LOGGER_INFO, "test", "first record of a new thread");
+    atomic_store(logged, 1);
+
+    return NULL;
+}
+
+static void*
+read_until_closed(void* arg)
+{
+
+    int fd = *(int*) arg;
+
+    char buffer[4096];
+    while (read(fd, buffer, sizeof(buffer)) > 0)
+    {
+    }
+
+    return NULL;
+}
+
+int
+logger_levels_test()
+{
+    TEST_SUITE("Logger Levels Test");
+
+    FILE* output = tmpfile();
+
+    struct logger_configuration_t config = {._level = LOGGER_INFO,
+                                            ._output = output};
+    int exit_code = logger_start(&config);
+    TEST_ASSERT(!exit_code, "Logger started");
+    TEST_ASSERT(logger_get_level() == LOGGER_INFO, "Configured level applied");
+
+    logger_log(LOGGER_DEBUG, "test", "hidden %d", 1);
+    logger_log(LOGGER_INFO, "test", "shown %d", 2);
+    logger_log(LOGGER_ERROR, "test", "shown %d", 3);
+    logger_flush();
+
+    struct _line_count_t count = count_lines(output, "shown");
+    TEST_ASSERT(count._n_lines == 2 && count._n_matched == 2,
+                "Records below the level discarded");
+
+    count = count_lines(output, "error [test] shown 3");
+    TEST_ASSERT(count._n_matched == 1, "Level and component written");
+
+    logger_set_level(LOGGER_DEBUG);
+    logger_log(LOGGER_DEBUG, "test", "debug on");
+    logger_set_level(LOGGER_ERROR);
+    logger_log(LOGGER_WARN, "test", "warn off");
+    logger_flush();
+
+    count = count_lines(output, NULL);
+    TEST_ASSERT(count._n_lines == 3, "Level changed at runtime");
+
+    exit_code = logger_set_level(LOGGER_OFF + 1);
+    TEST_ASSERT(exit_code == 1, "Unknown level rejected");
+
+    enum logger_level_t level = LOGGER_OFF;
+    exit_code = logger_parse_level("warn", &level);
+    TEST_ASSERT(!exit_code && level == LOGGER_WARN, "Level name parsed");
+
+    exit_code = logger_parse_level("verbose", &level);
+    TEST_ASSERT(exit_code == 1, "Unknown level name rejected");
+
+    logger_stop();
+    fclose(output);
+
+    return 0;
+}
+
+int
+logger_threads_test()
+{
+    TEST_SUITE("Logger Threads Test");
+
+    FILE* output = tmpfile();
+
+    struct logger_configuration_t config = {
+        ._level = LOGGER_INFO, ._output = output, ._flush_interval_ms = 1};
+    logger_start(&config);
+
+    // a second start only takes a reference
+    logger_start(NULL);
+    TEST_ASSERT(logger_get_level() == LOGGER_INFO, "Second start shares it");
+
+    pthread_t threads[N_LOG_THREADS];
+    size_t i = 0;
+    while (i < N_LOG_THREADS)
+    {
+        pthread_create(&threads[i], NULL, log_records, (void*) i);
+        i++;
+    }
+
+    i = 0;
+    while (i < N_LOG_THREADS)
+    {
+        pthread_join(threads[i], NULL);
+        i++;
+    }
+
+    logger_stop();
+    int exit_code = logger_flush();
+    TEST_ASSERT(!exit_code, "Logger kept running by the other reference");
+
+    logger_stop();
+    exit_code = logger_flush();
+    TEST_ASSERT(exit_code == 1, "Logger stopped by the last reference");
+
+    struct _line_count_t count = count_lines(output, "record");
+    TEST_ASSERT(count._n_matched == N_LOG_THREADS * N_RECORDS_PER_THREAD,
+                "Records of exited threads written");
+
+    count = count_lines(output, "thread 2 record 199");
+    TEST_ASSERT(count._n_matched == 1, "Last record of a thread written");
+
+    fclose(output);
+
+    return 0;
+}
+
+int
+logger_dropped_test()
+{
+    TEST_SUITE("Logger Dropped Test");
+
+    FILE* output = tmpfile();
+
+    // the flusher sleeps through the test: only the stop drains the ring
+    struct logger_configuration_t config = {._level = LOGGER_INFO,
+                                            ._output = output,
+                                            ._ring_capacity = 6,
+                                            ._flush_interval_ms = 60000};
+    logger_start(&config);
+
+    size_t n_dropped = logger_get_dropped_count();
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, overflow_ring, NULL);
+    pthread_join(thread, NULL);
+
+    TEST_ASSERT(logger_get_dropped_count() - n_dropped == 12,
+                "Records logged into a full ring dropped");
+
+    logger_stop();
+
+    struct _line_count_t count = count_lines(output, "overflow");
+    TEST_ASSERT(count._n_matched == 8, "Capacity rounded up to a power of two");
+
+    count = count_lines(output, "overflow 7");
+    TEST_ASSERT(count._n_matched == 1, "Oldest records kept");
+
+    TEST_ASSERT(logger_get_dropped_count() - n_dropped == 12,
+                "Drops of freed rings still counted");
+
+    fclose(output);
+
+    return 0;
+}
+
+int
+logger_blocked_output_test()
+{
+    TEST_SUITE("Logger Blocked Output Test");
+
+    // a full pipe: the drainer blocks writing to it
+    int fds[2];
+    pipe(fds);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    char filler[4096] = {0};
+    while (write(fds[1], filler, sizeof(filler)) > 0)
+    {
+    }
+    fcntl(fds[1], F_SETFL, 0);
+
+    FILE* output = fdopen(fds[1], "w");
+    setvbuf(output, NULL, _IONBF, 0);
+
+    struct logger_configuration_t config = {
+        ._level = LOGGER_INFO, ._output = output, ._flush_interval_ms = 1};
+    logger_start(&config);
+
+    logger_log(LOGGER_INFO, "test", "blocks the drainer");
+    usleep(50000);
+
+    atomic_int logged = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, log_once, &logged);
+
+    int waited_ms = 0;
+    while (!atomic_load(&logged) && waited_ms < 1000)
+    {
+        usleep(1000);
+        waited_ms++;
+    }
+    TEST_ASSERT(atomic_load(&logged),
+                "New thread logs while the drainer is stuck writing");
+
+    pthread_t reader;
+    pthread_create(&reader, NULL, read_until_closed, &fds[0]);
+
+    pthread_join(thread, NULL);
+    logger_stop();
+    fclose(output);
+
+    pthread_join(reader, NULL);
+    close(fds[0]);
+
+    return 0;
+}
+
+int
+main()
+{
+
+    printf("*****************************************\n");
+    printf("Start Logger Test Suite\n");
+    printf("*****************************************\n");
+
+    logger_levels_test();
+    logger_threads_test();
+    logger_dropped_test();
+    logger_blocked_output_test();
+
+    printf("\n");
+    printf("*****************************************\n");
+    printf("End Logger Test Suite\n");
+    printf("*****************************************\n");
+
+    printf("Tests passed: %d\nTests failed: %d\n", stats.passed, stats.failed);
+
+    return stats.failed;
+}
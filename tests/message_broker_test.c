@@ -0,0 +1,2984 @@
+#define _DEFAULT_SOURCE
+
+#include "message_broker.h"
+#include "test_utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct message_broker_t*
+new_broker(size_t n_threads)
+{
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = n_threads, ._channels_capacity = 16};
+
+    struct message_broker_t* broker = NULL;
+    if (message_broker_new(&config, &broker))
+    {
+        return NULL;
+    }
+
+    return broker;
+}
+
+// Runs body against the "<prefix>-queue" QUEUE channel, then the
+// "<prefix>-log" LOG channel of a sharded broker. The broker is returned for
+// the checks of the caller, NULL when it could not be set up.
+static struct message_broker_t*
+with_queue_and_log(const char* prefix,
+                   int (*body)(struct message_broker_t*, const char*))
+{
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 2};
+
+    struct message_broker_t* broker = NULL;
+    int exit_code = message_broker_new(&config, &broker);
+    TEST_ASSERT(!exit_code && broker, "Sharded broker created");
+    if (exit_code)
+    {
+        return NULL;
+    }
+
+    char queue[64];
+    char log[64];
+    snprintf(queue, sizeof(queue), "%s-queue", prefix);
+    snprintf(log, sizeof(log), "%s-log", prefix);
+
+    body(broker, queue);
+
+    struct channel_options_t log_options = {._storage = CHANNEL_STORAGE_LOG};
+    exit_code = message_broker_declare_channel(broker, log, &log_options);
+    TEST_ASSERT(!exit_code, "Log channel declared");
+    if (!exit_code)
+    {
+        body(broker, log);
+    }
+
+    return broker;
+}
+
+int
+message_broker_new_and_free_test()
+{
+    TEST_SUITE("Message Broker New and Free Test");
+
+    struct message_broker_configuration_t config = {._n_threads = 2,
+                                                    ._channels_capacity = 16};
+
+    struct message_broker_t* broker = NULL;
+    int exit_code = message_broker_new(NULL, &broker);
+    TEST_ASSERT(exit_code == 1, "Nullity check on configuration");
+
+    exit_code = message_broker_new(&config, NULL);
+    TEST_ASSERT(exit_code == 1, "Nullity check on out_self");
+
+    exit_code = message_broker_new(&config, &broker);
+    TEST_ASSERT(!exit_code && broker, "Message broker created");
+
+    exit_code = message_broker_free(broker);
+    TEST_ASSERT(!exit_code, "Message broker freed");
+
+    exit_code = message_broker_free(NULL);
+    TEST_ASSERT(exit_code == 1, "Nullity check on free");
+
+    return 0;
+}
+
+int
+message_broker_publish_receive_test()
+{
+    TEST_SUITE("Message Broker Publish/Receive Test");
+
+    struct message_broker_t* broker = new_broker(2);
+    TEST_ASSERT(broker != NULL, "Message broker created");
+
+    struct subscription_t* sub = NULL;
+    int exit_code = message_broker_subscribe(broker, "orders", &sub);
+    TEST_ASSERT(!exit_code && sub, "Subscribed to channel");
+
+    exit_code = message_broker_publish(broker, "orders", "first");
+    TEST_ASSERT(!exit_code, "First message published");
+
+    exit_code = message_broker_publish(broker, "payments", "ignored");
+    TEST_ASSERT(!exit_code, "Message published to another channel");
+
+    message_broker_wait(broker);
+
+    size_t pending = 0;
+    subscription_get_pending_count(sub, &pending);
+    TEST_ASSERT(pending == 1, "Only the subscribed channel is delivered");
+
+    struct message_t* msg = NULL;
+    exit_code = subscription_receive(sub, &msg);
+    TEST_ASSERT(!exit_code && msg, "Message received");
+
+    const char* channel = NULL;
+    const char* content = NULL;
+    uint64_t id = 0;
+    message_get_channel(msg, &channel);
+    message_get_content(msg, &content);
+    message_get_id(msg, &id);
+    TEST_ASSERT(strcmp(channel, "orders") == 0, "Channel name preserved");
+    TEST_ASSERT(strcmp(content, "first") == 0, "Content preserved");
+    TEST_ASSERT(id > 0, "Message id assigned");
+
+    message_free(msg);
+
+    exit_code = subscription_try_receive(sub, &msg);
+    TEST_ASSERT(exit_code == 1 && msg == NULL, "Inbox drained");
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_shared_payload_test()
+{
+    TEST_SUITE("Message Broker Shared Payload Test");
+
+    struct message_broker_t* broker = new_broker(2);
+
+    struct subscription_t* subs[8];
+    size_t i = 0;
+    while (i < 8)
+    {
+        message_broker_subscribe(broker, "fan-out", &subs[i]);
+        i++;
+    }
+
+    message_broker_publish(broker, "fan-out", "shared");
+    message_broker_wait(broker);
+
+    struct message_t* msgs[8];
+    i = 0;
+    while (i < 8)
+    {
+        msgs[i] = NULL;
+        subscription_try_receive(subs[i], &msgs[i]);
+        i++;
+    }
+
+    const char* first = NULL;
+    message_get_content(msgs[0], &first);
+
+    int shared = 1;
+    i = 1;
+    while (i < 8)
+    {
+
+        const char* content = NULL;
+        message_get_content(msgs[i], &content);
+        if (content != first)
+        {
+            shared = 0;
+        }
+
+        i++;
+    }
+    TEST_ASSERT(shared, "All subscribers reference the same payload");
+
+    // Releasing the references in any order must keep the payload readable
+    // for the remaining holders.
+    i = 0;
+    while (i < 7)
+    {
+        message_free(msgs[i]);
+        i++;
+    }
+
+    const char* content = NULL;
+    message_get_content(msgs[7], &content);
+    TEST_ASSERT(strcmp(content, "shared") == 0,
+                "Payload alive while a reference is held");
+    message_free(msgs[7]);
+
+    i = 0;
+    while (i < 8)
+    {
+        subscription_free(subs[i]);
+        i++;
+    }
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_unsubscribe_test()
+{
+    TEST_SUITE("Message Broker Unsubscribe Test");
+
+    struct message_broker_t* broker = new_broker(2);
+
+    struct subscription_t* sub_a = NULL;
+    struct subscription_t* sub_b = NULL;
+    message_broker_subscribe(broker, "news", &sub_a);
+    message_broker_subscribe(broker, "news", &sub_b);
+
+    int exit_code = subscription_unsubscribe(sub_a);
+    TEST_ASSERT(!exit_code, "Unsubscribed");
+
+    exit_code = subscription_unsubscribe(sub_a);
+    TEST_ASSERT(exit_code == 1, "Second unsubscribe rejected");
+
+    message_broker_publish(broker, "news", "after");
+    message_broker_wait(broker);
+
+    size_t pending = 0;
+    subscription_get_pending_count(sub_a, &pending);
+    TEST_ASSERT(pending == 0, "Unsubscribed proxy receives nothing");
+
+    subscription_get_pending_count(sub_b, &pending);
+    TEST_ASSERT(pending == 1, "Remaining subscriber still receives");
+
+    struct message_t* msg = NULL;
+    exit_code = subscription_receive(sub_a, &msg);
+    TEST_ASSERT(exit_code == 1, "Receive fails after unsubscribe");
+
+    subscription_free(sub_a);
+    subscription_free(sub_b);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_publish_bytes_test()
+{
+    TEST_SUITE("Message Broker Publish Bytes Test");
+
+    struct message_broker_t* broker = new_broker(2);
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, "binary", &sub);
+
+    const unsigned char data[] = {0x01, 0x00, 0x02, 0x00, 0xff};
+    int exit_code =
+        message_broker_publish_bytes(broker, "binary", data, sizeof(data));
+    TEST_ASSERT(!exit_code, "Binary payload published");
+
+    exit_code = message_broker_publish_bytes(broker, "binary", NULL, 0);
+    TEST_ASSERT(!exit_code, "Empty payload published");
+
+    exit_code = message_broker_publish_bytes(broker, "binary", NULL, 4);
+    TEST_ASSERT(exit_code == 1, "NULL payload with length rejected");
+
+    message_broker_wait(broker);
+
+    struct message_t* msg = NULL;
+    subscription_receive(sub, &msg);
+
+    const void* payload = NULL;
+    size_t len = 0;
+    exit_code = message_get_payload(msg, &payload, &len);
+    TEST_ASSERT(!exit_code, "Payload retrieved");
+    TEST_ASSERT(len == sizeof(data), "Length includes embedded zeros");
+    TEST_ASSERT(memcmp(payload, data, sizeof(data)) == 0,
+                "Bytes delivered unchanged");
+    message_free(msg);
+
+    subscription_receive(sub, &msg);
+    message_get_payload(msg, &payload, &len);
+    TEST_ASSERT(len == 0, "Empty payload delivered with zero length");
+
+    const char* content = NULL;
+    message_get_content(msg, &content);
+    TEST_ASSERT(content && content[0] == '\0',
+                "Empty payload reads as an empty string");
+    message_free(msg);
+
+    exit_code = message_get_payload(NULL, &payload, &len);
+    TEST_ASSERT(exit_code == 1, "Nullity check on message");
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_publish_batch_test()
+{
+    TEST_SUITE("Message Broker Publish Batch Test");
+
+    struct message_broker_t* broker = new_broker(2);
+
+    struct subscription_t* sub_a = NULL;
+    struct subscription_t* sub_b = NULL;
+    message_broker_subscribe(broker, "batch-a", &sub_a);
+    message_broker_subscribe(broker, "batch-b", &sub_b);
+
+    struct message_broker_batch_entry_t entries[] = {
+        {._channel = "batch-a", ._payload = "a0", ._len = 2},
+        {._channel = "batch-b", ._payload = "b0", ._len = 2},
+        {._channel = "batch-a", ._payload = "a1", ._len = 2},
+        {._channel = "batch-b", ._payload = "b1", ._len = 2},
+        {._channel = "batch-a", ._payload = "a2", ._len = 2},
+    };
+
+    int exit_code = message_broker_publish_batch(broker, entries, 5);
+    TEST_ASSERT(!exit_code, "Batch published");
+
+    exit_code = message_broker_publish_batch(broker, entries, 0);
+    TEST_ASSERT(!exit_code, "Empty batch accepted");
+
+    exit_code = message_broker_publish_batch(broker, NULL, 3);
+    TEST_ASSERT(exit_code == 1, "NULL entries rejected");
+
+    struct message_broker_batch_entry_t invalid[] = {
+        {._channel = NULL, ._payload = "x", ._len = 1}};
+    exit_code = message_broker_publish_batch(broker, invalid, 1);
+    TEST_ASSERT(exit_code == 1, "Entry without channel rejected");
+
+    message_broker_wait(broker);
+
+    size_t pending = 0;
+    subscription_get_pending_count(sub_a, &pending);
+    TEST_ASSERT(pending == 3, "Channel a received its three messages");
+    subscription_get_pending_count(sub_b, &pending);
+    TEST_ASSERT(pending == 2, "Channel b received its two messages");
+
+    const char* expected_a[] = {"a0", "a1", "a2"};
+    int in_order = 1;
+    uint64_t last_id = 0;
+    size_t i = 0;
+    while (i < 3)
+    {
+
+        struct message_t* msg = NULL;
+        subscription_receive(sub_a, &msg);
+
+        const char* content = NULL;
+        uint64_t id = 0;
+        message_get_content(msg, &content);
+        message_get_id(msg, &id);
+        if (strcmp(content, expected_a[i]) != 0 || id <= last_id)
+        {
+            in_order = 0;
+        }
+        last_id = id;
+
+        message_free(msg);
+        i++;
+    }
+    TEST_ASSERT(in_order, "Batch order preserved within a channel");
+
+    subscription_free(sub_a);
+    subscription_free(sub_b);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_sharded_ordering_test()
+{
+    TEST_SUITE("Message Broker Sharded Ordering Test");
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 4};
+
+    struct message_broker_t* broker = NULL;
+    int exit_code = message_broker_new(&config, &broker);
+    TEST_ASSERT(!exit_code && broker, "Sharded broker created");
+
+    const char* channels[] = {"shard-0", "shard-1", "shard-2", "shard-3"};
+    struct subscription_t* subs[4];
+    size_t c = 0;
+    while (c < 4)
+    {
+        message_broker_subscribe(broker, channels[c], &subs[c]);
+        c++;
+    }
+
+    const int n = 500;
+    int i = 0;
+    while (i < n)
+    {
+
+        char content[32];
+        snprintf(content, sizeof(content), "%d", i);
+
+        c = 0;
+        while (c < 4)
+        {
+            message_broker_publish(broker, channels[c], content);
+            c++;
+        }
+
+        i++;
+    }
+
+    struct message_broker_batch_entry_t entries[] = {
+        {._channel = "shard-0", ._payload = "500", ._len = 3},
+        {._channel = "shard-1", ._payload = "500", ._len = 3},
+        {._channel = "shard-0", ._payload = "501", ._len = 3},
+    };
+    exit_code = message_broker_publish_batch(broker, entries, 3);
+    TEST_ASSERT(!exit_code, "Batch split across shards");
+
+    message_broker_wait(broker);
+
+    int in_order = 1;
+    size_t expected_counts[] = {502, 501, 500, 500};
+    c = 0;
+    while (c < 4)
+    {
+
+        size_t pending = 0;
+        subscription_get_pending_count(subs[c], &pending);
+        if (pending != expected_counts[c])
+        {
+            in_order = 0;
+        }
+
+        int expected = 0;
+        struct message_t* msg = NULL;
+        while (subscription_try_receive(subs[c], &msg) == 0 && msg)
+        {
+
+            const char* content = NULL;
+            message_get_content(msg, &content);
+            if (atoi(content) != expected)
+            {
+                in_order = 0;
+            }
+            expected++;
+
+            message_free(msg);
+            msg = NULL;
+        }
+
+        c++;
+    }
+    TEST_ASSERT(in_order, "Per-channel FIFO preserved in sharded mode");
+
+    exit_code = subscription_unsubscribe(subs[0]);
+    TEST_ASSERT(!exit_code, "Unsubscribe routed through the owning shard");
+
+    message_broker_publish(broker, "shard-0", "after");
+    message_broker_wait(broker);
+
+    size_t pending = 0;
+    subscription_get_pending_count(subs[0], &pending);
+    TEST_ASSERT(pending == 0, "Unsubscribed proxy receives nothing");
+
+    c = 0;
+    while (c < 4)
+    {
+        subscription_free(subs[c]);
+        c++;
+    }
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_inline_publish_test()
+{
+    TEST_SUITE("Message Broker Inline Publish Test");
+
+    // a single pool worker keeps the pooled publishes in order
+    struct message_broker_configuration_t config = {
+        ._n_threads = 1,
+        ._channels_capacity = 16,
+        ._inline_fanout_threshold = 2};
+
+    struct message_broker_t* broker = NULL;
+    int exit_code = message_broker_new(&config, &broker);
+    TEST_ASSERT(!exit_code && broker, "Inline broker created");
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, "quotes", &sub);
+
+    exit_code = message_broker_publish(broker, "quotes", "inline");
+    TEST_ASSERT(!exit_code, "Message published below threshold");
+
+    struct message_t* msg = NULL;
+    exit_code = subscription_try_receive(sub, &msg);
+    TEST_ASSERT(!exit_code && msg,
+                "Message delivered before publish returned");
+    const char* content = NULL;
+    message_get_content(msg, &content);
+    TEST_ASSERT(content && !strcmp(content, "inline"),
+                "Inline content matches");
+    message_free(msg);
+
+    struct subscription_t* sub_2 = NULL;
+    message_broker_subscribe(broker, "quotes", &sub_2);
+
+    const int n = 200;
+    int i = 0;
+    while (i < n)
+    {
+
+        char content[32];
+        snprintf(content, sizeof(content), "%d", i);
+        message_broker_publish(broker, "quotes", content);
+        i++;
+    }
+
+    message_broker_wait(broker);
+
+    size_t pending = 0;
+    subscription_get_pending_count(sub_2, &pending);
+    TEST_ASSERT(pending == (size_t) n, "Pooled path used at threshold");
+
+    subscription_unsubscribe(sub_2);
+    subscription_free(sub_2);
+
+    int in_order = 1;
+    i = 0;
+    while (i < n)
+    {
+
+        msg = NULL;
+        if (subscription_try_receive(sub, &msg) || !msg)
+        {
+            in_order = 0;
+            break;
+        }
+
+        char expected[32];
+        snprintf(expected, sizeof(expected), "%d", i);
+        content = NULL;
+        message_get_content(msg, &content);
+        if (!content || strcmp(content, expected))
+        {
+            in_order = 0;
+        }
+
+        message_free(msg);
+        i++;
+    }
+    TEST_ASSERT(in_order, "Pooled messages received in order");
+
+    exit_code = message_broker_publish(broker, "quotes", "inline again");
+    TEST_ASSERT(!exit_code, "Message published after unsubscribe");
+
+    msg = NULL;
+    content = NULL;
+    subscription_try_receive(sub, &msg);
+    message_get_content(msg, &content);
+    TEST_ASSERT(content && !strcmp(content, "inline again"),
+                "Inline path resumes below threshold");
+    message_free(msg);
+
+    // a queued batch holds the inline path back on its channels
+    struct message_broker_batch_entry_t entries[50];
+    i = 0;
+    while (i < 50)
+    {
+        entries[i] = (struct message_broker_batch_entry_t) {
+            ._channel = "quotes", ._payload = "batch", ._len = 6};
+        i++;
+    }
+    message_broker_publish_batch(broker, entries, 50);
+    message_broker_publish(broker, "quotes", "after batch");
+    message_broker_wait(broker);
+
+    int batch_first = 1;
+    i = 0;
+    while (i < 51)
+    {
+
+        msg = NULL;
+        content = NULL;
+        subscription_try_receive(sub, &msg);
+        message_get_content(msg, &content);
+        if (!content || strcmp(content, i < 50 ? "batch" : "after batch"))
+        {
+            batch_first = 0;
+        }
+
+        message_free(msg);
+        i++;
+    }
+    TEST_ASSERT(batch_first, "Inline publish queued behind a pending batch");
+
+    subscription_unsubscribe(sub);
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+static struct subscription_t*
+subscribe_bounded(struct message_broker_t* broker, const char* channel,
+                  size_t capacity, enum subscription_overflow_policy_t policy)
+{
+
+    struct subscription_options_t options = {._capacity = capacity,
+                                             ._overflow_policy = policy,
+                                             ._block_timeout_ms = 20};
+
+    struct subscription_t* sub = NULL;
+    if (message_broker_subscribe_with_options(broker, channel, &options, &sub))
+    {
+        return NULL;
+    }
+
+    return sub;
+}
+
+static int
+front_content_is(struct subscription_t* sub, const char* expected)
+{
+
+    struct message_t* msg = NULL;
+    if (subscription_try_receive(sub, &msg) || !msg)
+    {
+        return 0;
+    }
+
+    const char* content = NULL;
+    message_get_content(msg, &content);
+    int matches = content && !strcmp(content, expected);
+    message_free(msg);
+
+    return matches;
+}
+
+int
+message_broker_overflow_policy_test()
+{
+    TEST_SUITE("Message Broker Overflow Policy Test");
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 1};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct subscription_t* oldest = subscribe_bounded(
+        broker, "ticks", 3, SUBSCRIPTION_OVERFLOW_DROP_OLDEST);
+    struct subscription_t* newest = subscribe_bounded(
+        broker, "ticks", 3, SUBSCRIPTION_OVERFLOW_DROP_NEWEST);
+    struct subscription_t* blocking =
+        subscribe_bounded(broker, "ticks", 3, SUBSCRIPTION_OVERFLOW_BLOCK);
+    struct subscription_t* disconnect = subscribe_bounded(
+        broker, "ticks", 3, SUBSCRIPTION_OVERFLOW_DISCONNECT);
+    TEST_ASSERT(oldest && newest && blocking && disconnect,
+                "Bounded subscriptions created");
+
+    struct subscription_options_t invalid = {._capacity = 1,
+                                             ._overflow_policy = 42};
+    struct subscription_t* rejected = NULL;
+    int exit_code = message_broker_subscribe_with_options(broker, "ticks",
+                                                          &invalid, &rejected);
+    TEST_ASSERT(exit_code == 1 && !rejected, "Unknown policy rejected");
+
+    int i = 0;
+    while (i < 5)
+    {
+
+        char content[8];
+        snprintf(content, sizeof(content), "%d", i);
+        message_broker_publish(broker, "ticks", content);
+        i++;
+    }
+    message_broker_wait(broker);
+
+    size_t pending = 0;
+    size_t dropped = 0;
+
+    subscription_get_pending_count(oldest, &pending);
+    subscription_get_dropped_count(oldest, &dropped);
+    TEST_ASSERT(pending == 3 && dropped == 2, "Drop oldest keeps the bound");
+    TEST_ASSERT(front_content_is(oldest, "2"), "Drop oldest kept the newest");
+
+    subscription_get_pending_count(newest, &pending);
+    subscription_get_dropped_count(newest, &dropped);
+    TEST_ASSERT(pending == 3 && dropped == 2, "Drop newest keeps the bound");
+    TEST_ASSERT(front_content_is(newest, "0"), "Drop newest kept the oldest");
+
+    subscription_get_pending_count(blocking, &pending);
+    subscription_get_dropped_count(blocking, &dropped);
+    TEST_ASSERT(pending == 3 && dropped == 2,
+                "Blocked publish dropped after the timeout");
+
+    subscription_get_dropped_count(disconnect, &dropped);
+    TEST_ASSERT(dropped == 1, "Disconnect drops the overflowing message");
+
+    struct message_t* msg = NULL;
+    exit_code = subscription_try_receive(disconnect, &msg);
+    TEST_ASSERT(exit_code && !msg, "Disconnected subscription stops receiving");
+
+    subscription_free(oldest);
+    subscription_free(newest);
+    subscription_free(disconnect);
+
+    struct message_t* drained = NULL;
+    while (subscription_try_receive(blocking, &drained) == 0 && drained)
+    {
+        message_free(drained);
+        drained = NULL;
+    }
+
+    message_broker_publish(broker, "ticks", "a");
+    message_broker_publish(broker, "ticks", "b");
+    message_broker_wait(broker);
+
+    subscription_get_dropped_count(blocking, &dropped);
+    TEST_ASSERT(dropped == 2, "Nothing dropped while there is room");
+    TEST_ASSERT(front_content_is(blocking, "a"), "Blocking keeps FIFO order");
+
+    subscription_free(blocking);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_blocked_publish_subscribe_test()
+{
+    TEST_SUITE("Message Broker Blocked Publish Subscribe Test");
+
+    struct message_broker_t* broker = new_broker(1);
+
+    struct subscription_options_t options = {
+        ._capacity = 1,
+        ._overflow_policy = SUBSCRIPTION_OVERFLOW_BLOCK,
+        ._block_timeout_ms = 5000};
+    struct subscription_t* blocking = NULL;
+    message_broker_subscribe_with_options(broker, "ticks", &options,
+                                          &blocking);
+
+    // the second publish waits for room in the inbox
+    message_broker_publish(broker, "ticks", "a");
+    message_broker_publish(broker, "ticks", "b");
+    usleep(50000);
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // a new group is published with a _channel_synchronize
+    struct subscription_t* member = NULL;
+    int exit_code = message_broker_subscribe_group(broker, "ticks", "workers",
+                                                   NULL, &member);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000
+                      + (end.tv_nsec - start.tv_nsec) / 1000000;
+    TEST_ASSERT(!exit_code && elapsed_ms < 1000,
+                "Subscribe does not wait for the blocked publisher");
+
+    TEST_ASSERT(front_content_is(blocking, "a"), "First publish received");
+    message_broker_wait(broker);
+
+    size_t dropped = 0;
+    subscription_get_dropped_count(blocking, &dropped);
+    TEST_ASSERT(front_content_is(blocking, "b") && !dropped,
+                "Blocked publish enqueued once there is room");
+
+    subscription_free(member);
+    subscription_free(blocking);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_ttl_test()
+{
+    TEST_SUITE("Message Broker TTL Test");
+
+    struct message_broker_t* broker = new_broker(2);
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, "quotes", &sub);
+
+    struct publish_options_t short_ttl = {._ttl_ms = 20};
+    int exit_code = message_broker_publish_with_options(broker, "quotes",
+                                                        "stale", 5, &short_ttl);
+    TEST_ASSERT(!exit_code, "Message published with a TTL");
+
+    exit_code = message_broker_publish(broker, "quotes", "fresh");
+    TEST_ASSERT(!exit_code, "Message published without a TTL");
+    message_broker_wait(broker);
+
+    usleep(50000);
+
+    struct message_t* msg = NULL;
+    exit_code = subscription_receive(sub, &msg);
+    const char* content = NULL;
+    message_get_content(msg, &content);
+    TEST_ASSERT(!exit_code && content && !strcmp(content, "fresh"),
+                "Expired message skipped on receive");
+    message_free(msg);
+
+    size_t expired = 0;
+    message_broker_get_channel_expired_count(broker, "quotes", &expired);
+    TEST_ASSERT(expired == 1, "Expired message counted on the channel");
+
+    struct channel_options_t channel_options = {._default_ttl_ms = 20};
+    exit_code =
+        message_broker_declare_channel(broker, "quotes", &channel_options);
+    TEST_ASSERT(!exit_code, "Channel default TTL declared");
+
+    struct publish_options_t long_ttl = {._ttl_ms = 60000};
+    message_broker_publish(broker, "quotes", "default");
+    message_broker_publish_with_options(broker, "quotes", "long", 4, &long_ttl);
+    message_broker_wait(broker);
+
+    // nobody receives: the sweeper has to drop the expired message
+    usleep(100000);
+
+    size_t pending = 0;
+    subscription_get_pending_count(sub, &pending);
+    TEST_ASSERT(pending == 1, "Expired message swept from the inbox");
+
+    message_broker_get_channel_expired_count(broker, "quotes", &expired);
+    TEST_ASSERT(expired == 2, "Swept message counted on the channel");
+
+    msg = NULL;
+    content = NULL;
+    subscription_try_receive(sub, &msg);
+    message_get_content(msg, &content);
+    TEST_ASSERT(content && !strcmp(content, "long"),
+                "Per-message TTL overrides the channel default");
+    message_free(msg);
+
+    exit_code = message_broker_get_channel_expired_count(broker, "missing",
+                                                         &expired);
+    TEST_ASSERT(exit_code == 1, "Unknown channel rejected");
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+struct _log_receiver_arg_t
+{
+    struct subscription_t* _sub;
+    int _received;
+};
+
+static void*
+log_receiver(void* arg)
+{
+
+    struct _log_receiver_arg_t* receiver_arg = arg;
+
+    struct message_t* msg = NULL;
+    if (subscription_receive(receiver_arg->_sub, &msg) == 0)
+    {
+        receiver_arg->_received = 1;
+        message_free(msg);
+    }
+
+    return NULL;
+}
+
+int
+message_broker_log_storage_test()
+{
+    TEST_SUITE("Message Broker Log Storage Test");
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 2};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct channel_options_t log_options = {._storage = CHANNEL_STORAGE_LOG};
+    int exit_code =
+        message_broker_declare_channel(broker, "ticks", &log_options);
+    TEST_ASSERT(!exit_code, "Log channel declared");
+
+    struct subscription_t* first = NULL;
+    struct subscription_t* second = NULL;
+    message_broker_subscribe(broker, "ticks", &first);
+    message_broker_subscribe(broker, "ticks", &second);
+
+    struct channel_options_t queue_options = {._storage =
+                                                  CHANNEL_STORAGE_QUEUE};
+    exit_code = message_broker_declare_channel(broker, "ticks", &queue_options);
+    TEST_ASSERT(exit_code == 1, "Storage change refused with subscribers");
+
+    const int n = 1000;
+    int i = 0;
+    while (i < n)
+    {
+
+        char content[32];
+        snprintf(content, sizeof(content), "%d", i);
+        message_broker_publish(broker, "ticks", content);
+        i++;
+    }
+    message_broker_wait(broker);
+
+    size_t pending = 0;
+    subscription_get_pending_count(first, &pending);
+    TEST_ASSERT(pending == (size_t) n, "Pending count is the cursor lag");
+
+    int in_order = 1;
+    int shared = 1;
+    i = 0;
+    while (i < n)
+    {
+
+        struct message_t* a = NULL;
+        struct message_t* b = NULL;
+        subscription_try_receive(first, &a);
+        subscription_try_receive(second, &b);
+
+        const char* content_a = NULL;
+        const char* content_b = NULL;
+        message_get_content(a, &content_a);
+        message_get_content(b, &content_b);
+
+        char expected[32];
+        snprintf(expected, sizeof(expected), "%d", i);
+        if (!content_a || strcmp(content_a, expected))
+        {
+            in_order = 0;
+        }
+
+        if (content_a != content_b)
+        {
+            shared = 0;
+        }
+
+        message_free(a);
+        message_free(b);
+        i++;
+    }
+    TEST_ASSERT(in_order, "Messages read in publish order");
+    TEST_ASSERT(shared, "Subscribers read the same appended message");
+
+    struct message_t* msg = NULL;
+    exit_code = subscription_try_receive(first, &msg);
+    TEST_ASSERT(exit_code == 1 && !msg, "Cursor caught up");
+
+    struct _log_receiver_arg_t receiver_arg = {._sub = first, ._received = 0};
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, log_receiver, &receiver_arg);
+
+    usleep(20000);
+    message_broker_publish(broker, "ticks", "wake");
+    pthread_join(receiver, NULL);
+    TEST_ASSERT(receiver_arg._received, "Blocked receiver woken by append");
+
+    subscription_get_pending_count(second, &pending);
+    TEST_ASSERT(pending == 1, "Other cursor unaffected");
+
+    subscription_free(first);
+    subscription_free(second);
+
+    exit_code = message_broker_declare_channel(broker, "ticks", &queue_options);
+    TEST_ASSERT(!exit_code, "Storage changed once unsubscribed");
+
+    message_broker_free(broker);
+
+    return 0;
+}
+
+static void
+remove_data_dir(const char* path, const char* channel)
+{
+
+    char channel_dir[256];
+    snprintf(channel_dir, sizeof(channel_dir), "%s/%s", path, channel);
+
+    DIR* dir = opendir(channel_dir);
+    if (dir)
+    {
+
+        struct dirent* entry = NULL;
+        while ((entry = readdir(dir)))
+        {
+
+            char file[512];
+            snprintf(file, sizeof(file), "%s/%s", channel_dir, entry->d_name);
+            unlink(file);
+        }
+
+        closedir(dir);
+        rmdir(channel_dir);
+    }
+
+    rmdir(path);
+}
+
+static int
+receive_content_is(struct subscription_t* sub, const char* expected)
+{
+
+    struct message_t* msg = NULL;
+    if (subscription_try_receive(sub, &msg))
+    {
+        return 0;
+    }
+
+    const char* content = NULL;
+    message_get_content(msg, &content);
+    int equal = content && !strcmp(content, expected);
+    message_free(msg);
+
+    return equal;
+}
+
+int
+message_broker_durable_channel_test()
+{
+    TEST_SUITE("Message Broker Durable Channel Test");
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/broker_test_XXXXXX");
+    mkdtemp(path);
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 2};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct channel_options_t durable_options = {
+        ._storage = CHANNEL_STORAGE_LOG, ._durable = 1};
+    int exit_code =
+        message_broker_declare_channel(broker, "orders", &durable_options);
+    TEST_ASSERT(exit_code == 1, "Durable channel needs a data directory");
+    message_broker_free(broker);
+
+    config._data_dir = path;
+    message_broker_new(&config, &broker);
+
+    exit_code =
+        message_broker_declare_channel(broker, "orders", &durable_options);
+    TEST_ASSERT(!exit_code, "Durable channel declared");
+
+    struct subscription_options_t named = {._name = "billing"};
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe_with_options(broker, "orders", &named, &sub);
+
+    struct subscription_t* twin = NULL;
+    exit_code =
+        message_broker_subscribe_with_options(broker, "orders", &named, &twin);
+    TEST_ASSERT(exit_code == 1, "Name already attached rejected");
+
+    int i = 0;
+    while (i < 10)
+    {
+
+        char content[32];
+        snprintf(content, sizeof(content), "%d", i);
+        message_broker_publish(broker, "orders", content);
+        i++;
+    }
+    message_broker_wait(broker);
+
+    receive_content_is(sub, "0");
+    receive_content_is(sub, "1");
+    subscription_free(sub);
+
+    message_broker_publish(broker, "orders", "10");
+    message_broker_wait(broker);
+
+    message_broker_subscribe_with_options(broker, "orders", &named, &sub);
+    TEST_ASSERT(receive_content_is(sub, "2"),
+                "Named subscription resumes after unsubscribe");
+    receive_content_is(sub, "3");
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    // restart on the same directory
+    message_broker_new(&config, &broker);
+    exit_code =
+        message_broker_declare_channel(broker, "orders", &durable_options);
+    TEST_ASSERT(!exit_code, "Durable channel recovered");
+
+    message_broker_subscribe_with_options(broker, "orders", &named, &sub);
+
+    size_t pending = 0;
+    subscription_get_pending_count(sub, &pending);
+    TEST_ASSERT(pending == 7, "Unread messages recovered");
+
+    TEST_ASSERT(receive_content_is(sub, "4"),
+                "Named subscription resumes after restart");
+
+    message_broker_publish(broker, "orders", "11");
+    message_broker_wait(broker);
+
+    i = 5;
+    int in_order = 1;
+    while (i <= 11)
+    {
+
+        char expected[32];
+        snprintf(expected, sizeof(expected), "%d", i);
+        if (!receive_content_is(sub, expected))
+        {
+            in_order = 0;
+        }
+        i++;
+    }
+    TEST_ASSERT(in_order, "Recovered and new messages read in order");
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    // a log left by a build with another record layout is not replayed
+    char segment[256];
+    snprintf(segment, sizeof(segment), "%s/orders/%020d.wal", path, 0);
+    int fd = open(segment, O_WRONLY);
+    const char magic[4] = {0};
+    pwrite(fd, magic, sizeof(magic), 0);
+    close(fd);
+
+    message_broker_new(&config, &broker);
+    exit_code =
+        message_broker_declare_channel(broker, "orders", &durable_options);
+    TEST_ASSERT(exit_code == EPROTO,
+                "Durable channel of another format rejected");
+
+    message_broker_free(broker);
+    remove_data_dir(path, "orders");
+
+    return 0;
+}
+
+int
+message_broker_durable_write_error_test()
+{
+    TEST_SUITE("Message Broker Durable Write Error Test");
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/broker_test_XXXXXX");
+    mkdtemp(path);
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 2};
+    config._data_dir = path;
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct channel_options_t durable_options = {
+        ._storage = CHANNEL_STORAGE_LOG, ._durable = 1};
+    message_broker_declare_channel(broker, "orders", &durable_options);
+
+    message_broker_publish(broker, "orders", "0");
+    int exit_code = message_broker_wait(broker);
+    TEST_ASSERT(!exit_code, "Wait succeeds while the log commits");
+
+    char segment[256];
+    snprintf(segment, sizeof(segment), "%s/orders/%020d.wal", path, 0);
+
+    struct stat st;
+    stat(segment, &st);
+
+    // the next commit gets a short write then EFBIG
+    struct rlimit saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    struct rlimit limited = {.rlim_cur = (rlim_t) st.st_size + 100,
+                             .rlim_max = saved.rlim_max};
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limited);
+
+    char large[512];
+    memset(large, 'x', sizeof(large) - 1);
+    large[sizeof(large) - 1] = '\0';
+    message_broker_publish(broker, "orders", large);
+    exit_code = message_broker_wait(broker);
+    TEST_ASSERT(exit_code == EFBIG, "Wait returns the failed commit");
+
+    message_broker_publish(broker, "orders", "1");
+    exit_code = message_broker_wait(broker);
+    TEST_ASSERT(exit_code == EFBIG, "Wait keeps returning the error");
+
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, SIG_DFL);
+
+    struct channel_stats_t channel_stats;
+    message_broker_get_channel_stats(broker, "orders", &channel_stats);
+    struct message_broker_stats_t broker_stats;
+    message_broker_get_stats(broker, &broker_stats);
+    TEST_ASSERT(channel_stats._counters._n_dropped == 1
+                    && broker_stats._counters._n_dropped == 1,
+                "Message refused by the log counted as dropped");
+    TEST_ASSERT(channel_stats._counters._n_fanned_out == 2,
+                "Dropped message not counted as appended");
+
+    message_broker_free(broker);
+    remove_data_dir(path, "orders");
+
+    return 0;
+}
+
+static uint64_t
+receive_id(struct subscription_t* sub, int blocking)
+{
+
+    struct message_t* msg = NULL;
+    int exit_code = blocking ? subscription_receive(sub, &msg)
+                             : subscription_try_receive(sub, &msg);
+    if (exit_code)
+    {
+        return 0;
+    }
+
+    uint64_t id = 0;
+    message_get_id(msg, &id);
+    message_free(msg);
+
+    return id;
+}
+
+static int
+ack_window_test(struct message_broker_t* broker, const char* channel)
+{
+
+    struct subscription_options_t options = {._ack_window = 3,
+                                             ._ack_timeout_ms = 50};
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe_with_options(broker, channel, &options, &sub);
+
+    int i = 0;
+    while (i < 5)
+    {
+        message_broker_publish(broker, channel, "ack");
+        i++;
+    }
+    message_broker_wait(broker);
+
+    uint64_t ids[5] = {0};
+    ids[0] = receive_id(sub, 0);
+    ids[1] = receive_id(sub, 0);
+    ids[2] = receive_id(sub, 1);
+
+    size_t in_flight = 0;
+    subscription_get_in_flight_count(sub, &in_flight);
+    TEST_ASSERT(in_flight == 3 && !receive_id(sub, 0),
+                "Full window stops the deliveries");
+
+    subscription_ack(sub, ids[1]);
+    subscription_get_in_flight_count(sub, &in_flight);
+    TEST_ASSERT(in_flight == 1, "Cumulative ack frees the window");
+
+    ids[3] = receive_id(sub, 0);
+    ids[4] = receive_id(sub, 1);
+    TEST_ASSERT(ids[3] && ids[4], "Deliveries resume after the ack");
+
+    // the blocking receive waits for the ack timeout of the oldest message
+    uint64_t redelivered_id = receive_id(sub, 1);
+    size_t redelivered = 0;
+    subscription_get_redelivered_count(sub, &redelivered);
+    TEST_ASSERT(redelivered_id == ids[2] && redelivered == 1,
+                "Unacked message delivered again after the timeout");
+
+    // the redelivery went after ids[4]: acking ids[4] leaves it in flight
+    subscription_ack(sub, ids[4]);
+    subscription_get_in_flight_count(sub, &in_flight);
+    TEST_ASSERT(in_flight == 1, "Ack covers the earlier deliveries only");
+
+    subscription_ack(sub, ids[4]);
+    subscription_get_in_flight_count(sub, &in_flight);
+    TEST_ASSERT(in_flight == 1, "Ack of an acked id ignored");
+
+    subscription_ack(sub, redelivered_id);
+    subscription_get_in_flight_count(sub, &in_flight);
+    TEST_ASSERT(in_flight == 0, "Every message acked");
+
+    subscription_free(sub);
+
+    return 0;
+}
+
+int
+message_broker_ack_test()
+{
+    TEST_SUITE("Message Broker Ack Test");
+
+    struct message_broker_t* broker =
+        with_queue_and_log("ack", ack_window_test);
+    if (!broker)
+    {
+        return 0;
+    }
+
+    struct subscription_t* auto_sub = NULL;
+    message_broker_subscribe(broker, "ack-queue", &auto_sub);
+    int exit_code = subscription_ack(auto_sub, 1);
+    TEST_ASSERT(exit_code == 1, "Ack rejected outside of ack mode");
+    subscription_free(auto_sub);
+
+    message_broker_free(broker);
+
+    // pooled: concurrent workers stamp the ids out of delivery order
+    broker = new_broker(4);
+    ack_window_test(broker, "ack-pooled");
+    message_broker_free(broker);
+
+    // named subscription: the position persisted is the oldest unacked one
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/broker_test_XXXXXX");
+    mkdtemp(path);
+
+    struct message_broker_configuration_t config = {._n_threads = 0,
+                                                    ._channels_capacity = 16,
+                                                    ._n_shards = 2,
+                                                    ._data_dir = path};
+    message_broker_new(&config, &broker);
+
+    struct channel_options_t durable_options = {
+        ._storage = CHANNEL_STORAGE_LOG, ._durable = 1};
+    message_broker_declare_channel(broker, "orders", &durable_options);
+
+    struct subscription_options_t options = {._name = "billing",
+                                             ._ack_window = 8};
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe_with_options(broker, "orders", &options, &sub);
+
+    message_broker_publish(broker, "orders", "0");
+    message_broker_publish(broker, "orders", "1");
+    message_broker_publish(broker, "orders", "2");
+    message_broker_wait(broker);
+
+    uint64_t first_id = receive_id(sub, 0);
+    receive_id(sub, 0);
+    receive_id(sub, 0);
+    subscription_ack(sub, first_id);
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    message_broker_new(&config, &broker);
+    message_broker_declare_channel(broker, "orders", &durable_options);
+    message_broker_subscribe_with_options(broker, "orders", &options, &sub);
+
+    TEST_ASSERT(receive_content_is(sub, "1"),
+                "Unacked messages delivered again after a restart");
+
+    subscription_free(sub);
+    message_broker_free(broker);
+    remove_data_dir(path, "orders");
+
+    return 0;
+}
+
+struct _delayed_publish_arg_t
+{
+    struct message_broker_t* _broker;
+    const char* _channel;
+};
+
+static void*
+delayed_publish(void* arg)
+{
+
+    struct _delayed_publish_arg_t* publish_arg = arg;
+
+    usleep(20000);
+    message_broker_publish(publish_arg->_broker, publish_arg->_channel,
+                           "late");
+
+    return NULL;
+}
+
+static void
+free_batch(struct message_t** msgs, size_t n)
+{
+
+    size_t i = 0;
+    while (i < n)
+    {
+        message_free(msgs[i]);
+        i++;
+    }
+}
+
+static int
+receive_batch_test(struct message_broker_t* broker, const char* channel)
+{
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, channel, &sub);
+
+    int i = 0;
+    while (i < 10)
+    {
+
+        char content[32];
+        snprintf(content, sizeof(content), "%d", i);
+        message_broker_publish(broker, channel, content);
+        i++;
+    }
+    message_broker_wait(broker);
+
+    struct message_t* msgs[10] = {NULL};
+    size_t n = 0;
+    int exit_code = subscription_receive_batch(sub, msgs, 4, 0, &n);
+    TEST_ASSERT(!exit_code && n == 4, "Batch limited to max messages");
+
+    const char* first = NULL;
+    const char* last = NULL;
+    message_get_content(msgs[0], &first);
+    message_get_content(msgs[3], &last);
+    TEST_ASSERT(!strcmp(first, "0") && !strcmp(last, "3"),
+                "Batch messages in publish order");
+    free_batch(msgs, n);
+
+    exit_code = subscription_receive_batch(sub, msgs, 10, 0, &n);
+    TEST_ASSERT(!exit_code && n == 6, "Batch drains the pending messages");
+    free_batch(msgs, n);
+
+    exit_code = subscription_receive_batch(sub, msgs, 10, 20, &n);
+    TEST_ASSERT(exit_code == 1 && n == 0, "Empty batch after the timeout");
+
+    struct _delayed_publish_arg_t publish_arg = {._broker = broker,
+                                                 ._channel = channel};
+    pthread_t publisher;
+    pthread_create(&publisher, NULL, delayed_publish, &publish_arg);
+
+    exit_code = subscription_receive_batch(sub, msgs, 10,
+                                           SUBSCRIPTION_WAIT_FOREVER, &n);
+    TEST_ASSERT(!exit_code && n == 1, "Blocking batch woken by a publish");
+    free_batch(msgs, n);
+
+    pthread_join(publisher, NULL);
+    subscription_free(sub);
+
+    return 0;
+}
+
+int
+message_broker_receive_batch_test()
+{
+    TEST_SUITE("Message Broker Receive Batch Test");
+
+    struct message_broker_t* broker =
+        with_queue_and_log("batch", receive_batch_test);
+    if (!broker)
+    {
+        return 0;
+    }
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, "batch-queue", &sub);
+
+    size_t n = 1;
+    int exit_code = subscription_receive_batch(sub, NULL, 4, 0, &n);
+    TEST_ASSERT(exit_code == 1, "NULL output array rejected");
+
+    subscription_unsubscribe(sub);
+    struct message_t* msgs[4];
+    exit_code = subscription_receive_batch(sub, msgs, 4, 0, &n);
+    TEST_ASSERT(exit_code == 1 && n == 0, "Inactive subscription rejected");
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+static int
+fd_readable(int fd)
+{
+
+    struct pollfd event = {.fd = fd, .events = POLLIN};
+
+    return poll(&event, 1, 0) == 1 && (event.revents & POLLIN);
+}
+
+static int
+subscription_fd_test(struct message_broker_t* broker, const char* channel)
+{
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, channel, &sub);
+
+    message_broker_publish(broker, channel, "before");
+    message_broker_wait(broker);
+
+    int fd = -1;
+    int exit_code = subscription_get_fd(sub, &fd);
+    TEST_ASSERT(!exit_code && fd >= 0, "Subscription fd created");
+    TEST_ASSERT(fd_readable(fd), "Fd readable for a message pending before");
+
+    int same_fd = -1;
+    subscription_get_fd(sub, &same_fd);
+    TEST_ASSERT(same_fd == fd, "Same fd returned on every call");
+
+    struct message_t* msg = NULL;
+    subscription_try_receive(sub, &msg);
+    message_free(msg);
+    exit_code = subscription_try_receive(sub, &msg);
+    TEST_ASSERT(exit_code == 1 && !fd_readable(fd),
+                "Fd cleared once the inbox is drained");
+
+    message_broker_publish(broker, channel, "one");
+    message_broker_publish(broker, channel, "two");
+    message_broker_wait(broker);
+    TEST_ASSERT(fd_readable(fd), "Fd readable after a publish");
+
+    int n_received = 0;
+    while (!subscription_try_receive(sub, &msg))
+    {
+        message_free(msg);
+        n_received++;
+    }
+    TEST_ASSERT(n_received == 2 && !fd_readable(fd),
+                "Drained until empty, fd cleared");
+
+    subscription_free(sub);
+
+    return 0;
+}
+
+int
+message_broker_fd_test()
+{
+    TEST_SUITE("Message Broker Subscription Fd Test");
+
+    struct message_broker_t* broker =
+        with_queue_and_log("fd", subscription_fd_test);
+    if (!broker)
+    {
+        return 0;
+    }
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, "fd-queue", &sub);
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct message_t* msg = NULL;
+    int exit_code = subscription_receive_timeout(sub, &msg, 20);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000
+                      + (end.tv_nsec - start.tv_nsec) / 1000000;
+    TEST_ASSERT(exit_code == 1 && !msg && elapsed_ms >= 19,
+                "Timed receive gives up after the timeout");
+
+    struct _delayed_publish_arg_t publish_arg = {._broker = broker,
+                                                 ._channel = "fd-queue"};
+    pthread_t publisher;
+    pthread_create(&publisher, NULL, delayed_publish, &publish_arg);
+
+    exit_code = subscription_receive_timeout(sub, &msg, 5000);
+    TEST_ASSERT(!exit_code && msg, "Timed receive woken by a publish");
+    message_free(msg);
+
+    pthread_join(publisher, NULL);
+
+    subscription_unsubscribe(sub);
+    int fd = -1;
+    exit_code = subscription_get_fd(sub, &fd);
+    TEST_ASSERT(exit_code == 1, "No fd for an inactive subscription");
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_pattern_subscribe_test()
+{
+    TEST_SUITE("Message Broker Pattern Subscribe Test");
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 2};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct subscription_t* star = NULL;
+    int exit_code =
+        message_broker_subscribe_pattern(broker, "sensors.*", NULL, &star);
+    TEST_ASSERT(!exit_code && star, "Star pattern subscribed");
+
+    struct subscription_t* hash = NULL;
+    message_broker_subscribe_pattern(broker, "sensors.#", NULL, &hash);
+
+    struct subscription_t* exact = NULL;
+    message_broker_subscribe(broker, "sensors.eu", &exact);
+
+    message_broker_publish(broker, "sensors.eu", "eu");
+    message_broker_publish(broker, "sensors.eu.temp", "temp");
+    message_broker_publish(broker, "orders.eu", "order");
+    message_broker_wait(broker);
+
+    struct message_t* msg = NULL;
+    subscription_try_receive(star, &msg);
+
+    const char* channel = NULL;
+    message_get_channel(msg, &channel);
+    TEST_ASSERT(channel && !strcmp(channel, "sensors.eu"),
+                "Message keeps the channel it was published to");
+    message_free(msg);
+
+    TEST_ASSERT(!receive_content_is(star, "temp"),
+                "Star does not match two segments");
+    TEST_ASSERT(receive_content_is(hash, "eu")
+                    && receive_content_is(hash, "temp")
+                    && !receive_content_is(hash, "order"),
+                "Hash matches one and more segments");
+    TEST_ASSERT(receive_content_is(exact, "eu")
+                    && !receive_content_is(exact, "temp"),
+                "Exact subscription unaffected");
+
+    subscription_unsubscribe(hash);
+    message_broker_publish(broker, "sensors.us", "us");
+    message_broker_wait(broker);
+
+    TEST_ASSERT(receive_content_is(star, "us"), "Remaining pattern matched");
+
+    const char* sub_channel = NULL;
+    subscription_get_channel(star, &sub_channel);
+    TEST_ASSERT(sub_channel && !strcmp(sub_channel, "sensors.*"),
+                "Subscription reports its pattern");
+
+    struct subscription_t* invalid = NULL;
+    exit_code =
+        message_broker_subscribe_pattern(broker, "a..b", NULL, &invalid);
+    TEST_ASSERT(exit_code == 1 && !invalid, "Empty segment rejected");
+
+    subscription_free(hash);
+    subscription_free(star);
+    subscription_free(exact);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+static void
+channel_handle_test(struct message_broker_t* broker, const char* channel)
+{
+
+    struct channel_handle_t* handle = NULL;
+    int exit_code = message_broker_channel_open(broker, channel, &handle);
+    TEST_ASSERT(!exit_code && handle, "Channel opened");
+
+    struct subscription_t* sub = NULL;
+    exit_code = message_broker_subscribe_to(handle, NULL, &sub);
+    TEST_ASSERT(!exit_code && sub, "Subscribed through the handle");
+
+    struct subscription_t* by_name = NULL;
+    message_broker_subscribe(broker, channel, &by_name);
+
+    message_broker_publish_to(handle, "first", 5, NULL);
+    message_broker_publish(broker, channel, "second");
+    message_broker_publish_to(handle, "third", 5, NULL);
+    message_broker_wait(broker);
+
+    TEST_ASSERT(receive_content_is(sub, "first")
+                    && receive_content_is(sub, "second")
+                    && receive_content_is(sub, "third"),
+                "Handle and name publishes reach the same channel in order");
+    TEST_ASSERT(receive_content_is(by_name, "first"),
+                "Subscription by name sees handle publishes");
+
+    exit_code = message_broker_channel_close(handle);
+    TEST_ASSERT(!exit_code, "Channel handle closed");
+
+    message_broker_publish(broker, channel, "after");
+    message_broker_wait(broker);
+    TEST_ASSERT(receive_content_is(sub, "after"),
+                "Channel kept after the handle is closed");
+
+    subscription_free(sub);
+    subscription_free(by_name);
+}
+
+int
+message_broker_channel_handle_test()
+{
+    TEST_SUITE("Message Broker Channel Handle Test");
+
+    struct message_broker_configuration_t sharded_config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 2};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&sharded_config, &broker);
+    channel_handle_test(broker, "handle-sharded");
+    message_broker_free(broker);
+
+    struct message_broker_configuration_t inline_config = {
+        ._n_threads = 1,
+        ._channels_capacity = 16,
+        ._inline_fanout_threshold = 4};
+
+    message_broker_new(&inline_config, &broker);
+    channel_handle_test(broker, "handle-inline");
+
+    struct channel_handle_t* handle = NULL;
+    int exit_code = message_broker_channel_open(broker, NULL, &handle);
+    TEST_ASSERT(exit_code == 1 && !handle, "NULL channel rejected");
+
+    exit_code = message_broker_publish_to(NULL, "x", 1, NULL);
+    TEST_ASSERT(exit_code == 1, "NULL handle rejected");
+
+    message_broker_free(broker);
+
+    return 0;
+}
+
+struct _reclaim_worker_arg_t
+{
+    struct message_broker_t* _broker;
+    int _seed;
+    int _n_received;
+};
+
+static void*
+reclaim_worker(void* arg)
+{
+
+    struct _reclaim_worker_arg_t* a = (struct _reclaim_worker_arg_t*) arg;
+
+    int i = 0;
+    while (i < 500)
+    {
+
+        char channel[32];
+        snprintf(channel, sizeof(channel), "churn.%d", (a->_seed + i) % 8);
+
+        struct subscription_t* sub = NULL;
+        message_broker_subscribe(a->_broker, channel, &sub);
+        message_broker_publish(a->_broker, channel, "x");
+
+        struct message_t* msg = NULL;
+        if (!subscription_receive_timeout(sub, &msg, 1000))
+        {
+            a->_n_received++;
+            message_free(msg);
+        }
+
+        subscription_free(sub);
+
+        snprintf(channel, sizeof(channel), "reply.%d.%d", a->_seed, i);
+        message_broker_publish(a->_broker, channel, "y");
+
+        i++;
+    }
+
+    return NULL;
+}
+
+int
+message_broker_channel_reclaim_test()
+{
+    TEST_SUITE("Message Broker Channel Reclaim Test");
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 2, ._channels_capacity = 16, ._channel_idle_ms = 20};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, "kept.subscribed", &sub);
+
+    struct channel_handle_t* handle = NULL;
+    message_broker_channel_open(broker, "kept.handle", &handle);
+
+    struct channel_options_t options = {._default_ttl_ms = 1000};
+    message_broker_declare_channel(broker, "kept.declared", &options);
+
+    int i = 0;
+    while (i < 50)
+    {
+
+        char channel[32];
+        snprintf(channel, sizeof(channel), "reply.%d", i);
+        message_broker_publish(broker, channel, "reply");
+        i++;
+    }
+    message_broker_wait(broker);
+
+    size_t n_live = 0;
+    size_t n_reclaimed = 0;
+    message_broker_get_channel_counts(broker, &n_live, &n_reclaimed);
+    TEST_ASSERT(n_live == 53, "Published channels created");
+
+    // the reclamation runs every 10 ms, idle channels go within 30 ms
+    usleep(100 * 1000);
+
+    message_broker_get_channel_counts(broker, &n_live, &n_reclaimed);
+    TEST_ASSERT(n_live == 3 && n_reclaimed == 50, "Idle channels reclaimed");
+
+    message_broker_publish(broker, "kept.subscribed", "still");
+    message_broker_publish_to(handle, "open", 4, NULL);
+    message_broker_wait(broker);
+    TEST_ASSERT(receive_content_is(sub, "still"),
+                "Subscribed channel kept its subscriber");
+
+    struct subscription_t* again = NULL;
+    message_broker_subscribe(broker, "reply.7", &again);
+    message_broker_publish(broker, "reply.7", "recreated");
+    message_broker_wait(broker);
+    TEST_ASSERT(receive_content_is(again, "recreated"),
+                "Reclaimed channel created again on use");
+
+    subscription_free(again);
+    subscription_free(sub);
+    message_broker_channel_close(handle);
+
+    struct _reclaim_worker_arg_t args[4];
+    pthread_t workers[4];
+    i = 0;
+    while (i < 4)
+    {
+
+        args[i] = (struct _reclaim_worker_arg_t) {
+            ._broker = broker, ._seed = i, ._n_received = 0};
+        pthread_create(&workers[i], NULL, reclaim_worker, &args[i]);
+        i++;
+    }
+
+    int n_received = 0;
+    i = 0;
+    while (i < 4)
+    {
+
+        pthread_join(workers[i], NULL);
+        n_received += args[i]._n_received;
+        i++;
+    }
+    message_broker_wait(broker);
+
+    TEST_ASSERT(n_received == 2000,
+                "Subscribers receive while channels are reclaimed");
+
+    usleep(100 * 1000);
+    message_broker_get_channel_counts(broker, &n_live, &n_reclaimed);
+    TEST_ASSERT(n_live == 1, "Only the declared channel left");
+
+    message_broker_free(broker);
+
+    return 0;
+}
+
+struct _membership_churn_arg_t
+{
+    struct message_broker_t* _broker;
+    atomic_int* _running;
+};
+
+static void*
+membership_churn(void* arg)
+{
+
+    struct _membership_churn_arg_t* a = (struct _membership_churn_arg_t*) arg;
+
+    while (atomic_load(a->_running))
+    {
+
+        struct subscription_t* sub = NULL;
+        message_broker_subscribe(a->_broker, "snapshot", &sub);
+        subscription_free(sub);
+    }
+
+    return NULL;
+}
+
+int
+message_broker_subscriber_snapshot_test()
+{
+    TEST_SUITE("Message Broker Subscriber Snapshot Test");
+
+    struct message_broker_configuration_t config = {._n_threads = 4,
+                                                    ._channels_capacity = 16};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct subscription_t* stable[8];
+    int i = 0;
+    while (i < 8)
+    {
+        message_broker_subscribe(broker, "snapshot", &stable[i]);
+        i++;
+    }
+
+    atomic_int running = 1;
+    struct _membership_churn_arg_t churn_arg = {._broker = broker,
+                                                ._running = &running};
+    pthread_t churners[2];
+    pthread_create(&churners[0], NULL, membership_churn, &churn_arg);
+    pthread_create(&churners[1], NULL, membership_churn, &churn_arg);
+
+    i = 0;
+    while (i < 500)
+    {
+        message_broker_publish(broker, "snapshot", "m");
+        i++;
+    }
+    message_broker_wait(broker);
+
+    atomic_store(&running, 0);
+    pthread_join(churners[0], NULL);
+    pthread_join(churners[1], NULL);
+
+    int all_received = 1;
+    i = 0;
+    while (i < 8)
+    {
+
+        size_t pending = 0;
+        subscription_get_pending_count(stable[i], &pending);
+        if (pending != 500)
+        {
+            all_received = 0;
+        }
+
+        subscription_free(stable[i]);
+        i++;
+    }
+
+    TEST_ASSERT(all_received,
+                "Stable subscribers get every message during churn");
+
+    message_broker_free(broker);
+
+    return 0;
+}
+
+struct _unsubscriber_arg_t
+{
+    struct subscription_t** _subs;
+    int _first;
+    int _n;
+    int _stride;
+};
+
+static void*
+unsubscriber(void* arg)
+{
+
+    struct _unsubscriber_arg_t* a = (struct _unsubscriber_arg_t*) arg;
+
+    int i = a->_first;
+    while (i < a->_n)
+    {
+        subscription_unsubscribe(a->_subs[i]);
+        i += a->_stride;
+    }
+
+    return NULL;
+}
+
+int
+message_broker_concurrent_unsubscribe_test()
+{
+    TEST_SUITE("Message Broker Concurrent Unsubscribe Test");
+
+    struct message_broker_configuration_t config = {._n_threads = 4,
+                                                    ._channels_capacity = 16};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct subscription_t* subs[1000];
+    int i = 0;
+    while (i < 1000)
+    {
+        message_broker_subscribe(broker, "mass", &subs[i]);
+        i++;
+    }
+
+    // every fifth subscription stays, the others are dropped by 4 threads
+    // while messages are published
+    struct _unsubscriber_arg_t args[4];
+    pthread_t threads[4];
+    i = 0;
+    while (i < 4)
+    {
+
+        args[i] = (struct _unsubscriber_arg_t) {
+            ._subs = subs, ._first = i + 1, ._n = 1000, ._stride = 5};
+        pthread_create(&threads[i], NULL, unsubscriber, &args[i]);
+        i++;
+    }
+
+    i = 0;
+    while (i < 50)
+    {
+        message_broker_publish(broker, "mass", "m");
+        i++;
+    }
+
+    i = 0;
+    while (i < 4)
+    {
+        pthread_join(threads[i], NULL);
+        i++;
+    }
+
+    message_broker_publish(broker, "mass", "last");
+    message_broker_wait(broker);
+
+    int all_received = 1;
+    i = 0;
+    while (i < 1000)
+    {
+
+        size_t pending = 0;
+        if (i % 5 == 0)
+        {
+
+            subscription_get_pending_count(subs[i], &pending);
+            if (pending != 51)
+            {
+                all_received = 0;
+            }
+        }
+
+        i++;
+    }
+    TEST_ASSERT(all_received, "Remaining subscribers get every message");
+
+    int exit_code = subscription_unsubscribe(subs[1]);
+    TEST_ASSERT(exit_code == 1, "Second unsubscribe rejected");
+
+    i = 0;
+    while (i < 1000)
+    {
+        subscription_free(subs[i]);
+        i++;
+    }
+
+    size_t n_live = 0;
+    size_t n_reclaimed = 0;
+    message_broker_get_channel_counts(broker, &n_live, &n_reclaimed);
+    TEST_ASSERT(n_live == 1, "Channel kept after its subscribers left");
+
+    message_broker_free(broker);
+
+    return 0;
+}
+
+static size_t
+pending_count(struct subscription_t* sub)
+{
+
+    size_t pending = 0;
+    subscription_get_pending_count(sub, &pending);
+
+    return pending;
+}
+
+int
+message_broker_consumer_group_test()
+{
+    TEST_SUITE("Message Broker Consumer Group Test");
+
+    // a single worker fans out one message at a time: the spread is exact
+    struct message_broker_t* broker = new_broker(1);
+
+    struct subscription_t* workers[3];
+    int i = 0;
+    while (i < 3)
+    {
+        message_broker_subscribe_group(broker, "jobs", "workers", NULL,
+                                       &workers[i]);
+        i++;
+    }
+
+    struct subscription_t* audit = NULL;
+    message_broker_subscribe_group(broker, "jobs", "audit", NULL, &audit);
+
+    struct subscription_t* plain = NULL;
+    message_broker_subscribe(broker, "jobs", &plain);
+
+    i = 0;
+    while (i < 300)
+    {
+        message_broker_publish(broker, "jobs", "job");
+        i++;
+    }
+    message_broker_wait(broker);
+
+    TEST_ASSERT(pending_count(workers[0]) == 100
+                    && pending_count(workers[1]) == 100
+                    && pending_count(workers[2]) == 100,
+                "Messages spread evenly across the members");
+    TEST_ASSERT(pending_count(audit) == 300,
+                "Every group gets every message once");
+    TEST_ASSERT(pending_count(plain) == 300,
+                "Plain subscribers still get every message");
+
+    // a busy member is skipped until the others catch up with it
+    struct message_t* msg = NULL;
+    i = 0;
+    while (i < 50)
+    {
+        subscription_receive(workers[0], &msg);
+        message_free(msg);
+        i++;
+    }
+
+    i = 0;
+    while (i < 50)
+    {
+        message_broker_publish(broker, "jobs", "job");
+        i++;
+    }
+    message_broker_wait(broker);
+
+    TEST_ASSERT(pending_count(workers[0]) == 100,
+                "Least pending member preferred");
+
+    subscription_free(workers[1]);
+    subscription_free(workers[2]);
+
+    i = 0;
+    while (i < 10)
+    {
+        message_broker_publish(broker, "jobs", "job");
+        i++;
+    }
+    message_broker_wait(broker);
+
+    TEST_ASSERT(pending_count(workers[0]) == 110,
+                "Remaining member takes over the group");
+
+    subscription_free(workers[0]);
+
+    message_broker_subscribe_group(broker, "jobs", "workers", NULL,
+                                   &workers[0]);
+    TEST_ASSERT(pending_count(workers[0]) == 0,
+                "Group recreated empty by a new member");
+    subscription_free(workers[0]);
+
+    int exit_code = message_broker_subscribe_group(broker, "jobs", "", NULL,
+                                                   &workers[0]);
+    TEST_ASSERT(exit_code == 1, "Empty group name rejected");
+
+    struct subscription_options_t named = {._name = "worker"};
+    exit_code = message_broker_subscribe_group(broker, "jobs", "workers",
+                                               &named, &workers[0]);
+    TEST_ASSERT(exit_code == 1, "Named member rejected");
+
+    struct channel_options_t log_options = {._storage = CHANNEL_STORAGE_LOG};
+    message_broker_declare_channel(broker, "log-jobs", &log_options);
+    exit_code = message_broker_subscribe_group(broker, "log-jobs", "workers",
+                                               NULL, &workers[0]);
+    TEST_ASSERT(exit_code == 1, "Group on a LOG channel rejected");
+
+    subscription_free(audit);
+    subscription_free(plain);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_partition_test()
+{
+    TEST_SUITE("Message Broker Partition Test");
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 4};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct channel_options_t options = {._n_partitions = 8};
+    int exit_code = message_broker_declare_channel(broker, "orders", &options);
+    TEST_ASSERT(!exit_code, "Partitioned channel declared");
+
+    struct subscription_options_t low_options = {._partitions = 0x0F};
+    struct subscription_options_t high_options = {._partitions = 0xF0};
+    struct subscription_t* low = NULL;
+    struct subscription_t* high = NULL;
+    struct subscription_t* all = NULL;
+    message_broker_subscribe_with_options(broker, "orders", &low_options, &low);
+    message_broker_subscribe_with_options(broker, "orders", &high_options,
+                                          &high);
+    message_broker_subscribe(broker, "orders", &all);
+
+    // 20 keys, each with its own increasing sequence
+    int i = 0;
+    while (i < 400)
+    {
+
+        char key[16];
+        char content[16];
+        snprintf(key, sizeof(key), "order-%d", i % 20);
+        snprintf(content, sizeof(content), "%d:%d", i % 20, i / 20);
+
+        struct publish_options_t publish_options = {._key = key,
+                                                    ._key_len = strlen(key)};
+        message_broker_publish_with_options(broker, "orders", content,
+                                            strlen(content) + 1,
+                                            &publish_options);
+        i++;
+    }
+    message_broker_wait(broker);
+
+    size_t n_low = 0;
+    size_t n_high = 0;
+    subscription_get_pending_count(low, &n_low);
+    subscription_get_pending_count(high, &n_high);
+    TEST_ASSERT(n_low + n_high == 400 && n_low && n_high,
+                "Each message delivered to the subscribers of its partition");
+
+    // per key: one partition and the sequence in order
+    int next_seq[20] = {0};
+    size_t partition_of[20];
+    int in_order = 1;
+    int one_partition = 1;
+    uint64_t next_partition_seq[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    int partition_sequences = 1;
+    i = 0;
+    while (i < 400)
+    {
+
+        struct message_t* msg = NULL;
+        if (subscription_try_receive(all, &msg) || !msg)
+        {
+            in_order = 0;
+            break;
+        }
+
+        const char* content = NULL;
+        size_t partition = 0;
+        message_get_content(msg, &content);
+        message_get_partition(msg, &partition);
+
+        uint64_t sequence = 0;
+        message_get_sequence(msg, &sequence);
+        if (sequence != next_partition_seq[partition]++)
+        {
+            partition_sequences = 0;
+        }
+
+        int key = 0;
+        int seq = 0;
+        sscanf(content, "%d:%d", &key, &seq);
+        if (seq != next_seq[key])
+        {
+            in_order = 0;
+        }
+
+        if (seq && partition_of[key] != partition)
+        {
+            one_partition = 0;
+        }
+
+        partition_of[key] = partition;
+        next_seq[key] = seq + 1;
+
+        message_free(msg);
+        i++;
+    }
+    TEST_ASSERT(in_order, "Messages of a key received in order");
+    TEST_ASSERT(one_partition, "Messages of a key share one partition");
+    TEST_ASSERT(partition_sequences, "Each partition numbers its messages");
+
+    struct message_t* msg = NULL;
+    subscription_try_receive(low, &msg);
+    size_t partition = 8;
+    message_get_partition(msg, &partition);
+    TEST_ASSERT(partition < 4, "Subscriber only gets its partitions");
+    message_free(msg);
+
+    // unkeyed publishes and batches take their partition's shard as well
+    message_broker_declare_channel(broker, "mixed", &options);
+    struct subscription_t* mixed = NULL;
+    message_broker_subscribe(broker, "mixed", &mixed);
+
+    struct message_broker_batch_entry_t entries[4];
+    i = 0;
+    while (i < 4)
+    {
+        entries[i] = (struct message_broker_batch_entry_t) {
+            ._channel = "mixed", ._payload = "b", ._len = 2};
+        i++;
+    }
+
+    i = 0;
+    while (i < 400)
+    {
+
+        char key[16];
+        snprintf(key, sizeof(key), "mixed-%d", i % 7);
+        struct publish_options_t publish_options = {._key = key,
+                                                    ._key_len = strlen(key)};
+        message_broker_publish_with_options(
+            broker, "mixed", "m", 2, i % 2 ? &publish_options : NULL);
+        if (i % 50 == 0)
+        {
+            message_broker_publish_batch(broker, entries, 4);
+        }
+        i++;
+    }
+    message_broker_wait(broker);
+
+    uint64_t next_mixed_seq[8] = {1, 1, 1, 1, 1, 1, 1, 1};
+    int mixed_sequences = 1;
+    size_t n_mixed = 0;
+    while (!subscription_try_receive(mixed, &msg) && msg)
+    {
+
+        uint64_t sequence = 0;
+        message_get_partition(msg, &partition);
+        message_get_sequence(msg, &sequence);
+        if (sequence != next_mixed_seq[partition]++)
+        {
+            mixed_sequences = 0;
+        }
+
+        message_free(msg);
+        msg = NULL;
+        n_mixed++;
+    }
+    TEST_ASSERT(n_mixed == 432 && mixed_sequences,
+                "Partition sequences follow delivery with unkeyed publishes");
+    subscription_free(mixed);
+
+    struct subscription_options_t wide_options = {._partitions = 0x100};
+    struct subscription_t* wide = NULL;
+    exit_code = message_broker_subscribe_with_options(broker, "orders",
+                                                      &wide_options, &wide);
+    TEST_ASSERT(exit_code == 1, "Missing partition rejected");
+
+    exit_code = message_broker_subscribe_with_options(broker, "plain",
+                                                      &low_options, &wide);
+    TEST_ASSERT(exit_code == 1, "Partitions of a plain channel rejected");
+
+    options._n_partitions = 4;
+    exit_code = message_broker_declare_channel(broker, "orders", &options);
+    TEST_ASSERT(exit_code == 1, "Partitions kept while subscribed");
+
+    struct channel_options_t log_options = {._storage = CHANNEL_STORAGE_LOG,
+                                            ._n_partitions = 4};
+    exit_code = message_broker_declare_channel(broker, "log", &log_options);
+    TEST_ASSERT(exit_code == 1, "Partitioned LOG channel rejected");
+
+    options._n_partitions = 65;
+    exit_code = message_broker_declare_channel(broker, "many", &options);
+    TEST_ASSERT(exit_code == 1, "Too many partitions rejected");
+
+    subscription_free(low);
+    subscription_free(high);
+    subscription_free(all);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+static uint64_t
+receive_sequence(struct subscription_t* sub, uint64_t* out_id)
+{
+
+    struct message_t* msg = NULL;
+    if (subscription_try_receive(sub, &msg) || !msg)
+    {
+        return 0;
+    }
+
+    uint64_t sequence = 0;
+    message_get_sequence(msg, &sequence);
+    if (out_id)
+    {
+        message_get_id(msg, out_id);
+    }
+    message_free(msg);
+
+    return sequence;
+}
+
+int
+message_broker_sequence_test()
+{
+    TEST_SUITE("Message Broker Sequence Test");
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 0, ._channels_capacity = 16, ._n_shards = 2};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct subscription_t* sub_a = NULL;
+    struct subscription_t* sub_b = NULL;
+    message_broker_subscribe(broker, "seq-a", &sub_a);
+    message_broker_subscribe(broker, "seq-b", &sub_b);
+
+    // a bounded inbox loses the oldest messages: the gap shows in sequences
+    struct subscription_options_t bounded_options = {
+        ._capacity = 3, ._overflow_policy = SUBSCRIPTION_OVERFLOW_DROP_OLDEST};
+    struct subscription_t* bounded = NULL;
+    message_broker_subscribe_with_options(broker, "seq-a", &bounded_options,
+                                          &bounded);
+
+    int i = 0;
+    while (i < 10)
+    {
+
+        message_broker_publish(broker, "seq-a", "a");
+        if (i < 5)
+        {
+            message_broker_publish(broker, "seq-b", "b");
+        }
+
+        i++;
+    }
+    message_broker_wait(broker);
+
+    int consecutive = 1;
+    int id_is_sequence = 1;
+    uint64_t expected = 1;
+    while (expected <= 10)
+    {
+
+        uint64_t id = 0;
+        uint64_t sequence = receive_sequence(sub_a, &id);
+        if (sequence != expected)
+        {
+            consecutive = 0;
+        }
+        if (id != sequence)
+        {
+            id_is_sequence = 0;
+        }
+
+        expected++;
+    }
+
+    expected = 1;
+    while (expected <= 5)
+    {
+
+        if (receive_sequence(sub_b, NULL) != expected)
+        {
+            consecutive = 0;
+        }
+
+        expected++;
+    }
+
+    TEST_ASSERT(consecutive, "Each channel numbers its messages from 1");
+    TEST_ASSERT(id_is_sequence, "Id is the sequence without global ids");
+
+    TEST_ASSERT(receive_sequence(bounded, NULL) == 8,
+                "Dropped messages show as a gap");
+
+    struct subscription_options_t ack_options = {._ack_window = 4};
+    struct subscription_t* pattern = NULL;
+    int exit_code = message_broker_subscribe_pattern(broker, "seq-*",
+                                                     &ack_options, &pattern);
+    TEST_ASSERT(exit_code == 1, "Pattern ack mode needs global ids");
+
+    subscription_free(sub_a);
+    subscription_free(sub_b);
+    subscription_free(bounded);
+    message_broker_free(broker);
+
+    config._global_message_ids = 1;
+    message_broker_new(&config, &broker);
+
+    message_broker_subscribe(broker, "seq-a", &sub_a);
+    message_broker_subscribe(broker, "seq-b", &sub_b);
+    message_broker_publish(broker, "seq-a", "a");
+    message_broker_publish(broker, "seq-b", "b");
+    message_broker_wait(broker);
+
+    uint64_t id_a = 0;
+    uint64_t id_b = 0;
+    uint64_t sequence_a = receive_sequence(sub_a, &id_a);
+    uint64_t sequence_b = receive_sequence(sub_b, &id_b);
+    TEST_ASSERT(sequence_a == 1 && sequence_b == 1 && id_a && id_b
+                    && id_a != id_b,
+                "Global ids on top of the channel sequences");
+
+    subscription_free(sub_a);
+    subscription_free(sub_b);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+struct _concurrent_publisher_arg_t
+{
+    struct message_broker_t* _broker;
+    int _count;
+};
+
+static void*
+concurrent_publisher(void* arg)
+{
+
+    struct _concurrent_publisher_arg_t* a =
+        (struct _concurrent_publisher_arg_t*) arg;
+
+    int i = 0;
+    while (i < a->_count)
+    {
+        message_broker_publish(a->_broker, "concurrent", "payload");
+        i++;
+    }
+
+    return NULL;
+}
+
+int
+message_broker_concurrent_publish_test()
+{
+    TEST_SUITE("Message Broker Concurrent Publish Test");
+
+    struct message_broker_t* broker = new_broker(4);
+
+    struct subscription_t* subs[4];
+    size_t i = 0;
+    while (i < 4)
+    {
+        message_broker_subscribe(broker, "concurrent", &subs[i]);
+        i++;
+    }
+
+    pthread_t threads[4];
+    struct _concurrent_publisher_arg_t arg = {._broker = broker,
+                                              ._count = 250};
+    i = 0;
+    while (i < 4)
+    {
+        pthread_create(&threads[i], NULL, concurrent_publisher, &arg);
+        i++;
+    }
+
+    i = 0;
+    while (i < 4)
+    {
+        pthread_join(threads[i], NULL);
+        i++;
+    }
+
+    message_broker_wait(broker);
+
+    int all_delivered = 1;
+    i = 0;
+    while (i < 4)
+    {
+
+        size_t pending = 0;
+        subscription_get_pending_count(subs[i], &pending);
+        if (pending != 1000)
+        {
+            all_delivered = 0;
+        }
+
+        i++;
+    }
+    TEST_ASSERT(all_delivered, "Every subscriber received every message");
+
+    i = 0;
+    while (i < 4)
+    {
+        subscription_free(subs[i]);
+        i++;
+    }
+    message_broker_free(broker);
+
+    return 0;
+}
+
+int
+message_broker_stats_test()
+{
+    TEST_SUITE("Message Broker Stats Test");
+
+    struct message_broker_t* broker = new_broker(2);
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, "stats", &sub);
+    struct subscription_t* bounded = subscribe_bounded(
+        broker, "stats", 2, SUBSCRIPTION_OVERFLOW_DROP_OLDEST);
+
+    int i = 0;
+    while (i < 5)
+    {
+        message_broker_publish(broker, "stats", "hello");
+        i++;
+    }
+    message_broker_wait(broker);
+
+    struct message_t* msg = NULL;
+    while (!subscription_try_receive(sub, &msg))
+    {
+        message_free(msg);
+    }
+
+    struct message_broker_stats_t broker_stats;
+    int exit_code = message_broker_get_stats(broker, &broker_stats);
+    struct message_broker_counters_t counters = broker_stats._counters;
+    TEST_ASSERT(!exit_code && counters._n_published == 5
+                    && counters._bytes_in == 25,
+                "Published messages and bytes counted");
+    TEST_ASSERT(counters._n_fanned_out == 10 && counters._n_dropped == 3,
+                "Copies and overflows counted");
+    TEST_ASSERT(counters._n_delivered == 5 && counters._bytes_out == 25,
+                "Delivered messages and bytes counted");
+    TEST_ASSERT(broker_stats._n_pending_tasks == 0
+                    && broker_stats._n_channels == 1,
+                "Pool drained, one channel");
+
+    struct channel_stats_t channel_stats;
+    exit_code =
+        message_broker_get_channel_stats(broker, "stats", &channel_stats);
+    TEST_ASSERT(!exit_code && channel_stats._n_subscribers == 2
+                    && channel_stats._counters._n_published == 5
+                    && channel_stats._counters._n_fanned_out == 10,
+                "Channel counters match");
+
+    exit_code =
+        message_broker_get_channel_stats(broker, "missing", &channel_stats);
+    TEST_ASSERT(exit_code == 1, "Unknown channel not found");
+
+    struct subscription_stats_t sub_stats;
+    subscription_get_stats(sub, &sub_stats);
+    TEST_ASSERT(sub_stats._n_delivered == 5 && sub_stats._bytes_out == 25
+                    && sub_stats._inbox_depth == 0
+                    && sub_stats._inbox_high_water == 5,
+                "Drained inbox keeps its high-water mark");
+
+    subscription_get_stats(bounded, &sub_stats);
+    TEST_ASSERT(sub_stats._n_delivered == 0 && sub_stats._n_dropped == 3
+                    && sub_stats._inbox_depth == 2
+                    && sub_stats._inbox_high_water == 2,
+                "Bounded inbox stats");
+
+    subscription_free(sub);
+    subscription_free(bounded);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+static int
+latency_is_ordered(const struct message_latency_t* latency)
+{
+    return latency->_p50_ns <= latency->_p90_ns
+           && latency->_p90_ns <= latency->_p99_ns
+           && latency->_p99_ns <= latency->_p999_ns
+           && latency->_p999_ns <= latency->_max_ns;
+}
+
+int
+message_broker_latency_test()
+{
+    TEST_SUITE("Message Broker Latency Test");
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 2, ._channels_capacity = 16, ._latency_tracing = 1};
+
+    struct message_broker_t* broker = NULL;
+    message_broker_new(&config, &broker);
+
+    struct subscription_t* first = NULL;
+    struct subscription_t* second = NULL;
+    message_broker_subscribe(broker, "latency", &first);
+    message_broker_subscribe(broker, "latency", &second);
+
+    int i = 0;
+    while (i < 10)
+    {
+        message_broker_publish(broker, "latency", "hello");
+        i++;
+    }
+    message_broker_wait(broker);
+
+    struct message_t* msg = NULL;
+    while (!subscription_try_receive(first, &msg))
+    {
+        message_free(msg);
+    }
+
+    struct message_latency_t latency;
+    int exit_code = message_broker_get_channel_latency(
+        broker, "latency", MESSAGE_LATENCY_FAN_OUT, &latency);
+    TEST_ASSERT(!exit_code && latency._count == 10
+                    && latency_is_ordered(&latency),
+                "Fan-out latency of every publish");
+
+    message_broker_get_channel_latency(broker, "latency",
+                                       MESSAGE_LATENCY_ENQUEUE, &latency);
+    TEST_ASSERT(latency._count == 10 && latency_is_ordered(&latency)
+                    && latency._max_ns > 0,
+                "Enqueue latency once per message, not per copy");
+
+    message_broker_get_channel_latency(broker, "latency",
+                                       MESSAGE_LATENCY_DEQUEUE, &latency);
+    TEST_ASSERT(latency._count == 10 && latency_is_ordered(&latency),
+                "Dequeue latency of the received copies only");
+
+    exit_code = message_broker_get_channel_latency(
+        broker, "missing", MESSAGE_LATENCY_FAN_OUT, &latency);
+    TEST_ASSERT(exit_code == 1, "Unknown channel not found");
+
+    exit_code = message_broker_get_channel_latency(
+        broker, "latency", MESSAGE_LATENCY_DEQUEUE + 1, &latency);
+    TEST_ASSERT(exit_code == 1, "Unknown stage rejected");
+
+    subscription_free(first);
+    subscription_free(second);
+    message_broker_free(broker);
+
+    broker = new_broker(2);
+    message_broker_subscribe(broker, "latency", &first);
+    message_broker_publish(broker, "latency", "hello");
+    message_broker_wait(broker);
+
+    exit_code = message_broker_get_channel_latency(
+        broker, "latency", MESSAGE_LATENCY_ENQUEUE, &latency);
+    TEST_ASSERT(!exit_code && latency._count == 0 && latency._max_ns == 0,
+                "Nothing recorded without tracing");
+
+    subscription_free(first);
+    message_broker_free(broker);
+
+    return 0;
+}
+
+static int
+header_string_is(struct message_t* msg, const char* key, const char* expected)
+{
+
+    struct message_header_t header;
+    if (message_get_header(msg, key, &header))
+    {
+        return 0;
+    }
+
+    return header._type == MESSAGE_HEADER_STRING
+           && header._len == strlen(expected)
+           && !strcmp(header._value, expected);
+}
+
+int
+message_broker_headers_test()
+{
+    TEST_SUITE("Message Broker Headers Test");
+
+    struct message_broker_t* broker = new_broker(2);
+
+    struct subscription_t* sub = NULL;
+    message_broker_subscribe(broker, "routed", &sub);
+
+    struct message_header_t headers[] = {
+        {._key = "region", ._value = "eu-west"},
+        {._key = "priority", ._type = MESSAGE_HEADER_INT, ._int_value = -3},
+        {._key = "trace", ._type = MESSAGE_HEADER_BYTES, ._value = "a\0b",
+         ._len = 3},
+        {._key = "region", ._value = "us-east"},
+    };
+    struct publish_options_t options = {._headers = headers, ._n_headers = 4};
+
+    int exit_code = message_broker_publish_with_options(broker, "routed",
+                                                        "{}", 2, &options);
+    TEST_ASSERT(!exit_code, "Message with headers published");
+    message_broker_wait(broker);
+
+    struct message_t* msg = NULL;
+    subscription_try_receive(sub, &msg);
+
+    TEST_ASSERT(header_string_is(msg, "region", "eu-west"),
+                "String header read, the first one wins");
+
+    struct message_header_t header;
+    message_get_header(msg, "priority", &header);
+    TEST_ASSERT(header._type == MESSAGE_HEADER_INT && header._int_value == -3,
+                "Int header read");
+
+    message_get_header(msg, "trace", &header);
+    TEST_ASSERT(header._type == MESSAGE_HEADER_BYTES && header._len == 3
+                    && !memcmp(header._value, "a\0b", 3),
+                "Bytes header read");
+
+    exit_code = message_get_header(msg, "regio", &header);
+    TEST_ASSERT(exit_code == 1, "Missing header not found");
+
+    const void* content = NULL;
+    size_t len = 0;
+    message_get_payload(msg, &content, &len);
+    TEST_ASSERT(len == 2 && !memcmp(content, "{}", 2),
+                "Payload unaffected by the headers");
+
+    const void* block = NULL;
+    size_t block_len = 0;
+    message_get_headers(msg, &block, &block_len);
+
+    struct message_header_t decoded[4];
+    size_t n_decoded = 0;
+    exit_code =
+        message_headers_decode(block, block_len, decoded, 4, &n_decoded);
+    TEST_ASSERT(!exit_code && n_decoded == 4
+                    && !strcmp(decoded[3]._value, "us-east"),
+                "Header block decoded");
+
+    exit_code =
+        message_headers_decode(block, block_len, decoded, 3, &n_decoded);
+    TEST_ASSERT(exit_code == 1, "Too many headers rejected");
+
+    exit_code =
+        message_headers_decode(block, block_len - 1, decoded, 4, &n_decoded);
+    TEST_ASSERT(exit_code == 1, "Truncated block rejected");
+
+    message_free(msg);
+
+    struct message_header_t invalid[] = {
+        {._key = NULL, ._value = "x"},
+        {._key = "", ._value = "x"},
+        {._key = "key", ._value = NULL},
+        {._key = "key", ._type = MESSAGE_HEADER_BYTES + 1},
+    };
+    int all_rejected = 1;
+    size_t i = 0;
+    while (i < 4)
+    {
+
+        options._headers = invalid + i;
+        options._n_headers = 1;
+        if (message_broker_publish_with_options(broker, "routed", "x", 1,
+                                                &options)
+            != 1)
+        {
+            all_rejected = 0;
+        }
+        i++;
+    }
+    TEST_ASSERT(all_rejected, "Invalid headers rejected");
+
+    struct message_broker_batch_entry_t entries[] = {
+        {._channel = "routed", ._payload = "a", ._len = 1},
+        {._channel = "routed",
+         ._payload = "b",
+         ._len = 1,
+         ._headers = headers,
+         ._n_headers = 1},
+    };
+    message_broker_publish_batch(broker, entries, 2);
+    message_broker_wait(broker);
+
+    subscription_try_receive(sub, &msg);
+    message_get_headers(msg, &block, &block_len);
+    exit_code = message_get_header(msg, "region", &header);
+    TEST_ASSERT(block_len == 0 && exit_code == 1, "Message without headers");
+    message_free(msg);
+
+    subscription_try_receive(sub, &msg);
+    TEST_ASSERT(header_string_is(msg, "region", "eu-west"),
+                "Batch entry headers carried");
+    message_free(msg);
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/broker_test_XXXXXX");
+    mkdtemp(path);
+
+    struct message_broker_configuration_t config = {
+        ._n_threads = 2, ._channels_capacity = 16, ._data_dir = path};
+    struct channel_options_t durable_options = {
+        ._storage = CHANNEL_STORAGE_LOG, ._durable = 1};
+    struct subscription_options_t named = {._name = "router"};
+
+    message_broker_new(&config, &broker);
+    message_broker_declare_channel(broker, "routed", &durable_options);
+    message_broker_subscribe_with_options(broker, "routed", &named, &sub);
+
+    options._headers = headers;
+    options._n_headers = 4;
+    message_broker_publish_with_options(broker, "routed", "{}", 2, &options);
+    message_broker_wait(broker);
+
+    subscription_free(sub);
+    message_broker_free(broker);
+
+    message_broker_new(&config, &broker);
+    message_broker_declare_channel(broker, "routed", &durable_options);
+    message_broker_subscribe_with_options(broker, "routed", &named, &sub);
+
+    msg = NULL;
+    subscription_try_receive(sub, &msg);
+    exit_code = message_get_header(msg, "priority", &header);
+    TEST_ASSERT(header_string_is(msg, "region", "eu-west") && !exit_code
+                    && header._int_value == -3,
+                "Headers recovered from the write-ahead log");
+
+    message_get_payload(msg, &content, &len);
+    TEST_ASSERT(len == 2 && !memcmp(content, "{}", 2),
+                "Recovered payload follows the headers");
+    message_free(msg);
+
+    subscription_free(sub);
+    message_broker_free(broker);
+    remove_data_dir(path, "routed");
+
+    return 0;
+}
+
+int
+main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
+{
+
+    printf("\n");
+    printf("*****************************************\n");
+    printf("Begin Message Broker Test Suite\n");
+    printf("*****************************************\n");
+
+    message_broker_new_and_free_test();
+    message_broker_publish_receive_test();
+    message_broker_shared_payload_test();
+    message_broker_publish_bytes_test();
+    message_broker_publish_batch_test();
+    message_broker_unsubscribe_test();
+    message_broker_concurrent_publish_test();
+    message_broker_sharded_ordering_test();
+    message_broker_inline_publish_test();
+    message_broker_overflow_policy_test();
+    message_broker_blocked_publish_subscribe_test();
+    message_broker_ttl_test();
+    message_broker_log_storage_test();
+    message_broker_durable_channel_test();
+    message_broker_durable_write_error_test();
+    message_broker_ack_test();
+    message_broker_receive_batch_test();
+    message_broker_fd_test();
+    message_broker_pattern_subscribe_test();
+    message_broker_channel_handle_test();
+    message_broker_channel_reclaim_test();
+    message_broker_subscriber_snapshot_test();
+    message_broker_concurrent_unsubscribe_test();
+    message_broker_consumer_group_test();
+    message_broker_partition_test();
+    message_broker_sequence_test();
+    message_broker_stats_test();
+    message_broker_latency_test();
+    message_broker_headers_test();
+
+    printf("\n");
+    printf("*****************************************\n");
+    printf("End Message Broker Test Suite\n");
+    printf("*****************************************\n");
+
+    printf("Tests passed: %d\nTests failed: %d\n", stats.passed, stats.failed);
+
+    return stats.failed;
+}
@@ -53,6 +53,49 @@ def read_line(sock: ssl.SSLSocket) -> str:
     return line.decode().strip()
 
 
+def read_exact(sock: ssl.SSLSocket, length: int) -> bytes:
+    data = b""
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if not chunk:
+            break
+        data += chunk
+    return data
+
+
+def read_varint(block: bytes, pos: int):
+    value = 0
+    shift = 0
+    while True:
+        byte = block[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+
+def decode_headers(block: bytes) -> dict:
+    # type and key length bytes, key and NUL, then the zigzag varint of an int
+    # or the varint length, the bytes and a NUL of a string or bytes value
+    headers = {}
+    pos = 0
+    while pos < len(block):
+        header_type = block[pos]
+        key_len = block[pos + 1]
+        key = block[pos + 2:pos + 2 + key_len].decode()
+        pos += 2 + key_len + 1
+        value, pos = read_varint(block, pos)
+        if header_type == 1:
+            value = (value >> 1) ^ -(value & 1)
+        else:
+            raw = block[pos:pos + value]
+            pos += value + 1
+            value = raw.decode() if header_type == 0 else raw
+        headers.setdefault(key, value)
+    return headers
+
+
 def receive_messages(sock: ssl.SSLSocket, stop_event: threading.Event):
     message_count = 0
     
@@ -71,18 +114,17 @@ def receive_messages(sock: ssl.SSLSocket, stop_event: threading.Event):
                     msg_id = parts[1]
                     channel = parts[2]
                     content_len = int(parts[3])
+                    headers_len = int(parts[4]) if len(parts) > 4 else 0
                     
-                    content = b""
-                    while len(content) < content_len:
-                        chunk = sock.recv(content_len - len(content))
-                        if not chunk:
-                            break
-                        content += chunk
+                    headers = decode_headers(read_exact(sock, headers_len))
+                    content = read_exact(sock, content_len)
                     
                     sock.recv(1)
                     
                     message_count += 1
                     print(f"[Subscriber] Message #{message_count} (ID: {msg_id}) from '{channel}':")
+                    if headers:
+                        print(f"             Headers: {headers}")
                     print(f"             Content: {content.decode()}")
             else:
                 print(f"[Subscriber] Received: {header}")
@@ -268,6 +268,56 @@ thread_pool_wait_test()
     return 0;
 }
 
+static atomic_int gate_open = 0;
+
+static void*
+gated_task(void* arg)
+{
+    (void) arg;
+    struct timespec ts = {0, 1000000};
+    while (!atomic_load(&gate_open))
+    {
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+int
+thread_pool_pending_count_test()
+{
+    TEST_SUITE("Thread Pool Pending Count Test");
+
+    struct thread_pool_t* pool = NULL;
+    thread_pool_new(2, &pool);
+
+    atomic_store(&gate_open, 0);
+
+    int i = 0;
+    while (i < 5)
+    {
+        thread_pool_submit(pool, gated_task, NULL);
+        i++;
+    }
+
+    size_t count = 0;
+    int exit_code = thread_pool_get_pending_count(pool, &count);
+    TEST_ASSERT(exit_code == 0 && count == 5,
+                "queued and running tasks counted");
+
+    atomic_store(&gate_open, 1);
+    thread_pool_wait(pool);
+
+    thread_pool_get_pending_count(pool, &count);
+    TEST_ASSERT(count == 0, "completed tasks no longer counted");
+
+    exit_code = thread_pool_get_pending_count(NULL, &count);
+    TEST_ASSERT(exit_code == 1, "NULL pool rejected");
+
+    thread_pool_free(pool);
+
+    return 0;
+}
+
 int
 thread_pool_shutdown_test()
 {
@@ -823,6 +873,7 @@ main(int argc __attribute__((unused)), char** argv __attribute__((unused)))
     thread_pool_submit_with_args_test();
 
     thread_pool_wait_test();
+    thread_pool_pending_count_test();
     thread_pool_shutdown_test();
 
     thread_pool_single_thread_test();
@@ -0,0 +1,279 @@
+#include "test_utils.h"
+#include "timer_wheel.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+struct _fire_record_t
+{
+    size_t _n_fired;
+    uint64_t _fired_at_ms;
+    uint64_t _rearm_at_ms;
+};
+
+static uint64_t
+record_fire(void* arg, uint64_t now_ms)
+{
+    struct _fire_record_t* record = arg;
+
+    record->_n_fired++;
+    record->_fired_at_ms = now_ms;
+
+    uint64_t rearm_at_ms = record->_rearm_at_ms;
+    record->_rearm_at_ms = 0;
+
+    return rearm_at_ms;
+}
+
+int
+timer_wheel_new_free_test()
+{
+    TEST_SUITE("Timer Wheel New/Free Test");
+
+    timer_wheel wheel = NULL;
+    int exit_code = timer_wheel_new(10, 1000, &wheel);
+    TEST_ASSERT(!exit_code && wheel, "Timer wheel created");
+
+    size_t size = 1;
+    timer_wheel_size(wheel, &size);
+    TEST_ASSERT(size == 0, "New timer wheel is empty");
+
+    exit_code = timer_wheel_new(0, 1000, &wheel);
+    TEST_ASSERT(exit_code == 1, "Zero tick rejected");
+
+    exit_code = timer_wheel_new(10, 1000, NULL);
+    TEST_ASSERT(exit_code == 1, "NULL out_self rejected");
+
+    exit_code = timer_wheel_free(wheel);
+    TEST_ASSERT(!exit_code, "Timer wheel freed");
+
+    exit_code = timer_wheel_free(NULL);
+    TEST_ASSERT(exit_code == 1, "Free NULL rejected");
+
+    return 0;
+}
+
+int
+timer_wheel_fire_test()
+{
+    TEST_SUITE("Timer Wheel Fire Test");
+
+    timer_wheel wheel = NULL;
+    timer_wheel_new(10, 0, &wheel);
+
+    struct _fire_record_t record = {0, 0, 0};
+    timer_wheel_timer timer = NULL;
+    int exit_code = timer_wheel_timer_new(record_fire, &record, &timer);
+    TEST_ASSERT(!exit_code && timer, "Timer created");
+
+    exit_code = timer_wheel_arm(wheel, timer, 105);
+    TEST_ASSERT(!exit_code, "Timer armed");
+
+    size_t n_fired = 0;
+    timer_wheel_advance(wheel, 100, &n_fired);
+    TEST_ASSERT(n_fired == 0 && record._n_fired == 0,
+                "Timer does not fire before its deadline");
+
+    timer_wheel_advance(wheel, 110, &n_fired);
+    TEST_ASSERT(n_fired == 1 && record._n_fired == 1,
+                "Timer fires once its deadline is reached");
+    TEST_ASSERT(record._fired_at_ms == 110, "Callback receives the time");
+
+    size_t size = 1;
+    timer_wheel_size(wheel, &size);
+    TEST_ASSERT(size == 0, "Fired timer is disarmed");
+
+    exit_code = timer_wheel_timer_free(timer);
+    TEST_ASSERT(!exit_code, "Disarmed timer freed");
+
+    timer_wheel_free(wheel);
+
+    return 0;
+}
+
+int
+timer_wheel_earliest_wins_test()
+{
+    TEST_SUITE("Timer Wheel Earliest Deadline Test");
+
+    timer_wheel wheel = NULL;
+    timer_wheel_new(1, 0, &wheel);
+
+    struct _fire_record_t record = {0, 0, 0};
+    timer_wheel_timer timer = NULL;
+    timer_wheel_timer_new(record_fire, &record, &timer);
+
+    timer_wheel_arm(wheel, timer, 500);
+    timer_wheel_arm(wheel, timer, 50);
+    timer_wheel_arm(wheel, timer, 300);
+
+    size_t size = 0;
+    timer_wheel_size(wheel, &size);
+    TEST_ASSERT(size == 1, "Re-arming does not duplicate the timer");
+
+    timer_wheel_advance(wheel, 50, NULL);
+    TEST_ASSERT(record._n_fired == 1, "Earliest deadline kept");
+
+    timer_wheel_advance(wheel, 1000, NULL);
+    TEST_ASSERT(record._n_fired == 1, "Later deadlines were dropped");
+
+    timer_wheel_timer_free(timer);
+    timer_wheel_free(wheel);
+
+    return 0;
+}
+
+int
+timer_wheel_cancel_test()
+{
+    TEST_SUITE("Timer Wheel Cancel Test");
+
+    timer_wheel wheel = NULL;
+    timer_wheel_new(10, 0, &wheel);
+
+    struct _fire_record_t record = {0, 0, 0};
+    timer_wheel_timer timer = NULL;
+    timer_wheel_timer_new(record_fire, &record, &timer);
+
+    timer_wheel_arm(wheel, timer, 200);
+
+    int exit_code = timer_wheel_timer_free(timer);
+    TEST_ASSERT(exit_code == 1, "Armed timer cannot be freed");
+
+    exit_code = timer_wheel_cancel(wheel, timer);
+    TEST_ASSERT(!exit_code, "Timer cancelled");
+
+    timer_wheel_advance(wheel, 1000, NULL);
+    TEST_ASSERT(record._n_fired == 0, "Cancelled timer does not fire");
+
+    exit_code = timer_wheel_cancel(wheel, timer);
+    TEST_ASSERT(!exit_code, "Cancelling a disarmed timer is a no-op");
+
+    timer_wheel_timer_free(timer);
+    timer_wheel_free(wheel);
+
+    return 0;
+}
+
+int
+timer_wheel_rearm_test()
+{
+    TEST_SUITE("Timer Wheel Rearm Test");
+
+    timer_wheel wheel = NULL;
+    timer_wheel_new(10, 0, &wheel);
+
+    struct _fire_record_t record = {0, 0, 250};
+    timer_wheel_timer timer = NULL;
+    timer_wheel_timer_new(record_fire, &record, &timer);
+
+    timer_wheel_arm(wheel, timer, 100);
+
+    timer_wheel_advance(wheel, 100, NULL);
+    TEST_ASSERT(record._n_fired == 1, "Timer fired");
+
+    size_t size = 0;
+    timer_wheel_size(wheel, &size);
+    TEST_ASSERT(size == 1, "Callback re-armed the timer");
+
+    timer_wheel_advance(wheel, 240, NULL);
+    TEST_ASSERT(record._n_fired == 1, "Re-armed timer waits for its deadline");
+
+    timer_wheel_advance(wheel, 250, NULL);
+    TEST_ASSERT(record._n_fired == 2 && record._fired_at_ms == 250,
+                "Re-armed timer fires at the returned time");
+
+    timer_wheel_timer_free(timer);
+    timer_wheel_free(wheel);
+
+    return 0;
+}
+
+int
+timer_wheel_levels_test()
+{
+    TEST_SUITE("Timer Wheel Levels Test");
+
+    // deadlines at the edges of every level plus two beyond the wheel range
+    const uint64_t deadlines[] = {3,      63,       64,       4095,     4096,
+                                  262143, 262144,   16777215, 16777216, 40000000};
+    const size_t n = sizeof(deadlines) / sizeof(deadlines[0]);
+
+    uint64_t start = 12345;
+    timer_wheel wheel = NULL;
+    timer_wheel_new(1, start, &wheel);
+
+    struct _fire_record_t records[sizeof(deadlines) / sizeof(deadlines[0])];
+    timer_wheel_timer timers[sizeof(deadlines) / sizeof(deadlines[0])];
+
+    size_t i = 0;
+    while (i < n)
+    {
+
+        records[i] = (struct _fire_record_t) {0, 0, 0};
+        timer_wheel_timer_new(record_fire, &records[i], &timers[i]);
+        timer_wheel_arm(wheel, timers[i], start + deadlines[i]);
+        i++;
+    }
+
+    int on_time = 1;
+    i = 0;
+    while (i < n)
+    {
+
+        uint64_t deadline = start + deadlines[i];
+
+        timer_wheel_advance(wheel, deadline - 1, NULL);
+        if (records[i]._n_fired)
+        {
+            on_time = 0;
+        }
+
+        timer_wheel_advance(wheel, deadline, NULL);
+        if (records[i]._n_fired != 1 || records[i]._fired_at_ms != deadline)
+        {
+            on_time = 0;
+        }
+
+        i++;
+    }
+    TEST_ASSERT(on_time, "Every timer fires exactly at its deadline");
+
+    size_t size = 1;
+    timer_wheel_size(wheel, &size);
+    TEST_ASSERT(size == 0, "All timers fired");
+
+    i = 0;
+    while (i < n)
+    {
+        timer_wheel_timer_free(timers[i]);
+        i++;
+    }
+    timer_wheel_free(wheel);
+
+    return 0;
+}
+
+int
+main()
+{
+
+    printf("*****************************************\n");
+    printf("Start Timer Wheel Test Suite\n");
+    printf("*****************************************\n");
+
+    timer_wheel_new_free_test();
+    timer_wheel_fire_test();
+    timer_wheel_earliest_wins_test();
+    timer_wheel_cancel_test();
+    timer_wheel_rearm_test();
+    timer_wheel_levels_test();
+
+    printf("\n");
+    printf("*****************************************\n");
+    printf("End Timer Wheel Test Suite\n");
+    printf("*****************************************\n");
+
+    printf("Tests passed: %d\nTests failed: %d\n", stats.passed, stats.failed);
+
+    return stats.failed;
+}
@@ -0,0 +1,278 @@
+#include "test_utils.h"
+#include "topic_trie.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct _match_record_t
+{
+    size_t _n_matched;
+    int _seen[8];
+};
+
+static int
+record_match(void* context, void* value)
+{
+
+    struct _match_record_t* record = context;
+
+    record->_n_matched++;
+    record->_seen[*(int*) value]++;
+
+    return 0;
+}
+
+static struct _match_record_t
+match(topic_trie trie, const char* topic)
+{
+
+    struct _match_record_t record;
+    memset(&record, 0, sizeof(record));
+    topic_trie_match(trie, topic, record_match, &record);
+
+    return record;
+}
+
+int
+topic_trie_new_free_test()
+{
+    TEST_SUITE("Topic Trie New/Free Test");
+
+    topic_trie trie = NULL;
+    int exit_code = topic_trie_new(&trie);
+    TEST_ASSERT(!exit_code && trie, "Trie created");
+
+    size_t size = 1;
+    topic_trie_get_size(trie, &size);
+    TEST_ASSERT(size == 0, "New trie is empty");
+
+    exit_code = topic_trie_free(trie);
+    TEST_ASSERT(!exit_code, "Trie freed");
+
+    exit_code = topic_trie_new(NULL);
+    TEST_ASSERT(exit_code == 1, "NULL output rejected");
+
+    exit_code = topic_trie_free(NULL);
+    TEST_ASSERT(exit_code == 1, "NULL trie rejected");
+
+    return 0;
+}
+
+int
+topic_trie_validate_test()
+{
+    TEST_SUITE("Topic Trie Validate Test");
+
+    TEST_ASSERT(!topic_trie_validate("sensors.eu.*"), "Star pattern valid");
+    TEST_ASSERT(!topic_trie_validate("#"), "Lone hash pattern valid");
+    TEST_ASSERT(topic_trie_validate(""), "Empty pattern invalid");
+    TEST_ASSERT(topic_trie_validate("a..b"), "Empty segment invalid");
+    TEST_ASSERT(topic_trie_validate(".a"), "Leading dot invalid");
+    TEST_ASSERT(topic_trie_validate("a."), "Trailing dot invalid");
+
+    TEST_ASSERT(topic_trie_is_pattern("orders.#"), "Hash segment is a pattern");
+    TEST_ASSERT(topic_trie_is_pattern("*.eu"), "Star segment is a pattern");
+    TEST_ASSERT(!topic_trie_is_pattern("orders.a*"),
+                "Star inside a segment is literal");
+    TEST_ASSERT(!topic_trie_is_pattern("orders.eu"), "Plain topic");
+
+    return 0;
+}
+
+int
+topic_trie_match_test()
+{
+    TEST_SUITE("Topic Trie Match Test");
+
+    topic_trie trie = NULL;
+    topic_trie_new(&trie);
+
+    int values[] = {0, 1, 2, 3, 4, 5};
+    topic_trie_insert(trie, "sensors.eu.temp", &values[0]);
+    topic_trie_insert(trie, "sensors.eu.*", &values[1]);
+    topic_trie_insert(trie, "sensors.#", &values[2]);
+    topic_trie_insert(trie, "*.us.*", &values[3]);
+    topic_trie_insert(trie, "#", &values[4]);
+    topic_trie_insert(trie, "sensors.eu.*", &values[5]);
+
+    size_t size = 0;
+    topic_trie_get_size(trie, &size);
+    TEST_ASSERT(size == 5, "Values of the same pattern share a node");
+
+    struct _match_record_t record = match(trie, "sensors.eu.temp");
+    TEST_ASSERT(record._n_matched == 5 && record._seen[0] && record._seen[1]
+                    && record._seen[2] && record._seen[4]
+                    && record._seen[5] && !record._seen[3],
+                "Exact, star and hash patterns matched");
+
+    record = match(trie, "sensors");
+    TEST_ASSERT(record._n_matched == 2 && record._seen[2] && record._seen[4],
+                "Hash matches zero segments");
+
+    record = match(trie, "sensors.eu.temp.max");
+    TEST_ASSERT(record._n_matched == 2 && record._seen[2] && record._seen[4],
+                "Star matches exactly one segment");
+
+    record = match(trie, "orders.us.ny");
+    TEST_ASSERT(record._n_matched == 2 && record._seen[3] && record._seen[4],
+                "Leading star matched");
+
+    record = match(trie, "sensorsx.eu");
+    TEST_ASSERT(record._n_matched == 1 && record._seen[4],
+                "Literal segments compared whole");
+
+    topic_trie_free(trie);
+
+    return 0;
+}
+
+int
+topic_trie_duplicate_paths_test()
+{
+    TEST_SUITE("Topic Trie Duplicate Paths Test");
+
+    topic_trie trie = NULL;
+    topic_trie_new(&trie);
+
+    int value = 0;
+    topic_trie_insert(trie, "#.x.#", &value);
+
+    struct _match_record_t record = match(trie, "x.x.x");
+    TEST_ASSERT(record._n_matched == 1,
+                "Pattern matching in several ways reported once");
+
+    record = match(trie, "a.b");
+    TEST_ASSERT(record._n_matched == 0, "Missing literal not matched");
+
+    topic_trie_free(trie);
+
+    return 0;
+}
+
+int
+topic_trie_remove_test()
+{
+    TEST_SUITE("Topic Trie Remove Test");
+
+    topic_trie trie = NULL;
+    topic_trie_new(&trie);
+
+    int values[] = {0, 1, 2};
+    topic_trie_insert(trie, "a.b.c", &values[0]);
+    topic_trie_insert(trie, "a.*", &values[1]);
+    topic_trie_insert(trie, "a.*", &values[2]);
+
+    int exit_code = topic_trie_remove(trie, "a.*", &values[1]);
+    TEST_ASSERT(!exit_code, "Value removed");
+
+    struct _match_record_t record = match(trie, "a.z");
+    TEST_ASSERT(record._n_matched == 1 && record._seen[2],
+                "Other values of the pattern kept");
+
+    exit_code = topic_trie_remove(trie, "a.*", &values[1]);
+    TEST_ASSERT(exit_code == 1, "Missing value not found");
+
+    exit_code = topic_trie_remove(trie, "a.b.c.d", &values[0]);
+    TEST_ASSERT(exit_code == 1, "Missing pattern not found");
+
+    topic_trie_remove(trie, "a.*", &values[2]);
+    topic_trie_remove(trie, "a.b.c", &values[0]);
+
+    size_t size = 1;
+    topic_trie_get_size(trie, &size);
+    TEST_ASSERT(size == 0, "Every pattern removed");
+
+    record = match(trie, "a.b.c");
+    TEST_ASSERT(record._n_matched == 0, "Removed patterns no longer match");
+
+    exit_code = topic_trie_insert(trie, "a..b", &values[0]);
+    TEST_ASSERT(exit_code == 1, "Invalid pattern rejected");
+
+    topic_trie_free(trie);
+
+    return 0;
+}
+
+int
+topic_trie_deep_hash_test()
+{
+    TEST_SUITE("Topic Trie Deep Hash Test");
+
+    topic_trie trie = NULL;
+    topic_trie_new(&trie);
+
+    // "#.a.#.a. ... #.z" and "a.a. ... a.y", "a.a. ... a.z" of the same depth
+    char pattern[256] = "";
+    char miss[256] = "";
+    char hit[256] = "";
+    int i = 0;
+    while (i < 40)
+    {
+        strcat(pattern, "#.a.");
+        strcat(miss, "a.a.");
+        i++;
+    }
+    strcat(pattern, "#.z");
+    strcpy(hit, miss);
+    strcat(miss, "a.y");
+    strcat(hit, "a.z");
+
+    int values[] = {0, 1};
+    topic_trie_insert(trie, pattern, &values[0]);
+
+    clock_t start = clock();
+    struct _match_record_t missed = match(trie, miss);
+    struct _match_record_t record = match(trie, hit);
+    double elapsed_s = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    TEST_ASSERT(!missed._n_matched && record._n_matched == 1,
+                "Deep hash pattern matched once");
+    TEST_ASSERT(elapsed_s < 1,
+                "Deep hash pattern matched without backtracking");
+
+    // a run of '#' is stored as a single one
+    topic_trie_insert(trie, "#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.z",
+                      &values[1]);
+    topic_trie_insert(trie, "#.z", &values[1]);
+
+    size_t size = 0;
+    topic_trie_get_size(trie, &size);
+    record = match(trie, "z");
+    TEST_ASSERT(size == 2 && record._n_matched == 2 && record._seen[1] == 2,
+                "Hash run shares the node of a single hash");
+
+    int exit_code = topic_trie_remove(
+        trie, "#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.#.z", &values[1]);
+    record = match(trie, "x.y.z");
+    TEST_ASSERT(!exit_code && record._n_matched == 1,
+                "Hash run removed by its own pattern");
+
+    topic_trie_free(trie);
+
+    return 0;
+}
+
+int
+main()
+{
+
+    printf("*****************************************\n");
+    printf("Start Topic Trie Test Suite\n");
+    printf("*****************************************\n");
+
+    topic_trie_new_free_test();
+    topic_trie_validate_test();
+    topic_trie_match_test();
+    topic_trie_duplicate_paths_test();
+    topic_trie_remove_test();
+    topic_trie_deep_hash_test();
+
+    printf("\n");
+    printf("*****************************************\n");
+    printf("End Topic Trie Test Suite\n");
+    printf("*****************************************\n");
+
+    printf("Tests passed: %d\nTests failed: %d\n", stats.passed, stats.failed);
+
+    return stats.failed;
+}
@@ -0,0 +1,501 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "test_utils.h"
+#include "wal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const struct wal_configuration_t test_config = {
+    ._segment_size = 1024, ._commit_batch_size = 8, ._commit_latency_ms = 2};
+
+static void
+make_temp_dir(char* path, size_t size)
+{
+    snprintf(path, size, "/tmp/wal_test_XXXXXX");
+    if (!mkdtemp(path))
+    {
+        path[0] = '\0';
+    }
+}
+
+static void
+remove_dir(const char* path)
+{
+
+    DIR* dir = opendir(path);
+    if (!dir)
+    {
+        return;
+    }
+
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)))
+    {
+
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+        {
+            continue;
+        }
+
+        char file[512];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        unlink(file);
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+static size_t
+count_segments(const char* path)
+{
+
+    DIR* dir = opendir(path);
+    if (!dir)
+    {
+        return 0;
+    }
+
+    size_t n = 0;
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)))
+    {
+
+        size_t len = strlen(entry->d_name);
+        if (len > 4 && !strcmp(entry->d_name + len - 4, ".wal"))
+        {
+            n++;
+        }
+    }
+
+    closedir(dir);
+
+    return n;
+}
+
+static int
+append_number(wal log, uint64_t value)
+{
+
+    struct iovec part = {.iov_base = &value, .iov_len = sizeof(value)};
+
+    return wal_append(log, &part, 1, NULL);
+}
+
+struct _replay_check_t
+{
+    uint64_t _expected;
+    int _in_order;
+};
+
+static int
+check_record(void* context, uint64_t offset, const void* data, size_t len)
+{
+
+    struct _replay_check_t* check = context;
+
+    uint64_t value = 0;
+    if (len == sizeof(value))
+    {
+        memcpy(&value, data, len);
+    }
+
+    if (len != sizeof(value) || offset != check->_expected
+        || value != offset * 10)
+    {
+        check->_in_order = 0;
+    }
+
+    check->_expected++;
+
+    return 0;
+}
+
+int
+wal_append_replay_test()
+{
+    TEST_SUITE("WAL Append/Replay Test");
+
+    char path[64];
+    make_temp_dir(path, sizeof(path));
+
+    wal log = NULL;
+    int exit_code = wal_open(path, &test_config, &log);
+    TEST_ASSERT(!exit_code && log, "WAL opened");
+
+    // pins every segment, see wal_retention_test
+    wal_commit_offset(log, "reader", 0);
+
+    uint64_t i = 0;
+    while (i < 100)
+    {
+        append_number(log, i * 10);
+        i++;
+    }
+
+    exit_code = wal_sync(log);
+    TEST_ASSERT(!exit_code, "Appended records synced");
+
+    uint64_t first = 1;
+    uint64_t next = 0;
+    wal_get_range(log, &first, &next);
+    TEST_ASSERT(first == 0 && next == 100, "Range covers every record");
+
+    struct _replay_check_t check = {._expected = 40, ._in_order = 1};
+    wal_replay(log, 40, check_record, &check);
+    TEST_ASSERT(check._in_order && check._expected == 100,
+                "Replay reads from the requested offset in order");
+
+    wal_close(log);
+
+    exit_code = wal_open(path, &test_config, &log);
+    TEST_ASSERT(!exit_code, "WAL reopened");
+
+    wal_get_range(log, NULL, &next);
+    TEST_ASSERT(next == 100, "Records recovered on open");
+
+    append_number(log, 1000);
+    wal_sync(log);
+
+    check = (struct _replay_check_t) {._expected = 0, ._in_order = 1};
+    wal_replay(log, 0, check_record, &check);
+    TEST_ASSERT(check._expected == 101, "Appends continue after recovery");
+
+    wal_close(log);
+    remove_dir(path);
+
+    exit_code = wal_open(NULL, &test_config, &log);
+    TEST_ASSERT(exit_code == 1, "NULL directory rejected");
+
+    return 0;
+}
+
+int
+wal_torn_tail_test()
+{
+    TEST_SUITE("WAL Torn Tail Test");
+
+    char path[64];
+    make_temp_dir(path, sizeof(path));
+
+    // large segments: every record lands in the first one
+    struct wal_configuration_t config = test_config;
+    config._segment_size = 1 << 20;
+
+    wal log = NULL;
+    wal_open(path, &config, &log);
+
+    uint64_t i = 0;
+    while (i < 10)
+    {
+        append_number(log, i * 10);
+        i++;
+    }
+    wal_close(log);
+
+    char segment[128];
+    snprintf(segment, sizeof(segment), "%s/%020d.wal", path, 0);
+
+    // flip a byte of the last record and append half a header
+    int fd = open(segment, O_RDWR);
+    struct stat st;
+    fstat(fd, &st);
+
+    char byte = 0;
+    pread(fd, &byte, 1, st.st_size - 1);
+    byte ^= 0x5A;
+    pwrite(fd, &byte, 1, st.st_size - 1);
+
+    const char garbage[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    pwrite(fd, garbage, sizeof(garbage), st.st_size);
+    close(fd);
+
+    int exit_code = wal_open(path, &config, &log);
+    TEST_ASSERT(!exit_code, "WAL with a corrupted tail opened");
+
+    uint64_t next = 0;
+    wal_get_range(log, NULL, &next);
+    TEST_ASSERT(next == 9, "Corrupted record dropped");
+
+    append_number(log, 90);
+    wal_sync(log);
+
+    struct _replay_check_t check = {._expected = 0, ._in_order = 1};
+    wal_replay(log, 0, check_record, &check);
+    TEST_ASSERT(check._in_order && check._expected == 10,
+                "New record appended right after the valid prefix");
+
+    wal_close(log);
+    remove_dir(path);
+
+    return 0;
+}
+
+int
+wal_offsets_test()
+{
+    TEST_SUITE("WAL Offsets Test");
+
+    char path[64];
+    make_temp_dir(path, sizeof(path));
+
+    wal log = NULL;
+    wal_open(path, &test_config, &log);
+
+    uint64_t i = 0;
+    while (i < 20)
+    {
+        append_number(log, i * 10);
+        i++;
+    }
+
+    int exit_code = wal_commit_offset(log, "reader", 12);
+    TEST_ASSERT(!exit_code, "Offset committed");
+
+    exit_code = wal_commit_offset(log, "bad\nname", 1);
+    TEST_ASSERT(exit_code == 1, "Name with a newline rejected");
+
+    wal_commit_offset(log, "reader", 15);
+    wal_close(log);
+
+    wal_open(path, &test_config, &log);
+
+    uint64_t offset = 0;
+    exit_code = wal_get_offset(log, "reader", &offset);
+    TEST_ASSERT(!exit_code && offset == 15, "Latest offset recovered");
+
+    exit_code = wal_get_offset(log, "unknown", &offset);
+    TEST_ASSERT(exit_code == 1, "Unknown name not found");
+
+    wal_close(log);
+    remove_dir(path);
+
+    return 0;
+}
+
+int
+wal_retention_test()
+{
+    TEST_SUITE("WAL Retention Test");
+
+    char path[64];
+    make_temp_dir(path, sizeof(path));
+
+    wal log = NULL;
+    wal_open(path, &test_config, &log);
+    wal_commit_offset(log, "slow", 0);
+
+    // small segments and one sync per batch: the log rolls many times
+    uint64_t i = 0;
+    while (i < 400)
+    {
+
+        append_number(log, i * 10);
+        if (i % 8 == 7)
+        {
+            wal_sync(log);
+        }
+
+        i++;
+    }
+    wal_sync(log);
+
+    size_t pinned = count_segments(path);
+    TEST_ASSERT(pinned > 4, "Segments kept for the slowest offset");
+
+    wal_commit_offset(log, "slow", 400);
+    append_number(log, 4000);
+    wal_sync(log);
+
+    size_t released = count_segments(path);
+    TEST_ASSERT(released < pinned && released <= 2,
+                "Segments below every offset deleted");
+
+    uint64_t first = 0;
+    wal_get_range(log, &first, NULL);
+    TEST_ASSERT(first > 0, "First offset moved past the deleted segments");
+
+    wal_close(log);
+    remove_dir(path);
+
+    return 0;
+}
+
+int
+wal_io_error_test()
+{
+    TEST_SUITE("WAL I/O Error Test");
+
+    char path[64];
+    make_temp_dir(path, sizeof(path));
+
+    wal log = NULL;
+    wal_open(path, &test_config, &log);
+
+    append_number(log, 0);
+    append_number(log, 10);
+    int exit_code = wal_sync(log);
+    TEST_ASSERT(!exit_code, "Records committed before the failure");
+
+    char segment[128];
+    snprintf(segment, sizeof(segment), "%s/%020d.wal", path, 0);
+
+    struct stat st;
+    stat(segment, &st);
+    off_t committed_size = st.st_size;
+
+    // the next commit gets a short write then EFBIG, leaving a torn record
+    struct rlimit saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    struct rlimit limited = {.rlim_cur = (rlim_t) committed_size + 100,
+                             .rlim_max = saved.rlim_max};
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limited);
+
+    char large[512] = {0};
+    struct iovec part = {.iov_base = large, .iov_len = sizeof(large)};
+    wal_append(log, &part, 1, NULL);
+    exit_code = wal_sync(log);
+    TEST_ASSERT(exit_code == EFBIG, "Failed commit reported by the sync");
+
+    exit_code = append_number(log, 30);
+    TEST_ASSERT(exit_code == EFBIG, "Later appends fail with the error");
+
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, SIG_DFL);
+
+    stat(segment, &st);
+    TEST_ASSERT(st.st_size == committed_size,
+                "Torn record truncated off the segment");
+
+    exit_code = wal_close(log);
+    TEST_ASSERT(exit_code == EFBIG, "Close returns the error");
+
+    uint64_t next = 0;
+    wal_open(path, &test_config, &log);
+    wal_get_range(log, NULL, &next);
+
+    struct _replay_check_t check = {._expected = 0, ._in_order = 1};
+    wal_replay(log, 0, check_record, &check);
+    TEST_ASSERT(next == 2 && check._in_order && check._expected == 2,
+                "Committed records recovered, failed ones not");
+
+    exit_code = append_number(log, 20);
+    if (!exit_code)
+    {
+        exit_code = wal_sync(log);
+    }
+    TEST_ASSERT(!exit_code, "Reopened log appends again");
+
+    wal_close(log);
+    remove_dir(path);
+
+    return 0;
+}
+
+int
+wal_format_version_test()
+{
+    TEST_SUITE("WAL Format Version Test");
+
+    char path[64];
+    make_temp_dir(path, sizeof(path));
+
+    struct wal_configuration_t config = test_config;
+    config._format_version = 1;
+
+    wal log = NULL;
+    wal_open(path, &config, &log);
+    append_number(log, 0);
+    append_number(log, 10);
+    wal_close(log);
+
+    char segment[128];
+    snprintf(segment, sizeof(segment), "%s/%020d.wal", path, 0);
+
+    struct stat before;
+    stat(segment, &before);
+
+    config._format_version = 2;
+    int exit_code = wal_open(path, &config, &log);
+
+    struct stat after;
+    stat(segment, &after);
+    TEST_ASSERT(exit_code == EPROTO && after.st_size == before.st_size,
+                "Segments of another format rejected and kept");
+
+    config._format_version = 1;
+    exit_code = wal_open(path, &config, &log);
+
+    uint64_t next = 0;
+    wal_get_range(log, NULL, &next);
+    TEST_ASSERT(!exit_code && next == 2, "Segments of the format reopened");
+    wal_close(log);
+
+    // a record framed the same way, without a segment header
+    char record[24] = {0};
+    uint32_t len = 8;
+    memcpy(record + 4, &len, sizeof(len));
+    int fd = open(segment, O_WRONLY | O_TRUNC);
+    write(fd, record, sizeof(record));
+    close(fd);
+
+    exit_code = wal_open(path, &config, &log);
+    stat(segment, &after);
+    TEST_ASSERT(exit_code == EPROTO && after.st_size == sizeof(record),
+                "Segment without a header rejected and kept");
+
+    // a segment torn on creation, before its header was written
+    fd = open(segment, O_WRONLY | O_TRUNC);
+    close(fd);
+
+    exit_code = wal_open(path, &config, &log);
+    TEST_ASSERT(!exit_code, "Empty segment opened");
+
+    append_number(log, 0);
+    exit_code = wal_sync(log);
+
+    struct _replay_check_t check = {._expected = 0, ._in_order = 1};
+    wal_replay(log, 0, check_record, &check);
+    TEST_ASSERT(!exit_code && check._in_order && check._expected == 1,
+                "Empty segment rewritten with its header");
+
+    wal_close(log);
+    remove_dir(path);
+
+    return 0;
+}
+
+int
+main()
+{
+
+    printf("*****************************************\n");
+    printf("Start WAL Test Suite\n");
+    printf("*****************************************\n");
+
+    wal_append_replay_test();
+    wal_torn_tail_test();
+    wal_offsets_test();
+    wal_retention_test();
+    wal_io_error_test();
+    wal_format_version_test();
+
+    printf("\n");
+    printf("*****************************************\n");
+    printf("End WAL Test Suite\n");
+    printf("*****************************************\n");
+
+    printf("Tests passed: %d\nTests failed: %d\n", stats.passed, stats.failed);
+
+    return stats.failed;
+}